@@ -10,15 +10,23 @@ use core::ffi::{c_char, c_int};
 use core::panic::PanicInfo;
 use crsql_core;
 use crsql_core::sqlite3_crsqlcore_init;
+#[cfg(feature = "alloc_stats")]
+use crsql_core::CountingAllocator;
 use crsql_fractindex_core::sqlite3_crsqlfractionalindex_init;
 use sqlite_nostd as sqlite;
 use sqlite_nostd::SQLite3Allocator;
 
 // This must be our allocator so we can transfer ownership of memory to SQLite and have SQLite free that memory for us.
 // This drastically reduces copies when passing strings and blobs back and forth between Rust and C.
+#[cfg(not(feature = "alloc_stats"))]
 #[global_allocator]
 static ALLOCATOR: SQLite3Allocator = SQLite3Allocator {};
 
+// Builds with the `alloc_stats` feature count allocations on the way, see `crsql_allocations()`.
+#[cfg(feature = "alloc_stats")]
+#[global_allocator]
+static ALLOCATOR: CountingAllocator<SQLite3Allocator> = CountingAllocator(SQLite3Allocator {});
+
 // This must be our panic handler for WASM builds. For simplicity, we make it our panic handler for
 // all builds. Abort is also more portable than unwind, enabling us to go to more embedded use cases.
 #[panic_handler]
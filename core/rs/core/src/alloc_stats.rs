@@ -0,0 +1,49 @@
+use core::alloc::{GlobalAlloc, Layout};
+use core::sync::atomic::{AtomicU64, Ordering};
+use sqlite::Context;
+use sqlite_nostd as sqlite;
+
+/**
+ * Counts the allocations the extension makes through its global allocator so
+ * allocation heavy paths can be measured from SQL with `crsql_allocations()`
+ * and `crsql_allocated_bytes()`. Counters are process wide and only grow.
+ */
+pub struct CountingAllocator<A: GlobalAlloc>(pub A);
+
+static ALLOCATIONS: AtomicU64 = AtomicU64::new(0);
+static ALLOCATED_BYTES: AtomicU64 = AtomicU64::new(0);
+
+unsafe impl<A: GlobalAlloc> GlobalAlloc for CountingAllocator<A> {
+    unsafe fn alloc(&self, layout: Layout) -> *mut u8 {
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        ALLOCATED_BYTES.fetch_add(layout.size() as u64, Ordering::Relaxed);
+        self.0.alloc(layout)
+    }
+
+    unsafe fn dealloc(&self, ptr: *mut u8, layout: Layout) {
+        self.0.dealloc(ptr, layout)
+    }
+
+    unsafe fn realloc(&self, ptr: *mut u8, layout: Layout, new_size: usize) -> *mut u8 {
+        // a grown buffer costs the allocator about as much as a new one
+        ALLOCATIONS.fetch_add(1, Ordering::Relaxed);
+        ALLOCATED_BYTES.fetch_add(new_size as u64, Ordering::Relaxed);
+        self.0.realloc(ptr, layout, new_size)
+    }
+}
+
+pub extern "C" fn crsql_allocations(
+    ctx: *mut sqlite::context,
+    _argc: i32,
+    _argv: *mut *mut sqlite::value,
+) {
+    ctx.result_int64(ALLOCATIONS.load(Ordering::Relaxed) as i64);
+}
+
+pub extern "C" fn crsql_allocated_bytes(
+    ctx: *mut sqlite::context,
+    _argc: i32,
+    _argv: *mut *mut sqlite::value,
+) {
+    ctx.result_int64(ALLOCATED_BYTES.load(Ordering::Relaxed) as i64);
+}
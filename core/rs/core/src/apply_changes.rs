@@ -0,0 +1,741 @@
+extern crate alloc;
+
+use alloc::collections::BTreeMap;
+use alloc::ffi::CString;
+use alloc::format;
+use alloc::vec;
+use alloc::vec::Vec;
+use core::alloc::Allocator;
+use core::ffi::{c_char, c_int};
+use core::slice;
+use sqlite::Stmt;
+use sqlite_nostd as sqlite;
+use sqlite_nostd::{sqlite3, Context, ResultCode, Value};
+
+use crate::arena::Arena;
+use crate::c::{
+    crsql_ExtData, crsql_TableInfo, crsql_ensureTableInfosAreUpToDate, CrsqlChangesColumn,
+};
+use crate::changes_vtab_write::{
+    check_for_local_delete, get_cached_stmt_rt_wt, get_curr_row_stmt, get_row_clock, merge_delete,
+    merge_pk_only_insert, non_pk_index, set_winner_clock, table_info_index, TableFragments,
+    Watermark,
+};
+use crate::col_ids::non_pk_col_id;
+use crate::compare_values::{compare_column_value, key_order_all};
+use crate::pack_columns::{
+    bind_package_to_stmt, bind_slot, unpack_columns_from, unpack_columns_from_in, unpack_columns_in,
+};
+use crate::stmt_cache::{get_col_set_cache_key, reset_cached_stmt, CachedStmtType};
+use crate::tombstones::sync_tombstone_filters;
+use crate::util;
+use crate::{unpack_columns, ColumnValue};
+
+/**
+ * Bulk merge entry point.
+ *
+ * `changes` is a stream of concatenated `crsql_pack_columns` records, each
+ * holding the columns of a `crsql_changes` row in order:
+ * `[table, pk, cid, val, col_version, db_version, site_id, seq?]`.
+ *
+ * Cells are grouped by (table, pk) so that each row costs a single clock
+ * lookup and a single base table upsert rather than one of each per cell.
+ * LWW outcomes are identical to inserting the same cells into `crsql_changes`.
+ *
+ * Rows are merged in the order they were first seen unless `in_key_order` is
+ * set, in which case they are merged sorted by table and then by primary key
+ * in the order SQLite stores them. Senders emit changes in db version order,
+ * which scatters them over the tables. Merging in key order has consecutive
+ * rows land on the same b-tree pages, so each page is read and dirtied once per
+ * batch rather than once per row once a batch outgrows the page cache. Each
+ * row's outcome only depends on its own cells, whose order is kept, so the
+ * merged state is the same either way.
+ *
+ * `sender`, if given, is the site the changes were received from. Its own
+ * changes at or below its watermark are dropped, see `Watermark`.
+ */
+#[no_mangle]
+pub unsafe extern "C" fn crsql_apply_changes(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    changes: *const u8,
+    changes_len: c_int,
+    in_key_order: c_int,
+    sender: *const u8,
+    sender_len: c_int,
+    applied: *mut sqlite::int64,
+    errmsg: *mut *mut c_char,
+) -> c_int {
+    let changes = if changes.is_null() || changes_len <= 0 {
+        &[]
+    } else {
+        slice::from_raw_parts(changes, changes_len as usize)
+    };
+    let sender = if sender.is_null() || sender_len <= 0 {
+        None
+    } else {
+        Some(slice::from_raw_parts(sender, sender_len as usize))
+    };
+    match apply_changes(db, ext_data, changes, in_key_order != 0, sender, errmsg) {
+        Ok(count) => {
+            *applied = count;
+            ResultCode::OK as c_int
+        }
+        Err(rc) => rc as c_int,
+    }
+}
+
+fn apply_changes(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    changes: &[u8],
+    in_key_order: bool,
+    sender: Option<&[u8]>,
+    errmsg: *mut *mut c_char,
+) -> Result<sqlite::int64, ResultCode> {
+    // prepared changes are already in key order
+    if changes.first() == Some(&PREPARED_MARKER) {
+        return apply_prepared(db, ext_data, &changes[1..], sender, errmsg);
+    }
+
+    // records, and everything else the merge needs, only live for the call
+    let arena = Arena::new();
+    let mut records = Vec::new_in(&arena);
+    let mut buf = changes;
+    while !buf.is_empty() {
+        let record = unpack_columns_from_in(&mut buf, &arena)?;
+        if record.len() < CrsqlChangesColumn::Seq as usize {
+            let err = CString::new("crsql - malformed change record")?;
+            unsafe { *errmsg = err.into_raw() };
+            return Err(ResultCode::ERROR);
+        }
+        records.push(record);
+    }
+
+    apply_records(db, ext_data, &records, in_key_order, sender, &arena, errmsg)
+}
+
+// An empty record, which no stream of changes otherwise holds, starts the output
+// of `crsql_prepare_changes`.
+const PREPARED_MARKER: u8 = 0;
+
+/**
+ * `crsql_prepare_changes(changes)` - decodes, validates and groups a stream of
+ * changes for `crsql_apply_changes` without touching the database.
+ *
+ * Only one connection can write, so everything that doesn't need the database
+ * is split off from applying. Hosts ingesting on many cores can prepare on
+ * other connections, in other threads, and hand the writer streams whose cells
+ * are already grouped by row and sorted by table and primary key, in the order
+ * SQLite stores rows. The writer then applies rows as they come, touching each
+ * b-tree page once.
+ */
+pub extern "C" fn crsql_prepare_changes(
+    ctx: *mut sqlite::context,
+    argc: i32,
+    argv: *mut *mut sqlite::value,
+) {
+    let args = sqlite::args!(argc, argv);
+    if args.len() != 1 {
+        ctx.result_error("crsql_prepare_changes takes a single stream of changes");
+        return;
+    }
+    let changes = args[0].blob();
+    if changes.first() == Some(&PREPARED_MARKER) {
+        ctx.result_blob_shared(changes);
+        return;
+    }
+    match prepare_changes(changes) {
+        Ok(prepared) => ctx.result_blob_shared(&prepared),
+        Err(msg) => ctx.result_error(msg),
+    }
+}
+
+fn prepare_changes(changes: &[u8]) -> Result<Vec<u8>, &'static str> {
+    // raw bytes of each record, by row
+    let mut rows: BTreeMap<(&str, &[u8]), Vec<&[u8]>> = BTreeMap::new();
+    let mut buf = changes;
+    while !buf.is_empty() {
+        let start = buf;
+        let record = unpack_columns_from(&mut buf).or(Err("crsql - malformed change record"))?;
+        validate_record(&record)?;
+        let raw = &start[..start.len() - buf.len()];
+        let key = (
+            text_at(&record, CrsqlChangesColumn::Tbl).or(Err("crsql - malformed change record"))?,
+            blob_at(&record, CrsqlChangesColumn::Pk).or(Err("crsql - malformed change record"))?,
+        );
+        rows.entry(key).or_insert_with(Vec::new).push(raw);
+    }
+
+    // Packed bytes don't sort like the values they hold, e.g. 256 packs longer
+    // than -1. Order rows by the unpacked keys.
+    let mut rows = rows
+        .into_iter()
+        .map(|((tbl, pk), cells)| Ok((tbl, unpack_columns(pk)?, cells)))
+        .collect::<Result<Vec<_>, ResultCode>>()
+        .or(Err("crsql - malformed change record"))?;
+    rows.sort_by(|l, r| l.0.cmp(r.0).then_with(|| key_order_all(&l.1, &r.1)));
+
+    let mut prepared = Vec::with_capacity(changes.len() + 1);
+    prepared.push(PREPARED_MARKER);
+    for (_, _, cells) in rows.iter() {
+        for raw in cells {
+            prepared.extend_from_slice(raw);
+        }
+    }
+    Ok(prepared)
+}
+
+/// Everything about a change record that can be checked without the schema.
+fn validate_record(record: &[ColumnValue]) -> Result<(), &'static str> {
+    if record.len() < CrsqlChangesColumn::Seq as usize {
+        return Err("crsql - malformed change record");
+    }
+    let malformed = |_| "crsql - malformed change record";
+    if text_at(record, CrsqlChangesColumn::Tbl)
+        .map_err(malformed)?
+        .len()
+        > crate::consts::MAX_TBL_NAME_LEN as usize
+    {
+        return Err("crsql - table name exceeded max length");
+    }
+    if text_at(record, CrsqlChangesColumn::Cid)
+        .map_err(malformed)?
+        .len()
+        > crate::consts::MAX_TBL_NAME_LEN as usize
+    {
+        return Err("crsql - column name exceeded max length");
+    }
+    if blob_at(record, CrsqlChangesColumn::SiteId)
+        .map_err(malformed)?
+        .len()
+        > crate::consts::SITE_ID_LEN as usize
+    {
+        return Err("crsql - site id exceeded max length");
+    }
+    int_at(record, CrsqlChangesColumn::ColVrsn).map_err(malformed)?;
+    int_at(record, CrsqlChangesColumn::DbVrsn).map_err(malformed)?;
+    unpack_columns(blob_at(record, CrsqlChangesColumn::Pk).map_err(malformed)?)
+        .map_err(malformed)?;
+    Ok(())
+}
+
+/// Applies the output of `crsql_prepare_changes`. Cells of a row are adjacent.
+fn apply_prepared(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    changes: &[u8],
+    sender: Option<&[u8]>,
+    errmsg: *mut *mut c_char,
+) -> Result<sqlite::int64, ResultCode> {
+    let arena = Arena::new();
+    let mut records = Vec::new_in(&arena);
+    let mut buf = changes;
+    while !buf.is_empty() {
+        let record = unpack_columns_from_in(&mut buf, &arena)?;
+        if record.len() < CrsqlChangesColumn::Seq as usize {
+            let err = CString::new("crsql - malformed change record")?;
+            unsafe { *errmsg = err.into_raw() };
+            return Err(ResultCode::ERROR);
+        }
+        records.push(record);
+    }
+
+    let mut rows: Vec<Vec<&[ColumnValue], &Arena>, &Arena> = Vec::new_in(&arena);
+    let mut last_key = None;
+    for record in records.iter() {
+        let key = (
+            text_at(record, CrsqlChangesColumn::Tbl)?,
+            blob_at(record, CrsqlChangesColumn::Pk)?,
+        );
+        match rows.last_mut() {
+            Some(row) if last_key == Some(key) => row.push(&record[..]),
+            _ => {
+                let mut row = Vec::new_in(&arena);
+                row.push(&record[..]);
+                rows.push(row);
+            }
+        }
+        last_key = Some(key);
+    }
+
+    apply_rows(db, ext_data, &rows, sender, &arena, errmsg)
+}
+
+/// Merges `crsql_changes` rows that have already been unpacked.
+/// Each record holds `[table, pk, cid, val, col_version, db_version, site_id, ...]`.
+/// The grouping of records by row, and the temporaries of each row, come out of `arena`.
+pub fn apply_records<A: Allocator>(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    records: &[Vec<ColumnValue, A>],
+    in_key_order: bool,
+    sender: Option<&[u8]>,
+    arena: &Arena,
+    errmsg: *mut *mut c_char,
+) -> Result<sqlite::int64, ResultCode> {
+    // Group cells by row while preserving the order in which rows were first seen
+    // and the order of cells within a row.
+    let mut row_index: BTreeMap<(&str, &[u8]), usize, &Arena> = BTreeMap::new_in(arena);
+    let mut rows: Vec<Vec<&[ColumnValue], &Arena>, &Arena> = Vec::new_in(arena);
+    for record in records.iter() {
+        let key = (
+            text_at(record, CrsqlChangesColumn::Tbl)?,
+            blob_at(record, CrsqlChangesColumn::Pk)?,
+        );
+        if let Some(idx) = row_index.get(&key) {
+            rows[*idx].push(&record[..]);
+        } else {
+            row_index.insert(key, rows.len());
+            let mut row = Vec::new_in(arena);
+            row.push(&record[..]);
+            rows.push(row);
+        }
+    }
+
+    if in_key_order {
+        let mut keyed = Vec::with_capacity_in(rows.len(), arena);
+        for row in rows.into_iter() {
+            let tbl = text_at(row[0], CrsqlChangesColumn::Tbl)?;
+            let pks = unpack_columns_in(blob_at(row[0], CrsqlChangesColumn::Pk)?, arena)?;
+            keyed.push((tbl, pks, row));
+        }
+        keyed.sort_by(|l, r| l.0.cmp(r.0).then_with(|| key_order_all(&l.1, &r.1)));
+        rows = Vec::with_capacity_in(keyed.len(), arena);
+        rows.extend(keyed.into_iter().map(|(_, _, row)| row));
+    }
+
+    apply_rows(db, ext_data, &rows, sender, arena, errmsg)
+}
+
+fn apply_rows(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    rows: &[Vec<&[ColumnValue], &Arena>],
+    sender: Option<&[u8]>,
+    arena: &Arena,
+    errmsg: *mut *mut c_char,
+) -> Result<sqlite::int64, ResultCode> {
+    let rc = unsafe { crsql_ensureTableInfosAreUpToDate(db, ext_data, errmsg) };
+    if rc != ResultCode::OK as i32 {
+        let err = CString::new("Failed to update CRR table information")?;
+        unsafe { *errmsg = err.into_raw() };
+        return Err(ResultCode::ERROR);
+    }
+    unsafe { sync_tombstone_filters(ext_data)? };
+
+    let watermark = match sender {
+        Some(sender) => Some(Watermark::load(db, sender)?),
+        None => None,
+    };
+    // pk SQL fragments by table info index, built once per table rather than per row
+    let mut tables: Vec<Option<TableFragments>> = vec![];
+
+    let mut applied = 0;
+    let mut cells = vec![];
+    for row in rows.iter() {
+        cells.clear();
+        for record in row.iter() {
+            // applied as far as the application knows, the cell can only lose
+            let seq = match record.get(CrsqlChangesColumn::Seq as usize) {
+                Some(ColumnValue::Integer(seq)) => Some(*seq),
+                _ => None,
+            };
+            let site_id = blob_at(record, CrsqlChangesColumn::SiteId)?;
+            let db_vrsn = int_at(record, CrsqlChangesColumn::DbVrsn)?;
+            if !watermark
+                .as_ref()
+                .map_or(false, |w| w.covers(site_id, db_vrsn, seq))
+            {
+                cells.push(*record);
+            }
+        }
+        if !cells.is_empty() {
+            applied += unsafe { apply_row(db, ext_data, &cells, &mut tables, arena, errmsg)? };
+        }
+    }
+
+    Ok(applied)
+}
+
+fn table_fragments<'a>(
+    tables: &'a mut Vec<Option<TableFragments>>,
+    tbl_info: *mut crsql_TableInfo,
+    tbl_info_idx: c_int,
+) -> Result<&'a TableFragments, ResultCode> {
+    let idx = tbl_info_idx as usize;
+    if tables.len() <= idx {
+        tables.resize_with(idx + 1, || None);
+    }
+    if tables[idx].is_none() {
+        let pk_cols = sqlite::args!((*tbl_info).pksLen, (*tbl_info).pks);
+        tables[idx] = Some(TableFragments {
+            pk_where_list: util::where_list(pk_cols)?,
+            pk_bind_list: util::binding_list(pk_cols.len()),
+            pk_ident_list: util::as_identifier_list(pk_cols, None)?,
+        });
+    }
+    tables[idx].as_ref().ok_or(ResultCode::ERROR)
+}
+
+unsafe fn apply_row(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    cells: &[&[ColumnValue]],
+    tables: &mut Vec<Option<TableFragments>>,
+    arena: &Arena,
+    errmsg: *mut *mut c_char,
+) -> Result<sqlite::int64, ResultCode> {
+    let insert_tbl = text_at(cells[0], CrsqlChangesColumn::Tbl)?;
+    if insert_tbl.len() > crate::consts::MAX_TBL_NAME_LEN as usize {
+        let err = CString::new("crsql - table name exceeded max length")?;
+        *errmsg = err.into_raw();
+        return Err(ResultCode::ERROR);
+    }
+
+    let tbl_info_index = table_info_index(ext_data, insert_tbl);
+    if tbl_info_index == -1 {
+        let err = CString::new(format!(
+            "crsql - could not find the schema information for table {}",
+            insert_tbl
+        ))?;
+        *errmsg = err.into_raw();
+        return Err(ResultCode::ERROR);
+    }
+    let tbl_infos = sqlite::args!((*ext_data).tableInfosLen, (*ext_data).zpTableInfos);
+    let tbl_info = tbl_infos[tbl_info_index as usize];
+
+    let fragments = table_fragments(tables, tbl_info, tbl_info_index)?;
+    let pk_where_list = &fragments.pk_where_list;
+    let unpacked_pks = unpack_columns_in(blob_at(cells[0], CrsqlChangesColumn::Pk)?, arena)?;
+
+    if check_for_local_delete(
+        db,
+        ext_data,
+        tbl_info_index,
+        insert_tbl,
+        &pk_where_list,
+        &unpacked_pks,
+    )? {
+        // Delete wins. Nothing in this row can be applied.
+        return Ok(0);
+    }
+
+    let pk_bind_list = &fragments.pk_bind_list;
+    let pk_ident_list = &fragments.pk_ident_list;
+    let row = RowTarget {
+        tbl_info,
+        tbl_info_idx: tbl_info_index,
+        tbl_name: insert_tbl,
+        pk_where_list: &pk_where_list,
+        pk_bind_list: &pk_bind_list,
+        pk_ident_list: &pk_ident_list,
+        unpacked_pks: &unpacked_pks,
+        arena,
+    };
+
+    let mut applied = 0;
+    let mut pending: Vec<PendingCell, &Arena> = Vec::with_capacity_in(cells.len(), arena);
+    for cell in cells {
+        let insert_col = text_at(cell, CrsqlChangesColumn::Cid)?;
+        if insert_col.len() > crate::consts::MAX_TBL_NAME_LEN as usize {
+            let err = CString::new("crsql - column name exceeded max length")?;
+            *errmsg = err.into_raw();
+            return Err(ResultCode::ERROR);
+        }
+        let col_version = int_at(cell, CrsqlChangesColumn::ColVrsn)?;
+        let db_version = int_at(cell, CrsqlChangesColumn::DbVrsn)?;
+        let site_id = blob_at(cell, CrsqlChangesColumn::SiteId)?;
+        if site_id.len() > crate::consts::SITE_ID_LEN as usize {
+            let err = CString::new("crsql - site id exceeded max length")?;
+            *errmsg = err.into_raw();
+            return Err(ResultCode::ERROR);
+        }
+
+        if crate::c::DELETE_SENTINEL == insert_col {
+            applied += merge_row_columns(db, ext_data, &row, &pending, errmsg)?;
+            merge_delete(
+                db,
+                ext_data,
+                tbl_info,
+                tbl_info_index,
+                &pk_where_list,
+                &unpacked_pks,
+                &pk_bind_list,
+                &pk_ident_list,
+                col_version,
+                db_version,
+                site_id,
+            )?;
+            // Any later cell for this row would lose to the delete we just applied.
+            return Ok(applied + 1);
+        }
+
+        let non_pk_idx = non_pk_index(tbl_info, insert_col)?;
+        if crate::c::INSERT_SENTINEL == insert_col || non_pk_idx.is_none() {
+            merge_pk_only_insert(
+                db,
+                ext_data,
+                tbl_info,
+                tbl_info_index,
+                &pk_bind_list,
+                &unpacked_pks,
+                &pk_ident_list,
+                col_version,
+                db_version,
+                site_id,
+            )?;
+            applied += 1;
+            continue;
+        }
+
+        if pending.iter().any(|p| p.col_name == insert_col) {
+            // The same cell shows up more than once. Merge what we have so the
+            // later version is compared against the earlier winner.
+            applied += merge_row_columns(db, ext_data, &row, &pending, errmsg)?;
+            pending.clear();
+        }
+        let non_pk_idx = non_pk_idx.unwrap_or(0);
+        pending.push(PendingCell {
+            col_name: insert_col,
+            col_id: non_pk_col_id(db, tbl_info, non_pk_idx)?,
+            non_pk_idx,
+            val: &cell[CrsqlChangesColumn::Cval as usize],
+            col_version,
+            db_version,
+            site_id,
+        });
+    }
+
+    applied += merge_row_columns(db, ext_data, &row, &pending, errmsg)?;
+    Ok(applied)
+}
+
+struct RowTarget<'a> {
+    tbl_info: *mut crsql_TableInfo,
+    tbl_info_idx: c_int,
+    tbl_name: &'a str,
+    pk_where_list: &'a str,
+    pk_bind_list: &'a str,
+    pk_ident_list: &'a str,
+    unpacked_pks: &'a [ColumnValue<'a>],
+    arena: &'a Arena,
+}
+
+struct PendingCell<'a> {
+    col_name: &'a str,
+    col_id: sqlite::int64,
+    non_pk_idx: usize,
+    val: &'a ColumnValue<'a>,
+    col_version: sqlite::int64,
+    db_version: sqlite::int64,
+    site_id: &'a [u8],
+}
+
+/// Merges a set of distinct, non-sentinel columns of one row.
+/// Issues one clock read for the row, at most one read of the current row
+/// values (only needed to break version ties) and one upsert of all winners.
+unsafe fn merge_row_columns(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    row: &RowTarget,
+    cells: &[PendingCell],
+    errmsg: *mut *mut c_char,
+) -> Result<sqlite::int64, ResultCode> {
+    if cells.is_empty() {
+        return Ok(0);
+    }
+
+    let mut local_versions = BTreeMap::new_in(row.arena);
+    get_row_clock(
+        db,
+        ext_data,
+        row.tbl_info_idx,
+        row.tbl_name,
+        row.pk_where_list,
+        row.unpacked_pks,
+        &mut local_versions,
+    )?;
+    let mut winners: Vec<&PendingCell, &Arena> = Vec::with_capacity_in(cells.len(), row.arena);
+    let mut ties: Vec<&PendingCell, &Arena> = Vec::with_capacity_in(cells.len(), row.arena);
+    for cell in cells {
+        match local_versions.get(&cell.col_id) {
+            None => winners.push(cell),
+            Some(local_version) => {
+                if cell.col_version > *local_version {
+                    winners.push(cell);
+                } else if cell.col_version == *local_version {
+                    ties.push(cell);
+                }
+            }
+        }
+    }
+
+    if !ties.is_empty() {
+        let curr_row_stmt = get_curr_row_stmt(
+            db,
+            ext_data,
+            row.tbl_info,
+            row.tbl_info_idx,
+            row.tbl_name,
+            row.pk_where_list,
+        )?;
+
+        if let Err(rc) = bind_package_to_stmt(curr_row_stmt, row.unpacked_pks) {
+            reset_cached_stmt(curr_row_stmt)?;
+            return Err(rc);
+        }
+        match curr_row_stmt.step() {
+            Ok(ResultCode::ROW) => {
+                for cell in ties {
+                    let local_value = curr_row_stmt.column_value(cell.non_pk_idx as i32);
+                    if compare_column_value(cell.val, local_value) > 0 {
+                        winners.push(cell);
+                    }
+                }
+                reset_cached_stmt(curr_row_stmt)?;
+            }
+            _ => {
+                reset_cached_stmt(curr_row_stmt)?;
+                let err = CString::new(format!(
+                    "could not find row to merge with for tbl {}",
+                    row.tbl_name
+                ))?;
+                *errmsg = err.into_raw();
+                return Err(ResultCode::ERROR);
+            }
+        }
+    }
+
+    if winners.is_empty() {
+        return Ok(0);
+    }
+
+    // Statements are cached per set of columns, tracked as a bitmask per 64 columns.
+    // Ordering by column keeps one statement per set.
+    winners.sort_by_key(|c| c.non_pk_idx);
+    let mut start = 0;
+    while start < winners.len() {
+        let bucket = winners[start].non_pk_idx / 64;
+        let end = start
+            + winners[start..]
+                .iter()
+                .take_while(|c| c.non_pk_idx / 64 == bucket)
+                .count();
+        upsert_columns(db, ext_data, row, &winners[start..end])?;
+        start = end;
+    }
+
+    for cell in winners.iter() {
+        set_winner_clock(
+            db,
+            ext_data,
+            row.tbl_info,
+            row.tbl_info_idx,
+            row.pk_ident_list,
+            row.pk_bind_list,
+            row.unpacked_pks,
+            cell.col_id,
+            cell.col_version,
+            cell.db_version,
+            cell.site_id,
+        )?;
+    }
+
+    Ok(winners.len() as sqlite::int64)
+}
+
+/// Writes the values of `cells`, all within the same 64 column bucket, with a single upsert.
+unsafe fn upsert_columns(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    row: &RowTarget,
+    cells: &[&PendingCell],
+) -> Result<ResultCode, ResultCode> {
+    let bucket = cells[0].non_pk_idx / 64;
+    let col_mask = cells
+        .iter()
+        .fold(0u64, |mask, c| mask | (1u64 << (c.non_pk_idx % 64)));
+    let stmt_key =
+        get_col_set_cache_key(CachedStmtType::MergeRow, row.tbl_info_idx, bucket, col_mask)?;
+    let merge_stmt = get_cached_stmt_rt_wt(db, ext_data, stmt_key, || {
+        let col_list = cells
+            .iter()
+            .map(|c| format!("\"{}\"", util::escape_ident(c.col_name)))
+            .collect::<Vec<_>>()
+            .join(",");
+        let set_list = cells
+            .iter()
+            .map(|c| {
+                format!(
+                    "\"{col_name}\" = excluded.\"{col_name}\"",
+                    col_name = util::escape_ident(c.col_name)
+                )
+            })
+            .collect::<Vec<_>>()
+            .join(", ");
+        format!(
+            "INSERT INTO \"{table_name}\" ({pk_list}, {col_list})
+            VALUES ({pk_bind_list}, {col_bind_list})
+            ON CONFLICT DO UPDATE
+            SET {set_list}",
+            table_name = util::escape_ident(row.tbl_name),
+            pk_list = row.pk_ident_list,
+            col_list = col_list,
+            pk_bind_list = row.pk_bind_list,
+            col_bind_list = util::binding_list(cells.len()),
+            set_list = set_list,
+        )
+    })?;
+
+    let mut bind_result = bind_package_to_stmt(merge_stmt, row.unpacked_pks);
+    for (i, cell) in cells.iter().enumerate() {
+        bind_result = bind_result
+            .and_then(|_| bind_slot(row.unpacked_pks.len() + i + 1, cell.val, merge_stmt));
+    }
+    if let Err(rc) = bind_result {
+        reset_cached_stmt(merge_stmt)?;
+        return Err(rc);
+    }
+
+    let rc = (*ext_data)
+        .pSetSyncBitStmt
+        .step()
+        .and_then(|_| (*ext_data).pSetSyncBitStmt.reset())
+        .and_then(|_| merge_stmt.step());
+
+    reset_cached_stmt(merge_stmt)?;
+
+    let sync_rc = (*ext_data)
+        .pClearSyncBitStmt
+        .step()
+        .and_then(|_| (*ext_data).pClearSyncBitStmt.reset());
+
+    rc?;
+    sync_rc
+}
+
+fn text_at<'a>(record: &[ColumnValue<'a>], col: CrsqlChangesColumn) -> Result<&'a str, ResultCode> {
+    match &record[col as usize] {
+        ColumnValue::Text(t) => Ok(t),
+        _ => Err(ResultCode::MISMATCH),
+    }
+}
+
+fn blob_at<'a>(
+    record: &[ColumnValue<'a>],
+    col: CrsqlChangesColumn,
+) -> Result<&'a [u8], ResultCode> {
+    match &record[col as usize] {
+        ColumnValue::Blob(b) => Ok(b),
+        ColumnValue::Null => Ok(&[]),
+        _ => Err(ResultCode::MISMATCH),
+    }
+}
+
+fn int_at(record: &[ColumnValue], col: CrsqlChangesColumn) -> Result<sqlite::int64, ResultCode> {
+    match &record[col as usize] {
+        ColumnValue::Integer(i) => Ok(*i),
+        _ => Err(ResultCode::MISMATCH),
+    }
+}
@@ -0,0 +1,136 @@
+use alloc::alloc::{alloc, dealloc};
+use alloc::vec::Vec;
+use core::alloc::{AllocError, Allocator, Layout};
+use core::cell::{Cell, RefCell};
+use core::ptr::{self, NonNull};
+
+// Chunks start this size and double as the arena runs out of room.
+const FIRST_CHUNK: usize = 4096;
+const CHUNK_ALIGN: usize = 16;
+
+/**
+ * Bump allocator for the short lived values of a merge: unpacked primary keys,
+ * change records, and the bookkeeping of each row.
+ *
+ * Allocations are carved out of a few large chunks taken from the global
+ * allocator, which only sees the chunks. Memory is given back when the arena
+ * is dropped, at the end of the vtab transaction or the `crsql_apply_changes`
+ * call that owns it. The one exception is the most recent allocation, which is
+ * popped off when freed, so values created and dropped once per cell keep
+ * reusing the same bytes however long the transaction runs.
+ */
+pub struct Arena {
+    chunks: RefCell<Vec<(NonNull<u8>, Layout)>>,
+    // free bytes of the newest chunk
+    start: Cell<usize>,
+    next: Cell<usize>,
+    end: Cell<usize>,
+}
+
+impl Arena {
+    pub fn new() -> Arena {
+        Arena {
+            chunks: RefCell::new(Vec::new()),
+            start: Cell::new(0),
+            next: Cell::new(0),
+            end: Cell::new(0),
+        }
+    }
+
+    fn bump(&self, layout: Layout) -> Option<NonNull<[u8]>> {
+        let at = self.next.get().checked_add(layout.align() - 1)? & !(layout.align() - 1);
+        let until = at.checked_add(layout.size())?;
+        if self.next.get() == 0 || until > self.end.get() {
+            return None;
+        }
+        self.next.set(until);
+        NonNull::new(ptr::slice_from_raw_parts_mut(at as *mut u8, layout.size()))
+    }
+
+    fn add_chunk(&self, layout: Layout) -> Result<(), AllocError> {
+        let mut chunks = self.chunks.borrow_mut();
+        let size = chunks
+            .last()
+            .map_or(FIRST_CHUNK, |(_, last)| last.size().saturating_mul(2))
+            .max(
+                layout
+                    .size()
+                    .checked_add(layout.align())
+                    .ok_or(AllocError)?,
+            );
+        let chunk_layout = Layout::from_size_align(size, CHUNK_ALIGN).map_err(|_| AllocError)?;
+        let chunk = NonNull::new(unsafe { alloc(chunk_layout) }).ok_or(AllocError)?;
+        chunks.push((chunk, chunk_layout));
+        self.start.set(chunk.as_ptr() as usize);
+        self.next.set(chunk.as_ptr() as usize);
+        self.end.set(chunk.as_ptr() as usize + size);
+        Ok(())
+    }
+
+    fn is_last(&self, ptr: NonNull<u8>, size: usize) -> bool {
+        let at = ptr.as_ptr() as usize;
+        at >= self.start.get() && at + size == self.next.get()
+    }
+}
+
+impl Drop for Arena {
+    fn drop(&mut self) {
+        for (chunk, layout) in self.chunks.get_mut().drain(..) {
+            unsafe { dealloc(chunk.as_ptr(), layout) };
+        }
+    }
+}
+
+unsafe impl<'a> Allocator for &'a Arena {
+    fn allocate(&self, layout: Layout) -> Result<NonNull<[u8]>, AllocError> {
+        if let Some(block) = self.bump(layout) {
+            return Ok(block);
+        }
+        self.add_chunk(layout)?;
+        self.bump(layout).ok_or(AllocError)
+    }
+
+    unsafe fn deallocate(&self, ptr: NonNull<u8>, layout: Layout) {
+        if self.is_last(ptr, layout.size()) {
+            self.next.set(ptr.as_ptr() as usize);
+        }
+    }
+
+    unsafe fn grow(
+        &self,
+        ptr: NonNull<u8>,
+        old_layout: Layout,
+        new_layout: Layout,
+    ) -> Result<NonNull<[u8]>, AllocError> {
+        let at = ptr.as_ptr() as usize;
+        if self.is_last(ptr, old_layout.size())
+            && at % new_layout.align() == 0
+            && at + new_layout.size() <= self.end.get()
+        {
+            self.next.set(at + new_layout.size());
+            return Ok(NonNull::slice_from_raw_parts(ptr, new_layout.size()));
+        }
+        let block = self.allocate(new_layout)?;
+        ptr::copy_nonoverlapping(ptr.as_ptr(), block.as_ptr() as *mut u8, old_layout.size());
+        self.deallocate(ptr, old_layout);
+        Ok(block)
+    }
+
+    unsafe fn shrink(
+        &self,
+        ptr: NonNull<u8>,
+        old_layout: Layout,
+        new_layout: Layout,
+    ) -> Result<NonNull<[u8]>, AllocError> {
+        if ptr.as_ptr() as usize % new_layout.align() != 0 {
+            let block = self.allocate(new_layout)?;
+            ptr::copy_nonoverlapping(ptr.as_ptr(), block.as_ptr() as *mut u8, new_layout.size());
+            self.deallocate(ptr, old_layout);
+            return Ok(block);
+        }
+        if self.is_last(ptr, old_layout.size()) {
+            self.next.set(ptr.as_ptr() as usize + new_layout.size());
+        }
+        Ok(NonNull::slice_from_raw_parts(ptr, new_layout.size()))
+    }
+}
@@ -1,189 +1,647 @@
+use core::ffi::{c_char, c_int, c_void, CStr};
 use sqlite_nostd::{sqlite3, Connection, Destructor, ManagedStmt, ResultCode};
 extern crate alloc;
+use crate::c::{crsql_TableInfo, crsql_freeTableInfo, crsql_getTableInfo};
+use crate::consts;
+use crate::pack_columns::{bind_slot, pack_value, unpack_columns, ColumnValue};
 use crate::util::get_dflt_value;
 use alloc::format;
 use alloc::string::String;
-use alloc::{vec, vec::Vec};
+use alloc::vec::Vec;
+use sqlite_nostd as sqlite;
 
 /**
  * Backfills rows in a table with clock values.
+ *
+ * Clock rows are inserted a chunk of rows at a time, each chunk being a range
+ * of the table's primary key, so no statement has to hold more than a chunk of
+ * the table in memory. The whole table is backfilled before returning. See
+ * `crsql_backfill_step` to spread a backfill over many transactions instead.
  */
 pub fn backfill_table(
     db: *mut sqlite3,
     table: &str,
     pk_cols: Vec<&str>,
     non_pk_cols: Vec<&str>,
+    non_pk_col_ids: &[c_int],
     is_commit_alter: bool,
 ) -> Result<ResultCode, ResultCode> {
     db.exec_safe("SAVEPOINT backfill")?;
 
-    let sql = format!(
-        "SELECT {pk_cols} FROM \"{table}\" AS t1
-        WHERE NOT EXISTS
-          (SELECT 1 FROM \"{table}__crsql_clock\" AS t2 WHERE {pk_where_conditions})",
-        table = crate::util::escape_ident(table),
-        pk_cols = pk_cols
-            .iter()
-            .map(|f| format!("t1.\"{}\"", crate::util::escape_ident(f)))
-            .collect::<Vec<_>>()
-            .join(", "),
-        pk_where_conditions = pk_cols
-            .iter()
-            .map(|f| format!(
-                "t1.\"{}\" IS t2.\"{}\"",
-                crate::util::escape_ident(f),
-                crate::util::escape_ident(f)
-            ))
-            .collect::<Vec<_>>()
-            .join(" AND "),
-    );
-    let stmt = db.prepare_v2(&sql);
-
-    let result = match stmt {
-        Ok(stmt) => {
-            create_clock_rows_from_stmt(stmt, db, table, &pk_cols, &non_pk_cols, is_commit_alter)
-        }
-        Err(e) => Err(e),
-    };
+    let result = backfill_all_chunks(
+        db,
+        table,
+        &pk_cols,
+        &non_pk_cols,
+        non_pk_col_ids,
+        is_commit_alter,
+    )
+    // anything an unfinished chunked backfill had left is done now
+    .and_then(|_| clear_backfill_progress(db, table));
 
     if let Err(e) = result {
         db.exec_safe("ROLLBACK TO backfill")?;
         return Err(e);
     }
 
-    if let Err(e) = backfill_missing_columns(db, table, &pk_cols, &non_pk_cols, is_commit_alter) {
-        db.exec_safe("ROLLBACK TO backfill")?;
-        return Err(e);
-    }
-
     db.exec_safe("RELEASE backfill")
 }
 
-/**
-* Given a statement that returns rows in the source table not present
-* in the clock table, create those rows in the clock table.
-*/
-fn create_clock_rows_from_stmt(
-    read_stmt: ManagedStmt,
+fn backfill_all_chunks(
     db: *mut sqlite3,
     table: &str,
-    pk_cols: &Vec<&str>,
-    non_pk_cols: &Vec<&str>,
+    pk_cols: &[&str],
+    non_pk_cols: &[&str],
+    non_pk_col_ids: &[c_int],
     is_commit_alter: bool,
 ) -> Result<ResultCode, ResultCode> {
+    let mut after: Option<Vec<u8>> = None;
+    loop {
+        let after_values = match &after {
+            Some(packed) => Some(unpack_columns(packed)?),
+            None => None,
+        };
+        let (_, next) = backfill_chunk(
+            db,
+            table,
+            pk_cols,
+            non_pk_cols,
+            non_pk_col_ids,
+            is_commit_alter,
+            after_values.as_deref(),
+            consts::BACKFILL_CHUNK_ROWS,
+        )?;
+        match next {
+            Some(next) => after = Some(next),
+            None => return Ok(ResultCode::OK),
+        }
+    }
+}
+
+/**
+ * Backfills at most `max_rows` rows whose primary key comes after `after`.
+ *
+ * Returns the number of rows the chunk covered and the primary key, packed, of
+ * its last row. That is `None` once the chunk reached the end of the table.
+ */
+fn backfill_chunk(
+    db: *mut sqlite3,
+    table: &str,
+    pk_cols: &[&str],
+    non_pk_cols: &[&str],
+    non_pk_col_ids: &[c_int],
+    is_commit_alter: bool,
+    after: Option<&[ColumnValue]>,
+    max_rows: i64,
+) -> Result<(i64, Option<Vec<u8>>), ResultCode> {
+    let table_ident = crate::util::escape_ident(table);
+    let pk_list = pk_cols
+        .iter()
+        .map(|f| format!("t1.\"{}\"", crate::util::escape_ident(f)))
+        .collect::<Vec<_>>()
+        .join(", ");
+    let after_condition = match after {
+        Some(_) => format!(
+            "({}) > ({})",
+            pk_list,
+            numbered_binding_list(1, pk_cols.len())
+        ),
+        None => String::from("1"),
+    };
+
+    // The last row of the chunk bounds it from above.
+    let stmt = db.prepare_v2(&format!(
+        "SELECT {pk_list} FROM \"{table}\" AS t1 WHERE {after_condition}
+          ORDER BY {pk_list} LIMIT 1 OFFSET ?",
+        pk_list = pk_list,
+        table = table_ident,
+        after_condition = after_condition,
+    ))?;
+    let num_after_bindings = bind_after(&stmt, after)?;
+    stmt.bind_int64(num_after_bindings as i32 + 1, max_rows.max(1) - 1)?;
+    let (rows, upto) = if stmt.step()? == ResultCode::ROW {
+        let mut packed = Vec::new();
+        packed.push(pk_cols.len() as u8);
+        for i in 0..pk_cols.len() {
+            pack_value(&mut packed, stmt.column_value(i as i32)?);
+        }
+        (max_rows.max(1), Some(packed))
+    } else {
+        let stmt = db.prepare_v2(&format!(
+            "SELECT count(*) FROM \"{table}\" AS t1 WHERE {after_condition}",
+            table = table_ident,
+            after_condition = after_condition,
+        ))?;
+        bind_after(&stmt, after)?;
+        stmt.step()?;
+        (stmt.column_int64(0)?, None)
+    };
+    if rows == 0 {
+        return Ok((0, None));
+    }
+
+    let range_condition = match &upto {
+        Some(_) => format!(
+            "{after_condition} AND (({pk_list}) <= ({upto_bindings}){null_pks})",
+            after_condition = after_condition,
+            pk_list = pk_list,
+            upto_bindings = numbered_binding_list(num_after_bindings + 1, pk_cols.len()),
+            // rows with NULLs in their primary key sort first and never compare
+            // as in range. The first chunk takes them.
+            null_pks = if after.is_none() {
+                pk_cols
+                    .iter()
+                    .map(|f| format!(" OR t1.\"{}\" IS NULL", crate::util::escape_ident(f)))
+                    .collect::<String>()
+            } else {
+                String::new()
+            }
+        ),
+        None => after_condition,
+    };
+    let upto_values = match &upto {
+        Some(packed) => Some(unpack_columns(packed)?),
+        None => None,
+    };
+    let bind_range = |stmt: &ManagedStmt| -> Result<ResultCode, ResultCode> {
+        let offset = bind_after(stmt, after)?;
+        if let Some(upto_values) = &upto_values {
+            for (i, value) in upto_values.iter().enumerate() {
+                bind_slot(offset + i + 1, value, stmt.stmt)?;
+            }
+        }
+        Ok(ResultCode::OK)
+    };
+
     // We do not grab nextdbversion on migration.
     // The idea is that other nodes will apply the same migration
     // in the future so if they have already seen this node up
     // to the current db version then the migration will place them into the correct
     // state. No need to re-sync post migration.
-    let sql = format!(
-        "INSERT INTO \"{table}__crsql_clock\"
-          ({pk_cols}, __crsql_col_name, __crsql_col_version, __crsql_db_version, __crsql_seq) VALUES
-          ({pk_values}, ?, 1, {dbversion_getter}, crsql_increment_and_get_seq())",
-        table = crate::util::escape_ident(table),
-        pk_cols = pk_cols
+    let dbversion_getter = if is_commit_alter {
+        "crsql_dbversion()"
+    } else {
+        "crsql_nextdbversion()"
+    };
+    let clock_pk_list = pk_cols
+        .iter()
+        .map(|f| format!("\"{}\"", crate::util::escape_ident(f)))
+        .collect::<Vec<_>>()
+        .join(", ");
+    let pk_match = pk_cols
+        .iter()
+        .map(|f| {
+            format!(
+                "t1.\"{col}\" IS t2.\"{col}\"",
+                col = crate::util::escape_ident(f)
+            )
+        })
+        .collect::<Vec<_>>()
+        .join(" AND ");
+
+    // Rows that have no clock rows at all get a clock row for every column,
+    // defaults included, since we can't differentiate between an explicit reset
+    // to a default vs an implicit set to default on create. Rows of tables
+    // without non-pk columns get the pk only sentinel.
+    // The SELECT reads the clock table it inserts into so SQLite runs it to
+    // completion before inserting anything.
+    let col_ids = if non_pk_col_ids.is_empty() {
+        format!("({})", crate::c::INSERT_SENTINEL_ID)
+    } else {
+        non_pk_col_ids
             .iter()
-            .map(|f| format!("\"{}\"", crate::util::escape_ident(f)))
+            .map(|id| format!("({})", id))
             .collect::<Vec<_>>()
-            .join(", "),
-        pk_values = pk_cols.iter().map(|_| "?").collect::<Vec<_>>().join(", "),
-        dbversion_getter = if is_commit_alter {
-            "crsql_dbversion()"
-        } else {
-            "crsql_nextdbversion()"
-        }
-    );
-    let write_stmt = db.prepare_v2(&sql)?;
-
-    while read_stmt.step()? == ResultCode::ROW {
-        // bind primary key values
-        for (i, _name) in pk_cols.iter().enumerate() {
-            let value = read_stmt.column_value(i as i32)?;
-            write_stmt.bind_value(i as i32 + 1, value)?;
-        }
+            .join(", ")
+    };
+    let stmt = db.prepare_v2(&format!(
+        "INSERT INTO \"{table}__crsql_clock\"
+          ({clock_pk_list}, __crsql_col_id, __crsql_col_version, __crsql_db_version, __crsql_seq)
+        SELECT {pk_list}, col_ids.column1, 1, {dbversion_getter}, crsql_increment_and_get_seq()
+          FROM \"{table}\" AS t1 CROSS JOIN (VALUES {col_ids}) AS col_ids
+          WHERE {range_condition}
+            AND NOT EXISTS (SELECT 1 FROM \"{table}__crsql_clock\" AS t2 WHERE {pk_match})",
+        table = table_ident,
+        clock_pk_list = clock_pk_list,
+        pk_list = pk_list,
+        dbversion_getter = dbversion_getter,
+        col_ids = col_ids,
+        range_condition = range_condition,
+        pk_match = pk_match,
+    ))?;
+    bind_range(&stmt)?;
+    stmt.step()?;
+    let mut written = db.changes64();
 
-        // TODO: handle the case here where the _are no_ non_pk_cols!!!
-        // just insert the pk only sentinel.
-        for col in non_pk_cols.iter() {
-            // We even backfill default values since we can't differentiate between an explicit
-            // reset to a default vs an implicit set to default on create.
-            write_stmt.bind_text(pk_cols.len() as i32 + 1, col, Destructor::STATIC)?;
-            write_stmt.step()?;
-            write_stmt.reset()?;
-        }
-        if non_pk_cols.len() == 0 {
-            write_stmt.bind_text(pk_cols.len() as i32 + 1, "__crsql_pko", Destructor::STATIC)?;
-            write_stmt.step()?;
-            write_stmt.reset()?;
+    // Rows that were already tracked get clock rows for the columns they are
+    // missing, unless the column holds its default value.
+    for (non_pk_col, col_id) in non_pk_cols.iter().zip(non_pk_col_ids) {
+        let dflt_value = get_dflt_value(db, table, non_pk_col)?;
+        let stmt = db.prepare_v2(&format!(
+            "INSERT INTO \"{table}__crsql_clock\"
+              ({clock_pk_list}, __crsql_col_id, __crsql_col_version, __crsql_db_version, __crsql_seq)
+            SELECT {pk_list}, {col_id}, 1, {dbversion_getter}, crsql_increment_and_get_seq()
+              FROM \"{table}\" AS t1
+              WHERE {range_condition} {dflt_value_condition}
+                AND NOT EXISTS (
+                  SELECT 1 FROM \"{table}__crsql_clock\" AS t2
+                  WHERE {pk_match} AND t2.__crsql_col_id = {col_id}
+                )",
+            table = table_ident,
+            clock_pk_list = clock_pk_list,
+            pk_list = pk_list,
+            col_id = col_id,
+            dbversion_getter = dbversion_getter,
+            range_condition = range_condition,
+            dflt_value_condition = if let Some(dflt) = dflt_value {
+                format!(
+                    "AND t1.\"{}\" IS NOT {}",
+                    crate::util::escape_ident(non_pk_col),
+                    dflt
+                )
+            } else {
+                String::from("")
+            },
+            pk_match = pk_match,
+        ))?;
+        bind_range(&stmt)?;
+        stmt.step()?;
+        written += db.changes64();
+    }
+    if !is_commit_alter && written > 0 {
+        db.exec_safe(consts::RAISE_DB_VERSION)?;
+    }
+
+    Ok((rows, upto))
+}
+
+fn numbered_binding_list(first: usize, num_slots: usize) -> String {
+    (first..first + num_slots)
+        .map(|i| format!("?{}", i))
+        .collect::<Vec<_>>()
+        .join(", ")
+}
+
+fn bind_after(stmt: &ManagedStmt, after: Option<&[ColumnValue]>) -> Result<usize, ResultCode> {
+    match after {
+        Some(after) => {
+            for (i, value) in after.iter().enumerate() {
+                bind_slot(i + 1, value, stmt.stmt)?;
+            }
+            Ok(after.len())
         }
+        None => Ok(0),
     }
+}
 
-    Ok(ResultCode::OK)
+/*
+ * Progress of a chunked backfill lives in `crsql_master` so it survives the
+ * connection. `backfill_after.<table>` holds the packed primary key of the
+ * last row backfilled, NULL before the first chunk, and `backfill_rows.<table>`
+ * the number of rows backfilled so far. The keys only exist while a backfill
+ * is unfinished.
+ */
+
+fn progress_key(kind: &str, table: &str) -> String {
+    format!("backfill_{}.{}", kind, table)
 }
 
-/**
-* For each column, make sure there was a clock table entry.
-* If not, fill the data in for it for each row.
-*
-* Can we optimize and skip cases where it is equivalent to the default value?
-* E.g., adding a new column set to default values should not require a backfill...
-*/
-fn backfill_missing_columns(
+/// Records that `table` still has to be backfilled, from its first row on.
+pub fn begin_backfill(db: *mut sqlite3, table: &str) -> Result<ResultCode, ResultCode> {
+    let stmt = db.prepare_v2(&format!(
+        "INSERT OR REPLACE INTO \"{tbl}\" (key, value) VALUES (?, NULL), (?, 0)",
+        tbl = consts::TBL_SCHEMA
+    ))?;
+    stmt.bind_text(1, &progress_key("after", table), Destructor::TRANSIENT)?;
+    stmt.bind_text(2, &progress_key("rows", table), Destructor::TRANSIENT)?;
+    stmt.step()
+}
+
+/// Where an unfinished backfill of `table` left off and how many rows it backfilled.
+fn backfill_progress(
     db: *mut sqlite3,
     table: &str,
-    pk_cols: &Vec<&str>,
-    non_pk_cols: &Vec<&str>,
-    is_commit_alter: bool,
+) -> Result<Option<(Option<Vec<u8>>, i64)>, ResultCode> {
+    let stmt = db.prepare_v2(&format!(
+        "SELECT
+          (SELECT value FROM \"{tbl}\" WHERE key = ?1),
+          (SELECT value FROM \"{tbl}\" WHERE key = ?2),
+          EXISTS (SELECT 1 FROM \"{tbl}\" WHERE key = ?1)",
+        tbl = consts::TBL_SCHEMA
+    ))?;
+    stmt.bind_text(1, &progress_key("after", table), Destructor::TRANSIENT)?;
+    stmt.bind_text(2, &progress_key("rows", table), Destructor::TRANSIENT)?;
+    stmt.step()?;
+    if stmt.column_int(2)? == 0 {
+        return Ok(None);
+    }
+    let after = match stmt.column_type(0)? {
+        sqlite::ColumnType::Blob => Some(stmt.column_blob(0)?.to_vec()),
+        _ => None,
+    };
+    Ok(Some((after, stmt.column_int64(1)?)))
+}
+
+fn set_backfill_progress(
+    db: *mut sqlite3,
+    table: &str,
+    after: &[u8],
+    rows: i64,
 ) -> Result<ResultCode, ResultCode> {
-    for non_pk_col in non_pk_cols {
-        fill_column(db, table, &pk_cols, non_pk_col, is_commit_alter)?;
+    let stmt = db.prepare_v2(&format!(
+        "UPDATE \"{tbl}\" SET value = CASE key WHEN ?1 THEN ?3 ELSE ?4 END WHERE key IN (?1, ?2)",
+        tbl = consts::TBL_SCHEMA
+    ))?;
+    stmt.bind_text(1, &progress_key("after", table), Destructor::TRANSIENT)?;
+    stmt.bind_text(2, &progress_key("rows", table), Destructor::TRANSIENT)?;
+    stmt.bind_blob(3, after, Destructor::STATIC)?;
+    stmt.bind_int64(4, rows)?;
+    stmt.step()
+}
+
+pub fn clear_backfill_progress(db: *mut sqlite3, table: &str) -> Result<ResultCode, ResultCode> {
+    let stmt = db.prepare_v2(&format!(
+        "DELETE FROM \"{tbl}\" WHERE key IN (?, ?)",
+        tbl = consts::TBL_SCHEMA
+    ))?;
+    stmt.bind_text(1, &progress_key("after", table), Destructor::TRANSIENT)?;
+    stmt.bind_text(2, &progress_key("rows", table), Destructor::TRANSIENT)?;
+    stmt.step()
+}
+
+#[no_mangle]
+pub extern "C" fn crsql_begin_backfill(db: *mut sqlite3, table: *const c_char) -> c_int {
+    match unsafe { CStr::from_ptr(table).to_str() } {
+        Ok(table) => match begin_backfill(db, table) {
+            Ok(_) => ResultCode::OK as c_int,
+            Err(rc) => rc as c_int,
+        },
+        Err(_) => ResultCode::ERROR as c_int,
     }
+}
 
-    Ok(ResultCode::OK)
+/**
+ * Backfills the next chunk of at most `max_rows` rows of a table whose
+ * backfill was deferred with `crsql_begin_backfill` and records how far it
+ * got. `rows` is set to the number of rows the chunk covered, 0 once the
+ * backfill is complete.
+ *
+ * Each chunk is meant to be committed on its own so a large table can be
+ * backfilled without holding the write lock for long, and so the backfill
+ * picks up where it left off after a crash.
+ */
+#[no_mangle]
+pub extern "C" fn crsql_backfill_step(
+    db: *mut sqlite3,
+    table: *const c_char,
+    max_rows: sqlite::int64,
+    rows: *mut sqlite::int64,
+) -> c_int {
+    match backfill_step(db, table, max_rows) {
+        Ok(count) => {
+            unsafe { *rows = count };
+            ResultCode::OK as c_int
+        }
+        Err(rc) => rc as c_int,
+    }
+}
+
+fn backfill_step(
+    db: *mut sqlite3,
+    table: *const c_char,
+    max_rows: sqlite::int64,
+) -> Result<sqlite::int64, ResultCode> {
+    let table_name = unsafe { CStr::from_ptr(table).to_str() }?;
+    let (after, rows_so_far) = match backfill_progress(db, table_name)? {
+        Some(progress) => progress,
+        None => return Ok(0),
+    };
+
+    with_table_columns(db, table, |table, pk_cols, non_pk_cols, non_pk_col_ids| {
+        backfill_step_for(
+            db,
+            table,
+            pk_cols,
+            non_pk_cols,
+            non_pk_col_ids,
+            after,
+            rows_so_far,
+            max_rows,
+        )
+    })
+}
+
+/// Calls `f` with the columns of `table` and their ids, read fresh from the schema.
+fn with_table_columns<T>(
+    db: *mut sqlite3,
+    table: *const c_char,
+    f: impl FnOnce(&str, &[&str], &[&str], &[c_int]) -> Result<T, ResultCode>,
+) -> Result<T, ResultCode> {
+    let mut table_info: *mut crsql_TableInfo = core::ptr::null_mut();
+    let mut err: *mut c_char = core::ptr::null_mut();
+    let mut rc = unsafe { crsql_getTableInfo(db, table, &mut table_info, &mut err) };
+    if !err.is_null() {
+        sqlite::free(err as *mut c_void);
+    }
+    if rc == ResultCode::OK as c_int {
+        rc = unsafe { crate::col_ids::crsql_ensure_col_ids(db, table_info) };
+    }
+    if rc != ResultCode::OK as c_int {
+        unsafe { crsql_freeTableInfo(table_info) };
+        return Err(ResultCode::ERROR);
+    }
+
+    let result = unsafe { with_columns_of(table_info, f) };
+    unsafe { crsql_freeTableInfo(table_info) };
+    result
+}
+
+unsafe fn with_columns_of<T>(
+    table_info: *mut crsql_TableInfo,
+    f: impl FnOnce(&str, &[&str], &[&str], &[c_int]) -> Result<T, ResultCode>,
+) -> Result<T, ResultCode> {
+    let table = CStr::from_ptr((*table_info).tblName).to_str()?;
+    let pk_cols = sqlite::args!((*table_info).pksLen, (*table_info).pks)
+        .iter()
+        .map(|c| CStr::from_ptr(c.name).to_str())
+        .collect::<Result<Vec<_>, _>>()?;
+    let non_pks = sqlite::args!((*table_info).nonPksLen, (*table_info).nonPks);
+    let non_pk_cols = non_pks
+        .iter()
+        .map(|c| CStr::from_ptr(c.name).to_str())
+        .collect::<Result<Vec<_>, _>>()?;
+    let non_pk_col_ids = non_pks.iter().map(|c| c.colId).collect::<Vec<_>>();
+    f(table, &pk_cols, &non_pk_cols, &non_pk_col_ids)
 }
 
-// This doesn't fill compeltely new columns...
-// Wel... does it not? The on condition x left join should do it.
-fn fill_column(
+fn backfill_step_for(
     db: *mut sqlite3,
     table: &str,
-    pk_cols: &Vec<&str>,
-    non_pk_col: &str,
-    is_commit_alter: bool,
+    pk_cols: &[&str],
+    non_pk_cols: &[&str],
+    non_pk_col_ids: &[c_int],
+    after: Option<Vec<u8>>,
+    rows_so_far: i64,
+    max_rows: i64,
+) -> Result<sqlite::int64, ResultCode> {
+    let after_values = match &after {
+        Some(packed) => Some(unpack_columns(packed)?),
+        None => None,
+    };
+    let (rows, next) = backfill_chunk(
+        db,
+        table,
+        pk_cols,
+        non_pk_cols,
+        non_pk_col_ids,
+        false,
+        after_values.as_deref(),
+        max_rows,
+    )?;
+    match next {
+        Some(next) => set_backfill_progress(db, table, &next, rows_so_far + rows)?,
+        None => clear_backfill_progress(db, table)?,
+    };
+    Ok(rows)
+}
+
+/**
+ * Ends a bulk load of a crr by giving every row the load inserted its clock
+ * rows, all at the next db version, as if the insert trigger had run for
+ * each of them in this one transaction.
+ *
+ * Rows inserted during the load are the rows without any clock rows, so this
+ * is a backfill of the whole table that skips the rows already tracked. Rows
+ * that were deleted before the load and inserted again during it only have
+ * their delete sentinel, and are clocked first.
+ */
+#[no_mangle]
+pub extern "C" fn crsql_end_bulk_load(db: *mut sqlite3, table: *const c_char) -> c_int {
+    let result = with_table_columns(db, table, |table, pk_cols, non_pk_cols, non_pk_col_ids| {
+        clock_reinserted_rows(db, table, pk_cols, non_pk_col_ids)?;
+        backfill_all_chunks(db, table, pk_cols, non_pk_cols, non_pk_col_ids, false)
+    });
+    match result {
+        Ok(_) => ResultCode::OK as c_int,
+        Err(rc) => rc as c_int,
+    }
+}
+
+/// Gives rows that have a delete sentinel and no other clock rows, but exist in
+/// `table`, a clock row for every column. That is what the insert trigger
+/// writes for a row inserted again after its delete. The sentinel is left as
+/// the trigger leaves it.
+fn clock_reinserted_rows(
+    db: *mut sqlite3,
+    table: &str,
+    pk_cols: &[&str],
+    non_pk_col_ids: &[c_int],
 ) -> Result<ResultCode, ResultCode> {
-    // Only fill rows for which
-    // - a row does not exist for that pk combo _and_ the cid in the clock table.
-    // - the value is not the default value for that column.
-    let dflt_value = get_dflt_value(db, table, non_pk_col)?;
-    let sql = format!(
-        "SELECT {pk_cols} FROM {table} as t1
-          LEFT JOIN \"{table}__crsql_clock\" as t2 ON {pk_on_conditions} AND t2.__crsql_col_name = ?
-          WHERE t2.\"{first_pk}\" IS NULL {dflt_value_condition}",
-        table = crate::util::escape_ident(table),
-        pk_cols = pk_cols
+    let table_ident = crate::util::escape_ident(table);
+    let pk_list = pk_cols
+        .iter()
+        .map(|f| format!("t1.\"{}\"", crate::util::escape_ident(f)))
+        .collect::<Vec<_>>()
+        .join(", ");
+    let clock_pk_list = pk_cols
+        .iter()
+        .map(|f| format!("\"{}\"", crate::util::escape_ident(f)))
+        .collect::<Vec<_>>()
+        .join(", ");
+    let pk_match = |clock: &str| {
+        pk_cols
             .iter()
-            .map(|f| format!("t1.\"{}\"", crate::util::escape_ident(f)))
+            .map(|f| {
+                format!(
+                    "t1.\"{col}\" IS {clock}.\"{col}\"",
+                    col = crate::util::escape_ident(f),
+                    clock = clock
+                )
+            })
             .collect::<Vec<_>>()
-            .join(", "),
-        pk_on_conditions = pk_cols
+            .join(" AND ")
+    };
+    let col_ids = if non_pk_col_ids.is_empty() {
+        format!("({})", crate::c::INSERT_SENTINEL_ID)
+    } else {
+        non_pk_col_ids
             .iter()
-            .map(|f| format!(
-                "t1.\"{}\" = t2.\"{}\"",
-                crate::util::escape_ident(f),
-                crate::util::escape_ident(f)
-            ))
+            .map(|id| format!("({})", id))
             .collect::<Vec<_>>()
-            .join(" AND "),
-        first_pk = crate::util::escape_ident(pk_cols[0]),
-        dflt_value_condition = if let Some(dflt) = dflt_value {
-            format!("AND t1.\"{}\" IS NOT {}", non_pk_col, dflt)
-        } else {
-            String::from("")
-        },
-    );
-    let read_stmt = db.prepare_v2(&sql)?;
-    read_stmt.bind_text(1, non_pk_col, Destructor::STATIC)?;
+            .join(", ")
+    };
+    // Reads the clock table it inserts into, so it runs to completion first.
+    let stmt = db.prepare_v2(&format!(
+        "INSERT INTO \"{table}__crsql_clock\"
+          ({clock_pk_list}, __crsql_col_id, __crsql_col_version, __crsql_db_version, __crsql_seq)
+        SELECT {pk_list}, col_ids.column1, 1, crsql_nextdbversion(), crsql_increment_and_get_seq()
+          FROM \"{table}__crsql_clock\" AS t2
+          JOIN \"{table}\" AS t1 ON {t2_match}
+          CROSS JOIN (VALUES {col_ids}) AS col_ids
+          WHERE t2.__crsql_col_id = {sentinel_id}
+            AND NOT EXISTS (
+              SELECT 1 FROM \"{table}__crsql_clock\" AS t3
+              WHERE {t3_match} AND t3.__crsql_col_id != {sentinel_id}
+            )",
+        table = table_ident,
+        clock_pk_list = clock_pk_list,
+        pk_list = pk_list,
+        t2_match = pk_match("t2"),
+        t3_match = pk_match("t3"),
+        col_ids = col_ids,
+        sentinel_id = crate::c::DELETE_SENTINEL_ID,
+    ))?;
+    stmt.step()?;
+    if db.changes64() > 0 {
+        db.exec_safe(consts::RAISE_DB_VERSION)?;
+    }
+    Ok(ResultCode::OK)
+}
+
+/**
+ * `crsql_backfill_progress(table)` - how far the backfill of a crr is, as
+ * `{"backfilled":n,"total":n,"complete":true|false}`.
+ */
+pub extern "C" fn crsql_backfill_progress_fn(
+    ctx: *mut sqlite::context,
+    argc: i32,
+    argv: *mut *mut sqlite::value,
+) {
+    use sqlite::{Context, Value};
+    let args = sqlite::args!(argc, argv);
+    if args.len() != 1 {
+        ctx.result_error("crsql_backfill_progress takes the name of a table");
+        return;
+    }
+    match backfill_progress_json(ctx.db_handle(), args[0].text()) {
+        Ok(json) => ctx.result_text_transient(&json),
+        Err(rc) => {
+            ctx.result_error("crsql - failed to read the backfill progress");
+            ctx.result_error_code(rc);
+        }
+    }
+}
 
-    let non_pk_cols = vec![non_pk_col];
-    create_clock_rows_from_stmt(read_stmt, db, table, pk_cols, &non_pk_cols, is_commit_alter)
+fn backfill_progress_json(db: *mut sqlite3, table: &str) -> Result<String, ResultCode> {
+    let stmt = db.prepare_v2(&format!(
+        "SELECT count(*) FROM \"{}\"",
+        crate::util::escape_ident(table)
+    ))?;
+    stmt.step()?;
+    let total = stmt.column_int64(0)?;
+
+    let (backfilled, complete) = match backfill_progress(db, table)? {
+        Some((_, rows)) => (rows, false),
+        None => {
+            if crate::is_crr(db, table)? {
+                (total, true)
+            } else {
+                (0, false)
+            }
+        }
+    };
+    Ok(format!(
+        "{{\"backfilled\":{},\"total\":{},\"complete\":{}}}",
+        backfilled, total, complete
+    ))
 }
@@ -1,7 +1,11 @@
-use core::ffi::{c_char, c_int, CStr};
+use core::ffi::{c_char, c_int, c_void, CStr};
 
-use crate::{c::crsql_TableInfo, consts};
+use crate::c::{crsql_TableInfo, crsql_freeTableInfo, crsql_getTableInfo};
+use crate::{col_ids, consts, site_ordinals};
+use alloc::ffi::CString;
 use alloc::format;
+use alloc::string::String;
+use alloc::vec;
 use core::slice;
 use sqlite::{sqlite3, Connection, Destructor, ResultCode};
 use sqlite_nostd as sqlite;
@@ -117,13 +121,234 @@ fn update_to_0_13_0(db: *mut sqlite3) -> Result<ResultCode, ResultCode> {
     Ok(ResultCode::OK)
 }
 
+/**
+ * Creates the table holding the db version, seeded from the clock tables
+ * of dbs that predate it. Writers keep it up to date, see
+ * `crsql_raiseDbVersion`.
+ */
+fn create_db_version_table_if_not_exists(db: *mut sqlite3) -> Result<ResultCode, ResultCode> {
+    let stmt =
+        db.prepare_v2("SELECT 1 FROM sqlite_master WHERE type = 'table' AND tbl_name = ?")?;
+    stmt.bind_text(1, consts::TBL_DB_VERSION, Destructor::STATIC)?;
+    if stmt.step()? == ResultCode::ROW {
+        return drop_db_version_triggers(db);
+    }
+
+    match db.exec_safe(&format!(
+        "CREATE TABLE \"{tbl}\" (db_version INTEGER NOT NULL)",
+        tbl = consts::TBL_DB_VERSION
+    )) {
+        // Read-only connections keep computing the version from the clock tables.
+        Err(ResultCode::READONLY) => return Ok(ResultCode::OK),
+        Err(rc) => return Err(rc),
+        Ok(_) => {}
+    }
+
+    let mut clock_tables = vec![];
+    let stmt = db.prepare_v2(consts::CLOCK_TABLES_SELECT)?;
+    while stmt.step()? == ResultCode::ROW {
+        clock_tables.push(String::from(stmt.column_text(0)?));
+    }
+
+    // Clock rows removed by `crsql_commit_alter` left their version behind in
+    // `pre_compact_dbversion`.
+    let versions = clock_tables
+        .iter()
+        .map(|tbl| {
+            format!(
+                "SELECT max(__crsql_db_version) AS version FROM \"{tbl}\" UNION ALL ",
+                tbl = crate::util::escape_ident(tbl)
+            )
+        })
+        .collect::<String>();
+    db.exec_safe(&format!(
+        "INSERT INTO \"{tbl}\" (db_version) SELECT coalesce(max(version), {min_version}) FROM (
+          {versions}SELECT value AS version FROM \"{schema_tbl}\" WHERE key = 'pre_compact_dbversion'
+        )",
+        tbl = consts::TBL_DB_VERSION,
+        min_version = consts::MIN_POSSIBLE_DB_VERSION,
+        versions = versions,
+        schema_tbl = consts::TBL_SCHEMA,
+    ))?;
+
+    Ok(ResultCode::OK)
+}
+
+/**
+ * The version used to be raised by triggers on every clock table, which cost
+ * every clock row write a lookup of the version. Writers raise it themselves
+ * now.
+ */
+fn drop_db_version_triggers(db: *mut sqlite3) -> Result<ResultCode, ResultCode> {
+    let mut triggers = vec![];
+    let stmt = db.prepare_v2(
+        "SELECT name FROM sqlite_master WHERE type = 'trigger'
+          AND tbl_name LIKE '%__crsql_clock'
+          AND name IN (tbl_name || '_dbv_insert', tbl_name || '_dbv_update')",
+    )?;
+    while stmt.step()? == ResultCode::ROW {
+        triggers.push(String::from(stmt.column_text(0)?));
+    }
+
+    for trigger in triggers.iter() {
+        match db.exec_safe(&format!(
+            "DROP TRIGGER \"{}\"",
+            crate::util::escape_ident(trigger)
+        )) {
+            // The next writable connection drops them.
+            Err(ResultCode::READONLY) => return Ok(ResultCode::OK),
+            Err(rc) => return Err(rc),
+            Ok(_) => {}
+        }
+    }
+    Ok(ResultCode::OK)
+}
+
+/**
+ * Clock tables used to record the name of the column each clock is for and
+ * the id of the site it came from. Rewrites them to record the column's id and
+ * the site's ordinal instead and recreates the triggers of their crrs, which
+ * now write ids.
+ */
+fn update_to_0_14_0(db: *mut sqlite3) -> Result<ResultCode, ResultCode> {
+    let mut clock_tables = vec![];
+    let stmt = db.prepare_v2(consts::CLOCK_TABLES_SELECT)?;
+    while stmt.step()? == ResultCode::ROW {
+        clock_tables.push(String::from(stmt.column_text(0)?));
+    }
+
+    for clock_table in clock_tables.iter() {
+        migrate_clock_table_to_col_ids(db, clock_table)?;
+    }
+
+    Ok(ResultCode::OK)
+}
+
+fn migrate_clock_table_to_col_ids(
+    db: *mut sqlite3,
+    clock_table: &str,
+) -> Result<ResultCode, ResultCode> {
+    let table = &clock_table[..clock_table.len() - "__crsql_clock".len()];
+
+    let stmt = db.prepare_v2(
+        "SELECT name FROM pragma_table_info(?) WHERE pk > 0 AND name != '__crsql_col_name' ORDER BY pk",
+    )?;
+    stmt.bind_text(1, clock_table, Destructor::STATIC)?;
+    let mut pk_cols = vec![];
+    while stmt.step()? == ResultCode::ROW {
+        pk_cols.push(format!(
+            "\"{}\"",
+            crate::util::escape_ident(stmt.column_text(0)?)
+        ));
+    }
+    let pk_list = pk_cols.join(", ");
+
+    let stmt = db.prepare_v2(&format!(
+        "SELECT DISTINCT __crsql_col_name FROM \"{clock_table}\" WHERE __crsql_col_name NOT IN ('{delete_sentinel}', '{insert_sentinel}')",
+        clock_table = crate::util::escape_ident(clock_table),
+        delete_sentinel = crate::c::DELETE_SENTINEL,
+        insert_sentinel = crate::c::INSERT_SENTINEL,
+    ))?;
+    while stmt.step()? == ResultCode::ROW {
+        col_ids::assign_col_id(db, table, stmt.column_text(0)?)?;
+    }
+
+    db.exec_safe(&format!(
+        "INSERT OR IGNORE INTO \"{site_ordinals}\" (site_id)
+          SELECT DISTINCT __crsql_site_id FROM \"{clock_table}\" WHERE __crsql_site_id IS NOT NULL",
+        site_ordinals = consts::TBL_SITE_ORDINALS,
+        clock_table = crate::util::escape_ident(clock_table),
+    ))?;
+
+    // The old triggers write names into the clock table.
+    crate::teardown::remove_crr_triggers_if_exist(db, table)?;
+
+    db.exec_safe(&format!(
+        "CREATE TABLE \"{clock_table}_0_14_0\" AS SELECT
+          {pk_list},
+          CASE __crsql_col_name
+            WHEN '{delete_sentinel}' THEN {delete_sentinel_id}
+            WHEN '{insert_sentinel}' THEN {insert_sentinel_id}
+            ELSE (SELECT col_id FROM \"{col_ids}\" WHERE tbl_name = '{table_val}' AND col_name = __crsql_col_name)
+          END AS __crsql_col_id,
+          __crsql_col_version,
+          __crsql_db_version,
+          (SELECT ordinal FROM \"{site_ordinals}\" WHERE site_id = __crsql_site_id) AS __crsql_site_ordinal,
+          __crsql_seq
+        FROM \"{clock_table}\"",
+        clock_table = crate::util::escape_ident(clock_table),
+        pk_list = pk_list,
+        delete_sentinel = crate::c::DELETE_SENTINEL,
+        delete_sentinel_id = crate::c::DELETE_SENTINEL_ID,
+        insert_sentinel = crate::c::INSERT_SENTINEL,
+        insert_sentinel_id = crate::c::INSERT_SENTINEL_ID,
+        col_ids = consts::TBL_COL_IDS,
+        table_val = crate::util::escape_ident_as_value(table),
+        site_ordinals = consts::TBL_SITE_ORDINALS,
+    ))?;
+    // Takes the index and db version triggers along with it.
+    db.exec_safe(&format!(
+        "DROP TABLE \"{}\"",
+        crate::util::escape_ident(clock_table)
+    ))?;
+    create_clock_table_for_pks(db, table, &pk_list)?;
+    db.exec_safe(&format!(
+        "INSERT INTO \"{clock_table}\" (
+          {pk_list},
+          __crsql_col_id,
+          __crsql_col_version,
+          __crsql_db_version,
+          __crsql_site_ordinal,
+          __crsql_seq
+        ) SELECT * FROM \"{clock_table}_0_14_0\"",
+        clock_table = crate::util::escape_ident(clock_table),
+        pk_list = pk_list,
+    ))?;
+    db.exec_safe(&format!(
+        "DROP TABLE \"{}_0_14_0\"",
+        crate::util::escape_ident(clock_table)
+    ))?;
+
+    let stmt =
+        db.prepare_v2("SELECT 1 FROM sqlite_master WHERE type = 'table' AND tbl_name = ?")?;
+    stmt.bind_text(1, table, Destructor::STATIC)?;
+    if stmt.step()? != ResultCode::ROW {
+        // A clock table left behind by a dropped crr.
+        return Ok(ResultCode::OK);
+    }
+    recreate_crr_triggers(db, table)
+}
+
+fn recreate_crr_triggers(db: *mut sqlite3, table: &str) -> Result<ResultCode, ResultCode> {
+    let table = CString::new(table)?;
+    let mut table_info: *mut crsql_TableInfo = core::ptr::null_mut();
+    let mut err: *mut c_char = core::ptr::null_mut();
+    let mut rc = unsafe { crsql_getTableInfo(db, table.as_ptr(), &mut table_info, &mut err) };
+    if rc == ResultCode::OK as c_int {
+        rc = unsafe { col_ids::crsql_ensure_col_ids(db, table_info) };
+    }
+    if rc == ResultCode::OK as c_int {
+        rc = crate::triggers::crsql_create_crr_triggers(db, table_info, &mut err);
+    }
+    unsafe { crsql_freeTableInfo(table_info) };
+    if !err.is_null() {
+        sqlite::free(err as *mut c_void);
+    }
+
+    if rc == ResultCode::OK as c_int {
+        Ok(ResultCode::OK)
+    } else {
+        Err(ResultCode::ERROR)
+    }
+}
+
 #[no_mangle]
-pub extern "C" fn crsql_maybe_update_db(db: *mut sqlite3) -> c_int {
+pub extern "C" fn crsql_maybe_update_db(db: *mut sqlite3, errmsg: *mut *mut c_char) -> c_int {
     let r = db.exec_safe("SAVEPOINT crsql_maybe_update_db;");
     if let Err(code) = r {
         return code as c_int;
     }
-    if let Ok(_) = maybe_update_db_inner(db) {
+    if let Ok(_) = maybe_update_db_inner(db, errmsg) {
         let _ = db.exec_safe("RELEASE crsql_maybe_update_db;");
         return ResultCode::OK as c_int;
     } else {
@@ -132,7 +357,10 @@ pub extern "C" fn crsql_maybe_update_db(db: *mut sqlite3) -> c_int {
     }
 }
 
-fn maybe_update_db_inner(db: *mut sqlite3) -> Result<ResultCode, ResultCode> {
+fn maybe_update_db_inner(
+    db: *mut sqlite3,
+    errmsg: *mut *mut c_char,
+) -> Result<ResultCode, ResultCode> {
     let stmt = db.prepare_v2("SELECT value FROM crsql_master WHERE key = 'crsqlite_version'")?;
 
     let step_result = stmt.step()?;
@@ -142,9 +370,34 @@ fn maybe_update_db_inner(db: *mut sqlite3) -> Result<ResultCode, ResultCode> {
     // if matches current version, we're good.
     if step_result == ResultCode::ROW {
         recorded_version = stmt.column_int(0)?;
+        // the clock tables can't be dropped under an unfinished read
+        stmt.reset()?;
     } else if step_result == ResultCode::DONE {
         update_to_0_13_0(db)?;
     }
+    create_db_version_table_if_not_exists(db)?;
+    match col_ids::create_col_ids_table_if_not_exists(db) {
+        Err(ResultCode::READONLY) if recorded_version >= consts::CLOCK_COL_IDS_VERSION => {
+            return Ok(ResultCode::OK)
+        }
+        // Clock tables that still store column names and site ids can't be read, and a
+        // read-only connection can't migrate them.
+        Err(ResultCode::READONLY) => {
+            if !errmsg.is_null() {
+                let err = CString::new(
+                    "crsql - the database needs migration, open it writable once to migrate it",
+                )?;
+                unsafe { *errmsg = err.into_raw() };
+            }
+            return Err(ResultCode::READONLY);
+        }
+        Err(rc) => return Err(rc),
+        Ok(_) => {}
+    }
+    site_ordinals::create_site_ordinals_table_if_not_exists(db)?;
+    if recorded_version < consts::CLOCK_COL_IDS_VERSION {
+        update_to_0_14_0(db)?;
+    }
 
     if recorded_version < consts::CRSQLITE_VERSION {
         let stmt =
@@ -193,15 +446,25 @@ fn create_clock_table(
     let pk_list = crate::util::as_identifier_list(columns, None)?;
     let table_name = unsafe { CStr::from_ptr((*table_info).tblName).to_str() }?;
 
+    create_clock_table_for_pks(db, table_name, &pk_list)
+}
+
+fn create_clock_table_for_pks(
+    db: *mut sqlite3,
+    table_name: &str,
+    pk_list: &str,
+) -> Result<ResultCode, ResultCode> {
+    // `__crsql_col_id` is the column's id in `__crsql_colids` or one of the sentinel ids.
+    // `__crsql_site_ordinal` is the site's ordinal in `crsql_site_ordinals`, NULL for the local site.
     db.exec_safe(&format!(
         "CREATE TABLE IF NOT EXISTS \"{table_name}__crsql_clock\" (
       {pk_list},
-      __crsql_col_name NOT NULL,
+      __crsql_col_id INTEGER NOT NULL,
       __crsql_col_version NOT NULL,
       __crsql_db_version NOT NULL,
-      __crsql_site_id,
+      __crsql_site_ordinal INTEGER,
       __crsql_seq NOT NULL,
-      PRIMARY KEY ({pk_list}, __crsql_col_name)
+      PRIMARY KEY ({pk_list}, __crsql_col_id)
     )",
         pk_list = pk_list,
         table_name = crate::util::escape_ident(table_name)
@@ -209,7 +472,18 @@ fn create_clock_table(
 
     db.exec_safe(
       &format!(
-        "CREATE INDEX IF NOT EXISTS \"{table_name}__crsql_clock_dbv_idx\" ON \"{table_name}__crsql_clock\" (\"__crsql_db_version\")",
+        // (db version, seq) is the order changes are read and resumed in.
+        "CREATE INDEX IF NOT EXISTS \"{table_name}__crsql_clock_dbv_idx\" ON \"{table_name}__crsql_clock\" (\"__crsql_db_version\", \"__crsql_seq\")",
         table_name = crate::util::escape_ident(table_name),
-      ))
+      ))?;
+
+    db.exec_safe(
+      &format!(
+        // Delete sentinels by version, so collecting tombstones doesn't walk every clock row.
+        "CREATE INDEX IF NOT EXISTS \"{table_name}__crsql_clock_del_idx\" ON \"{table_name}__crsql_clock\" (\"__crsql_db_version\") WHERE __crsql_col_id = {delete_sentinel_id}",
+        table_name = crate::util::escape_ident(table_name),
+        delete_sentinel_id = crate::c::DELETE_SENTINEL_ID,
+      ))?;
+
+    Ok(ResultCode::OK)
 }
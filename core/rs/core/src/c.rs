@@ -9,6 +9,9 @@ use sqlite_nostd as sqlite;
 
 pub static INSERT_SENTINEL: &str = "__crsql_pko";
 pub static DELETE_SENTINEL: &str = "__crsql_del";
+// What the sentinels are stored as in `__crsql_col_id`. Column ids start at 1.
+pub const INSERT_SENTINEL_ID: sqlite::int64 = -2;
+pub const DELETE_SENTINEL_ID: sqlite::int64 = -1;
 // pub static INSERT_SENTINEL_CSTR: &str = "__crsql_pko\0";
 // pub static DELETE_SENTINEL_CSTR: &str = "__crsql_del\0";
 
@@ -22,6 +25,9 @@ pub enum CrsqlChangesColumn {
     DbVrsn = 5,
     SiteId = 6,
     Seq = 7,
+    ResumeToken = 8,
+    Vv = 9,
+    Sender = 10,
 }
 
 #[derive(FromPrimitive, PartialEq, Debug)]
@@ -54,6 +60,17 @@ pub struct crsql_TableInfo {
     pub pksLen: ::core::ffi::c_int,
     pub nonPks: *mut crsql_ColumnInfo,
     pub nonPksLen: ::core::ffi::c_int,
+    pub pkIndex: crsql_NameIndex,
+    pub nonPkIndex: crsql_NameIndex,
+}
+
+#[repr(C)]
+#[derive(Debug, Copy, Clone)]
+#[allow(non_snake_case, non_camel_case_types)]
+pub struct crsql_NameIndex {
+    pub azNames: *mut *const ::core::ffi::c_char,
+    pub aIdx: *mut ::core::ffi::c_int,
+    pub nSlot: ::core::ffi::c_int,
 }
 
 #[repr(C)]
@@ -65,6 +82,7 @@ pub struct crsql_ColumnInfo {
     pub type_: *mut ::core::ffi::c_char,
     pub notnull: ::core::ffi::c_int,
     pub pk: ::core::ffi::c_int,
+    pub colId: ::core::ffi::c_int,
 }
 
 #[repr(C)]
@@ -81,11 +99,17 @@ pub struct crsql_ExtData {
     pub pDbVersionStmt: *mut sqlite::stmt,
     pub zpTableInfos: *mut *mut crsql_TableInfo,
     pub tableInfosLen: ::core::ffi::c_int,
+    pub tableInfoIndex: crsql_NameIndex,
     pub rowsImpacted: ::core::ffi::c_int,
     pub seq: ::core::ffi::c_int,
     pub pSetSyncBitStmt: *mut sqlite::stmt,
     pub pClearSyncBitStmt: *mut sqlite::stmt,
     pub pStmtCache: *mut ::core::ffi::c_void,
+    pub zpBulkLoadTables: *mut *mut ::core::ffi::c_char,
+    pub bulkLoadTablesLen: ::core::ffi::c_int,
+    pub pAlterStarts: *mut ::core::ffi::c_void,
+    pub pTombstoneFilters: *mut ::core::ffi::c_void,
+    pub pSetDbVersionStmt: *mut sqlite::stmt,
 }
 
 #[repr(C)]
@@ -95,6 +119,7 @@ pub struct crsql_Changes_vtab {
     pub base: sqlite::vtab,
     pub db: *mut sqlite::sqlite3,
     pub pExtData: *mut crsql_ExtData,
+    pub pMergeCtx: *mut ::core::ffi::c_void,
 }
 
 #[repr(C)]
@@ -109,24 +134,50 @@ pub struct crsql_Changes_cursor {
     pub rowType: ::core::ffi::c_int,
     pub changesRowid: sqlite::int64,
     pub tblInfoIdx: ::core::ffi::c_int,
+    pub pChangesMerge: *mut ::core::ffi::c_void,
+    pub pRowKey: *mut ::core::ffi::c_void,
+    pub rowStmtCol: ::core::ffi::c_int,
 }
 
 extern "C" {
-    pub fn crsql_indexofTableInfo(
-        tblInfos: *mut *mut crsql_TableInfo,
-        len: ::core::ffi::c_int,
-        tblName: *const ::core::ffi::c_char,
-    ) -> ::core::ffi::c_int;
     pub fn crsql_ensureTableInfosAreUpToDate(
         db: *mut sqlite::sqlite3,
         pExtData: *mut crsql_ExtData,
         errmsg: *mut *mut c_char,
     ) -> c_int;
-    pub fn crsql_columnExists(
+    pub fn crsql_indexofTableInfoByName(
+        pExtData: *mut crsql_ExtData,
+        tblName: *const c_char,
+        tblNameLen: c_int,
+    ) -> c_int;
+    pub fn crsql_indexofPk(
+        tblInfo: *mut crsql_TableInfo,
         colName: *const c_char,
-        colInfos: *mut crsql_ColumnInfo,
-        colInfosLen: c_int,
+        colNameLen: c_int,
     ) -> c_int;
+    pub fn crsql_indexofNonPk(
+        tblInfo: *mut crsql_TableInfo,
+        colName: *const c_char,
+        colNameLen: c_int,
+    ) -> c_int;
+    pub fn crsql_getDbVersion(
+        db: *mut sqlite::sqlite3,
+        pExtData: *mut crsql_ExtData,
+        errmsg: *mut *mut c_char,
+    ) -> c_int;
+    pub fn crsql_raiseDbVersion(
+        db: *mut sqlite::sqlite3,
+        pExtData: *mut crsql_ExtData,
+        version: sqlite::int64,
+    ) -> c_int;
+    pub fn crsql_isStmtBusy(pStmt: *mut sqlite::stmt) -> c_int;
+    pub fn crsql_getTableInfo(
+        db: *mut sqlite::sqlite3,
+        tblName: *const c_char,
+        pTableInfo: *mut *mut crsql_TableInfo,
+        pErrMsg: *mut *mut c_char,
+    ) -> c_int;
+    pub fn crsql_freeTableInfo(tableInfo: *mut crsql_TableInfo);
 }
 
 #[test]
@@ -135,7 +186,7 @@ fn bindgen_test_layout_crsql_Changes_vtab() {
     let ptr = UNINIT.as_ptr();
     assert_eq!(
         ::core::mem::size_of::<crsql_Changes_vtab>(),
-        40usize,
+        48usize,
         concat!("Size of: ", stringify!(crsql_Changes_vtab))
     );
     assert_eq!(
@@ -173,6 +224,16 @@ fn bindgen_test_layout_crsql_Changes_vtab() {
             stringify!(pExtData)
         )
     );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).pMergeCtx) as usize - ptr as usize },
+        40usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_Changes_vtab),
+            "::",
+            stringify!(pMergeCtx)
+        )
+    );
 }
 
 #[test]
@@ -182,7 +243,7 @@ fn bindgen_test_layout_crsql_Changes_cursor() {
     let ptr = UNINIT.as_ptr();
     assert_eq!(
         ::core::mem::size_of::<crsql_Changes_cursor>(),
-        64usize,
+        88usize,
         concat!("Size of: ", stringify!(crsql_Changes_cursor))
     );
     assert_eq!(
@@ -270,6 +331,36 @@ fn bindgen_test_layout_crsql_Changes_cursor() {
             stringify!(tblInfoIdx)
         )
     );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).pChangesMerge) as usize - ptr as usize },
+        64usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_Changes_cursor),
+            "::",
+            stringify!(pChangesMerge)
+        )
+    );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).pRowKey) as usize - ptr as usize },
+        72usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_Changes_cursor),
+            "::",
+            stringify!(pRowKey)
+        )
+    );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).rowStmtCol) as usize - ptr as usize },
+        80usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_Changes_cursor),
+            "::",
+            stringify!(rowStmtCol)
+        )
+    );
 }
 
 #[test]
@@ -279,7 +370,7 @@ fn bindgen_test_layout_crsql_ColumnInfo() {
     let ptr = UNINIT.as_ptr();
     assert_eq!(
         ::core::mem::size_of::<crsql_ColumnInfo>(),
-        32usize,
+        40usize,
         concat!("Size of: ", stringify!(crsql_ColumnInfo))
     );
     assert_eq!(
@@ -337,6 +428,38 @@ fn bindgen_test_layout_crsql_ColumnInfo() {
             stringify!(pk)
         )
     );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).colId) as usize - ptr as usize },
+        32usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_ColumnInfo),
+            "::",
+            stringify!(colId)
+        )
+    );
+}
+
+#[test]
+#[allow(non_snake_case)]
+fn bindgen_test_layout_crsql_NameIndex() {
+    const UNINIT: ::core::mem::MaybeUninit<crsql_NameIndex> = ::core::mem::MaybeUninit::uninit();
+    let ptr = UNINIT.as_ptr();
+    assert_eq!(
+        ::core::mem::size_of::<crsql_NameIndex>(),
+        24usize,
+        concat!("Size of: ", stringify!(crsql_NameIndex))
+    );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).nSlot) as usize - ptr as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_NameIndex),
+            "::",
+            stringify!(nSlot)
+        )
+    );
 }
 
 #[test]
@@ -346,7 +469,7 @@ fn bindgen_test_layout_crsql_TableInfo() {
     let ptr = UNINIT.as_ptr();
     assert_eq!(
         ::core::mem::size_of::<crsql_TableInfo>(),
-        56usize,
+        104usize,
         concat!("Size of: ", stringify!(crsql_TableInfo))
     );
     assert_eq!(
@@ -424,6 +547,26 @@ fn bindgen_test_layout_crsql_TableInfo() {
             stringify!(nonPksLen)
         )
     );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).pkIndex) as usize - ptr as usize },
+        56usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_TableInfo),
+            "::",
+            stringify!(pkIndex)
+        )
+    );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).nonPkIndex) as usize - ptr as usize },
+        80usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_TableInfo),
+            "::",
+            stringify!(nonPkIndex)
+        )
+    );
 }
 
 #[test]
@@ -433,7 +576,7 @@ fn bindgen_test_layout_crsql_ExtData() {
     let ptr = UNINIT.as_ptr();
     assert_eq!(
         ::core::mem::size_of::<crsql_ExtData>(),
-        104usize,
+        184usize,
         concat!("Size of: ", stringify!(crsql_ExtData))
     );
     assert_eq!(
@@ -543,9 +686,19 @@ fn bindgen_test_layout_crsql_ExtData() {
             stringify!(tableInfosLen)
         )
     );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).tableInfoIndex) as usize - ptr as usize },
+        72usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_ExtData),
+            "::",
+            stringify!(tableInfoIndex)
+        )
+    );
     assert_eq!(
         unsafe { ::core::ptr::addr_of!((*ptr).rowsImpacted) as usize - ptr as usize },
-        68usize,
+        96usize,
         concat!(
             "Offset of field: ",
             stringify!(crsql_ExtData),
@@ -555,7 +708,7 @@ fn bindgen_test_layout_crsql_ExtData() {
     );
     assert_eq!(
         unsafe { ::core::ptr::addr_of!((*ptr).seq) as usize - ptr as usize },
-        72usize,
+        100usize,
         concat!(
             "Offset of field: ",
             stringify!(crsql_ExtData),
@@ -565,7 +718,7 @@ fn bindgen_test_layout_crsql_ExtData() {
     );
     assert_eq!(
         unsafe { ::core::ptr::addr_of!((*ptr).pSetSyncBitStmt) as usize - ptr as usize },
-        80usize,
+        104usize,
         concat!(
             "Offset of field: ",
             stringify!(crsql_ExtData),
@@ -575,7 +728,7 @@ fn bindgen_test_layout_crsql_ExtData() {
     );
     assert_eq!(
         unsafe { ::core::ptr::addr_of!((*ptr).pClearSyncBitStmt) as usize - ptr as usize },
-        88usize,
+        112usize,
         concat!(
             "Offset of field: ",
             stringify!(crsql_ExtData),
@@ -585,7 +738,7 @@ fn bindgen_test_layout_crsql_ExtData() {
     );
     assert_eq!(
         unsafe { ::core::ptr::addr_of!((*ptr).pStmtCache) as usize - ptr as usize },
-        96usize,
+        120usize,
         concat!(
             "Offset of field: ",
             stringify!(crsql_ExtData),
@@ -593,4 +746,54 @@ fn bindgen_test_layout_crsql_ExtData() {
             stringify!(hStmts)
         )
     );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).zpBulkLoadTables) as usize - ptr as usize },
+        128usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_ExtData),
+            "::",
+            stringify!(zpBulkLoadTables)
+        )
+    );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).bulkLoadTablesLen) as usize - ptr as usize },
+        136usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_ExtData),
+            "::",
+            stringify!(bulkLoadTablesLen)
+        )
+    );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).pAlterStarts) as usize - ptr as usize },
+        144usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_ExtData),
+            "::",
+            stringify!(pAlterStarts)
+        )
+    );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).pTombstoneFilters) as usize - ptr as usize },
+        152usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_ExtData),
+            "::",
+            stringify!(pTombstoneFilters)
+        )
+    );
+    assert_eq!(
+        unsafe { ::core::ptr::addr_of!((*ptr).pSetDbVersionStmt) as usize - ptr as usize },
+        160usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(crsql_ExtData),
+            "::",
+            stringify!(pSetDbVersionStmt)
+        )
+    );
 }
@@ -1,12 +1,17 @@
 extern crate alloc;
 use crate::alloc::string::ToString;
-use crate::changes_vtab_write::crsql_merge_insert;
+use crate::changes_vtab_write::{
+    begin_merge_ctx, crsql_merge_insert, end_merge_ctx, invalidate_merge_ctx, non_pk_index,
+};
 use crate::stmt_cache::{
     get_cache_key, get_cached_stmt, reset_cached_stmt, set_cached_stmt, CachedStmtType,
 };
+use alloc::boxed::Box;
 use alloc::format;
 use alloc::string::String;
-use core::ffi::{c_char, c_int, CStr};
+use alloc::vec;
+use alloc::vec::Vec;
+use core::ffi::{c_char, c_int, c_void, CStr};
 use core::mem::forget;
 use core::ptr::null_mut;
 use core::slice;
@@ -22,25 +27,49 @@ use crate::c::{
     crsql_Changes_cursor, crsql_Changes_vtab, crsql_ensureTableInfosAreUpToDate, ChangeRowType,
     ClockUnionColumn, CrsqlChangesColumn,
 };
-use crate::changes_vtab_read::{changes_union_query, row_patch_data_query};
-use crate::pack_columns::bind_package_to_stmt;
+use crate::changes_vtab_read::{
+    changes_query_for_table, changes_union_query, decode_resume_token, encode_resume_token,
+    row_data_query, ChangesMerge,
+};
+use crate::pack_columns::{bind_package_to_stmt, bind_packed_to_stmt};
+use crate::site_ordinals::site_ordinal;
 use crate::unpack_columns;
+use crate::version_vector::{vv_condition, VV_CONDITION};
+
+// Stands in for a site id argument in the WHERE clause built by
+// `changes_best_index` until `changes_filter` resolves it to an ordinal.
+const SITE_ID_ARG: &str = "crsql_site_id_arg";
+
+#[no_mangle]
+pub extern "C" fn crsql_changes_crsr_finalize(crsr: *mut crsql_Changes_cursor) -> c_int {
+    changes_crsr_finalize(crsr)
+}
 
 fn changes_crsr_finalize(crsr: *mut crsql_Changes_cursor) -> c_int {
     // Assign pointers to null after freeing
     // since we can get into this twice for the same cursor object.
     unsafe {
         let mut rc = 0;
-        rc += match (*crsr).pChangesStmt.finalize() {
-            Ok(rc) => rc as c_int,
-            Err(rc) => rc as c_int,
-        };
+        if (*crsr).pChangesMerge.is_null() {
+            rc += match (*crsr).pChangesStmt.finalize() {
+                Ok(rc) => rc as c_int,
+                Err(rc) => rc as c_int,
+            };
+        } else {
+            // pChangesStmt is one of the merge's statements
+            drop(Box::from_raw((*crsr).pChangesMerge as *mut ChangesMerge));
+            (*crsr).pChangesMerge = null_mut();
+        }
         (*crsr).pChangesStmt = null_mut();
         let reset_rc = reset_cached_stmt((*crsr).pRowStmt);
         match reset_rc {
             Ok(r) | Err(r) => rc += r as c_int,
         }
         (*crsr).pRowStmt = null_mut();
+        if !(*crsr).pRowKey.is_null() {
+            drop(Box::from_raw((*crsr).pRowKey as *mut RowKey));
+            (*crsr).pRowKey = null_mut();
+        }
         (*crsr).dbVersion = crate::consts::MIN_POSSIBLE_DB_VERSION;
 
         return rc;
@@ -71,13 +100,70 @@ fn changes_best_index(
     let constraint_usage =
         sqlite::args_mut!((*index_info).nConstraint, (*index_info).aConstraintUsage);
     let mut arg_v_index = 1;
+    // `table = ?` and `pk = ?` are not part of the WHERE clause. They pick which
+    // clock tables to read and which rows to probe in them, see `changes_filter`.
+    let mut tbl_constraint = None;
+    let mut pk_constraint = None;
+    // `resume_token > ?` is the (db_vrsn, seq) position a previous read stopped at.
+    let mut resume_constraint = None;
+    // `vv = ?` holds back the changes a peer already has, see `version_vector`.
+    let mut vv_constraint = None;
+    let mut limit_constraint = None;
+    let mut offset_constraint = None;
     for (i, constraint) in constraints.iter().enumerate() {
+        if constraint.usable != 0 {
+            match constraint.op as u32 {
+                sqlite::INDEX_CONSTRAINT_LIMIT => {
+                    limit_constraint = Some(i);
+                    continue;
+                }
+                sqlite::INDEX_CONSTRAINT_OFFSET => {
+                    offset_constraint = Some(i);
+                    continue;
+                }
+                sqlite::INDEX_CONSTRAINT_GT
+                    if resume_constraint.is_none()
+                        && CrsqlChangesColumn::from_i32(constraint.iColumn)
+                            == Some(CrsqlChangesColumn::ResumeToken) =>
+                {
+                    resume_constraint = Some(i);
+                    continue;
+                }
+                _ => {}
+            }
+        }
+        if constraint.usable != 0 && constraint.op == sqlite::INDEX_CONSTRAINT_EQ as u8 {
+            match CrsqlChangesColumn::from_i32(constraint.iColumn) {
+                Some(CrsqlChangesColumn::Tbl) if tbl_constraint.is_none() => {
+                    tbl_constraint = Some(i);
+                    continue;
+                }
+                Some(CrsqlChangesColumn::Pk) if pk_constraint.is_none() => {
+                    pk_constraint = Some(i);
+                    continue;
+                }
+                Some(CrsqlChangesColumn::Vv) if vv_constraint.is_none() => {
+                    vv_constraint = Some(i);
+                    continue;
+                }
+                _ => {}
+            }
+        }
         if !constraint_is_usable(constraint) {
             continue;
         }
         let col = CrsqlChangesColumn::from_i32(constraint.iColumn);
         if let Some(col_name) = get_clock_table_col_name(&col) {
             if let Some(op_string) = get_operator_string(constraint.op) {
+                // Clock tables record sites by ordinal. (In)equality with a site id
+                // is checked against its ordinal so site ids are never looked up per row.
+                let (col_name, arg) = if col == Some(CrsqlChangesColumn::SiteId)
+                    && is_site_ordinal_op(constraint.op)
+                {
+                    ("site_ordinal".to_string(), SITE_ID_ARG)
+                } else {
+                    (col_name, "?")
+                };
                 if first_constraint {
                     str.push_str("WHERE ");
                     first_constraint = false
@@ -92,7 +178,7 @@ fn changes_best_index(
                     constraint_usage[i].argvIndex = 0;
                     constraint_usage[i].omit = 1;
                 } else {
-                    str.push_str(&format!("{} {} ?", col_name, op_string));
+                    str.push_str(&format!("{} {} {}", col_name, op_string, arg));
                     constraint_usage[i].argvIndex = arg_v_index;
                     constraint_usage[i].omit = 1;
                     arg_v_index += 1;
@@ -108,38 +194,100 @@ fn changes_best_index(
         }
     }
 
-    let mut desc = 0;
+    // The token is decoded into the bindings of the last condition of the WHERE clause
+    // that has bindings.
+    if let Some(i) = resume_constraint {
+        if first_constraint {
+            str.push_str("WHERE ");
+            first_constraint = false;
+        } else {
+            str.push_str(" AND ");
+        }
+        str.push_str("db_vrsn >= ? AND (db_vrsn, seq) > (?, ?)");
+        constraint_usage[i].argvIndex = arg_v_index;
+        constraint_usage[i].omit = 1;
+        arg_v_index += 1;
+        idx_num |= 2 | 64;
+    }
+
+    // The vector becomes a condition on site ordinals and versions once its value
+    // is known. It is the very last argument of the WHERE clause.
+    if let Some(i) = vv_constraint {
+        if first_constraint {
+            str.push_str("WHERE ");
+        } else {
+            str.push_str(" AND ");
+        }
+        str.push_str(VV_CONDITION);
+        constraint_usage[i].argvIndex = arg_v_index;
+        constraint_usage[i].omit = 1;
+        arg_v_index += 1;
+        idx_num |= 2 | 512;
+    }
+
+    // These come after the arguments of the WHERE clause.
+    // An `IN` list reaches filter one value at a time.
+    if let Some(i) = tbl_constraint {
+        constraint_usage[i].argvIndex = arg_v_index;
+        constraint_usage[i].omit = 1;
+        arg_v_index += 1;
+        idx_num |= 16;
+    }
+    if let Some(i) = pk_constraint {
+        constraint_usage[i].argvIndex = arg_v_index;
+        constraint_usage[i].omit = 1;
+        arg_v_index += 1;
+        idx_num |= 32;
+    }
+
     let order_bys = sqlite::args!((*index_info).nOrderBy, (*index_info).aOrderBy);
     let mut order_by_consumed = true;
-    if order_bys.len() > 0 {
-        str.push_str(" ORDER BY ");
-    } else {
-        // The user didn't provide an ordering? Tack on a default one that will
-        // retrieve changes in-order
+    if is_merge_order(order_bys) {
+        // No ordering, or an ascending ordering by (db_vrsn, seq) or a prefix of it.
+        // Tables are read in that order and merged rather than sorted as a union.
         str.push_str(" ORDER BY db_vrsn, seq ASC");
-    }
-    first_constraint = true;
-    for order_by in order_bys {
-        desc = order_by.desc;
-        let col = CrsqlChangesColumn::from_i32(order_by.iColumn);
-        if let Some(col_name) = get_clock_table_col_name(&col) {
-            if first_constraint {
-                first_constraint = false;
+        idx_num |= 8;
+    } else {
+        // Each term keeps its own direction. Ordering stops at the first term we
+        // can't order by and SQLite sorts the rest.
+        let mut terms = vec![];
+        for order_by in order_bys {
+            let col = CrsqlChangesColumn::from_i32(order_by.iColumn);
+            if let Some(col_name) = get_clock_table_col_name(&col) {
+                let dir = if order_by.desc != 0 { "DESC" } else { "ASC" };
+                terms.push(format!("{} {}", col_name, dir));
             } else {
-                str.push_str(", ");
+                order_by_consumed = false;
+                break;
             }
-            str.push_str(&col_name);
-        } else {
-            // TODO: test we're consuming
-            order_by_consumed = false;
+        }
+        if !terms.is_empty() {
+            str.push_str(" ORDER BY ");
+            str.push_str(&terms.join(", "));
         }
     }
 
-    if order_bys.len() > 0 {
-        if desc != 0 {
-            str.push_str(" DESC");
-        } else {
-            str.push_str(" ASC");
+    // Pushed down constraints read tables one at a time. Their changes are only
+    // returned in order when merged by (db_vrsn, seq).
+    if idx_num & 48 != 0 && idx_num & 8 == 0 {
+        order_by_consumed = false;
+    }
+
+    // LIMIT and OFFSET can only be pushed down when SQLite won't filter or sort our
+    // rows any further. Every table then returns at most LIMIT + OFFSET rows in
+    // order. SQLite still applies both itself.
+    let all_constraints_consumed = constraint_usage.iter().enumerate().all(|(i, usage)| {
+        usage.omit != 0 || Some(i) == limit_constraint || Some(i) == offset_constraint
+    });
+    if order_by_consumed && all_constraints_consumed {
+        if let Some(i) = limit_constraint {
+            constraint_usage[i].argvIndex = arg_v_index;
+            arg_v_index += 1;
+            idx_num |= 128;
+            if let Some(i) = offset_constraint {
+                constraint_usage[i].argvIndex = arg_v_index;
+                idx_num |= 256;
+            }
         }
     }
 
@@ -148,7 +296,13 @@ fn changes_best_index(
 
     // TODO: update your order by py test to explain query plans to ensure correct indices are selected
     // both constraints are present. Also to check that order by is consumed.
-    if idx_num & 6 == 6 {
+    // a primary key probe touches a handful of rows per table
+    if idx_num & 32 == 32 {
+        unsafe {
+            (*index_info).estimatedCost = if idx_num & 16 == 16 { 1.0 } else { 5.0 };
+            (*index_info).estimatedRows = 1;
+        }
+    } else if idx_num & 6 == 6 {
         unsafe {
             (*index_info).estimatedCost = 1.0;
             (*index_info).estimatedRows = 1;
@@ -161,6 +315,13 @@ fn changes_best_index(
             (*index_info).estimatedRows = 10;
         }
     }
+    // only the table constraint is present
+    else if idx_num & 16 == 16 {
+        unsafe {
+            (*index_info).estimatedCost = 1000000.0;
+            (*index_info).estimatedRows = 1000000;
+        }
+    }
     // only the requestor constraint is present
     else if idx_num & 4 == 4 {
         unsafe {
@@ -190,13 +351,38 @@ fn changes_best_index(
     Ok(ResultCode::OK)
 }
 
+fn is_merge_order(order_bys: &[sqlite::index_orderby]) -> bool {
+    // resume tokens order like the changes they point to
+    if order_bys.len() == 1
+        && order_bys[0].desc == 0
+        && CrsqlChangesColumn::from_i32(order_bys[0].iColumn)
+            == Some(CrsqlChangesColumn::ResumeToken)
+    {
+        return true;
+    }
+    let merge_order = [CrsqlChangesColumn::DbVrsn, CrsqlChangesColumn::Seq];
+    order_bys.len() <= merge_order.len()
+        && order_bys
+            .iter()
+            .zip(merge_order.iter())
+            .all(|(order_by, col)| {
+                order_by.desc == 0
+                    && CrsqlChangesColumn::from_i32(order_by.iColumn).as_ref() == Some(col)
+            })
+}
+
 fn constraint_is_usable(constraint: &sqlite::index_constraint) -> bool {
     if constraint.usable == 0 {
         return false;
     }
     if let Some(col) = CrsqlChangesColumn::from_i32(constraint.iColumn) {
         match col {
-            CrsqlChangesColumn::Tbl | CrsqlChangesColumn::Pk | CrsqlChangesColumn::Cval => false,
+            CrsqlChangesColumn::Tbl
+            | CrsqlChangesColumn::Pk
+            | CrsqlChangesColumn::Cval
+            | CrsqlChangesColumn::ResumeToken
+            | CrsqlChangesColumn::Vv
+            | CrsqlChangesColumn::Sender => false,
             _ => true,
         }
     } else {
@@ -214,10 +400,23 @@ fn get_clock_table_col_name(col: &Option<CrsqlChangesColumn>) -> Option<String>
         Some(CrsqlChangesColumn::DbVrsn) => Some("db_vrsn".to_string()),
         Some(CrsqlChangesColumn::SiteId) => Some("site_id".to_string()),
         Some(CrsqlChangesColumn::Seq) => Some("seq".to_string()),
+        Some(CrsqlChangesColumn::ResumeToken) => None,
+        Some(CrsqlChangesColumn::Vv) => None,
+        Some(CrsqlChangesColumn::Sender) => None,
         None => None,
     }
 }
 
+fn is_site_ordinal_op(op: u8) -> bool {
+    match op as u32 {
+        sqlite::INDEX_CONSTRAINT_EQ
+        | sqlite::INDEX_CONSTRAINT_NE
+        | sqlite::INDEX_CONSTRAINT_IS
+        | sqlite::INDEX_CONSTRAINT_ISNOT => true,
+        _ => false,
+    }
+}
+
 fn get_operator_string(op: u8) -> Option<String> {
     // TODO: convert to proper enum
     match op as u32 {
@@ -243,7 +442,7 @@ fn get_operator_string(op: u8) -> Option<String> {
 #[no_mangle]
 pub unsafe extern "C" fn crsql_changes_filter(
     cursor: *mut sqlite::vtab_cursor,
-    _idx_num: c_int,
+    idx_num: c_int,
     idx_str: *const c_char,
     argc: c_int,
     argv: *mut *mut sqlite::value,
@@ -252,7 +451,7 @@ pub unsafe extern "C" fn crsql_changes_filter(
     let cursor = cursor.cast::<crsql_Changes_cursor>();
     let idx_str = unsafe { CStr::from_ptr(idx_str).to_str() };
     match idx_str {
-        Ok(idx_str) => match changes_filter(cursor, idx_str, args) {
+        Ok(idx_str) => match changes_filter(cursor, idx_num, idx_str, args) {
             Err(rc) | Ok(rc) => rc as c_int,
         },
         Err(_) => ResultCode::FORMAT as c_int,
@@ -261,6 +460,7 @@ pub unsafe extern "C" fn crsql_changes_filter(
 
 unsafe fn changes_filter(
     cursor: *mut crsql_Changes_cursor,
+    idx_num: c_int,
     idx_str: &str,
     args: &[*mut sqlite::value],
 ) -> Result<ResultCode, ResultCode> {
@@ -268,9 +468,8 @@ unsafe fn changes_filter(
     let db = (*tab).db;
     // This should never happen. pChangesStmt should be finalized
     // before filter is ever invoked.
-    if !(*cursor).pChangesStmt.is_null() {
-        (*cursor).pChangesStmt.finalize()?;
-        (*cursor).pChangesStmt = null_mut();
+    if !(*cursor).pChangesStmt.is_null() || !(*cursor).pChangesMerge.is_null() {
+        changes_crsr_finalize(cursor);
     }
 
     let c_rc =
@@ -292,18 +491,223 @@ unsafe fn changes_filter(
         (*(*tab).pExtData).tableInfosLen,
         (*(*tab).pExtData).zpTableInfos
     );
-    let sql = changes_union_query(table_infos, idx_str)?;
+    // pushed down constraints are the trailing arguments
+    let num_pushed_down = [16, 32, 128, 256]
+        .iter()
+        .filter(|bit| idx_num & **bit != 0)
+        .count();
+    let (args, pushed_down) = args.split_at(args.len() - num_pushed_down);
+    let mut pushed_down = pushed_down.iter();
+    let tbl_arg = if idx_num & 16 != 0 {
+        pushed_down.next().copied()
+    } else {
+        None
+    };
+    let pk_arg = if idx_num & 32 != 0 {
+        pushed_down.next().copied()
+    } else {
+        None
+    };
+    let limit = if idx_num & 128 != 0 {
+        pushed_down.next().map(|limit| limit.int64())
+    } else {
+        None
+    };
+    let offset = if idx_num & 256 != 0 {
+        pushed_down.next().map(|offset| offset.int64().max(0))
+    } else {
+        None
+    };
+    // SQLite skips the offset itself so every table has to return the rows it skips
+    let limit = limit.map(|limit| {
+        if limit < 0 {
+            -1
+        } else {
+            limit.saturating_add(offset.unwrap_or(0))
+        }
+    });
+    let (args, vv_condition) = if idx_num & 512 != 0 {
+        let (vv, args) = args.split_last().ok_or(ResultCode::MISUSE)?;
+        let condition = if vv.value_type() == ColumnType::Blob {
+            vv_condition(db, (*tab).pExtData, vv.blob())?
+        } else {
+            None
+        };
+        match condition {
+            Some(condition) => (args, condition),
+            None => {
+                let err = CString::new("crsql - malformed vv")?;
+                (*tab).base.zErrMsg = err.into_raw();
+                return Err(ResultCode::ERROR);
+            }
+        }
+    } else {
+        (args, String::new())
+    };
+    let idx_str = &idx_str.replacen(VV_CONDITION, &vv_condition, 1);
+    let (idx_str, args) = &resolve_site_id_args(db, idx_str, args)?;
+    let idx_str = idx_str.as_str();
+    let resume = if idx_num & 64 != 0 {
+        match args.last().and_then(|token| {
+            if token.value_type() == ColumnType::Blob {
+                decode_resume_token(token.blob())
+            } else {
+                None
+            }
+        }) {
+            Some(resume) => Some(resume),
+            None => {
+                let err = CString::new("crsql - malformed resume_token")?;
+                (*tab).base.zErrMsg = err.into_raw();
+                return Err(ResultCode::ERROR);
+            }
+        }
+    } else {
+        None
+    };
 
-    let stmt = db.prepare_v2(&sql)?;
-    for (i, arg) in args.iter().enumerate() {
-        stmt.bind_value(i as i32 + 1, *arg)?;
+    if idx_num & (8 | 16 | 32) != 0 {
+        // `table = ?` and `pk = ?` never match anything but text and blobs
+        let tbl = match &tbl_arg {
+            Some(tbl) if tbl.value_type() != ColumnType::Text => None,
+            Some(tbl) => Some(Some(tbl.text())),
+            None => Some(None),
+        };
+        // the merge holds on to the packed pk so its values can be bound without copies
+        let bindings = match &pk_arg {
+            Some(pk) => pk.blob().to_vec(),
+            None => vec![],
+        };
+        let pk = match &pk_arg {
+            Some(pk) if pk.value_type() != ColumnType::Blob => None,
+            Some(_) => unpack_columns(&bindings).ok().map(Some),
+            None => Some(None),
+        };
+
+        let mut stmts = vec![];
+        if let (Some(tbl), Some(pk)) = (tbl, pk) {
+            for table_info in table_infos {
+                if let Some(tbl) = tbl {
+                    if CStr::from_ptr((**table_info).tblName).to_bytes() != tbl.as_bytes() {
+                        continue;
+                    }
+                }
+                if let Some(pk) = &pk {
+                    // the packed pk can't belong to a table with a different number of pks
+                    if pk.len() != (**table_info).pksLen as usize {
+                        continue;
+                    }
+                }
+                let stmt = db.prepare_v2(&changes_query_for_table(
+                    *table_info,
+                    pk.is_some(),
+                    idx_str,
+                    limit.is_some(),
+                )?)?;
+                // pk probe bindings come first as the per table query precedes the WHERE clause
+                let mut offset = 0;
+                if let Some(pk) = &pk {
+                    bind_package_to_stmt(stmt.stmt, pk)?;
+                    offset = pk.len();
+                }
+                bind_where_args(&stmt, offset, args, resume, limit)?;
+                stmts.push(stmt);
+            }
+        }
+        // the merge finalizes the statements
+        let merge = ChangesMerge::new(
+            stmts
+                .into_iter()
+                .map(|stmt| {
+                    let raw = stmt.stmt;
+                    forget(stmt);
+                    raw
+                })
+                .collect(),
+            bindings,
+        )?;
+        (*cursor).pChangesMerge = Box::into_raw(Box::new(merge)) as *mut c_void;
+        return changes_next(cursor, (*cursor).pTab.cast::<sqlite::vtab>());
     }
+
+    let sql = changes_union_query(table_infos, idx_str, limit.is_some())?;
+
+    let stmt = db.prepare_v2(&sql)?;
+    bind_where_args(&stmt, 0, args, resume, limit)?;
     (*cursor).pChangesStmt = stmt.stmt;
     // forget the stmt. it will be managed by the vtab
     forget(stmt);
     changes_next(cursor, (*cursor).pTab.cast::<sqlite::vtab>())
 }
 
+/// Writes the ordinal of every site id argument into the WHERE clause in place of the
+/// argument. Sites without an ordinal get `-1`, which no clock row holds. Returns the
+/// clause and the arguments that are left to bind.
+///
+/// Site constraints come before the resume token, the only condition with more
+/// than one `?` for its argument.
+fn resolve_site_id_args(
+    db: *mut sqlite::sqlite3,
+    idx_str: &str,
+    args: &[*mut sqlite::value],
+) -> Result<(String, Vec<*mut sqlite::value>), ResultCode> {
+    let mut resolved = String::new();
+    let mut remaining = vec![];
+    let mut rest = idx_str;
+    let mut next_arg = 0;
+    while let Some(at) = rest.find(SITE_ID_ARG) {
+        let before = &rest[..at];
+        let bound = next_arg + before.matches('?').count();
+        remaining.extend_from_slice(args.get(next_arg..bound).ok_or(ResultCode::MISUSE)?);
+        resolved.push_str(before);
+        let site_id = *args.get(bound).ok_or(ResultCode::MISUSE)?;
+        let ordinal = match site_id.value_type() {
+            ColumnType::Null => String::from("NULL"),
+            // site ids are blobs, nothing else ever compares equal to one
+            ColumnType::Blob => format!("{}", site_ordinal(db, site_id.blob())?.unwrap_or(-1)),
+            _ => String::from("-1"),
+        };
+        resolved.push_str(&ordinal);
+        next_arg = bound + 1;
+        rest = &rest[at + SITE_ID_ARG.len()..];
+    }
+    resolved.push_str(rest);
+    remaining.extend_from_slice(args.get(next_arg..).ok_or(ResultCode::MISUSE)?);
+    Ok((resolved, remaining))
+}
+
+/// Binds the arguments of the WHERE clause built by `changes_best_index` after the
+/// first `offset` bindings, followed by the LIMIT. A resume token, the last argument,
+/// stands for three bindings.
+fn bind_where_args(
+    stmt: &sqlite::ManagedStmt,
+    offset: usize,
+    args: &[*mut sqlite::value],
+    resume: Option<(sqlite::int64, sqlite::int64)>,
+    limit: Option<sqlite::int64>,
+) -> Result<ResultCode, ResultCode> {
+    let args = if resume.is_some() {
+        &args[..args.len() - 1]
+    } else {
+        args
+    };
+    let mut i = offset as i32;
+    for arg in args {
+        i += 1;
+        stmt.bind_value(i, *arg)?;
+    }
+    if let Some((db_vrsn, seq)) = resume {
+        stmt.bind_int64(i + 1, db_vrsn)?;
+        stmt.bind_int64(i + 2, db_vrsn)?;
+        stmt.bind_int64(i + 3, seq)?;
+        i += 3;
+    }
+    if let Some(limit) = limit {
+        stmt.bind_int64(i + 1, limit)?;
+    }
+    Ok(ResultCode::OK)
+}
+
 /**
  * Advances our Changes_cursor to its next row of output.
  * TODO: this'll get more idiomatic as we move dependencies to Rust
@@ -326,21 +730,24 @@ unsafe fn changes_next(
     cursor: *mut crsql_Changes_cursor,
     vtab: *mut sqlite::vtab,
 ) -> Result<ResultCode, ResultCode> {
-    if (*cursor).pChangesStmt.is_null() {
+    if (*cursor).pChangesStmt.is_null() && (*cursor).pChangesMerge.is_null() {
         let err = CString::new("pChangesStmt is null in changes_next")?;
         (*vtab).zErrMsg = err.into_raw();
         return Err(ResultCode::ABORT);
     }
 
-    if !(*cursor).pRowStmt.is_null() {
-        let rc = reset_cached_stmt((*cursor).pRowStmt);
-        (*cursor).pRowStmt = null_mut();
-        if rc.is_err() {
-            return rc;
+    let rc = if (*cursor).pChangesMerge.is_null() {
+        (*cursor).pChangesStmt.step()?
+    } else {
+        // column reads go to whichever table's statement holds the next change
+        match (*((*cursor).pChangesMerge as *mut ChangesMerge)).next()? {
+            Some(stmt) => {
+                (*cursor).pChangesStmt = stmt;
+                ResultCode::ROW
+            }
+            None => ResultCode::DONE,
         }
-    }
-
-    let rc = (*cursor).pChangesStmt.step()?;
+    };
     if rc == ResultCode::DONE {
         let c_rc = changes_crsr_finalize(cursor);
         if c_rc == 0 {
@@ -368,12 +775,8 @@ unsafe fn changes_next(
         .column_int64(ClockUnionColumn::RowId as i32);
     (*cursor).dbVersion = db_version;
 
-    let tbl_info_index = crate::c::crsql_indexofTableInfo(
-        (*(*(*cursor).pTab).pExtData).zpTableInfos,
-        (*(*(*cursor).pTab).pExtData).tableInfosLen,
-        // this should be safe since the underlying memory from column_text is null terminated at slice_len + 1.
-        tbl.as_ptr() as *const c_char,
-    );
+    let tbl_info_index =
+        crate::changes_vtab_write::table_info_index((*(*cursor).pTab).pExtData, tbl);
 
     if tbl_info_index < 0 {
         let err = CString::new(format!("could not find schema for table {}", tbl))?;
@@ -405,7 +808,35 @@ unsafe fn changes_next(
         (*cursor).rowType = ChangeRowType::Update as c_int;
     }
 
-    let stmt_key = get_cache_key(CachedStmtType::RowPatchData, tbl, Some(cid))?;
+    let col_idx = match non_pk_index(tbl_info, cid)? {
+        Some(col_idx) => col_idx,
+        None => {
+            let err = CString::new(format!(
+                "could not generate row data fetch query for {}",
+                tbl
+            ))?;
+            (*vtab).zErrMsg = err.into_raw();
+            return Err(ResultCode::ERROR);
+        }
+    };
+    (*cursor).rowStmtCol = col_idx as c_int;
+
+    // changes come grouped by row so the previous fetch usually still applies
+    let packed_pks = pks.blob();
+    let row_key = row_key(cursor);
+    if !(*cursor).pRowStmt.is_null()
+        && row_key.tbl_info_idx == tbl_info_index
+        && row_key.pks == packed_pks
+    {
+        return Ok(ResultCode::OK);
+    }
+    // forget the old row first so a failed fetch is never mistaken for it
+    row_key.tbl_info_idx = -1;
+    let rc = reset_cached_stmt((*cursor).pRowStmt);
+    (*cursor).pRowStmt = null_mut();
+    rc?;
+
+    let stmt_key = get_cache_key(CachedStmtType::RowPatchData, tbl_info_index, None)?;
     let mut row_stmt = if let Some(stmt) = get_cached_stmt((*(*cursor).pTab).pExtData, &stmt_key) {
         stmt
     } else {
@@ -413,7 +844,7 @@ unsafe fn changes_next(
     };
 
     if row_stmt.is_null() {
-        let sql = row_patch_data_query(tbl_info, cid);
+        let sql = row_data_query(tbl_info);
         if let Some(sql) = sql {
             let stmt = (*(*cursor).pTab)
                 .db
@@ -432,9 +863,7 @@ unsafe fn changes_next(
         }
     }
 
-    let packed_pks = pks.blob();
-    let unpacked_pks = unpack_columns(packed_pks)?;
-    bind_package_to_stmt(row_stmt, &unpacked_pks)?;
+    bind_packed_to_stmt(row_stmt, packed_pks)?;
 
     match row_stmt.step() {
         Ok(ResultCode::DONE) => {
@@ -448,9 +877,28 @@ unsafe fn changes_next(
     }
 
     (*cursor).pRowStmt = row_stmt;
+    row_key.tbl_info_idx = tbl_info_index;
+    row_key.pks.clear();
+    row_key.pks.extend_from_slice(packed_pks);
     Ok(ResultCode::OK)
 }
 
+/// The row `pRowStmt` was last fetched for.
+struct RowKey {
+    tbl_info_idx: c_int,
+    pks: Vec<u8>,
+}
+
+unsafe fn row_key<'a>(cursor: *mut crsql_Changes_cursor) -> &'a mut RowKey {
+    if (*cursor).pRowKey.is_null() {
+        (*cursor).pRowKey = Box::into_raw(Box::new(RowKey {
+            tbl_info_idx: -1,
+            pks: vec![],
+        })) as *mut c_void;
+    }
+    &mut *((*cursor).pRowKey as *mut RowKey)
+}
+
 #[no_mangle]
 pub extern "C" fn crsql_changes_eof(cursor: *mut sqlite::vtab_cursor) -> c_int {
     let cursor = cursor.cast::<crsql_Changes_cursor>();
@@ -489,10 +937,11 @@ fn column_impl(
             ctx.result_value(changes_stmt.column_value(ClockUnionColumn::Pks as i32));
         }
         Some(CrsqlChangesColumn::Cval) => unsafe {
-            if (*cursor).pRowStmt.is_null() {
+            // the row stmt may still hold an earlier row across sentinel changes
+            if (*cursor).pRowStmt.is_null() || (*cursor).rowType != ChangeRowType::Update as c_int {
                 ctx.result_null();
             } else {
-                ctx.result_value((*cursor).pRowStmt.column_value(0));
+                ctx.result_value((*cursor).pRowStmt.column_value((*cursor).rowStmtCol));
             }
         },
         Some(CrsqlChangesColumn::Cid) => unsafe {
@@ -524,6 +973,14 @@ fn column_impl(
         Some(CrsqlChangesColumn::Seq) => {
             ctx.result_value(changes_stmt.column_value(ClockUnionColumn::Seq as i32));
         }
+        Some(CrsqlChangesColumn::ResumeToken) => {
+            ctx.result_blob_shared(&encode_resume_token(
+                changes_stmt.column_int64(ClockUnionColumn::DbVrsn as i32),
+                changes_stmt.column_int64(ClockUnionColumn::Seq as i32),
+            ));
+        }
+        // only ever compared against or written, never read back
+        Some(CrsqlChangesColumn::Vv) | Some(CrsqlChangesColumn::Sender) => ctx.result_null(),
         None => return Err(ResultCode::MISUSE),
     }
 
@@ -581,7 +1038,8 @@ pub extern "C" fn crsql_changes_update(
 
 // If xBegin is not defined xCommit is not called.
 #[no_mangle]
-pub extern "C" fn crsql_changes_begin(_vtab: *mut sqlite::vtab) -> c_int {
+pub extern "C" fn crsql_changes_begin(vtab: *mut sqlite::vtab) -> c_int {
+    unsafe { begin_merge_ctx(vtab.cast::<crsql_Changes_vtab>()) };
     ResultCode::OK as c_int
 }
 
@@ -591,5 +1049,24 @@ pub extern "C" fn crsql_changes_commit(vtab: *mut sqlite::vtab) -> c_int {
     unsafe {
         (*(*tab).pExtData).rowsImpacted = 0;
     }
+    crsql_changes_end_merge_ctx(vtab);
+    ResultCode::OK as c_int
+}
+
+#[no_mangle]
+pub extern "C" fn crsql_changes_rollback(vtab: *mut sqlite::vtab) -> c_int {
+    crsql_changes_end_merge_ctx(vtab);
     ResultCode::OK as c_int
 }
+
+// Rows merged, or schema changed, after the savepoint are gone so anything cached about them is stale.
+#[no_mangle]
+pub extern "C" fn crsql_changes_rollback_to(vtab: *mut sqlite::vtab, _savepoint: c_int) -> c_int {
+    unsafe { invalidate_merge_ctx(vtab.cast::<crsql_Changes_vtab>()) };
+    ResultCode::OK as c_int
+}
+
+#[no_mangle]
+pub extern "C" fn crsql_changes_end_merge_ctx(vtab: *mut sqlite::vtab) {
+    unsafe { end_merge_ctx(vtab.cast::<crsql_Changes_vtab>()) };
+}
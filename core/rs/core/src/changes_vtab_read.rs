@@ -1,18 +1,24 @@
 extern crate alloc;
-use crate::c::crsql_TableInfo;
+use crate::c::{crsql_TableInfo, ClockUnionColumn};
+use alloc::collections::BinaryHeap;
 use alloc::format;
 use alloc::string::String;
 use alloc::vec;
+use alloc::vec::Vec;
+use core::cmp::Reverse;
 use core::{
     ffi::{c_char, c_int, CStr},
     ptr::null_mut,
     slice,
 };
-use sqlite::ResultCode;
+use sqlite::{ResultCode, Stmt};
 
 use sqlite_nostd as sqlite;
 
-fn crsql_changes_query_for_table(table_info: *mut crsql_TableInfo) -> Result<String, ResultCode> {
+fn crsql_changes_query_for_table(
+    table_info: *mut crsql_TableInfo,
+    pk_probe: bool,
+) -> Result<String, ResultCode> {
     unsafe {
         if (*table_info).pksLen == 0 {
             // no primary keys? We can't get changes for a table w/o primary keys...
@@ -25,21 +31,53 @@ fn crsql_changes_query_for_table(table_info: *mut crsql_TableInfo) -> Result<Str
     let pk_columns =
         unsafe { slice::from_raw_parts((*table_info).pks, (*table_info).pksLen as usize) };
     let pk_list = crate::util::as_identifier_list(pk_columns, None)?;
+    // looks up a single row through the clock table's primary key
+    let pk_where = if pk_probe {
+        format!(" WHERE {}", crate::util::where_list(pk_columns)?)
+    } else {
+        String::new()
+    };
 
+    // Clock tables store column ids. Translate them back to names.
+    let non_pk_columns =
+        unsafe { slice::from_raw_parts((*table_info).nonPks, (*table_info).nonPksLen as usize) };
+    let mut cid_cases = format!(
+        "WHEN {} THEN '{}' WHEN {} THEN '{}'",
+        crate::c::DELETE_SENTINEL_ID,
+        crate::c::DELETE_SENTINEL,
+        crate::c::INSERT_SENTINEL_ID,
+        crate::c::INSERT_SENTINEL
+    );
+    for col in non_pk_columns.iter().filter(|c| c.colId != 0) {
+        let col_name = unsafe { CStr::from_ptr(col.name).to_str()? };
+        cid_cases.push_str(&format!(
+            " WHEN {} THEN '{}'",
+            col.colId,
+            crate::util::escape_ident_as_value(col_name)
+        ));
+    }
+
+    // Site ordinals are looked up only for the rows that are returned. Filters on
+    // the site go through `site_ordinal`, see `changes_best_index`.
     Ok(format!(
         "SELECT
           '{table_name_val}' as tbl,
           crsql_pack_columns({pk_list}) as pks,
-          __crsql_col_name as cid,
+          CASE __crsql_col_id {cid_cases} ELSE (SELECT col_name FROM \"{col_ids}\" WHERE tbl_name = '{table_name_val}' AND col_id = __crsql_col_id) END as cid,
           __crsql_col_version as col_vrsn,
           __crsql_db_version as db_vrsn,
-          __crsql_site_id as site_id,
+          (SELECT site_id FROM \"{site_ordinals}\" WHERE ordinal = __crsql_site_ordinal) as site_id,
+          __crsql_site_ordinal as site_ordinal,
           _rowid_,
           __crsql_seq as seq
-      FROM \"{table_name_ident}__crsql_clock\"",
+      FROM \"{table_name_ident}__crsql_clock\"{pk_where}",
         table_name_val = crate::util::escape_ident_as_value(table_name),
         pk_list = pk_list,
-        table_name_ident = crate::util::escape_ident(table_name)
+        cid_cases = cid_cases,
+        col_ids = crate::consts::TBL_COL_IDS,
+        site_ordinals = crate::consts::TBL_SITE_ORDINALS,
+        table_name_ident = crate::util::escape_ident(table_name),
+        pk_where = pk_where
     ))
 }
 
@@ -51,7 +89,7 @@ pub extern "C" fn crsql_changes_union_query(
 ) -> *mut c_char {
     if let Ok(idx_str) = unsafe { CStr::from_ptr(idx_str).to_str() } {
         let table_infos = sqlite::args!(table_infos_len, table_infos);
-        let query = changes_union_query(table_infos, idx_str);
+        let query = changes_union_query(table_infos, idx_str, false);
         if let Ok(query) = query {
             // release ownership of the memory
             let (ptr, _, _) = query.into_raw_parts();
@@ -65,23 +103,135 @@ pub extern "C" fn crsql_changes_union_query(
 pub fn changes_union_query(
     table_infos: &[*mut crsql_TableInfo],
     idx_str: &str,
+    limit: bool,
 ) -> Result<String, ResultCode> {
     let mut sub_queries = vec![];
 
     for table_info in table_infos {
-        let query_part = crsql_changes_query_for_table(*table_info)?;
+        let query_part = crsql_changes_query_for_table(*table_info, false)?;
         sub_queries.push(query_part);
     }
 
     // Manually null-terminate the string so we don't have to copy it to create a CString.
     // We can just extract the raw bytes of the Rust string.
     return Ok(format!(
-      "SELECT tbl, pks, cid, col_vrsn, db_vrsn, site_id, _rowid_, seq FROM ({unions}) {idx_str}\0",
+      "SELECT tbl, pks, cid, col_vrsn, db_vrsn, site_id, _rowid_, seq FROM ({unions}) {idx_str}{limit}\0",
       unions = sub_queries.join(" UNION ALL "),
       idx_str = idx_str,
+      limit = if limit { " LIMIT ?" } else { "" },
     ));
 }
 
+/// Query for the changes of a single table, filtered and ordered per `idx_str`.
+/// Used when the changes of every table are merged on read rather than by `UNION ALL`.
+/// With `pk_probe` the query takes the table's primary key values as its first bindings.
+/// With `limit` it takes the most rows to return as its last.
+pub fn changes_query_for_table(
+    table_info: *mut crsql_TableInfo,
+    pk_probe: bool,
+    idx_str: &str,
+    limit: bool,
+) -> Result<String, ResultCode> {
+    Ok(format!(
+        "SELECT tbl, pks, cid, col_vrsn, db_vrsn, site_id, _rowid_, seq FROM ({table_query}) {idx_str}{limit}",
+        table_query = crsql_changes_query_for_table(table_info, pk_probe)?,
+        idx_str = idx_str,
+        limit = if limit { " LIMIT ?" } else { "" },
+    ))
+}
+
+/// Encodes the position of a change in (db_vrsn, seq) order as the `resume_token` of
+/// `crsql_changes`. Both are stored big endian with the sign bit flipped so tokens
+/// compare bytewise in the same order as the changes they point to.
+pub fn encode_resume_token(db_vrsn: sqlite::int64, seq: sqlite::int64) -> [u8; 16] {
+    let mut token = [0; 16];
+    token[..8].copy_from_slice(&((db_vrsn as u64) ^ (1 << 63)).to_be_bytes());
+    token[8..].copy_from_slice(&((seq as u64) ^ (1 << 63)).to_be_bytes());
+    token
+}
+
+/// An empty token comes before every change.
+pub fn decode_resume_token(token: &[u8]) -> Option<(sqlite::int64, sqlite::int64)> {
+    if token.is_empty() {
+        return Some((sqlite::int64::MIN, sqlite::int64::MIN));
+    }
+    if token.len() != 16 {
+        return None;
+    }
+    let mut part = [0; 8];
+    part.copy_from_slice(&token[..8]);
+    let db_vrsn = (u64::from_be_bytes(part) ^ (1 << 63)) as sqlite::int64;
+    part.copy_from_slice(&token[8..]);
+    let seq = (u64::from_be_bytes(part) ^ (1 << 63)) as sqlite::int64;
+    Some((db_vrsn, seq))
+}
+
+/// K-way merge of per table change streams that are each ordered by (db_vrsn, seq).
+///
+/// Every clock table is read through its db version index so rows come back
+/// without materializing and sorting the union of all clock tables first.
+/// Holds one pending row per table.
+pub struct ChangesMerge {
+    stmts: Vec<*mut sqlite::stmt>,
+    heap: BinaryHeap<Reverse<(sqlite::int64, sqlite::int64, usize)>>,
+    current: Option<usize>,
+    // packed values that `stmts` bind without copying, kept alive until they are finalized
+    _bindings: Vec<u8>,
+}
+
+impl ChangesMerge {
+    pub fn new(
+        stmts: Vec<*mut sqlite::stmt>,
+        bindings: Vec<u8>,
+    ) -> Result<ChangesMerge, ResultCode> {
+        let mut merge = ChangesMerge {
+            heap: BinaryHeap::with_capacity(stmts.len()),
+            stmts,
+            current: None,
+            _bindings: bindings,
+        };
+        for i in 0..merge.stmts.len() {
+            merge.step(i)?;
+        }
+        Ok(merge)
+    }
+
+    fn step(&mut self, i: usize) -> Result<(), ResultCode> {
+        let stmt = self.stmts[i];
+        if stmt.step()? == ResultCode::ROW {
+            self.heap.push(Reverse((
+                stmt.column_int64(ClockUnionColumn::DbVrsn as i32),
+                stmt.column_int64(ClockUnionColumn::Seq as i32),
+                i,
+            )));
+        }
+        Ok(())
+    }
+
+    /// Moves to the next change. Returns the statement positioned on it, or
+    /// `None` once every table is exhausted.
+    pub fn next(&mut self) -> Result<Option<*mut sqlite::stmt>, ResultCode> {
+        if let Some(i) = self.current.take() {
+            self.step(i)?;
+        }
+        match self.heap.pop() {
+            Some(Reverse((_, _, i))) => {
+                self.current = Some(i);
+                Ok(Some(self.stmts[i]))
+            }
+            None => Ok(None),
+        }
+    }
+}
+
+impl Drop for ChangesMerge {
+    fn drop(&mut self) {
+        for stmt in self.stmts.iter() {
+            let _ = stmt.finalize();
+        }
+    }
+}
+
 #[no_mangle]
 pub extern "C" fn crsql_row_patch_data_query(
     table_info: *mut crsql_TableInfo,
@@ -114,3 +264,32 @@ pub fn row_patch_data_query(table_info: *mut crsql_TableInfo, col_name: &str) ->
 
     return None;
 }
+
+/// Selects every non-pk column of one row of the table so consecutive changes to
+/// that row can be read with a single lookup. Columns are in `nonPks` order.
+pub fn row_data_query(table_info: *mut crsql_TableInfo) -> Option<String> {
+    let (pk_columns, non_pk_columns) = unsafe {
+        (
+            slice::from_raw_parts((*table_info).pks, (*table_info).pksLen as usize),
+            slice::from_raw_parts((*table_info).nonPks, (*table_info).nonPksLen as usize),
+        )
+    };
+    if non_pk_columns.is_empty() {
+        return None;
+    }
+    let table_name = unsafe { CStr::from_ptr((*table_info).tblName).to_str() }.ok()?;
+    let col_list = non_pk_columns
+        .iter()
+        .map(|c| {
+            unsafe { CStr::from_ptr(c.name).to_str() }
+                .map(|name| format!("\"{}\"", crate::util::escape_ident(name)))
+        })
+        .collect::<Result<Vec<_>, _>>()
+        .ok()?
+        .join(", ");
+    let where_list = crate::util::where_list(pk_columns).ok()?;
+    Some(format!(
+        "SELECT {col_list} FROM \"{table_name}\" WHERE {where_list}\0",
+        table_name = crate::util::escape_ident(table_name),
+    ))
+}
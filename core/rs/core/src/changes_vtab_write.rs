@@ -1,143 +1,575 @@
+use alloc::boxed::Box;
 use alloc::ffi::CString;
 use alloc::format;
+use alloc::rc::Rc;
 use alloc::string::String;
+use alloc::vec;
 use alloc::vec::Vec;
-use core::ffi::{c_char, c_int, CStr};
+use core::ffi::{c_char, c_int, c_void, CStr};
 use core::mem::forget;
 use core::ptr::null_mut;
 use core::slice;
-use sqlite::{Connection, Stmt};
+use sqlite::{ColumnType, Connection, Stmt};
 use sqlite_nostd as sqlite;
 use sqlite_nostd::{sqlite3, ResultCode, Value};
 
+use crate::arena::Arena;
+use crate::c::crsql_ExtData;
 use crate::c::{
-    crsql_Changes_vtab, crsql_TableInfo, crsql_ensureTableInfosAreUpToDate, crsql_indexofTableInfo,
-    CrsqlChangesColumn,
+    crsql_Changes_vtab, crsql_TableInfo, crsql_ensureTableInfosAreUpToDate, crsql_indexofNonPk,
+    crsql_indexofPk, crsql_indexofTableInfoByName, crsql_raiseDbVersion, CrsqlChangesColumn,
 };
-use crate::c::{crsql_ExtData, crsql_columnExists};
-use crate::compare_values::crsql_compare_sqlite_values;
+use crate::col_ids::non_pk_col_id;
+use crate::compare_values::compare_column_value;
 use crate::pack_columns::bind_package_to_stmt;
+use crate::pack_columns::{unpack_columns_in, OwnedColumnValue};
+use crate::site_ordinals::intern_site_id;
 use crate::stmt_cache::{
-    get_cache_key, get_cached_stmt, reset_cached_stmt, set_cached_stmt, CachedStmtType,
+    get_cache_key, get_cached_stmt, reset_cached_stmt, set_cached_stmt, CachedStmtType, StmtKey,
 };
+use crate::tombstones::{may_have_tombstone, note_tombstone, sync_tombstone_filters};
 use crate::util::{self, slab_rowid};
-use crate::{unpack_columns, ColumnValue};
+use crate::ColumnValue;
 
-fn did_cid_win(
+/// Clock versions, and lazily the current values, of the row being merged.
+///
+/// The cells of a row arrive back to back so every cell after the first is
+/// decided without probing the clock table or, on a version tie, the base table.
+/// Kept on the vtab and dropped at transaction boundaries, whenever anything other
+/// than a column merge touches the row, or when a local write bumps `seq`.
+pub struct MergeRowCache {
+    tbl_name: String,
+    pks: Vec<u8>,
+    schema_version: c_int,
+    seq: c_int,
+    // (column id, version), sorted by column id
+    col_versions: Vec<(sqlite::int64, sqlite::int64)>,
+    // current values, in table info order, once a tie needed them
+    values: Vec<OwnedColumnValue>,
+    has_values: bool,
+}
+
+impl MergeRowCache {
+    fn col_version(&self, col_id: sqlite::int64) -> Option<sqlite::int64> {
+        self.col_versions
+            .binary_search_by_key(&col_id, |(id, _)| *id)
+            .ok()
+            .map(|i| self.col_versions[i].1)
+    }
+
+    fn set_col_version(&mut self, col_id: sqlite::int64, version: sqlite::int64) {
+        match self
+            .col_versions
+            .binary_search_by_key(&col_id, |(id, _)| *id)
+        {
+            Ok(i) => self.col_versions[i].1 = version,
+            Err(i) => self.col_versions.insert(i, (col_id, version)),
+        }
+    }
+
+    unsafe fn is_current(&self, ext_data: *mut crsql_ExtData, tbl_name: &str, pks: &[u8]) -> bool {
+        self.seq == (*ext_data).seq
+            && self.schema_version == (*ext_data).pragmaSchemaVersionForTableInfos
+            && self.tbl_name == tbl_name
+            && self.pks == pks
+    }
+}
+
+/// SQL fragments over a table's primary key columns.
+pub struct TableFragments {
+    pub pk_where_list: String,
+    pub pk_bind_list: String,
+    pub pk_ident_list: String,
+}
+
+/// State for the merges of a single transaction against `crsql_changes`.
+///
+/// Created in `crsql_changes_begin` and dropped when the transaction ends.
+/// The schema is checked by the first merge of the transaction, and checked again
+/// only when a merge names a table or column that isn't known yet.
+/// The temporaries of each merge come out of `arena`, which goes with the context.
+pub struct MergeContext {
+    schema_checked: bool,
+    schema_version: c_int,
+    tables: Vec<Option<Rc<TableFragments>>>,
+    row: Option<Box<MergeRowCache>>,
+    watermark: Option<Watermark>,
+    arena: Rc<Arena>,
+}
+
+impl MergeContext {
+    fn new() -> MergeContext {
+        MergeContext {
+            schema_checked: false,
+            schema_version: -1,
+            tables: vec![],
+            row: None,
+            watermark: None,
+            arena: Rc::new(Arena::new()),
+        }
+    }
+
+    /// Whether a change `sender` passed on was already applied, see `Watermark`.
+    /// The sender's watermark is loaded by the first merge that names it.
+    fn is_applied(
+        &mut self,
+        db: *mut sqlite3,
+        sender: &[u8],
+        site_id: &[u8],
+        db_vrsn: sqlite::int64,
+        seq: Option<sqlite::int64>,
+    ) -> Result<bool, ResultCode> {
+        if sender.is_empty() || site_id != sender {
+            // nothing to load for changes the sender only forwarded
+            return Ok(false);
+        }
+        if self
+            .watermark
+            .as_ref()
+            .map_or(true, |w| w.sender.as_slice() != sender)
+        {
+            self.watermark = Some(Watermark::load(db, sender)?);
+        }
+        Ok(self
+            .watermark
+            .as_ref()
+            .map_or(false, |w| w.covers(site_id, db_vrsn, seq)))
+    }
+
+    unsafe fn ensure_schema(
+        &mut self,
+        db: *mut sqlite3,
+        ext_data: *mut crsql_ExtData,
+        errmsg: *mut *mut c_char,
+    ) -> Result<(), ResultCode> {
+        if !self.schema_checked {
+            let rc = crsql_ensureTableInfosAreUpToDate(db, ext_data, errmsg);
+            if rc != ResultCode::OK as i32 {
+                let err = CString::new("Failed to update CRR table information")?;
+                *errmsg = err.into_raw();
+                return Err(ResultCode::ERROR);
+            }
+            sync_tombstone_filters(ext_data)?;
+            self.schema_checked = true;
+        }
+        // table infos may have been re-pulled by anything else that checked the schema
+        if self.schema_version != (*ext_data).pragmaSchemaVersionForTableInfos {
+            self.schema_version = (*ext_data).pragmaSchemaVersionForTableInfos;
+            self.tables.clear();
+        }
+        Ok(())
+    }
+
+    /// Index of the table info for `tbl_name`. If the table, or `col_name` within it,
+    /// is unknown the schema is checked again in case it changed mid transaction.
+    unsafe fn lookup(
+        &mut self,
+        db: *mut sqlite3,
+        ext_data: *mut crsql_ExtData,
+        tbl_name: &str,
+        col_name: &str,
+        errmsg: *mut *mut c_char,
+    ) -> Result<c_int, ResultCode> {
+        self.ensure_schema(db, ext_data, errmsg)?;
+        let idx = table_info_index(ext_data, tbl_name);
+        if idx != -1 && !is_unknown_column(ext_data, idx, col_name)? {
+            return Ok(idx);
+        }
+        self.schema_checked = false;
+        self.ensure_schema(db, ext_data, errmsg)?;
+        Ok(table_info_index(ext_data, tbl_name))
+    }
+
+    fn fragments(
+        &mut self,
+        tbl_info: *mut crsql_TableInfo,
+        tbl_info_idx: c_int,
+    ) -> Result<Rc<TableFragments>, ResultCode> {
+        let idx = tbl_info_idx as usize;
+        if self.tables.len() <= idx {
+            self.tables.resize(idx + 1, None);
+        }
+        if let Some(fragments) = &self.tables[idx] {
+            return Ok(fragments.clone());
+        }
+        let pk_cols = sqlite::args!((*tbl_info).pksLen, (*tbl_info).pks);
+        let fragments = Rc::new(TableFragments {
+            pk_where_list: util::where_list(pk_cols)?,
+            pk_bind_list: util::binding_list(pk_cols.len()),
+            pk_ident_list: util::as_identifier_list(pk_cols, None)?,
+        });
+        self.tables[idx] = Some(fragments.clone());
+        Ok(fragments)
+    }
+}
+
+/// The (db_version, seq) up to which the application says everything a peer
+/// sent has been applied. Changes at or below the watermark can only lose, so
+/// merges drop them before any of their SQL runs and re-sent changesets cost
+/// next to nothing.
+///
+/// Dropping changes is opt in, twice over. The application names the peer it
+/// got the changes from, the `sender` of `crsql_apply_changes` or of an insert
+/// into `crsql_changes`. The watermark is that peer's row of
+/// `crsql_tracked_peers` under the applied event and tag 0, which nothing but
+/// the application writes. It must only record one once the changes are
+/// applied, and only for peers it syncs with in full: a watermark recorded
+/// ahead of the changes, even in the same transaction, or after a sync that
+/// skipped some tables or rows, drops changes that were never applied. Rows of
+/// the receive event are never used.
+///
+/// Only changes made by the sender itself are dropped. The db version of a
+/// change is that of the site it came from, so changes the sender forwarded
+/// from other sites carry the sender's versions, not their own site's, and are
+/// never compared with a watermark. A change without a `seq` is dropped only
+/// if its whole db version is covered.
+pub(crate) struct Watermark {
+    sender: Vec<u8>,
+    // (version, seq), if the application recorded one
+    applied: Option<(sqlite::int64, sqlite::int64)>,
+}
+
+impl Watermark {
+    pub(crate) fn load(db: *mut sqlite3, sender: &[u8]) -> Result<Watermark, ResultCode> {
+        let stmt = db.prepare_v2(&format!(
+            "SELECT version, coalesce(seq, 0) FROM \"{tbl}\" WHERE site_id = ? AND event = {event} AND tag = 0",
+            tbl = crate::consts::TBL_TRACKED_PEERS,
+            event = crate::consts::TRACKED_PEER_APPLIED_EVENT,
+        ))?;
+        stmt.bind_blob(1, sender, sqlite::Destructor::STATIC)?;
+        let applied = if stmt.step()? == ResultCode::ROW {
+            Some((stmt.column_int64(0)?, stmt.column_int64(1)?))
+        } else {
+            None
+        };
+        Ok(Watermark {
+            sender: sender.to_vec(),
+            applied,
+        })
+    }
+
+    pub(crate) fn covers(
+        &self,
+        site_id: &[u8],
+        db_vrsn: sqlite::int64,
+        seq: Option<sqlite::int64>,
+    ) -> bool {
+        if site_id.is_empty() || site_id != self.sender.as_slice() {
+            return false;
+        }
+        match self.applied {
+            Some((version, watermark_seq)) => {
+                db_vrsn < version
+                    || (db_vrsn == version && seq.map_or(false, |seq| seq <= watermark_seq))
+            }
+            None => false,
+        }
+    }
+}
+
+unsafe fn is_unknown_column(
+    ext_data: *mut crsql_ExtData,
+    tbl_info_idx: c_int,
+    col_name: &str,
+) -> Result<bool, ResultCode> {
+    if col_name == crate::c::DELETE_SENTINEL || col_name == crate::c::INSERT_SENTINEL {
+        return Ok(false);
+    }
+    let tbl_infos = sqlite::args!((*ext_data).tableInfosLen, (*ext_data).zpTableInfos);
+    let tbl_info = tbl_infos[tbl_info_idx as usize];
+    if non_pk_index(tbl_info, col_name)?.is_some() {
+        return Ok(false);
+    }
+    Ok(crsql_indexofPk(
+        tbl_info,
+        col_name.as_ptr() as *const c_char,
+        col_name.len() as c_int,
+    ) == -1)
+}
+
+/// Index of the table info for `tbl_name`, or -1.
+pub(crate) unsafe fn table_info_index(ext_data: *mut crsql_ExtData, tbl_name: &str) -> c_int {
+    crsql_indexofTableInfoByName(
+        ext_data,
+        tbl_name.as_ptr() as *const c_char,
+        tbl_name.len() as c_int,
+    )
+}
+
+unsafe fn merge_ctx<'a>(tab: *mut crsql_Changes_vtab) -> &'a mut MergeContext {
+    // Merges always run inside `crsql_changes_begin` but be defensive.
+    if (*tab).pMergeCtx.is_null() {
+        begin_merge_ctx(tab);
+    }
+    &mut *((*tab).pMergeCtx as *mut MergeContext)
+}
+
+pub unsafe fn begin_merge_ctx(tab: *mut crsql_Changes_vtab) {
+    end_merge_ctx(tab);
+    (*tab).pMergeCtx = Box::into_raw(Box::new(MergeContext::new())) as *mut c_void;
+}
+
+pub unsafe fn end_merge_ctx(tab: *mut crsql_Changes_vtab) {
+    let ctx = (*tab).pMergeCtx as *mut MergeContext;
+    if !ctx.is_null() {
+        (*tab).pMergeCtx = null_mut();
+        drop(Box::from_raw(ctx));
+    }
+}
+
+unsafe fn take_row_cache(tab: *mut crsql_Changes_vtab) -> Option<Box<MergeRowCache>> {
+    merge_ctx(tab).row.take()
+}
+
+unsafe fn put_row_cache(tab: *mut crsql_Changes_vtab, cache: Box<MergeRowCache>) {
+    merge_ctx(tab).row = Some(cache);
+}
+
+/// Forgets the cached row, schema check and watermark. All may describe state that
+/// was rolled back.
+pub unsafe fn invalidate_merge_ctx(tab: *mut crsql_Changes_vtab) {
+    let ctx = (*tab).pMergeCtx as *mut MergeContext;
+    if !ctx.is_null() {
+        (*ctx).row = None;
+        (*ctx).schema_checked = false;
+        (*ctx).watermark = None;
+    }
+}
+
+unsafe fn load_row_cache(
     db: *mut sqlite3,
     ext_data: *mut crsql_ExtData,
+    cached: Option<Box<MergeRowCache>>,
+    tbl_info_idx: c_int,
     insert_tbl: &str,
+    insert_pks: &[u8],
     pk_where_list: &str,
-    unpacked_pks: &Vec<ColumnValue>,
-    col_name: &str,
-    insert_val: *mut sqlite::value,
-    col_version: sqlite::int64,
-    errmsg: *mut *mut c_char,
-) -> Result<bool, ResultCode> {
-    let stmt_key = get_cache_key(CachedStmtType::GetColVersion, insert_tbl, None)?;
-    let col_vrsn_stmt = get_cached_stmt_rt_wt(db, ext_data, stmt_key, || {
+    unpacked_pks: &[ColumnValue],
+) -> Result<Box<MergeRowCache>, ResultCode> {
+    // refill the previous row's cache rather than allocating one per row
+    let mut cache = match cached {
+        Some(cached) if cached.is_current(ext_data, insert_tbl, insert_pks) => {
+            return Ok(cached);
+        }
+        Some(cached) => cached,
+        None => Box::new(MergeRowCache {
+            tbl_name: String::new(),
+            pks: vec![],
+            schema_version: 0,
+            seq: 0,
+            col_versions: vec![],
+            values: vec![],
+            has_values: false,
+        }),
+    };
+    cache.tbl_name.clear();
+    cache.tbl_name.push_str(insert_tbl);
+    cache.pks.clear();
+    cache.pks.extend_from_slice(insert_pks);
+    cache.schema_version = (*ext_data).pragmaSchemaVersionForTableInfos;
+    cache.seq = (*ext_data).seq;
+    cache.has_values = false;
+    cache.col_versions.clear();
+    get_row_clock(
+        db,
+        ext_data,
+        tbl_info_idx,
+        insert_tbl,
+        pk_where_list,
+        unpacked_pks,
+        &mut cache.col_versions,
+    )?;
+    cache.col_versions.sort_unstable_by_key(|(id, _)| *id);
+    Ok(cache)
+}
+
+/// Reads every clock entry of a row, as (column id, version), into `clock` with a
+/// single probe of the clock table.
+pub(crate) fn get_row_clock(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    tbl_info_idx: c_int,
+    tbl_name: &str,
+    pk_where_list: &str,
+    unpacked_pks: &[ColumnValue],
+    clock: &mut impl Extend<(sqlite::int64, sqlite::int64)>,
+) -> Result<(), ResultCode> {
+    let stmt_key = get_cache_key(CachedStmtType::GetRowClock, tbl_info_idx, None)?;
+    let clock_stmt = get_cached_stmt_rt_wt(db, ext_data, stmt_key, || {
         format!(
-          "SELECT __crsql_col_version FROM \"{table_name}__crsql_clock\" WHERE {pk_where_list} AND ? = __crsql_col_name",
-          table_name = crate::util::escape_ident(insert_tbl),
-          pk_where_list = pk_where_list,
+            "SELECT __crsql_col_id, __crsql_col_version FROM \"{table_name}__crsql_clock\" WHERE {pk_where_list}",
+            table_name = crate::util::escape_ident(tbl_name),
+            pk_where_list = pk_where_list,
         )
     })?;
 
-    let bind_result = bind_package_to_stmt(col_vrsn_stmt, &unpacked_pks);
-    if let Err(rc) = bind_result {
-        reset_cached_stmt(col_vrsn_stmt)?;
+    if let Err(rc) = bind_package_to_stmt(clock_stmt, unpacked_pks) {
+        reset_cached_stmt(clock_stmt)?;
         return Err(rc);
     }
-    if let Err(rc) = col_vrsn_stmt.bind_text(
-        unpacked_pks.len() as i32 + 1,
-        col_name,
-        sqlite::Destructor::STATIC,
-    ) {
-        reset_cached_stmt(col_vrsn_stmt)?;
-        return Err(rc);
+
+    loop {
+        match clock_stmt.step() {
+            Ok(ResultCode::ROW) => {
+                clock.extend([(clock_stmt.column_int64(0), clock_stmt.column_int64(1))]);
+            }
+            Ok(ResultCode::DONE) => {
+                reset_cached_stmt(clock_stmt)?;
+                return Ok(());
+            }
+            Ok(rc) | Err(rc) => {
+                reset_cached_stmt(clock_stmt)?;
+                return Err(rc);
+            }
+        }
     }
+}
 
-    match col_vrsn_stmt.step() {
-        Ok(ResultCode::ROW) => {
-            let local_version = col_vrsn_stmt.column_int64(0);
-            reset_cached_stmt(col_vrsn_stmt)?;
+/// Statement that selects all non-pk columns of a row, in table info order.
+pub(crate) fn get_curr_row_stmt(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    tbl_info: *mut crsql_TableInfo,
+    tbl_info_idx: c_int,
+    tbl_name: &str,
+    pk_where_list: &str,
+) -> Result<*mut sqlite::stmt, ResultCode> {
+    let stmt_key = get_cache_key(CachedStmtType::GetCurrRow, tbl_info_idx, None)?;
+    get_cached_stmt_rt_wt(db, ext_data, stmt_key, || {
+        let non_pk_cols = sqlite::args!((*tbl_info).nonPksLen, (*tbl_info).nonPks);
+        format!(
+            "SELECT {col_list} FROM \"{table_name}\" WHERE {pk_where_list}",
+            col_list = crate::util::as_identifier_list(non_pk_cols, None).unwrap_or_default(),
+            table_name = crate::util::escape_ident(tbl_name),
+            pk_where_list = pk_where_list,
+        )
+    })
+}
+
+pub(crate) fn non_pk_index(
+    tbl_info: *mut crsql_TableInfo,
+    col_name: &str,
+) -> Result<Option<usize>, ResultCode> {
+    let idx = unsafe {
+        crsql_indexofNonPk(
+            tbl_info,
+            col_name.as_ptr() as *const c_char,
+            col_name.len() as c_int,
+        )
+    };
+    if idx < 0 {
+        Ok(None)
+    } else {
+        Ok(Some(idx as usize))
+    }
+}
+
+fn did_cid_win(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    row_cache: &mut MergeRowCache,
+    tbl_info: *mut crsql_TableInfo,
+    tbl_info_idx: c_int,
+    insert_tbl: &str,
+    pk_where_list: &str,
+    unpacked_pks: &[ColumnValue],
+    col_idx: usize,
+    col_id: sqlite::int64,
+    insert_val: *mut sqlite::value,
+    col_version: sqlite::int64,
+    errmsg: *mut *mut c_char,
+) -> Result<bool, ResultCode> {
+    match row_cache.col_version(col_id) {
+        Some(local_version) => {
             if col_version > local_version {
                 return Ok(true);
             } else if col_version < local_version {
                 return Ok(false);
             }
         }
-        Ok(ResultCode::DONE) => {
-            reset_cached_stmt(col_vrsn_stmt)?;
-            // no rows returned
+        None => {
             // of course the incoming change wins if there's nothing there locally.
             return Ok(true);
         }
-        Ok(rc) | Err(rc) => {
-            reset_cached_stmt(col_vrsn_stmt)?;
-            let err = CString::new("Bad return code when selecting local column version")?;
-            unsafe { *errmsg = err.into_raw() };
-            return Err(rc);
-        }
     }
 
     // versions are equal
     // need to pull the current value and compare
     // we could compare on site_id if we can guarantee site_id is always provided.
     // would be slightly more performant..
-    let stmt_key = get_cache_key(CachedStmtType::GetCurrValue, insert_tbl, Some(col_name))?;
-    let col_val_stmt = get_cached_stmt_rt_wt(db, ext_data, stmt_key, || {
-        format!(
-            "SELECT \"{col_name}\" FROM \"{table_name}\" WHERE {pk_where_list}",
-            col_name = crate::util::escape_ident(col_name),
-            table_name = crate::util::escape_ident(insert_tbl),
-            pk_where_list = pk_where_list,
-        )
-    })?;
-
-    let bind_result = bind_package_to_stmt(col_val_stmt, &unpacked_pks);
-    if let Err(rc) = bind_result {
-        reset_cached_stmt(col_val_stmt)?;
-        return Err(rc);
-    }
+    if !row_cache.has_values {
+        let col_val_stmt = get_curr_row_stmt(
+            db,
+            ext_data,
+            tbl_info,
+            tbl_info_idx,
+            insert_tbl,
+            pk_where_list,
+        )?;
 
-    let step_result = col_val_stmt.step();
-    match step_result {
-        Ok(ResultCode::ROW) => {
-            let local_value = col_val_stmt.column_value(0);
-            let ret = crsql_compare_sqlite_values(insert_val, local_value);
+        let bind_result = bind_package_to_stmt(col_val_stmt, &unpacked_pks);
+        if let Err(rc) = bind_result {
             reset_cached_stmt(col_val_stmt)?;
-            return Ok(ret > 0);
+            return Err(rc);
         }
-        _ => {
-            // ResultCode::DONE would happen if clock values exist but actual values are missing.
-            // should we just allow the insert anyway?
-            reset_cached_stmt(col_val_stmt)?;
-            let err = CString::new(format!(
-                "could not find row to merge with for tbl {}",
-                insert_tbl
-            ))?;
-            unsafe { *errmsg = err.into_raw() };
-            return Err(ResultCode::ERROR);
+
+        match col_val_stmt.step() {
+            Ok(ResultCode::ROW) => {
+                // reuses the buffers of the previous row's values
+                let count = col_val_stmt.column_count() as usize;
+                row_cache.values.truncate(count);
+                for i in 0..count {
+                    let value = col_val_stmt.column_value(i as i32);
+                    match row_cache.values.get_mut(i) {
+                        Some(cached) => cached.set_from_value(value),
+                        None => row_cache.values.push(OwnedColumnValue::from_value(value)),
+                    }
+                }
+                row_cache.has_values = true;
+                reset_cached_stmt(col_val_stmt)?;
+            }
+            _ => {
+                // ResultCode::DONE would happen if clock values exist but actual values are missing.
+                // should we just allow the insert anyway?
+                reset_cached_stmt(col_val_stmt)?;
+                let err = CString::new(format!(
+                    "could not find row to merge with for tbl {}",
+                    insert_tbl
+                ))?;
+                unsafe { *errmsg = err.into_raw() };
+                return Err(ResultCode::ERROR);
+            }
         }
     }
+
+    match row_cache.values.get(col_idx) {
+        Some(value) => Ok(compare_column_value(&value.as_column_value(), insert_val) < 0),
+        None => Err(ResultCode::ERROR),
+    }
 }
 
-fn check_for_local_delete(
+pub(crate) fn check_for_local_delete(
     db: *mut sqlite::sqlite3,
     ext_data: *mut crsql_ExtData,
+    tbl_info_idx: c_int,
     tbl_name: &str,
     pk_where_list: &str,
-    unpacked_pks: &Vec<ColumnValue>,
+    unpacked_pks: &[ColumnValue],
 ) -> Result<bool, ResultCode> {
-    let stmt_key = get_cache_key(CachedStmtType::CheckForLocalDelete, tbl_name, None)?;
+    let tbl_infos = sqlite::args!((*ext_data).tableInfosLen, (*ext_data).zpTableInfos);
+    let tbl_info = tbl_infos[tbl_info_idx as usize];
+    if !unsafe { may_have_tombstone(db, ext_data, tbl_info, tbl_name, unpacked_pks)? } {
+        return Ok(false);
+    }
+
+    let stmt_key = get_cache_key(CachedStmtType::CheckForLocalDelete, tbl_info_idx, None)?;
 
     let check_del_stmt = get_cached_stmt_rt_wt(db, ext_data, stmt_key, || {
         format!(
-          "SELECT 1 FROM \"{table_name}__crsql_clock\" WHERE {pk_where_list} AND __crsql_col_name = '{delete_sentinel}' LIMIT 1",
+          "SELECT 1 FROM \"{table_name}__crsql_clock\" WHERE {pk_where_list} AND __crsql_col_id = {delete_sentinel_id} LIMIT 1",
           table_name = crate::util::escape_ident(tbl_name),
           pk_where_list = pk_where_list,
-          delete_sentinel = crate::c::DELETE_SENTINEL,
+          delete_sentinel_id = crate::c::DELETE_SENTINEL_ID,
         )
     })?;
 
@@ -159,10 +591,10 @@ fn check_for_local_delete(
     }
 }
 
-fn get_cached_stmt_rt_wt<F>(
+pub(crate) fn get_cached_stmt_rt_wt<F>(
     db: *mut sqlite::sqlite3,
     ext_data: *mut crsql_ExtData,
-    key: String,
+    key: StmtKey,
     query_builder: F,
 ) -> Result<*mut sqlite::stmt, ResultCode>
 where
@@ -187,26 +619,28 @@ where
     Ok(ret)
 }
 
-fn set_winner_clock(
+pub(crate) fn set_winner_clock(
     db: *mut sqlite3,
     ext_data: *mut crsql_ExtData,
     tbl_info: *mut crsql_TableInfo,
+    tbl_info_idx: c_int,
     pk_ident_list: &str,
     pk_bind_list: &str,
-    unpacked_pks: &Vec<ColumnValue>,
-    insert_col_name: &str,
+    unpacked_pks: &[ColumnValue],
+    insert_col_id: sqlite::int64,
     insert_col_vrsn: sqlite::int64,
     insert_db_vrsn: sqlite::int64,
     insert_site_id: &[u8],
 ) -> Result<sqlite::int64, ResultCode> {
     let tbl_name_str = unsafe { CStr::from_ptr((*tbl_info).tblName).to_str()? };
+    let insert_site_ordinal = intern_site_id(db, ext_data, tbl_info_idx, insert_site_id)?;
 
-    let stmt_key = get_cache_key(CachedStmtType::SetWinnerClock, tbl_name_str, None)?;
+    let stmt_key = get_cache_key(CachedStmtType::SetWinnerClock, tbl_info_idx, None)?;
 
     let set_stmt = get_cached_stmt_rt_wt(db, ext_data, stmt_key, || {
         format!(
           "INSERT OR REPLACE INTO \"{table_name}__crsql_clock\"
-            ({pk_ident_list}, __crsql_col_name, __crsql_col_version, __crsql_db_version, __crsql_seq, __crsql_site_id)
+            ({pk_ident_list}, __crsql_col_id, __crsql_col_version, __crsql_db_version, __crsql_seq, __crsql_site_ordinal)
             VALUES (
               {pk_bind_list},
               ?,
@@ -214,7 +648,7 @@ fn set_winner_clock(
               MAX(crsql_nextdbversion(), ?),
               crsql_increment_and_get_seq(),
               ?
-            ) RETURNING _rowid_",
+            ) RETURNING _rowid_, __crsql_db_version",
           table_name = crate::util::escape_ident(tbl_name_str),
           pk_ident_list = pk_ident_list,
           pk_bind_list = pk_bind_list,
@@ -227,23 +661,12 @@ fn set_winner_clock(
         return Err(rc);
     }
     let bind_result = set_stmt
-        .bind_text(
-            unpacked_pks.len() as i32 + 1,
-            insert_col_name,
-            sqlite::Destructor::STATIC,
-        )
+        .bind_int64(unpacked_pks.len() as i32 + 1, insert_col_id)
         .and_then(|_| set_stmt.bind_int64(unpacked_pks.len() as i32 + 2, insert_col_vrsn))
         .and_then(|_| set_stmt.bind_int64(unpacked_pks.len() as i32 + 3, insert_db_vrsn))
-        .and_then(|_| {
-            if insert_site_id.is_empty() {
-                set_stmt.bind_null(unpacked_pks.len() as i32 + 4)
-            } else {
-                set_stmt.bind_blob(
-                    unpacked_pks.len() as i32 + 4,
-                    insert_site_id,
-                    sqlite::Destructor::STATIC,
-                )
-            }
+        .and_then(|_| match insert_site_ordinal {
+            Some(ordinal) => set_stmt.bind_int64(unpacked_pks.len() as i32 + 4, ordinal),
+            None => set_stmt.bind_null(unpacked_pks.len() as i32 + 4),
         });
 
     if let Err(rc) = bind_result {
@@ -254,7 +677,11 @@ fn set_winner_clock(
     match set_stmt.step() {
         Ok(ResultCode::ROW) => {
             let rowid = set_stmt.column_int64(0);
+            let db_vrsn = set_stmt.column_int64(1);
             reset_cached_stmt(set_stmt)?;
+            if unsafe { crsql_raiseDbVersion(db, ext_data, db_vrsn) } != ResultCode::OK as c_int {
+                return Err(ResultCode::ERROR);
+            }
             Ok(rowid)
         }
         _ => {
@@ -264,12 +691,13 @@ fn set_winner_clock(
     }
 }
 
-fn merge_pk_only_insert(
+pub(crate) fn merge_pk_only_insert(
     db: *mut sqlite3,
     ext_data: *mut crsql_ExtData,
     tbl_info: *mut crsql_TableInfo,
+    tbl_info_idx: c_int,
     pk_bind_list: &str,
-    unpacked_pks: &Vec<ColumnValue>,
+    unpacked_pks: &[ColumnValue],
     pk_ident_list: &str,
     remote_col_vrsn: sqlite::int64,
     remote_db_vsn: sqlite::int64,
@@ -277,7 +705,7 @@ fn merge_pk_only_insert(
 ) -> Result<sqlite::int64, ResultCode> {
     let tbl_name_str = unsafe { CStr::from_ptr((*tbl_info).tblName).to_str()? };
 
-    let stmt_key = get_cache_key(CachedStmtType::MergePkOnlyInsert, tbl_name_str, None)?;
+    let stmt_key = get_cache_key(CachedStmtType::MergePkOnlyInsert, tbl_info_idx, None)?;
     let merge_stmt = get_cached_stmt_rt_wt(db, ext_data, stmt_key, || {
         format!(
             "INSERT OR IGNORE INTO \"{table_name}\" ({pk_idents}) VALUES ({pk_bindings})",
@@ -321,10 +749,11 @@ fn merge_pk_only_insert(
         db,
         ext_data,
         tbl_info,
+        tbl_info_idx,
         pk_ident_list,
         pk_bind_list,
         unpacked_pks,
-        crate::c::INSERT_SENTINEL,
+        crate::c::INSERT_SENTINEL_ID,
         remote_col_vrsn,
         remote_db_vsn,
         remote_site_id,
@@ -333,12 +762,13 @@ fn merge_pk_only_insert(
 
 // TODO: we can commonize this with `merge_pkonly_insert` -- basically the same logic.
 // although with CL they may diverge.
-unsafe fn merge_delete(
+pub(crate) unsafe fn merge_delete(
     db: *mut sqlite3,
     ext_data: *mut crsql_ExtData,
     tbl_info: *mut crsql_TableInfo,
+    tbl_info_idx: c_int,
     pk_where_list: &str,
-    unpacked_pks: &Vec<ColumnValue>,
+    unpacked_pks: &[ColumnValue],
     pk_bind_list: &str,
     pk_ident_list: &str,
     remote_col_vrsn: sqlite::int64,
@@ -346,7 +776,7 @@ unsafe fn merge_delete(
     remote_site_id: &[u8],
 ) -> Result<sqlite::int64, ResultCode> {
     let tbl_name_str = CStr::from_ptr((*tbl_info).tblName).to_str()?;
-    let stmt_key = get_cache_key(CachedStmtType::MergeDelete, tbl_name_str, None)?;
+    let stmt_key = get_cache_key(CachedStmtType::MergeDelete, tbl_info_idx, None)?;
     let delete_stmt = get_cached_stmt_rt_wt(db, ext_data, stmt_key, || {
         format!(
             "DELETE FROM \"{table_name}\" WHERE {pk_where_list}",
@@ -379,18 +809,21 @@ unsafe fn merge_delete(
         return Err(rc);
     }
 
-    set_winner_clock(
+    let rowid = set_winner_clock(
         db,
         ext_data,
         tbl_info,
+        tbl_info_idx,
         pk_ident_list,
         pk_bind_list,
         unpacked_pks,
-        crate::c::DELETE_SENTINEL,
+        crate::c::DELETE_SENTINEL_ID,
         remote_col_vrsn,
         remote_db_vrsn,
         remote_site_id,
-    )
+    )?;
+    note_tombstone(ext_data, tbl_name_str, unpacked_pks.iter().cloned());
+    Ok(rowid)
 }
 
 #[no_mangle]
@@ -415,13 +848,8 @@ unsafe fn merge_insert(
 ) -> Result<ResultCode, ResultCode> {
     let tab = vtab.cast::<crsql_Changes_vtab>();
     let db = (*tab).db;
-
-    let rc = crsql_ensureTableInfosAreUpToDate(db, (*tab).pExtData, errmsg);
-    if rc != ResultCode::OK as i32 {
-        let err = CString::new("Failed to update CRR table information")?;
-        *errmsg = err.into_raw();
-        return Err(ResultCode::ERROR);
-    }
+    // Only handed back to the vtab once a column merge completes.
+    let cached_row = take_row_cache(tab);
 
     let args = sqlite::args!(argc, argv);
     let insert_tbl = args[2 + CrsqlChangesColumn::Tbl as usize];
@@ -453,11 +881,32 @@ unsafe fn merge_insert(
     }
 
     let insert_site_id = insert_site_id.blob();
-    let tbl_info_index = crsql_indexofTableInfo(
-        (*(*tab).pExtData).zpTableInfos,
-        (*(*tab).pExtData).tableInfosLen,
-        insert_tbl.as_ptr() as *const c_char,
-    );
+    let insert_seq = args[2 + CrsqlChangesColumn::Seq as usize];
+    let insert_seq = if insert_seq.value_type() == ColumnType::Integer {
+        Some(insert_seq.int64())
+    } else {
+        None
+    };
+    let insert_sender = args[2 + CrsqlChangesColumn::Sender as usize];
+    let insert_sender = if insert_sender.value_type() == ColumnType::Blob {
+        insert_sender.blob()
+    } else {
+        &[]
+    };
+    let merge_ctx = merge_ctx(tab);
+    if merge_ctx.is_applied(
+        db,
+        insert_sender,
+        insert_site_id,
+        insert_db_vrsn,
+        insert_seq,
+    )? {
+        if let Some(cached_row) = cached_row {
+            put_row_cache(tab, cached_row);
+        }
+        return Ok(ResultCode::OK);
+    }
+    let tbl_info_index = merge_ctx.lookup(db, (*tab).pExtData, insert_tbl, insert_col, errmsg)?;
 
     let tbl_infos = sqlite::args!(
         (*(*tab).pExtData).tableInfosLen,
@@ -477,32 +926,35 @@ unsafe fn merge_insert(
     let is_delete = crate::c::DELETE_SENTINEL == insert_col;
     let is_pk_only = crate::c::INSERT_SENTINEL == insert_col;
 
-    let pk_cols = sqlite::args!((*tbl_info).pksLen, (*tbl_info).pks);
-    let pk_where_list = util::where_list(pk_cols)?;
-    let unpacked_pks = unpack_columns(insert_pks.blob())?;
+    let fragments = merge_ctx.fragments(tbl_info, tbl_info_index)?;
+    let pk_where_list = &fragments.pk_where_list;
+    let arena = merge_ctx.arena.clone();
+    let unpacked_pks = unpack_columns_in(insert_pks.blob(), &*arena)?;
 
     if check_for_local_delete(
         db,
         (*tab).pExtData,
+        tbl_info_index,
         insert_tbl,
-        &pk_where_list,
+        pk_where_list,
         &unpacked_pks,
     )? {
         // Delete wins. Our work is done.
         return Ok(ResultCode::OK);
     }
 
-    let pk_bind_list = crate::util::binding_list(pk_cols.len());
-    let pk_ident_list = crate::util::as_identifier_list(pk_cols, None)?;
+    let pk_bind_list = &fragments.pk_bind_list;
+    let pk_ident_list = &fragments.pk_ident_list;
     if is_delete {
         let merge_result = merge_delete(
             db,
             (*tab).pExtData,
             tbl_info,
-            &pk_where_list,
+            tbl_info_index,
+            pk_where_list,
             &unpacked_pks,
-            &pk_bind_list,
-            &pk_ident_list,
+            pk_bind_list,
+            pk_ident_list,
             insert_col_vrsn,
             insert_db_vrsn,
             insert_site_id,
@@ -519,21 +971,16 @@ unsafe fn merge_insert(
         }
     }
 
-    if is_pk_only
-        || crsql_columnExists(
-            // TODO: only safe because we _know_ this is actually a cstr
-            insert_col.as_ptr() as *const c_char,
-            (*tbl_info).nonPks,
-            (*tbl_info).nonPksLen,
-        ) == 0
-    {
+    let col_idx = non_pk_index(tbl_info, insert_col)?;
+    if is_pk_only || col_idx.is_none() {
         let merge_result = merge_pk_only_insert(
             db,
             (*tab).pExtData,
             tbl_info,
-            &pk_bind_list,
+            tbl_info_index,
+            pk_bind_list,
             &unpacked_pks,
-            &pk_ident_list,
+            pk_ident_list,
             insert_col_vrsn,
             insert_db_vrsn,
             insert_site_id,
@@ -550,13 +997,29 @@ unsafe fn merge_insert(
         }
     }
 
+    let col_idx = col_idx.unwrap_or(0);
+    let col_id = non_pk_col_id(db, tbl_info, col_idx)?;
+    let mut row_cache = load_row_cache(
+        db,
+        (*tab).pExtData,
+        cached_row,
+        tbl_info_index,
+        insert_tbl,
+        insert_pks.blob(),
+        pk_where_list,
+        &unpacked_pks,
+    )?;
     let does_cid_win = did_cid_win(
         db,
         (*tab).pExtData,
+        &mut row_cache,
+        tbl_info,
+        tbl_info_index,
         insert_tbl,
-        &pk_where_list,
+        pk_where_list,
         &unpacked_pks,
-        insert_col,
+        col_idx,
+        col_id,
         insert_val,
         insert_col_vrsn,
         errmsg,
@@ -565,16 +1028,12 @@ unsafe fn merge_insert(
     if does_cid_win == false {
         // doesCidWin == 0? compared against our clocks, nothing wins. OK and
         // Done.
+        put_row_cache(tab, row_cache);
         return Ok(ResultCode::OK);
     }
 
     // TODO: this is all almost identical between all three merge cases!
-    let stmt_key = get_cache_key(
-        CachedStmtType::MergeInsert,
-        // This is currently safe since these are c strings under the hood
-        insert_tbl,
-        Some(insert_col),
-    )?;
+    let stmt_key = get_cache_key(CachedStmtType::MergeInsert, tbl_info_index, Some(col_idx))?;
     let merge_stmt = get_cached_stmt_rt_wt(db, (*tab).pExtData, stmt_key, || {
         format!(
             "INSERT INTO \"{table_name}\" ({pk_list}, \"{col_name}\")
@@ -620,10 +1079,11 @@ unsafe fn merge_insert(
         db,
         (*tab).pExtData,
         tbl_info,
-        &pk_ident_list,
-        &pk_bind_list,
+        tbl_info_index,
+        pk_ident_list,
+        pk_bind_list,
         &unpacked_pks,
-        insert_col,
+        col_id,
         insert_col_vrsn,
         insert_db_vrsn,
         insert_site_id,
@@ -635,6 +1095,13 @@ unsafe fn merge_insert(
         Ok(inner_rowid) => {
             (*(*tab).pExtData).rowsImpacted += 1;
             *rowid = slab_rowid(tbl_info_index, inner_rowid);
+
+            row_cache.set_col_version(col_id, insert_col_vrsn);
+            if row_cache.has_values {
+                row_cache.values[col_idx].set_from_value(insert_val);
+            }
+            row_cache.seq = (*(*tab).pExtData).seq;
+            put_row_cache(tab, row_cache);
             return Ok(ResultCode::OK);
         }
     }
@@ -0,0 +1,355 @@
+extern crate alloc;
+
+use alloc::collections::BTreeMap;
+use alloc::ffi::CString;
+use alloc::string::String;
+use alloc::vec;
+use alloc::vec::Vec;
+use core::ffi::{c_char, c_int};
+use core::slice;
+use sqlite::{ColumnType, Connection, ManagedStmt};
+use sqlite_nostd as sqlite;
+use sqlite_nostd::{sqlite3, ResultCode};
+
+use crate::apply_changes::apply_records;
+use crate::arena::Arena;
+use crate::c::{crsql_ExtData, CrsqlChangesColumn};
+use crate::consts;
+use crate::pack_columns::{pack_column_value, pack_value, unpack_value};
+use crate::ColumnValue;
+
+/**
+ * Compact encoding of a set of `crsql_changes` rows.
+ *
+ * Rather than repeating the table name, packed pk and site id in every cell,
+ * names and site ids are written once into dictionaries and cells are grouped
+ * under the row they belong to. Every value uses the `crsql_pack_columns`
+ * value encoding so integers take as few bytes as they need.
+ *
+ * Format:
+ * [
+ *   format_version,
+ *   num_tables, ...table_names,
+ *   num_columns, ...column_names,
+ *   num_sites, ...site_ids,
+ *   num_rows, ...[tbl_idx, pk, num_cells, ...[cid_idx, val, col_version, db_version_delta, site_idx, seq]]
+ * ]
+ *
+ * `db_version_delta` is the zigzag encoded difference with the db_version of
+ * the previous cell in the changeset.
+ *
+ * Changes made locally are exported under the local site id, so the receiver
+ * records them as changes of this site rather than as its own.
+ */
+const CHANGESET_FORMAT_VERSION: i64 = 1;
+
+#[no_mangle]
+pub unsafe extern "C" fn crsql_changeset_export(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    since: sqlite::int64,
+    exclude_site: *const u8,
+    exclude_site_len: c_int,
+    changeset: *mut *mut u8,
+    changeset_len: *mut c_int,
+    errmsg: *mut *mut c_char,
+) -> c_int {
+    let exclude_site = if exclude_site.is_null() {
+        None
+    } else {
+        Some(slice::from_raw_parts(
+            exclude_site,
+            exclude_site_len.max(0) as usize,
+        ))
+    };
+    let local_site_id = slice::from_raw_parts((*ext_data).siteId, consts::SITE_ID_LEN as usize);
+    match changeset_export(db, local_site_id, since, exclude_site) {
+        Ok(buf) => {
+            let len: Result<c_int, _> = buf.len().try_into();
+            if let Ok(len) = len {
+                // release ownership of the memory. C frees it with sqlite3_free.
+                let (ptr, _, _) = buf.into_raw_parts();
+                *changeset = ptr;
+                *changeset_len = len;
+                ResultCode::OK as c_int
+            } else {
+                ResultCode::TOOBIG as c_int
+            }
+        }
+        Err(rc) => {
+            if let Ok(err) = CString::new("crsql - failed to export changes") {
+                *errmsg = err.into_raw();
+            }
+            rc as c_int
+        }
+    }
+}
+
+struct Dictionary<K: Ord + Clone> {
+    entries: Vec<K>,
+    index: BTreeMap<K, i64>,
+}
+
+impl<K: Ord + Clone> Dictionary<K> {
+    fn new() -> Self {
+        Dictionary {
+            entries: vec![],
+            index: BTreeMap::new(),
+        }
+    }
+
+    fn intern(&mut self, key: K) -> i64 {
+        if let Some(idx) = self.index.get(&key) {
+            return *idx;
+        }
+        let idx = self.entries.len() as i64;
+        self.entries.push(key.clone());
+        self.index.insert(key, idx);
+        idx
+    }
+}
+
+struct ExportCell {
+    cid: i64,
+    val: Vec<u8>,
+    col_version: i64,
+    db_version: i64,
+    site: i64,
+    seq: i64,
+}
+
+fn changeset_export(
+    db: *mut sqlite3,
+    local_site_id: &[u8],
+    since: sqlite::int64,
+    exclude_site: Option<&[u8]>,
+) -> Result<Vec<u8>, ResultCode> {
+    let stmt = db.prepare_v2(if exclude_site.is_some() {
+        "SELECT [table], pk, cid, val, col_version, db_version, site_id, seq FROM crsql_changes WHERE db_version > ? AND site_id IS NOT ? ORDER BY db_version, seq ASC"
+    } else {
+        "SELECT [table], pk, cid, val, col_version, db_version, site_id, seq FROM crsql_changes WHERE db_version > ? ORDER BY db_version, seq ASC"
+    })?;
+    stmt.bind_int64(1, since)?;
+    if let Some(exclude_site) = exclude_site {
+        stmt.bind_blob(2, exclude_site, sqlite::Destructor::STATIC)?;
+    }
+
+    let mut tables: Dictionary<String> = Dictionary::new();
+    let mut columns: Dictionary<String> = Dictionary::new();
+    let mut sites: Dictionary<Vec<u8>> = Dictionary::new();
+    // rows keep the order in which they were first seen, cells the order they were read in
+    let mut row_index: BTreeMap<(i64, Vec<u8>), usize> = BTreeMap::new();
+    let mut rows: Vec<(i64, Vec<u8>, Vec<ExportCell>)> = vec![];
+
+    while stmt.step()? == ResultCode::ROW {
+        let tbl = tables.intern(String::from(
+            stmt.column_text(CrsqlChangesColumn::Tbl as i32)?,
+        ));
+        let pk = stmt.column_blob(CrsqlChangesColumn::Pk as i32)?.to_vec();
+        let mut val = vec![];
+        pack_value(
+            &mut val,
+            stmt.column_value(CrsqlChangesColumn::Cval as i32)?,
+        );
+        let site = sites.intern(read_site_id(&stmt, local_site_id)?);
+        let cell = ExportCell {
+            cid: columns.intern(String::from(
+                stmt.column_text(CrsqlChangesColumn::Cid as i32)?,
+            )),
+            val,
+            col_version: stmt.column_int64(CrsqlChangesColumn::ColVrsn as i32)?,
+            db_version: stmt.column_int64(CrsqlChangesColumn::DbVrsn as i32)?,
+            site,
+            seq: stmt.column_int64(CrsqlChangesColumn::Seq as i32)?,
+        };
+
+        let key = (tbl, pk);
+        if let Some(idx) = row_index.get(&key) {
+            rows[*idx].2.push(cell);
+        } else {
+            row_index.insert(key.clone(), rows.len());
+            rows.push((key.0, key.1, vec![cell]));
+        }
+    }
+
+    let mut buf = vec![];
+    pack_column_value(&mut buf, &ColumnValue::Integer(CHANGESET_FORMAT_VERSION));
+    pack_int(&mut buf, tables.entries.len() as i64);
+    for name in tables.entries {
+        pack_column_value(&mut buf, &ColumnValue::Text(&name));
+    }
+    pack_int(&mut buf, columns.entries.len() as i64);
+    for name in columns.entries {
+        pack_column_value(&mut buf, &ColumnValue::Text(&name));
+    }
+    pack_int(&mut buf, sites.entries.len() as i64);
+    for site in sites.entries.iter() {
+        pack_column_value(&mut buf, &ColumnValue::Blob(site));
+    }
+
+    pack_int(&mut buf, rows.len() as i64);
+    let mut prev_db_version = 0;
+    for (tbl, pk, cells) in rows {
+        pack_int(&mut buf, tbl);
+        pack_column_value(&mut buf, &ColumnValue::Blob(&pk));
+        pack_int(&mut buf, cells.len() as i64);
+        for cell in cells {
+            pack_int(&mut buf, cell.cid);
+            buf.extend_from_slice(&cell.val);
+            pack_int(&mut buf, cell.col_version);
+            pack_int(
+                &mut buf,
+                zigzag(cell.db_version.wrapping_sub(prev_db_version)),
+            );
+            pack_int(&mut buf, cell.site);
+            pack_int(&mut buf, cell.seq);
+            prev_db_version = cell.db_version;
+        }
+    }
+
+    Ok(buf)
+}
+
+fn read_site_id(stmt: &ManagedStmt, local_site_id: &[u8]) -> Result<Vec<u8>, ResultCode> {
+    if stmt.column_type(CrsqlChangesColumn::SiteId as i32)? == ColumnType::Null {
+        Ok(local_site_id.to_vec())
+    } else {
+        Ok(stmt
+            .column_blob(CrsqlChangesColumn::SiteId as i32)?
+            .to_vec())
+    }
+}
+
+fn pack_int(buf: &mut Vec<u8>, val: i64) {
+    pack_column_value(buf, &ColumnValue::Integer(val));
+}
+
+fn zigzag(val: i64) -> i64 {
+    (val << 1) ^ (val >> 63)
+}
+
+fn unzigzag(val: i64) -> i64 {
+    ((val as u64 >> 1) as i64) ^ -(val & 1)
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn crsql_changeset_import(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    changeset: *const u8,
+    changeset_len: c_int,
+    applied: *mut sqlite::int64,
+    errmsg: *mut *mut c_char,
+) -> c_int {
+    let changeset = if changeset.is_null() || changeset_len <= 0 {
+        &[]
+    } else {
+        slice::from_raw_parts(changeset, changeset_len as usize)
+    };
+    let records = match decode_changeset(changeset) {
+        Ok(records) => records,
+        Err(rc) => {
+            if let Ok(err) = CString::new("crsql - malformed changeset") {
+                *errmsg = err.into_raw();
+            }
+            return rc as c_int;
+        }
+    };
+    match apply_records(db, ext_data, &records, false, None, &Arena::new(), errmsg) {
+        Ok(count) => {
+            *applied = count;
+            ResultCode::OK as c_int
+        }
+        Err(rc) => rc as c_int,
+    }
+}
+
+/// Expands a changeset back into `crsql_changes` rows.
+fn decode_changeset(changeset: &[u8]) -> Result<Vec<Vec<ColumnValue<'_>>>, ResultCode> {
+    let mut records = vec![];
+    if changeset.is_empty() {
+        return Ok(records);
+    }
+
+    let mut buf = changeset;
+    if unpack_int(&mut buf)? != CHANGESET_FORMAT_VERSION {
+        return Err(ResultCode::MISMATCH);
+    }
+    let tables = unpack_dictionary(&mut buf)?;
+    let columns = unpack_dictionary(&mut buf)?;
+    let sites = unpack_dictionary(&mut buf)?;
+    for table in tables.iter().chain(columns.iter()) {
+        if !matches!(table, ColumnValue::Text(_)) {
+            return Err(ResultCode::MISMATCH);
+        }
+    }
+    for site in sites.iter() {
+        if !matches!(site, ColumnValue::Blob(_) | ColumnValue::Null) {
+            return Err(ResultCode::MISMATCH);
+        }
+    }
+
+    let num_rows = unpack_int(&mut buf)?;
+    let mut db_version = 0i64;
+    for _ in 0..num_rows {
+        let tbl = lookup(&tables, unpack_int(&mut buf)?)?;
+        let pk = unpack_value(&mut buf)?;
+        if !matches!(pk, ColumnValue::Blob(_)) {
+            return Err(ResultCode::MISMATCH);
+        }
+        let num_cells = unpack_int(&mut buf)?;
+        for _ in 0..num_cells {
+            let cid = lookup(&columns, unpack_int(&mut buf)?)?;
+            let val = unpack_value(&mut buf)?;
+            let col_version = unpack_int(&mut buf)?;
+            db_version = db_version.wrapping_add(unzigzag(unpack_int(&mut buf)?));
+            let site = lookup(&sites, unpack_int(&mut buf)?)?;
+            let seq = unpack_int(&mut buf)?;
+            records.push(vec![
+                tbl,
+                pk,
+                cid,
+                val,
+                ColumnValue::Integer(col_version),
+                ColumnValue::Integer(db_version),
+                site,
+                ColumnValue::Integer(seq),
+            ]);
+        }
+    }
+
+    if !buf.is_empty() {
+        return Err(ResultCode::MISMATCH);
+    }
+    Ok(records)
+}
+
+fn unpack_int(buf: &mut &[u8]) -> Result<i64, ResultCode> {
+    match unpack_value(buf)? {
+        ColumnValue::Integer(i) => Ok(i),
+        _ => Err(ResultCode::MISMATCH),
+    }
+}
+
+fn unpack_dictionary<'a>(buf: &mut &'a [u8]) -> Result<Vec<ColumnValue<'a>>, ResultCode> {
+    let len = unpack_int(buf)?;
+    // every entry takes at least a byte
+    if len < 0 || len as usize > buf.len() {
+        return Err(ResultCode::MISMATCH);
+    }
+    let mut entries = Vec::with_capacity(len as usize);
+    for _ in 0..len {
+        entries.push(unpack_value(buf)?);
+    }
+    Ok(entries)
+}
+
+fn lookup<'a>(dictionary: &[ColumnValue<'a>], idx: i64) -> Result<ColumnValue<'a>, ResultCode> {
+    if idx < 0 {
+        return Err(ResultCode::MISMATCH);
+    }
+    dictionary
+        .get(idx as usize)
+        .copied()
+        .ok_or(ResultCode::MISMATCH)
+}
@@ -0,0 +1,164 @@
+extern crate alloc;
+
+use alloc::format;
+use core::ffi::{c_char, c_int, CStr};
+use sqlite::{Connection, Destructor, ResultCode};
+use sqlite_nostd as sqlite;
+use sqlite_nostd::sqlite3;
+
+use crate::c::{crsql_TableInfo, crsql_indexofNonPk};
+use crate::consts;
+
+/**
+ * Clock tables record which column a clock belongs to as a small integer
+ * rather than by name. `__crsql_colids` maps each crr's column names to those
+ * ids. Ids only mean something locally: `crsql_changes` reads and writes
+ * column names.
+ *
+ * Ids are never reused within a table so a clock row left behind by a
+ * dropped column can't be mistaken for a later column.
+ */
+pub fn create_col_ids_table_if_not_exists(db: *mut sqlite3) -> Result<ResultCode, ResultCode> {
+    db.exec_safe(&format!(
+        "CREATE TABLE IF NOT EXISTS \"{tbl}\" (
+          tbl_name TEXT NOT NULL,
+          col_name TEXT NOT NULL,
+          col_id INTEGER NOT NULL,
+          PRIMARY KEY (tbl_name, col_name)
+        ) STRICT",
+        tbl = consts::TBL_COL_IDS
+    ))
+}
+
+/// Id of `col_name` in `tbl_name`, assigning the next free one if it has none.
+pub fn assign_col_id(
+    db: *mut sqlite3,
+    tbl_name: &str,
+    col_name: &str,
+) -> Result<sqlite::int64, ResultCode> {
+    let stmt = db.prepare_v2(&format!(
+        "INSERT INTO \"{tbl}\" (tbl_name, col_name, col_id)
+          SELECT ?1, ?2, coalesce(max(col_id), 0) + 1 FROM \"{tbl}\" WHERE tbl_name = ?1
+          ON CONFLICT DO NOTHING",
+        tbl = consts::TBL_COL_IDS
+    ))?;
+    stmt.bind_text(1, tbl_name, Destructor::STATIC)?;
+    stmt.bind_text(2, col_name, Destructor::STATIC)?;
+    stmt.step()?;
+
+    let stmt = db.prepare_v2(&format!(
+        "SELECT col_id FROM \"{tbl}\" WHERE tbl_name = ? AND col_name = ?",
+        tbl = consts::TBL_COL_IDS
+    ))?;
+    stmt.bind_text(1, tbl_name, Destructor::STATIC)?;
+    stmt.bind_text(2, col_name, Destructor::STATIC)?;
+    match stmt.step()? {
+        ResultCode::ROW => stmt.column_int64(0),
+        _ => Err(ResultCode::ERROR),
+    }
+}
+
+unsafe fn set_col_id(table_info: *mut crsql_TableInfo, col_name: &str, col_id: c_int) {
+    let idx = crsql_indexofNonPk(
+        table_info,
+        col_name.as_ptr() as *const c_char,
+        col_name.len() as c_int,
+    );
+    if idx < 0 {
+        return;
+    }
+    let non_pks = sqlite::args_mut!((*table_info).nonPksLen, (*table_info).nonPks);
+    non_pks[idx as usize].colId = col_id;
+    // pks and nonPks are copies of the base columns
+    let base_cols = sqlite::args_mut!((*table_info).baseColsLen, (*table_info).baseCols);
+    for col in base_cols.iter_mut() {
+        if col.pk == 0 && CStr::from_ptr(col.name).to_bytes() == col_name.as_bytes() {
+            col.colId = col_id;
+        }
+    }
+}
+
+/**
+ * Fills in the `colId` of every non-pk column of `table_info` that has been
+ * given one. Run whenever a table info is pulled.
+ */
+#[no_mangle]
+pub unsafe extern "C" fn crsql_load_col_ids(
+    db: *mut sqlite3,
+    table_info: *mut crsql_TableInfo,
+) -> c_int {
+    match load_col_ids(db, table_info) {
+        Ok(rc) | Err(rc) => rc as c_int,
+    }
+}
+
+unsafe fn load_col_ids(
+    db: *mut sqlite3,
+    table_info: *mut crsql_TableInfo,
+) -> Result<ResultCode, ResultCode> {
+    if (*table_info).nonPksLen == 0 {
+        return Ok(ResultCode::OK);
+    }
+    let tbl_name = CStr::from_ptr((*table_info).tblName).to_str()?;
+    let stmt = db.prepare_v2(&format!(
+        "SELECT col_name, col_id FROM \"{tbl}\" WHERE tbl_name = ?",
+        tbl = consts::TBL_COL_IDS
+    ))?;
+    stmt.bind_text(1, tbl_name, Destructor::STATIC)?;
+    while stmt.step()? == ResultCode::ROW {
+        set_col_id(table_info, stmt.column_text(0)?, stmt.column_int(1)?);
+    }
+    Ok(ResultCode::OK)
+}
+
+/**
+ * Gives every non-pk column of `table_info` that doesn't have an id yet the
+ * next free one.
+ */
+#[no_mangle]
+pub unsafe extern "C" fn crsql_ensure_col_ids(
+    db: *mut sqlite3,
+    table_info: *mut crsql_TableInfo,
+) -> c_int {
+    match ensure_col_ids(db, table_info) {
+        Ok(rc) | Err(rc) => rc as c_int,
+    }
+}
+
+unsafe fn ensure_col_ids(
+    db: *mut sqlite3,
+    table_info: *mut crsql_TableInfo,
+) -> Result<ResultCode, ResultCode> {
+    let tbl_name = CStr::from_ptr((*table_info).tblName).to_str()?;
+    for i in 0..(*table_info).nonPksLen as usize {
+        let col = (*table_info).nonPks.add(i);
+        if (*col).colId == 0 {
+            let col_name = CStr::from_ptr((*col).name).to_str()?;
+            let col_id = assign_col_id(db, tbl_name, col_name)?;
+            set_col_id(table_info, col_name, col_id as c_int);
+        }
+    }
+    Ok(ResultCode::OK)
+}
+
+/// Id of the non-pk column at `idx`. Columns added without going through
+/// `crsql_commit_alter` get theirs here.
+pub(crate) unsafe fn non_pk_col_id(
+    db: *mut sqlite3,
+    table_info: *mut crsql_TableInfo,
+    idx: usize,
+) -> Result<sqlite::int64, ResultCode> {
+    if (*(*table_info).nonPks.add(idx)).colId == 0 {
+        ensure_col_ids(db, table_info)?;
+    }
+    Ok((*(*table_info).nonPks.add(idx)).colId as sqlite::int64)
+}
+
+pub fn remove_col_ids(db: *mut sqlite3, tbl_name: &str) -> Result<ResultCode, ResultCode> {
+    let stmt = db.prepare_v2(&format!(
+        "DELETE FROM \"{tbl}\" WHERE tbl_name = ?",
+        tbl = consts::TBL_COL_IDS
+    ))?;
+    stmt.bind_text(1, tbl_name, Destructor::STATIC)?;
+    stmt.step()
+}
@@ -1,7 +1,10 @@
+use core::cmp::Ordering;
 use core::ffi::c_int;
 use sqlite::Value;
 use sqlite_nostd as sqlite;
 
+use crate::ColumnValue;
+
 #[no_mangle]
 pub extern "C" fn crsql_compare_sqlite_values(
     l: *mut sqlite::value,
@@ -43,3 +46,86 @@ pub extern "C" fn crsql_compare_sqlite_values(
         sqlite::ColumnType::Text => l.text().cmp(r.text()) as c_int,
     }
 }
+
+/// Same ordering as `crsql_compare_sqlite_values` but for a value that was
+/// decoded from a packed changeset rather than handed to us by SQLite.
+pub fn compare_column_value(l: &ColumnValue, r: *mut sqlite::value) -> c_int {
+    let l_type = match l {
+        ColumnValue::Integer(_) => sqlite::ColumnType::Integer,
+        ColumnValue::Float(_) => sqlite::ColumnType::Float,
+        ColumnValue::Text(_) => sqlite::ColumnType::Text,
+        ColumnValue::Blob(_) => sqlite::ColumnType::Blob,
+        ColumnValue::Null => sqlite::ColumnType::Null,
+    };
+    let r_type = r.value_type();
+
+    if l_type != r_type {
+        return (r_type as i32) - (l_type as i32);
+    }
+
+    match l {
+        ColumnValue::Blob(b) => (*b).cmp(r.blob()) as c_int,
+        ColumnValue::Float(l_double) => {
+            let r_double = r.double();
+            if *l_double < r_double {
+                return -1;
+            } else if *l_double > r_double {
+                return 1;
+            }
+            return 0;
+        }
+        ColumnValue::Integer(l_int) => {
+            let r_int = r.int64();
+            if *l_int < r_int {
+                return -1;
+            } else if *l_int > r_int {
+                return 1;
+            }
+            return 0;
+        }
+        ColumnValue::Null => 0,
+        ColumnValue::Text(t) => (*t).cmp(r.text()) as c_int,
+    }
+}
+
+/// The order SQLite keeps keys in within an index or a table b-tree: NULLs,
+/// then numbers compared by value whatever their storage class, then text and
+/// blobs compared bytewise. Unlike the LWW tie breaker above, integers and
+/// floats interleave.
+pub fn key_order(l: &ColumnValue, r: &ColumnValue) -> Ordering {
+    fn class(v: &ColumnValue) -> u8 {
+        match v {
+            ColumnValue::Null => 0,
+            ColumnValue::Integer(_) | ColumnValue::Float(_) => 1,
+            ColumnValue::Text(_) => 2,
+            ColumnValue::Blob(_) => 3,
+        }
+    }
+
+    match (l, r) {
+        (ColumnValue::Integer(l), ColumnValue::Integer(r)) => l.cmp(r),
+        (ColumnValue::Integer(l), ColumnValue::Float(r)) => {
+            (*l as f64).partial_cmp(r).unwrap_or(Ordering::Equal)
+        }
+        (ColumnValue::Float(l), ColumnValue::Integer(r)) => {
+            l.partial_cmp(&(*r as f64)).unwrap_or(Ordering::Equal)
+        }
+        (ColumnValue::Float(l), ColumnValue::Float(r)) => {
+            l.partial_cmp(r).unwrap_or(Ordering::Equal)
+        }
+        (ColumnValue::Text(l), ColumnValue::Text(r)) => l.as_bytes().cmp(r.as_bytes()),
+        (ColumnValue::Blob(l), ColumnValue::Blob(r)) => l.cmp(r),
+        _ => class(l).cmp(&class(r)),
+    }
+}
+
+/// `key_order` over whole composite keys, column by column.
+pub fn key_order_all(l: &[ColumnValue], r: &[ColumnValue]) -> Ordering {
+    for (l, r) in l.iter().zip(r.iter()) {
+        match key_order(l, r) {
+            Ordering::Equal => continue,
+            ord => return ord,
+        }
+    }
+    l.len().cmp(&r.len())
+}
@@ -1,9 +1,30 @@
 pub const TBL_SITE_ID: &'static str = "__crsql_siteid";
 pub const TBL_SCHEMA: &'static str = "crsql_master";
+pub const TBL_DB_VERSION: &'static str = "__crsql_dbversion";
+// Stores the version of the clock rows the transaction writes, as
+// `crsql_raiseDbVersion` does, for the writes made in SQL.
+pub const RAISE_DB_VERSION: &'static str = "UPDATE \"__crsql_dbversion\"
+  SET db_version = crsql_nextdbversion() WHERE db_version < crsql_nextdbversion()";
+pub const TBL_COL_IDS: &'static str = "__crsql_colids";
+pub const TBL_SITE_ORDINALS: &'static str = "crsql_site_ordinals";
+pub const TBL_TRACKED_PEERS: &'static str = "crsql_tracked_peers";
+// `event` of the `crsql_tracked_peers` rows recording what was sent to a peer
+pub const TRACKED_PEER_SEND_EVENT: i64 = 1;
+// `event` of the `crsql_tracked_peers` rows an application records once it has
+// applied everything a peer sent up to a version. Opts into dropping changes
+// from that peer at or below it, see `Watermark`.
+pub const TRACKED_PEER_APPLIED_EVENT: i64 = 2;
 pub const CLOCK_TABLES_SELECT: &'static str =
     "SELECT tbl_name FROM sqlite_master WHERE type='table' AND tbl_name LIKE '%__crsql_clock'";
-pub const CRSQLITE_VERSION: i32 = 130000;
+pub const CRSQLITE_VERSION: i32 = 140000;
+// first `crsqlite_version` whose clock tables store column ids and site ordinals
+pub const CLOCK_COL_IDS_VERSION: i32 = 140000;
 pub const SITE_ID_LEN: i32 = 16;
 pub const ROWID_SLAB_SIZE: i64 = 10000000000000;
 pub const MIN_POSSIBLE_DB_VERSION: i64 = 0;
 pub const MAX_TBL_NAME_LEN: i32 = 2048;
+pub const STMT_CACHE_CAPACITY: usize = 512;
+// rows per chunk when a table is backfilled in one go
+pub const BACKFILL_CHUNK_ROWS: i64 = 10000;
+// SQLite's default SQLITE_MAX_FUNCTION_ARG
+pub const MAX_FUNCTION_ARGS: usize = 127;
@@ -1,6 +1,12 @@
 #![cfg_attr(not(test), no_std)]
+#![feature(allocator_api)]
+#![feature(btreemap_alloc)]
 #![feature(vec_into_raw_parts)]
 
+#[cfg(feature = "alloc_stats")]
+mod alloc_stats;
+mod apply_changes;
+mod arena;
 mod automigrate;
 mod backfill;
 mod bootstrap;
@@ -8,19 +14,27 @@ mod c;
 mod changes_vtab;
 mod changes_vtab_read;
 mod changes_vtab_write;
+mod changeset;
+mod col_ids;
 mod compare_values;
 mod consts;
 mod is_crr;
+mod local_writes;
 mod pack_columns;
+mod site_ordinals;
 mod stmt_cache;
 mod teardown;
+mod tombstones;
 mod triggers;
 mod unpack_columns_vtab;
 mod util;
+mod version_vector;
 
 use core::{ffi::c_char, slice};
 extern crate alloc;
 use alloc::vec::Vec;
+#[cfg(feature = "alloc_stats")]
+pub use alloc_stats::CountingAllocator;
 pub use automigrate::*;
 pub use backfill::*;
 use core::ffi::{c_int, CStr};
@@ -121,6 +135,106 @@ pub extern "C" fn sqlite3_crsqlcore_init(
         return rc as c_int;
     }
 
+    let rc = db
+        .create_function_v2(
+            "crsql_site_ordinal",
+            1,
+            // reads crsql_site_ordinals, which merges add to
+            sqlite::UTF8 | sqlite::INNOCUOUS,
+            None,
+            Some(site_ordinals::crsql_site_ordinal),
+            None,
+            None,
+            None,
+        )
+        .unwrap_or(sqlite::ResultCode::ERROR);
+    if rc != ResultCode::OK {
+        return rc as c_int;
+    }
+
+    let rc = db
+        .create_function_v2(
+            "crsql_backfill_progress",
+            1,
+            sqlite::UTF8,
+            None,
+            Some(crsql_backfill_progress_fn),
+            None,
+            None,
+            None,
+        )
+        .unwrap_or(sqlite::ResultCode::ERROR);
+    if rc != ResultCode::OK {
+        return rc as c_int;
+    }
+
+    let rc = db
+        .create_function_v2(
+            "crsql_vv",
+            -1,
+            sqlite::UTF8 | sqlite::DETERMINISTIC | sqlite::INNOCUOUS,
+            None,
+            Some(version_vector::crsql_vv),
+            None,
+            None,
+            None,
+        )
+        .unwrap_or(sqlite::ResultCode::ERROR);
+    if rc != ResultCode::OK {
+        return rc as c_int;
+    }
+
+    let rc = db
+        .create_function_v2(
+            "crsql_prepare_changes",
+            1,
+            sqlite::UTF8 | sqlite::DETERMINISTIC | sqlite::INNOCUOUS,
+            None,
+            Some(apply_changes::crsql_prepare_changes),
+            None,
+            None,
+            None,
+        )
+        .unwrap_or(sqlite::ResultCode::ERROR);
+    if rc != ResultCode::OK {
+        return rc as c_int;
+    }
+
+    #[cfg(feature = "alloc_stats")]
+    {
+        let rc = db
+            .create_function_v2(
+                "crsql_allocations",
+                0,
+                sqlite::UTF8 | sqlite::INNOCUOUS,
+                None,
+                Some(alloc_stats::crsql_allocations),
+                None,
+                None,
+                None,
+            )
+            .unwrap_or(sqlite::ResultCode::ERROR);
+        if rc != ResultCode::OK {
+            return rc as c_int;
+        }
+
+        let rc = db
+            .create_function_v2(
+                "crsql_allocated_bytes",
+                0,
+                sqlite::UTF8 | sqlite::INNOCUOUS,
+                None,
+                Some(alloc_stats::crsql_allocated_bytes),
+                None,
+                None,
+                None,
+            )
+            .unwrap_or(sqlite::ResultCode::ERROR);
+        if rc != ResultCode::OK {
+            return rc as c_int;
+        }
+    }
+
     let rc = unpack_columns_vtab::create_module(db).unwrap_or(sqlite::ResultCode::ERROR);
     return rc as c_int;
 }
@@ -132,6 +246,7 @@ pub extern "C" fn crsql_backfill_table(
     pk_cols: *const *const c_char,
     pk_cols_len: c_int,
     non_pk_cols: *const *const c_char,
+    non_pk_col_ids: *const c_int,
     non_pk_cols_len: c_int,
     is_commit_alter: c_int,
 ) -> c_int {
@@ -150,11 +265,19 @@ pub extern "C" fn crsql_backfill_table(
             .map(|&p| CStr::from_ptr(p).to_str())
             .collect::<Result<Vec<_>, _>>()
     };
+    let non_pk_col_ids = sqlite::args!(non_pk_cols_len, non_pk_col_ids);
 
     let result = match (table, pk_cols, non_pk_cols) {
         (Ok(table), Ok(pk_cols), Ok(non_pk_cols)) => {
             let db = context.db_handle();
-            backfill_table(db, table, pk_cols, non_pk_cols, is_commit_alter != 0)
+            backfill_table(
+                db,
+                table,
+                pk_cols,
+                non_pk_cols,
+                non_pk_col_ids,
+                is_commit_alter != 0,
+            )
         }
         _ => Err(ResultCode::ERROR),
     };
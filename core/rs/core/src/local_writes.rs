@@ -0,0 +1,211 @@
+extern crate alloc;
+
+use alloc::ffi::CString;
+use alloc::format;
+use alloc::vec::Vec;
+use core::ffi::{c_char, c_int, CStr};
+use sqlite::Stmt;
+use sqlite_nostd as sqlite;
+use sqlite_nostd::{sqlite3, ResultCode, Value};
+
+use crate::c::{
+    crsql_ExtData, crsql_TableInfo, crsql_ensureTableInfosAreUpToDate, crsql_getDbVersion,
+    crsql_raiseDbVersion,
+};
+use crate::changes_vtab_write::{get_cached_stmt_rt_wt, table_info_index};
+use crate::col_ids::non_pk_col_id;
+use crate::pack_columns::OwnedColumnValue;
+use crate::stmt_cache::{get_cache_key, reset_cached_stmt, CachedStmtType};
+use crate::tombstones::note_tombstone;
+
+/**
+ * Records a local update to a row of a crr.
+ *
+ * Called once per updated row by the `__crsql_utrig` trigger as
+ * `crsql_after_update(table, NEW.pk..., NEW.col, OLD.col, ...)` with the
+ * non-pk columns in table info order.
+ *
+ * Columns are diffed here rather than with a guarded statement per column in
+ * the trigger so an update only pays for the columns it actually changed.
+ */
+#[no_mangle]
+pub unsafe extern "C" fn crsql_after_update(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    argc: c_int,
+    argv: *mut *mut sqlite::value,
+    errmsg: *mut *mut c_char,
+) -> c_int {
+    let args = sqlite::args!(argc, argv);
+    match after_update(db, ext_data, args, errmsg) {
+        Ok(rc) | Err(rc) => rc as c_int,
+    }
+}
+
+/**
+ * Records a local delete of a row of a crr.
+ *
+ * Called once per deleted row by the `__crsql_dtrig` trigger as
+ * `crsql_after_delete(table, OLD.pk...)`. The trigger itself writes the delete
+ * sentinel. This only tells the connection's tombstone filter about the row.
+ */
+#[no_mangle]
+pub unsafe extern "C" fn crsql_after_delete(
+    ext_data: *mut crsql_ExtData,
+    argc: c_int,
+    argv: *mut *mut sqlite::value,
+) -> c_int {
+    let args = sqlite::args!(argc, argv);
+    if args.is_empty() {
+        return ResultCode::MISUSE as c_int;
+    }
+    let pks = args[1..]
+        .iter()
+        .map(|pk| OwnedColumnValue::from_value(*pk))
+        .collect::<Vec<_>>();
+    note_tombstone(
+        ext_data,
+        args[0].text(),
+        pks.iter().map(|pk| pk.as_column_value()),
+    );
+    ResultCode::OK as c_int
+}
+
+unsafe fn after_update(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    args: &[*mut sqlite::value],
+    errmsg: *mut *mut c_char,
+) -> Result<ResultCode, ResultCode> {
+    if args.is_empty() {
+        return Err(ResultCode::MISUSE);
+    }
+    if crsql_ensureTableInfosAreUpToDate(db, ext_data, errmsg) != ResultCode::OK as c_int {
+        return Err(ResultCode::ERROR);
+    }
+
+    let tbl_name = args[0].text();
+    let tbl_info_idx = table_info_index(ext_data, tbl_name);
+    if tbl_info_idx < 0 {
+        let err = CString::new(format!(
+            "crsql - could not find the schema information for table {}",
+            tbl_name
+        ))?;
+        *errmsg = err.into_raw();
+        return Err(ResultCode::ERROR);
+    }
+    let tbl_infos = sqlite::args!((*ext_data).tableInfosLen, (*ext_data).zpTableInfos);
+    let tbl_info = tbl_infos[tbl_info_idx as usize];
+    let non_pk_cols = sqlite::args!((*tbl_info).nonPksLen, (*tbl_info).nonPks);
+    let num_pks = (*tbl_info).pksLen as usize;
+    if args.len() != 1 + num_pks + 2 * non_pk_cols.len() {
+        let err = CString::new(format!(
+            "crsql - the update trigger for table {} is out of date with its schema",
+            tbl_name
+        ))?;
+        *errmsg = err.into_raw();
+        return Err(ResultCode::MISUSE);
+    }
+    let pks = &args[1..1 + num_pks];
+    let cols = &args[1 + num_pks..];
+
+    if non_pk_cols.is_empty() {
+        return bump_clock(
+            db,
+            ext_data,
+            tbl_info,
+            tbl_info_idx,
+            pks,
+            crate::c::INSERT_SENTINEL_ID,
+            errmsg,
+        );
+    }
+    for i in 0..non_pk_cols.len() {
+        if values_differ(cols[2 * i], cols[2 * i + 1]) {
+            let col_id = non_pk_col_id(db, tbl_info, i)?;
+            bump_clock(db, ext_data, tbl_info, tbl_info_idx, pks, col_id, errmsg)?;
+        }
+    }
+
+    Ok(ResultCode::OK)
+}
+
+/// `NEW.col IS NOT OLD.col`, less collations.
+fn values_differ(new: *mut sqlite::value, old: *mut sqlite::value) -> bool {
+    let new_type = new.value_type();
+    let old_type = old.value_type();
+    match (new_type, old_type) {
+        (sqlite::ColumnType::Integer, sqlite::ColumnType::Float)
+        | (sqlite::ColumnType::Float, sqlite::ColumnType::Integer) => new.double() != old.double(),
+        _ => crate::compare_values::crsql_compare_sqlite_values(new, old) != 0,
+    }
+}
+
+/// Creates or increments the clock of a column the same way the per column
+/// trigger statements did, with the db version and seq bound rather than
+/// fetched through UDFs.
+unsafe fn bump_clock(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    tbl_info: *mut crsql_TableInfo,
+    tbl_info_idx: c_int,
+    pks: &[*mut sqlite::value],
+    col_id: sqlite::int64,
+    errmsg: *mut *mut c_char,
+) -> Result<ResultCode, ResultCode> {
+    let stmt_key = get_cache_key(CachedStmtType::LocalUpdateClock, tbl_info_idx, None)?;
+    let stmt = get_cached_stmt_rt_wt(db, ext_data, stmt_key, || {
+        let tbl_name = CStr::from_ptr((*tbl_info).tblName).to_str().unwrap_or("");
+        let pk_cols = sqlite::args!((*tbl_info).pksLen, (*tbl_info).pks);
+        let pk_list = crate::util::as_identifier_list(pk_cols, None).unwrap_or_default();
+        format!(
+            "INSERT INTO \"{table_name}__crsql_clock\" (
+              {pk_list},
+              __crsql_col_id,
+              __crsql_col_version,
+              __crsql_db_version,
+              __crsql_seq,
+              __crsql_site_ordinal
+            ) VALUES ({pk_bind_list}, ?, 1, ?, ?, NULL)
+            ON CONFLICT DO UPDATE SET
+              __crsql_col_version = __crsql_col_version + 1,
+              __crsql_db_version = excluded.__crsql_db_version,
+              __crsql_seq = excluded.__crsql_seq,
+              __crsql_site_ordinal = NULL",
+            table_name = crate::util::escape_ident(tbl_name),
+            pk_list = pk_list,
+            pk_bind_list = crate::util::binding_list(pk_cols.len()),
+        )
+    })?;
+
+    if crsql_getDbVersion(db, ext_data, errmsg) != ResultCode::OK as c_int {
+        return Err(ResultCode::ERROR);
+    }
+    let db_version = (*ext_data).dbVersion + 1;
+    let seq = (*ext_data).seq;
+    (*ext_data).seq += 1;
+
+    let mut bind_result = Ok(ResultCode::OK);
+    for (i, pk) in pks.iter().enumerate() {
+        bind_result = bind_result.and_then(|_| stmt.bind_value(i as i32 + 1, *pk));
+    }
+    let bind_result = bind_result
+        .and_then(|_| stmt.bind_int64(pks.len() as i32 + 1, col_id))
+        .and_then(|_| stmt.bind_int64(pks.len() as i32 + 2, db_version))
+        .and_then(|_| stmt.bind_int(pks.len() as i32 + 3, seq));
+    if let Err(rc) = bind_result {
+        reset_cached_stmt(stmt)?;
+        return Err(rc);
+    }
+
+    let step_result = stmt.step();
+    reset_cached_stmt(stmt)?;
+    match step_result {
+        Ok(ResultCode::DONE) => {}
+        Ok(rc) | Err(rc) => return Err(rc),
+    }
+    if crsql_raiseDbVersion(db, ext_data, db_version) != ResultCode::OK as c_int {
+        return Err(ResultCode::ERROR);
+    }
+    Ok(ResultCode::OK)
+}
@@ -1,15 +1,21 @@
 extern crate alloc;
 
+use alloc::alloc::Global;
 use alloc::string::String;
-use alloc::vec;
 use alloc::vec::Vec;
 use bytes::{Buf, BufMut};
+use core::alloc::Allocator;
 use core::slice;
 #[cfg(not(feature = "std"))]
 use num_traits::FromPrimitive;
 use sqlite_nostd as sqlite;
 use sqlite_nostd::{ColumnType, Context, ResultCode, Stmt, Value};
 
+// Most packs are of a handful of primary key values, `crsql_changes` makes one
+// per change it reads. Those are packed on the stack for SQLite to copy out
+// rather than allocated.
+const STACK_PACK_LEN: usize = 128;
+
 pub extern "C" fn crsql_pack_columns(
     ctx: *mut sqlite::context,
     argc: i32,
@@ -17,20 +23,31 @@ pub extern "C" fn crsql_pack_columns(
 ) {
     let args = sqlite::args!(argc, argv);
 
-    match pack_columns(args) {
+    let len = 1 + args.iter().map(|v| packed_value_len(*v)).sum::<usize>();
+    if len <= STACK_PACK_LEN {
+        let mut stack = [0u8; STACK_PACK_LEN];
+        let mut buf = &mut stack[..];
+        match pack_columns(&mut buf, args) {
+            Err(code) => {
+                ctx.result_error("Failed to pack columns");
+                ctx.result_error_code(code);
+            }
+            Ok(_) => ctx.result_blob_shared(&stack[..len]),
+        }
+        return;
+    }
+
+    let mut buf = Vec::with_capacity(len);
+    match pack_columns(&mut buf, args) {
         Err(code) => {
             ctx.result_error("Failed to pack columns");
             ctx.result_error_code(code);
         }
-        Ok(blob) => {
-            // TODO: pass a destructor so we don't have to copy the blob
-            ctx.result_blob_owned(blob);
-        }
+        Ok(_) => ctx.result_blob_owned(buf),
     }
 }
 
-fn pack_columns(args: &[*mut sqlite::value]) -> Result<Vec<u8>, ResultCode> {
-    let mut buf = vec![];
+fn pack_columns<B: BufMut>(buf: &mut B, args: &[*mut sqlite::value]) -> Result<(), ResultCode> {
     /*
      * Format:
      * [num_columns:u8,...[(type(0-3),num_bytes?(3-7)):u8, length?:i32, ...bytes:u8[]]]
@@ -47,45 +64,72 @@ fn pack_columns(args: &[*mut sqlite::value]) -> Result<Vec<u8>, ResultCode> {
     if let Ok(len) = len_result {
         buf.put_u8(len);
         for value in args {
-            match value.value_type() {
-                ColumnType::Blob => {
-                    let len = value.bytes();
-                    let num_bytes_for_len = num_bytes_needed_i32(len);
-                    let type_byte = num_bytes_for_len << 3 | (ColumnType::Blob as u8);
-                    buf.put_u8(type_byte);
-                    buf.put_int(len as i64, num_bytes_for_len as usize);
-                    buf.put_slice(value.blob());
-                }
-                ColumnType::Null => {
-                    buf.put_u8(ColumnType::Null as u8);
-                }
-                ColumnType::Float => {
-                    buf.put_u8(ColumnType::Float as u8);
-                    buf.put_f64(value.double());
-                }
-                ColumnType::Integer => {
-                    let val = value.int64();
-                    let num_bytes_for_int = num_bytes_needed_i64(val);
-                    let type_byte = num_bytes_for_int << 3 | (ColumnType::Integer as u8);
-                    buf.put_u8(type_byte);
-                    buf.put_int(val, num_bytes_for_int as usize);
-                }
-                ColumnType::Text => {
-                    let len = value.bytes();
-                    let num_bytes_for_len = num_bytes_needed_i32(len);
-                    let type_byte = num_bytes_for_len << 3 | (ColumnType::Text as u8);
-                    buf.put_u8(type_byte);
-                    buf.put_int(len as i64, num_bytes_for_len as usize);
-                    buf.put_slice(value.blob());
-                }
-            }
+            pack_value(buf, *value);
         }
-        Ok(buf)
+        Ok(())
     } else {
         Err(ResultCode::ABORT)
     }
 }
 
+/// The number of bytes `pack_value` appends for `value`.
+fn packed_value_len(value: *mut sqlite::value) -> usize {
+    match value.value_type() {
+        ColumnType::Blob | ColumnType::Text => {
+            // measured the way `pack_value` reads it
+            let len = value.blob().len();
+            1 + num_bytes_needed_i32(len as i32) as usize + len
+        }
+        ColumnType::Null => 1,
+        ColumnType::Float => 9,
+        ColumnType::Integer => 1 + num_bytes_needed_i64(value.int64()) as usize,
+    }
+}
+
+/// Appends a single value in the format used by each column of `crsql_pack_columns`.
+pub fn pack_value<B: BufMut>(buf: &mut B, value: *mut sqlite::value) {
+    match value.value_type() {
+        ColumnType::Blob => put_bytes(buf, ColumnType::Blob, value.blob()),
+        ColumnType::Null => buf.put_u8(ColumnType::Null as u8),
+        ColumnType::Float => {
+            buf.put_u8(ColumnType::Float as u8);
+            buf.put_f64(value.double());
+        }
+        ColumnType::Integer => put_integer(buf, value.int64()),
+        ColumnType::Text => put_bytes(buf, ColumnType::Text, value.blob()),
+    }
+}
+
+/// `pack_value` for a value that has already been copied out of SQLite.
+pub fn pack_column_value<B: BufMut>(buf: &mut B, value: &ColumnValue) {
+    match value {
+        ColumnValue::Blob(b) => put_bytes(buf, ColumnType::Blob, b),
+        ColumnValue::Null => buf.put_u8(ColumnType::Null as u8),
+        ColumnValue::Float(f) => {
+            buf.put_u8(ColumnType::Float as u8);
+            buf.put_f64(*f);
+        }
+        ColumnValue::Integer(i) => put_integer(buf, *i),
+        ColumnValue::Text(t) => put_bytes(buf, ColumnType::Text, t.as_bytes()),
+    }
+}
+
+fn put_integer<B: BufMut>(buf: &mut B, val: i64) {
+    let num_bytes_for_int = num_bytes_needed_i64(val);
+    let type_byte = num_bytes_for_int << 3 | (ColumnType::Integer as u8);
+    buf.put_u8(type_byte);
+    buf.put_int(val, num_bytes_for_int as usize);
+}
+
+fn put_bytes<B: BufMut>(buf: &mut B, column_type: ColumnType, bytes: &[u8]) {
+    let len = bytes.len() as i32;
+    let num_bytes_for_len = num_bytes_needed_i32(len);
+    let type_byte = num_bytes_for_len << 3 | (column_type as u8);
+    buf.put_u8(type_byte);
+    buf.put_int(len as i64, num_bytes_for_len as usize);
+    buf.put_slice(bytes);
+}
+
 fn num_bytes_needed_i32(val: i32) -> u8 {
     if val & 0xFF000000u32 as i32 != 0 {
         return 4;
@@ -114,7 +158,20 @@ fn num_bytes_needed_i64(val: i64) -> u8 {
     }
 }
 
-pub enum ColumnValue {
+/// A value unpacked from a `crsql_pack_columns` blob.
+/// Text and blobs borrow from the blob they were unpacked from.
+#[derive(Clone, Copy)]
+pub enum ColumnValue<'a> {
+    Blob(&'a [u8]),
+    Float(f64),
+    Integer(i64),
+    Null,
+    Text(&'a str),
+}
+
+/// A `ColumnValue` that owns its bytes.
+#[derive(Clone)]
+pub enum OwnedColumnValue {
     Blob(Vec<u8>),
     Float(f64),
     Integer(i64),
@@ -122,70 +179,133 @@ pub enum ColumnValue {
     Text(String),
 }
 
+impl OwnedColumnValue {
+    /// Copies a value handed to us by SQLite so it can outlive the statement or
+    /// call that produced it.
+    pub fn from_value(value: *mut sqlite::value) -> OwnedColumnValue {
+        match value.value_type() {
+            ColumnType::Blob => OwnedColumnValue::Blob(value.blob().to_vec()),
+            ColumnType::Float => OwnedColumnValue::Float(value.double()),
+            ColumnType::Integer => OwnedColumnValue::Integer(value.int64()),
+            ColumnType::Null => OwnedColumnValue::Null,
+            ColumnType::Text => OwnedColumnValue::Text(String::from(value.text())),
+        }
+    }
+
+    /// `from_value` into an existing value, reusing its buffer if it holds the same type.
+    pub fn set_from_value(&mut self, value: *mut sqlite::value) {
+        match (&mut *self, value.value_type()) {
+            (OwnedColumnValue::Blob(b), ColumnType::Blob) => {
+                b.clear();
+                b.extend_from_slice(value.blob());
+            }
+            (OwnedColumnValue::Text(t), ColumnType::Text) => {
+                t.clear();
+                t.push_str(value.text());
+            }
+            _ => *self = OwnedColumnValue::from_value(value),
+        }
+    }
+
+    pub fn as_column_value(&self) -> ColumnValue<'_> {
+        match self {
+            OwnedColumnValue::Blob(b) => ColumnValue::Blob(b),
+            OwnedColumnValue::Float(f) => ColumnValue::Float(*f),
+            OwnedColumnValue::Integer(i) => ColumnValue::Integer(*i),
+            OwnedColumnValue::Null => ColumnValue::Null,
+            OwnedColumnValue::Text(t) => ColumnValue::Text(t),
+        }
+    }
+}
+
 // TODO: make a table valued function that can be used to extract a row per packed column?
-pub fn unpack_columns(data: &[u8]) -> Result<Vec<ColumnValue>, ResultCode> {
-    let mut ret = vec![];
+pub fn unpack_columns(data: &[u8]) -> Result<Vec<ColumnValue<'_>>, ResultCode> {
+    unpack_columns_in(data, Global)
+}
+
+/// `unpack_columns` into a vector allocated from `alloc`.
+pub fn unpack_columns_in<A: Allocator>(
+    data: &[u8],
+    alloc: A,
+) -> Result<Vec<ColumnValue<'_>, A>, ResultCode> {
     let mut buf = data;
+    unpack_columns_from_in(&mut buf, alloc)
+}
+
+/// Unpacks a single packed record from the front of `buf` and advances `buf`
+/// past it. Used to walk a stream of concatenated `crsql_pack_columns` records.
+pub fn unpack_columns_from<'a>(buf: &mut &'a [u8]) -> Result<Vec<ColumnValue<'a>>, ResultCode> {
+    unpack_columns_from_in(buf, Global)
+}
+
+/// `unpack_columns_from` into a vector allocated from `alloc`.
+pub fn unpack_columns_from_in<'a, A: Allocator>(
+    buf: &mut &'a [u8],
+    alloc: A,
+) -> Result<Vec<ColumnValue<'a>, A>, ResultCode> {
+    if !buf.has_remaining() {
+        return Err(ResultCode::ABORT);
+    }
     let num_columns = buf.get_u8();
+    let mut ret = Vec::with_capacity_in(num_columns as usize, alloc);
 
     for _i in 0..num_columns {
-        if !buf.has_remaining() {
-            return Err(ResultCode::ABORT);
-        }
-        let column_type_and_maybe_intlen = buf.get_u8();
-        let column_type = ColumnType::from_u8(column_type_and_maybe_intlen & 0x07);
-        let intlen = (column_type_and_maybe_intlen >> 3 & 0xFF) as usize;
-
-        match column_type {
-            Some(ColumnType::Blob) => {
-                if buf.remaining() < intlen {
-                    return Err(ResultCode::ABORT);
-                }
-                let len = buf.get_int(intlen) as usize;
-                if buf.remaining() < len {
-                    return Err(ResultCode::ABORT);
-                }
-                let bytes = buf.copy_to_bytes(len);
-                ret.push(ColumnValue::Blob(bytes.to_vec()));
-            }
-            Some(ColumnType::Float) => {
-                if buf.remaining() < 8 {
-                    return Err(ResultCode::ABORT);
-                }
-                ret.push(ColumnValue::Float(buf.get_f64()));
-            }
-            Some(ColumnType::Integer) => {
-                if buf.remaining() < intlen {
-                    return Err(ResultCode::ABORT);
-                }
-                ret.push(ColumnValue::Integer(buf.get_int(intlen)));
-            }
-            Some(ColumnType::Null) => {
-                ret.push(ColumnValue::Null);
+        ret.push(unpack_value(buf)?);
+    }
+
+    Ok(ret)
+}
+
+/// Unpacks a single value written by `pack_value` from the front of `buf`.
+pub fn unpack_value<'a>(buf: &mut &'a [u8]) -> Result<ColumnValue<'a>, ResultCode> {
+    if !buf.has_remaining() {
+        return Err(ResultCode::ABORT);
+    }
+    let column_type_and_maybe_intlen = buf.get_u8();
+    let column_type = ColumnType::from_u8(column_type_and_maybe_intlen & 0x07);
+    let intlen = (column_type_and_maybe_intlen >> 3 & 0xFF) as usize;
+
+    match column_type {
+        Some(ColumnType::Blob) => Ok(ColumnValue::Blob(take_bytes(buf, intlen)?)),
+        Some(ColumnType::Float) => {
+            if buf.remaining() < 8 {
+                return Err(ResultCode::ABORT);
             }
-            Some(ColumnType::Text) => {
-                if buf.remaining() < intlen {
-                    return Err(ResultCode::ABORT);
-                }
-                let len = buf.get_int(intlen) as usize;
-                if buf.remaining() < len {
-                    return Err(ResultCode::ABORT);
-                }
-                let bytes = buf.copy_to_bytes(len);
-                ret.push(ColumnValue::Text(unsafe {
-                    String::from_utf8_unchecked(bytes.to_vec())
-                }))
+            Ok(ColumnValue::Float(buf.get_f64()))
+        }
+        Some(ColumnType::Integer) => {
+            if buf.remaining() < intlen {
+                return Err(ResultCode::ABORT);
             }
-            None => return Err(ResultCode::MISUSE),
+            Ok(ColumnValue::Integer(buf.get_int(intlen)))
         }
+        Some(ColumnType::Null) => Ok(ColumnValue::Null),
+        Some(ColumnType::Text) => {
+            let bytes = take_bytes(buf, intlen)?;
+            Ok(ColumnValue::Text(unsafe {
+                core::str::from_utf8_unchecked(bytes)
+            }))
+        }
+        None => Err(ResultCode::MISUSE),
     }
+}
 
-    Ok(ret)
+fn take_bytes<'a>(buf: &mut &'a [u8], intlen: usize) -> Result<&'a [u8], ResultCode> {
+    if buf.remaining() < intlen {
+        return Err(ResultCode::ABORT);
+    }
+    let len = buf.get_int(intlen) as usize;
+    if buf.remaining() < len {
+        return Err(ResultCode::ABORT);
+    }
+    let (bytes, rest) = buf.split_at(len);
+    *buf = rest;
+    Ok(bytes)
 }
 
 pub fn bind_package_to_stmt(
     stmt: *mut sqlite::stmt,
-    values: &Vec<crate::ColumnValue>,
+    values: &[ColumnValue],
 ) -> Result<ResultCode, ResultCode> {
     for (i, val) in values.iter().enumerate() {
         bind_slot(i + 1, val, stmt)?;
@@ -193,7 +313,23 @@ pub fn bind_package_to_stmt(
     Ok(ResultCode::OK)
 }
 
-fn bind_slot(
+/// Binds the values of a packed record without unpacking them into a vector.
+pub fn bind_packed_to_stmt(
+    stmt: *mut sqlite::stmt,
+    packed: &[u8],
+) -> Result<ResultCode, ResultCode> {
+    let mut buf = packed;
+    if !buf.has_remaining() {
+        return Err(ResultCode::ABORT);
+    }
+    let num_columns = buf.get_u8();
+    for i in 0..num_columns as usize {
+        bind_slot(i + 1, &unpack_value(&mut buf)?, stmt)?;
+    }
+    Ok(ResultCode::OK)
+}
+
+pub fn bind_slot(
     slot_num: usize,
     val: &ColumnValue,
     stmt: *mut sqlite::stmt,
@@ -0,0 +1,130 @@
+extern crate alloc;
+
+use alloc::format;
+use core::ffi::c_int;
+use sqlite::{ColumnType, Connection, Context, Destructor, ResultCode, Stmt, Value};
+use sqlite_nostd as sqlite;
+use sqlite_nostd::sqlite3;
+
+use crate::c::crsql_ExtData;
+use crate::changes_vtab_write::get_cached_stmt_rt_wt;
+use crate::consts;
+use crate::stmt_cache::{get_cache_key, reset_cached_stmt, CachedStmtType};
+
+/**
+ * Clock tables record the site a change came from as a small integer rather
+ * than the site's 16 byte id. `crsql_site_ordinals` maps site ids to those
+ * ordinals. Like column ids, ordinals only mean something locally:
+ * `crsql_changes` reads and writes site ids.
+ *
+ * Changes made by the local site are recorded with a NULL ordinal.
+ */
+pub fn create_site_ordinals_table_if_not_exists(
+    db: *mut sqlite3,
+) -> Result<ResultCode, ResultCode> {
+    db.exec_safe(&format!(
+        "CREATE TABLE IF NOT EXISTS \"{tbl}\" (
+          ordinal INTEGER PRIMARY KEY,
+          site_id BLOB NOT NULL UNIQUE
+        ) STRICT",
+        tbl = consts::TBL_SITE_ORDINALS
+    ))
+}
+
+/// Ordinal of `site_id`, assigning the next free one if it has none.
+/// An empty site id is the local site.
+pub(crate) fn intern_site_id(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    tbl_info_idx: c_int,
+    site_id: &[u8],
+) -> Result<Option<sqlite::int64>, ResultCode> {
+    if site_id.is_empty() {
+        return Ok(None);
+    }
+
+    let stmt_key = get_cache_key(CachedStmtType::SiteOrdinal, tbl_info_idx, None)?;
+    let select_stmt = get_cached_stmt_rt_wt(db, ext_data, stmt_key, || {
+        format!(
+            "SELECT ordinal FROM \"{tbl}\" WHERE site_id = ?",
+            tbl = consts::TBL_SITE_ORDINALS
+        )
+    })?;
+    if let Some(ordinal) = step_for_ordinal(select_stmt, site_id)? {
+        return Ok(Some(ordinal));
+    }
+
+    let stmt_key = get_cache_key(CachedStmtType::InternSiteId, tbl_info_idx, None)?;
+    let insert_stmt = get_cached_stmt_rt_wt(db, ext_data, stmt_key, || {
+        format!(
+            "INSERT INTO \"{tbl}\" (site_id) VALUES (?) RETURNING ordinal",
+            tbl = consts::TBL_SITE_ORDINALS
+        )
+    })?;
+    match step_for_ordinal(insert_stmt, site_id)? {
+        Some(ordinal) => Ok(Some(ordinal)),
+        None => Err(ResultCode::ERROR),
+    }
+}
+
+fn step_for_ordinal(
+    stmt: *mut sqlite::stmt,
+    site_id: &[u8],
+) -> Result<Option<sqlite::int64>, ResultCode> {
+    if let Err(rc) = stmt.bind_blob(1, site_id, Destructor::STATIC) {
+        reset_cached_stmt(stmt)?;
+        return Err(rc);
+    }
+    let ret = match stmt.step() {
+        Ok(ResultCode::ROW) => Ok(Some(stmt.column_int64(0))),
+        Ok(ResultCode::DONE) => Ok(None),
+        Ok(rc) | Err(rc) => Err(rc),
+    };
+    // the insert is only complete once it has been stepped to the end
+    reset_cached_stmt(stmt)?;
+    ret
+}
+
+/**
+ * `crsql_site_ordinal(site_id)` - the ordinal a site id is recorded under.
+ *
+ * Sites that have no ordinal get `-1`, which no clock row holds, and a NULL
+ * site id stays NULL. Ordinals are assigned as changes are merged, so the
+ * function is not deterministic.
+ */
+pub extern "C" fn crsql_site_ordinal(
+    ctx: *mut sqlite::context,
+    argc: i32,
+    argv: *mut *mut sqlite::value,
+) {
+    let args = sqlite::args!(argc, argv);
+    if args.len() != 1 {
+        ctx.result_error("crsql_site_ordinal takes a single site id");
+        return;
+    }
+    match args[0].value_type() {
+        ColumnType::Null => ctx.result_null(),
+        // site ids are blobs, nothing else ever compares equal to one
+        ColumnType::Blob => match site_ordinal(ctx.db_handle(), args[0].blob()) {
+            Ok(ordinal) => ctx.result_int64(ordinal.unwrap_or(-1)),
+            Err(rc) => ctx.result_error_code(rc),
+        },
+        _ => ctx.result_int64(-1),
+    }
+}
+
+/// Ordinal of `site_id`, if it has one. Used where a site id is resolved once rather than per row.
+pub(crate) fn site_ordinal(
+    db: *mut sqlite3,
+    site_id: &[u8],
+) -> Result<Option<sqlite::int64>, ResultCode> {
+    let stmt = db.prepare_v2(&format!(
+        "SELECT ordinal FROM \"{tbl}\" WHERE site_id = ?",
+        tbl = consts::TBL_SITE_ORDINALS
+    ))?;
+    stmt.bind_blob(1, site_id, Destructor::STATIC)?;
+    match stmt.step()? {
+        ResultCode::ROW => Ok(Some(stmt.column_int64(0)?)),
+        _ => Ok(None),
+    }
+}
@@ -1,38 +1,251 @@
 extern crate alloc;
 use core::ffi::c_void;
-use core::mem::forget;
 use core::ptr::null_mut;
 
 use alloc::boxed::Box;
 use alloc::collections::BTreeMap;
-use alloc::format;
-use alloc::string::String;
-use alloc::string::ToString;
+use alloc::vec;
+use alloc::vec::Vec;
 use sqlite::Stmt;
 use sqlite_nostd as sqlite;
 use sqlite_nostd::ResultCode;
 
-use crate::c::crsql_ExtData;
+use crate::c::{crsql_ExtData, crsql_isStmtBusy};
 
-// port the stmt cache so we can
-// - start removing some unsafe code
-// - remove uthash and just use rust btreemap
+// Prepared statements used by the merge and read paths, keyed by
+// (statement type, table info index, column index).
+//
+// - lookups index straight into per-table slot vectors, no hashing or string compares
+// - keys are plain integers so building one never allocates
+// - the cache is bounded and evicts the least recently used statement
+//
+// Keys use table info indices so the cache is reset whenever table infos are re-pulled.
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
 pub enum CachedStmtType {
     SetWinnerClock = 0,
     CheckForLocalDelete = 1,
-    GetColVersion = 2,
-    GetCurrValue = 3,
+    GetRowClock = 2,
+    GetCurrRow = 3,
     MergePkOnlyInsert = 4,
     MergeDelete = 5,
     MergeInsert = 6,
     RowPatchData = 7,
+    MergeRow = 8,
+    LocalUpdateClock = 9,
+    SiteOrdinal = 10,
+    InternSiteId = 11,
+}
+
+const NUM_STMT_TYPES: usize = 12;
+const NONE: u32 = u32::MAX;
+
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+pub struct StmtKey {
+    stmt_type: CachedStmtType,
+    tbl_idx: u32,
+    // 0 for statements that are per table, column index + 1 otherwise.
+    // For `MergeRow` this is the 64 column bucket the `col_mask` applies to, + 1.
+    col_slot: u32,
+    col_mask: u64,
+}
+
+struct CacheEntry {
+    key: StmtKey,
+    stmt: *mut sqlite::stmt,
+    // towards the most recently used entry
+    prev: u32,
+    // towards the least recently used entry
+    next: u32,
+}
+
+pub struct StmtCache {
+    // tables[tbl_idx][col_slot * NUM_STMT_TYPES + stmt_type] -> index into entries
+    tables: Vec<Vec<u32>>,
+    // (tbl_idx, col_slot, col_mask) -> index into entries, for `MergeRow`
+    col_sets: BTreeMap<(u32, u32, u64), u32>,
+    entries: Vec<CacheEntry>,
+    free: Vec<u32>,
+    mru: u32,
+    lru: u32,
+    len: usize,
+    capacity: usize,
+    hits: i64,
+    misses: i64,
+    evictions: i64,
+}
+
+impl StmtCache {
+    fn new(capacity: usize) -> Self {
+        StmtCache {
+            tables: vec![],
+            col_sets: BTreeMap::new(),
+            entries: vec![],
+            free: vec![],
+            mru: NONE,
+            lru: NONE,
+            len: 0,
+            capacity,
+            hits: 0,
+            misses: 0,
+            evictions: 0,
+        }
+    }
+
+    fn slot(&self, key: &StmtKey) -> u32 {
+        if key.stmt_type == CachedStmtType::MergeRow {
+            return *self
+                .col_sets
+                .get(&(key.tbl_idx, key.col_slot, key.col_mask))
+                .unwrap_or(&NONE);
+        }
+        let idx = key.col_slot as usize * NUM_STMT_TYPES + key.stmt_type as usize;
+        self.tables
+            .get(key.tbl_idx as usize)
+            .and_then(|slots| slots.get(idx))
+            .copied()
+            .unwrap_or(NONE)
+    }
+
+    fn set_slot(&mut self, key: &StmtKey, entry: u32) {
+        if key.stmt_type == CachedStmtType::MergeRow {
+            if entry == NONE {
+                self.col_sets
+                    .remove(&(key.tbl_idx, key.col_slot, key.col_mask));
+            } else {
+                self.col_sets
+                    .insert((key.tbl_idx, key.col_slot, key.col_mask), entry);
+            }
+            return;
+        }
+        let tbl_idx = key.tbl_idx as usize;
+        if self.tables.len() <= tbl_idx {
+            self.tables.resize_with(tbl_idx + 1, Vec::new);
+        }
+        let slots = &mut self.tables[tbl_idx];
+        let idx = key.col_slot as usize * NUM_STMT_TYPES + key.stmt_type as usize;
+        if slots.len() <= idx {
+            slots.resize((key.col_slot as usize + 1) * NUM_STMT_TYPES, NONE);
+        }
+        slots[idx] = entry;
+    }
+
+    fn unlink(&mut self, entry: u32) {
+        let (prev, next) = {
+            let e = &self.entries[entry as usize];
+            (e.prev, e.next)
+        };
+        if prev == NONE {
+            self.mru = next;
+        } else {
+            self.entries[prev as usize].next = next;
+        }
+        if next == NONE {
+            self.lru = prev;
+        } else {
+            self.entries[next as usize].prev = prev;
+        }
+    }
+
+    fn link_front(&mut self, entry: u32) {
+        self.entries[entry as usize].prev = NONE;
+        self.entries[entry as usize].next = self.mru;
+        if self.mru != NONE {
+            self.entries[self.mru as usize].prev = entry;
+        }
+        self.mru = entry;
+        if self.lru == NONE {
+            self.lru = entry;
+        }
+    }
+
+    fn get(&mut self, key: &StmtKey) -> Option<*mut sqlite::stmt> {
+        let entry = self.slot(key);
+        if entry == NONE {
+            self.misses += 1;
+            return None;
+        }
+        self.hits += 1;
+        if self.mru != entry {
+            self.unlink(entry);
+            self.link_front(entry);
+        }
+        Some(self.entries[entry as usize].stmt)
+    }
+
+    fn insert(&mut self, key: StmtKey, stmt: *mut sqlite::stmt) {
+        let existing = self.slot(&key);
+        if existing != NONE {
+            self.remove(existing);
+        }
+        self.evict_to(self.capacity.saturating_sub(1));
+
+        let new_entry = CacheEntry {
+            key,
+            stmt,
+            prev: NONE,
+            next: NONE,
+        };
+        let entry = if let Some(entry) = self.free.pop() {
+            self.entries[entry as usize] = new_entry;
+            entry
+        } else {
+            self.entries.push(new_entry);
+            (self.entries.len() - 1) as u32
+        };
+        self.set_slot(&key, entry);
+        self.link_front(entry);
+        self.len += 1;
+    }
+
+    // Finalizes least recently used statements until at most `target` remain.
+    // Skips statements that are mid-step as well as row patch statements since an open
+    // changes cursor keeps pointing at its row patch statement between steps.
+    fn evict_to(&mut self, target: usize) {
+        let mut candidate = self.lru;
+        while self.len > target && candidate != NONE {
+            let prev = self.entries[candidate as usize].prev;
+            let entry = &self.entries[candidate as usize];
+            if entry.key.stmt_type != CachedStmtType::RowPatchData
+                && unsafe { crsql_isStmtBusy(entry.stmt) } == 0
+            {
+                self.remove(candidate);
+                self.evictions += 1;
+            }
+            candidate = prev;
+        }
+    }
+
+    fn remove(&mut self, entry: u32) {
+        self.unlink(entry);
+        let key = self.entries[entry as usize].key;
+        let _ = self.entries[entry as usize].stmt.finalize();
+        self.entries[entry as usize].stmt = null_mut();
+        self.set_slot(&key, NONE);
+        self.free.push(entry);
+        self.len -= 1;
+    }
+
+    fn clear(&mut self) {
+        for e in self.entries.iter() {
+            if !e.stmt.is_null() {
+                let _ = e.stmt.finalize();
+            }
+        }
+        self.tables.clear();
+        self.col_sets.clear();
+        self.entries.clear();
+        self.free.clear();
+        self.mru = NONE;
+        self.lru = NONE;
+        self.len = 0;
+    }
 }
 
 #[no_mangle]
 pub extern "C" fn crsql_init_stmt_cache(ext_data: *mut crsql_ExtData) {
-    let map: BTreeMap<String, *mut sqlite::stmt> = BTreeMap::new();
+    let cache = StmtCache::new(crate::consts::STMT_CACHE_CAPACITY);
     unsafe {
-        (*ext_data).pStmtCache = Box::into_raw(Box::new(map)) as *mut c_void;
+        (*ext_data).pStmtCache = Box::into_raw(Box::new(cache)) as *mut c_void;
     }
 }
 
@@ -41,74 +254,130 @@ pub extern "C" fn crsql_clear_stmt_cache(ext_data: *mut crsql_ExtData) {
     if unsafe { (*ext_data).pStmtCache.is_null() } {
         return;
     }
-    let map: Box<BTreeMap<String, *mut sqlite::stmt>> = unsafe {
-        Box::from_raw((*ext_data).pStmtCache as *mut BTreeMap<String, *mut sqlite::stmt>)
-    };
-    for (_key, stmt) in map.iter() {
-        let _ = stmt.finalize();
-    }
+    let mut cache: Box<StmtCache> =
+        unsafe { Box::from_raw((*ext_data).pStmtCache as *mut StmtCache) };
+    cache.clear();
     unsafe {
         (*ext_data).pStmtCache = null_mut();
     }
 }
 
+/// Finalizes every cached statement but keeps the cache and its counters.
+/// Called when table infos are re-pulled since keys refer to table info indices.
+#[no_mangle]
+pub extern "C" fn crsql_reset_stmt_cache(ext_data: *mut crsql_ExtData) {
+    if let Some(cache) = stmt_cache(ext_data) {
+        cache.clear();
+    }
+}
+
+#[no_mangle]
+pub extern "C" fn crsql_get_stmt_cache_stats(
+    ext_data: *mut crsql_ExtData,
+    hits: *mut sqlite::int64,
+    misses: *mut sqlite::int64,
+    evictions: *mut sqlite::int64,
+    size: *mut sqlite::int64,
+    capacity: *mut sqlite::int64,
+) {
+    if let Some(cache) = stmt_cache(ext_data) {
+        unsafe {
+            *hits = cache.hits;
+            *misses = cache.misses;
+            *evictions = cache.evictions;
+            *size = cache.len as sqlite::int64;
+            *capacity = cache.capacity as sqlite::int64;
+        }
+    }
+}
+
+fn stmt_cache<'a>(ext_data: *mut crsql_ExtData) -> Option<&'a mut StmtCache> {
+    unsafe {
+        if (*ext_data).pStmtCache.is_null() {
+            return None;
+        }
+        // C owns this memory.
+        Some(&mut *((*ext_data).pStmtCache as *mut StmtCache))
+    }
+}
+
 pub fn get_cache_key(
     stmt_type: CachedStmtType,
-    tbl_name: &str,
-    col_name: Option<&str>,
-) -> Result<String, ResultCode> {
+    tbl_idx: i32,
+    col_idx: Option<usize>,
+) -> Result<StmtKey, ResultCode> {
+    if tbl_idx < 0 {
+        return Err(ResultCode::MISUSE);
+    }
     match stmt_type {
         CachedStmtType::SetWinnerClock
         | CachedStmtType::CheckForLocalDelete
-        | CachedStmtType::GetColVersion
         | CachedStmtType::MergePkOnlyInsert
-        | CachedStmtType::MergeDelete => {
-            if col_name.is_some() {
-                // col name should not be specified for these cases
+        | CachedStmtType::MergeDelete
+        | CachedStmtType::GetRowClock
+        | CachedStmtType::GetCurrRow
+        | CachedStmtType::LocalUpdateClock
+        | CachedStmtType::SiteOrdinal
+        | CachedStmtType::InternSiteId
+        | CachedStmtType::RowPatchData => {
+            if col_idx.is_some() {
+                // col should not be specified for these cases
                 return Err(ResultCode::MISUSE);
             }
-            Ok(format!(
-                "{stmt_type}_{tbl_name}",
-                stmt_type = (stmt_type as i32).to_string(),
-                tbl_name = tbl_name
-            ))
-        }
-        CachedStmtType::GetCurrValue
-        | CachedStmtType::MergeInsert
-        | CachedStmtType::RowPatchData => {
-            if let Some(col_name) = col_name {
-                Ok(format!(
-                    "{stmt_type}_{tbl_name}_{col_name}",
-                    stmt_type = (stmt_type as i32).to_string(),
-                    tbl_name = tbl_name,
-                    col_name = col_name
-                ))
+            Ok(StmtKey {
+                stmt_type,
+                tbl_idx: tbl_idx as u32,
+                col_slot: 0,
+                col_mask: 0,
+            })
+        }
+        CachedStmtType::MergeInsert => {
+            if let Some(col_idx) = col_idx {
+                Ok(StmtKey {
+                    stmt_type,
+                    tbl_idx: tbl_idx as u32,
+                    col_slot: col_idx as u32 + 1,
+                    col_mask: 0,
+                })
             } else {
-                // col_name must be specified in this case
+                // col must be specified in this case
                 Err(ResultCode::MISUSE)
             }
         }
+        // column sets are keyed with `get_col_set_cache_key`
+        CachedStmtType::MergeRow => Err(ResultCode::MISUSE),
     }
 }
 
-pub fn set_cached_stmt(ext_data: *mut crsql_ExtData, key: String, stmt: *mut sqlite::stmt) {
-    // give ownership of the key to C
-    let mut map: Box<BTreeMap<String, *mut sqlite::stmt>> = unsafe {
-        Box::from_raw((*ext_data).pStmtCache as *mut BTreeMap<String, *mut sqlite::stmt>)
-    };
-    map.insert(key, stmt);
-    // C owns this memory.
-    forget(map);
+/// Key for a statement that touches a set of columns.
+/// `col_mask` has bit `i` set for column index `bucket * 64 + i`.
+pub fn get_col_set_cache_key(
+    stmt_type: CachedStmtType,
+    tbl_idx: i32,
+    bucket: usize,
+    col_mask: u64,
+) -> Result<StmtKey, ResultCode> {
+    if tbl_idx < 0 || stmt_type != CachedStmtType::MergeRow {
+        return Err(ResultCode::MISUSE);
+    }
+    Ok(StmtKey {
+        stmt_type,
+        tbl_idx: tbl_idx as u32,
+        col_slot: bucket as u32 + 1,
+        col_mask,
+    })
+}
+
+pub fn set_cached_stmt(ext_data: *mut crsql_ExtData, key: StmtKey, stmt: *mut sqlite::stmt) {
+    if let Some(cache) = stmt_cache(ext_data) {
+        cache.insert(key, stmt);
+    } else {
+        let _ = stmt.finalize();
+    }
 }
 
-pub fn get_cached_stmt(ext_data: *mut crsql_ExtData, key: &String) -> Option<*mut sqlite::stmt> {
-    let map: Box<BTreeMap<String, *mut sqlite::stmt>> = unsafe {
-        Box::from_raw((*ext_data).pStmtCache as *mut BTreeMap<String, *mut sqlite::stmt>)
-    };
-    let ret = map.get(key).copied();
-    // C owns this memory
-    forget(map);
-    return ret;
+pub fn get_cached_stmt(ext_data: *mut crsql_ExtData, key: &StmtKey) -> Option<*mut sqlite::stmt> {
+    stmt_cache(ext_data).and_then(|cache| cache.get(key))
 }
 
 pub fn reset_cached_stmt(stmt: *mut sqlite::stmt) -> Result<ResultCode, ResultCode> {
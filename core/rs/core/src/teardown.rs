@@ -11,7 +11,9 @@ pub fn remove_crr_clock_table_if_exists(
     db.exec_safe(&format!(
         "DROP TABLE IF EXISTS \"{table}__crsql_clock\"",
         table = escaped_table
-    ))
+    ))?;
+    crate::col_ids::remove_col_ids(db, table)?;
+    crate::backfill::clear_backfill_progress(db, table)
 }
 
 pub fn remove_crr_triggers_if_exist(
@@ -0,0 +1,385 @@
+extern crate alloc;
+
+use alloc::boxed::Box;
+use alloc::collections::BTreeMap;
+use alloc::ffi::CString;
+use alloc::format;
+use alloc::string::String;
+use alloc::vec;
+use alloc::vec::Vec;
+use core::ffi::{c_char, c_int, c_void, CStr};
+use core::ptr::null_mut;
+use sqlite::{Connection, ResultCode, Stmt};
+use sqlite_nostd as sqlite;
+use sqlite_nostd::sqlite3;
+
+use crate::c::{crsql_ExtData, crsql_TableInfo, crsql_ensureTableInfosAreUpToDate};
+use crate::consts;
+use crate::pack_columns::OwnedColumnValue;
+use crate::ColumnValue;
+
+/**
+ * Removes the delete sentinels of rows that every tracked peer has already
+ * received, at most `budget` of them per call. `removed` is set to the number
+ * removed so a maintenance loop can call again until it reaches 0.
+ *
+ * A peer has received everything up to the db version recorded for it under
+ * the send event in `crsql_tracked_peers`. The lowest of those versions is the
+ * watermark. Nothing is removed until at least one peer is tracked.
+ *
+ * Tombstones of rows that have since been re-inserted are kept.
+ */
+#[no_mangle]
+pub unsafe extern "C" fn crsql_gc_tombstones(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    budget: sqlite::int64,
+    removed: *mut sqlite::int64,
+    errmsg: *mut *mut c_char,
+) -> c_int {
+    match gc_tombstones(db, ext_data, budget, errmsg) {
+        Ok(count) => {
+            *removed = count;
+            ResultCode::OK as c_int
+        }
+        Err(rc) => {
+            if (*errmsg).is_null() {
+                if let Ok(err) = CString::new("crsql - failed to collect tombstones") {
+                    *errmsg = err.into_raw();
+                }
+            }
+            rc as c_int
+        }
+    }
+}
+
+unsafe fn gc_tombstones(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    budget: sqlite::int64,
+    errmsg: *mut *mut c_char,
+) -> Result<sqlite::int64, ResultCode> {
+    if crsql_ensureTableInfosAreUpToDate(db, ext_data, errmsg) != ResultCode::OK as c_int {
+        return Err(ResultCode::ERROR);
+    }
+    let watermark = match peer_watermark(db)? {
+        Some(watermark) => watermark,
+        None => return Ok(0),
+    };
+
+    let mut removed = 0;
+    let table_infos = sqlite::args!((*ext_data).tableInfosLen, (*ext_data).zpTableInfos);
+    for table_info in table_infos {
+        if removed >= budget {
+            break;
+        }
+        let table_name = CStr::from_ptr((**table_info).tblName).to_str()?;
+        let pk_cols = sqlite::args!((**table_info).pksLen, (**table_info).pks);
+        // walks the index of delete sentinels up to the watermark, bounded by the budget
+        let stmt = db.prepare_v2(&format!(
+            "DELETE FROM \"{table_name}__crsql_clock\" WHERE _rowid_ IN (
+              SELECT _rowid_ FROM \"{table_name}__crsql_clock\" AS clock
+              WHERE __crsql_col_id = {delete_sentinel_id} AND __crsql_db_version <= ?
+                AND NOT EXISTS (SELECT 1 FROM \"{table_name}\" WHERE {pk_where_list})
+              LIMIT ?
+            )",
+            table_name = crate::util::escape_ident(table_name),
+            delete_sentinel_id = crate::c::DELETE_SENTINEL_ID,
+            pk_where_list = crate::util::pk_where_list(pk_cols, Some("clock."))?,
+        ))?;
+        stmt.bind_int64(1, watermark)?;
+        stmt.bind_int64(2, budget - removed)?;
+        stmt.step()?;
+        removed += db.changes64();
+    }
+
+    if removed > 0 {
+        // Were a filter built now and this removal rolled back, the filter would
+        // miss rows that have a tombstone again.
+        let filters = filters(ext_data);
+        filters.tables.clear();
+        filters.unsettled = true;
+    }
+    Ok(removed)
+}
+
+/// The lowest db version that every tracked peer has received, if any peer is tracked.
+fn peer_watermark(db: *mut sqlite3) -> Result<Option<sqlite::int64>, ResultCode> {
+    let stmt = db.prepare_v2(&format!(
+        "SELECT min(version) FROM \"{tbl}\" WHERE event = {send_event}",
+        tbl = consts::TBL_TRACKED_PEERS,
+        send_event = consts::TRACKED_PEER_SEND_EVENT,
+    ))?;
+    stmt.step()?;
+    match stmt.column_type(0)? {
+        sqlite::ColumnType::Null => Ok(None),
+        _ => Ok(Some(stmt.column_int64(0)?)),
+    }
+}
+
+/**
+ * Per table Bloom filters over the pks that have a delete sentinel.
+ *
+ * Every merge first checks whether the row was deleted, which is an index probe
+ * of the clock table. Few rows are ever deleted, so a filter that says a row was
+ * never deleted saves that probe for nearly every merged row. A filter may claim
+ * a row was deleted when it wasn't, which only costs the probe. It must never
+ * miss a row that was.
+ *
+ * Filters are built from the clock table the first time a merge needs them and
+ * then kept for the life of the connection. Deletes on this connection add to
+ * them: local deletes through `crsql_after_delete` in the delete trigger and
+ * merged deletes through `merge_delete`. Tables whose delete trigger predates
+ * `crsql_after_delete` are never filtered. Commits by other connections, schema
+ * changes and rollbacks drop all filters.
+ */
+pub struct TombstoneFilters {
+    data_version: sqlite::int64,
+    schema_version: c_int,
+    // tombstones were removed in the open transaction, see `gc_tombstones`
+    unsettled: bool,
+    tables: BTreeMap<String, TableFilter>,
+}
+
+enum TableFilter {
+    // local deletes of the table aren't reported to us
+    Unreported,
+    Bloom(BloomFilter),
+}
+
+// ~1% false positives at 10 bits and 7 probes per key
+const BITS_PER_KEY: usize = 10;
+const PROBES: u64 = 7;
+
+struct BloomFilter {
+    bits: Vec<u64>,
+    len: usize,
+}
+
+impl BloomFilter {
+    fn with_capacity(capacity: usize) -> BloomFilter {
+        let num_bits = (capacity.max(64) * BITS_PER_KEY).next_power_of_two();
+        BloomFilter {
+            bits: vec![0; num_bits / 64],
+            len: 0,
+        }
+    }
+
+    fn capacity(&self) -> usize {
+        self.bits.len() * 64 / BITS_PER_KEY
+    }
+
+    fn probes(&self, hash: u64) -> impl Iterator<Item = usize> {
+        let mask = (self.bits.len() * 64 - 1) as u64;
+        let h2 = mix(hash) | 1;
+        (0..PROBES).map(move |i| (hash.wrapping_add(i.wrapping_mul(h2)) & mask) as usize)
+    }
+
+    fn insert(&mut self, hash: u64) {
+        for bit in self.probes(hash).collect::<Vec<_>>() {
+            self.bits[bit / 64] |= 1 << (bit % 64);
+        }
+        self.len += 1;
+    }
+
+    fn may_contain(&self, hash: u64) -> bool {
+        self.probes(hash)
+            .all(|bit| self.bits[bit / 64] & (1 << (bit % 64)) != 0)
+    }
+}
+
+fn mix(mut x: u64) -> u64 {
+    x ^= x >> 30;
+    x = x.wrapping_mul(0xbf58476d1ce4e5b9);
+    x ^= x >> 27;
+    x = x.wrapping_mul(0x94d049bb133111eb);
+    x ^ (x >> 31)
+}
+
+/// Hashes pk values so that values SQLite considers equal hash the same. The
+/// pk columns of clock tables have no affinity, so 1 and 1.0 are the same key
+/// while 1 and '1' are not.
+fn hash_pks<'a>(pks: impl Iterator<Item = ColumnValue<'a>>) -> u64 {
+    let mut hash: u64 = 0xcbf29ce484222325;
+    let mut feed = |bytes: &[u8]| {
+        for b in bytes {
+            hash = (hash ^ *b as u64).wrapping_mul(0x100000001b3);
+        }
+    };
+    for pk in pks {
+        match pk {
+            ColumnValue::Integer(i) => {
+                feed(&[1]);
+                feed(&i.to_be_bytes());
+            }
+            ColumnValue::Float(f) if f.abs() < 9.2e18 && (f as i64) as f64 == f => {
+                feed(&[1]);
+                feed(&(f as i64).to_be_bytes());
+            }
+            ColumnValue::Float(f) => {
+                feed(&[2]);
+                feed(&f.to_bits().to_be_bytes());
+            }
+            ColumnValue::Text(t) => {
+                feed(&[3]);
+                feed(&(t.len() as u64).to_be_bytes());
+                feed(t.as_bytes());
+            }
+            ColumnValue::Blob(b) => {
+                feed(&[4]);
+                feed(&(b.len() as u64).to_be_bytes());
+                feed(b);
+            }
+            ColumnValue::Null => feed(&[5]),
+        }
+    }
+    mix(hash)
+}
+
+unsafe fn filters<'a>(ext_data: *mut crsql_ExtData) -> &'a mut TombstoneFilters {
+    if (*ext_data).pTombstoneFilters.is_null() {
+        (*ext_data).pTombstoneFilters = Box::into_raw(Box::new(TombstoneFilters {
+            data_version: -1,
+            schema_version: -1,
+            unsettled: false,
+            tables: BTreeMap::new(),
+        })) as *mut c_void;
+    }
+    &mut *((*ext_data).pTombstoneFilters as *mut TombstoneFilters)
+}
+
+#[no_mangle]
+pub unsafe extern "C" fn crsql_free_tombstone_filters(ext_data: *mut crsql_ExtData) {
+    if !(*ext_data).pTombstoneFilters.is_null() {
+        drop(Box::from_raw(
+            (*ext_data).pTombstoneFilters as *mut TombstoneFilters,
+        ));
+        (*ext_data).pTombstoneFilters = null_mut();
+    }
+}
+
+/// Called when a transaction ends. Filters may hold state that was rolled back.
+#[no_mangle]
+pub unsafe extern "C" fn crsql_end_tombstone_filters_txn(
+    ext_data: *mut crsql_ExtData,
+    committed: c_int,
+) {
+    if (*ext_data).pTombstoneFilters.is_null() {
+        return;
+    }
+    let filters = filters(ext_data);
+    if committed == 0 {
+        filters.tables.clear();
+    }
+    filters.unsettled = false;
+}
+
+/// Drops the filters if another connection committed or the schema changed since
+/// they were built. Merges call this once per transaction, after table infos are
+/// up to date and within the transaction so nothing else can commit until they
+/// are done.
+pub unsafe fn sync_tombstone_filters(ext_data: *mut crsql_ExtData) -> Result<(), ResultCode> {
+    let stmt = (*ext_data).pPragmaDataVersionStmt;
+    let data_version = match stmt.step() {
+        Ok(ResultCode::ROW) => stmt.column_int64(0),
+        _ => {
+            stmt.reset()?;
+            return Err(ResultCode::ERROR);
+        }
+    };
+    stmt.reset()?;
+
+    let filters = filters(ext_data);
+    let schema_version = (*ext_data).pragmaSchemaVersionForTableInfos;
+    if filters.data_version != data_version || filters.schema_version != schema_version {
+        filters.tables.clear();
+        filters.data_version = data_version;
+        filters.schema_version = schema_version;
+    }
+    Ok(())
+}
+
+/// Whether the row of `tbl_info` with `pks` may have a delete sentinel. False
+/// only if it certainly has none.
+pub unsafe fn may_have_tombstone(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    tbl_info: *mut crsql_TableInfo,
+    tbl_name: &str,
+    pks: &[ColumnValue],
+) -> Result<bool, ResultCode> {
+    let filters = filters(ext_data);
+    if filters.unsettled {
+        return Ok(true);
+    }
+    if !filters.tables.contains_key(tbl_name) {
+        let filter = build_filter(db, tbl_info, tbl_name)?;
+        filters.tables.insert(String::from(tbl_name), filter);
+    }
+    match filters.tables.get(tbl_name) {
+        Some(TableFilter::Bloom(bloom)) => Ok(bloom.may_contain(hash_pks(pks.iter().cloned()))),
+        _ => Ok(true),
+    }
+}
+
+/// Adds a row that was just deleted to its table's filter, if there is one.
+pub unsafe fn note_tombstone<'a>(
+    ext_data: *mut crsql_ExtData,
+    tbl_name: &str,
+    pks: impl Iterator<Item = ColumnValue<'a>>,
+) {
+    if (*ext_data).pTombstoneFilters.is_null() {
+        return;
+    }
+    let filters = filters(ext_data);
+    if let Some(TableFilter::Bloom(bloom)) = filters.tables.get_mut(tbl_name) {
+        if bloom.len >= bloom.capacity() {
+            // rebuilt, twice as large, the next time it is needed
+            filters.tables.remove(tbl_name);
+        } else {
+            bloom.insert(hash_pks(pks));
+        }
+    }
+}
+
+unsafe fn build_filter(
+    db: *mut sqlite3,
+    tbl_info: *mut crsql_TableInfo,
+    tbl_name: &str,
+) -> Result<TableFilter, ResultCode> {
+    let trigger_stmt = db.prepare_v2(
+        "SELECT 1 FROM sqlite_master WHERE type = 'trigger' AND name = ?
+          AND sql LIKE '%crsql_after_delete(%'",
+    )?;
+    trigger_stmt.bind_text(
+        1,
+        &format!("{}__crsql_dtrig", tbl_name),
+        sqlite::Destructor::TRANSIENT,
+    )?;
+    if trigger_stmt.step()? != ResultCode::ROW {
+        return Ok(TableFilter::Unreported);
+    }
+
+    let pk_cols = sqlite::args!((*tbl_info).pksLen, (*tbl_info).pks);
+    let stmt = db.prepare_v2(&format!(
+        "SELECT {pk_list} FROM \"{table_name}__crsql_clock\" WHERE __crsql_col_id = {delete_sentinel_id}",
+        pk_list = crate::util::as_identifier_list(pk_cols, None)?,
+        table_name = crate::util::escape_ident(tbl_name),
+        delete_sentinel_id = crate::c::DELETE_SENTINEL_ID,
+    ))?;
+    let mut hashes = vec![];
+    let mut pks = Vec::with_capacity(pk_cols.len());
+    while stmt.step()? == ResultCode::ROW {
+        pks.clear();
+        for i in 0..pk_cols.len() {
+            pks.push(OwnedColumnValue::from_value(stmt.column_value(i as i32)?));
+        }
+        hashes.push(hash_pks(pks.iter().map(|pk| pk.as_column_value())));
+    }
+
+    let mut bloom = BloomFilter::with_capacity(hashes.len() * 2);
+    for hash in hashes {
+        bloom.insert(hash);
+    }
+    Ok(TableFilter::Bloom(bloom))
+}
@@ -50,11 +50,13 @@ fn create_insert_trigger(
 
     let create_trigger_sql = format!(
         "CREATE TRIGGER IF NOT EXISTS \"{table_name}__crsql_itrig\"
-      AFTER INSERT ON \"{table_name}\" WHEN crsql_internal_sync_bit() = 0
+      AFTER INSERT ON \"{table_name}\"
+      WHEN crsql_internal_sync_bit() = 0 AND crsql_internal_bulk_load_bit('{table_name_val}') = 0
       BEGIN
         {trigger_body}
       END;",
         table_name = crate::util::escape_ident(table_name),
+        table_name_val = crate::util::escape_ident_as_value(table_name),
         trigger_body = trigger_body
     );
 
@@ -75,18 +77,18 @@ fn insert_trigger_body(
             table_name,
             &pk_list,
             &pk_new_list,
-            crate::c::INSERT_SENTINEL,
+            crate::c::INSERT_SENTINEL_ID,
         ))
     }
     for col in non_pk_columns {
-        let col_name = unsafe { CStr::from_ptr(col.name).to_str()? };
         trigger_components.push(format_insert_trigger_component(
             table_name,
             &pk_list,
             &pk_new_list,
-            col_name,
+            col.colId as sqlite::int64,
         ))
     }
+    trigger_components.push(format!("{};", crate::consts::RAISE_DB_VERSION));
 
     Ok(trigger_components.join("\n"))
 }
@@ -95,19 +97,19 @@ fn format_insert_trigger_component(
     table_name: &str,
     pk_list: &str,
     pk_new_list: &str,
-    col_name: &str,
+    col_id: sqlite::int64,
 ) -> String {
     format!(
         "INSERT INTO \"{table_name}__crsql_clock\" (
   {pk_list},
-  __crsql_col_name,
+  __crsql_col_id,
   __crsql_col_version,
   __crsql_db_version,
   __crsql_seq,
-  __crsql_site_id
+  __crsql_site_ordinal
 ) SELECT
   {pk_new_list},
-  '{col_name}',
+  {col_id},
   1,
   crsql_nextdbversion(),
   crsql_increment_and_get_seq(),
@@ -116,11 +118,11 @@ ON CONFLICT DO UPDATE SET
   __crsql_col_version = __crsql_col_version + 1,
   __crsql_db_version = crsql_nextdbversion(),
   __crsql_seq = crsql_get_seq() - 1,
-  __crsql_site_id = NULL;",
+  __crsql_site_ordinal = NULL;",
         table_name = crate::util::escape_ident(table_name),
         pk_list = pk_list,
         pk_new_list = pk_new_list,
-        col_name = crate::util::escape_ident_as_value(col_name)
+        col_id = col_id
     )
 }
 
@@ -168,6 +170,40 @@ fn update_trigger_body(
     // this would only row if the insert:
     // 1. changes pk columns
     // 2. one or more of those pk columns attain a different value
+    let non_pk_columns =
+        unsafe { slice::from_raw_parts((*table_info).nonPks, (*table_info).nonPksLen as usize) };
+    // `crsql_after_update` diffs NEW against OLD itself and only bumps the clocks of
+    // columns that changed. See local_writes.rs.
+    // Tables too wide to pass through a single function call fall back to a
+    // statement per column.
+    let num_args = 1 + unsafe { (*table_info).pksLen } as usize + 2 * non_pk_columns.len();
+    if num_args > crate::consts::MAX_FUNCTION_ARGS {
+        return per_column_update_trigger_body(table_info, table_name, pk_list, pk_new_list);
+    }
+    let mut args = vec![format!(
+        "'{}'",
+        crate::util::escape_ident_as_value(table_name)
+    )];
+    if !pk_new_list.is_empty() {
+        args.push(pk_new_list);
+    }
+    for col in non_pk_columns {
+        let col_name = crate::util::escape_ident(unsafe { CStr::from_ptr(col.name).to_str()? });
+        args.push(format!(
+            "NEW.\"{col_name}\", OLD.\"{col_name}\"",
+            col_name = col_name
+        ));
+    }
+
+    Ok(format!("SELECT crsql_after_update({});", args.join(", ")))
+}
+
+fn per_column_update_trigger_body(
+    table_info: *mut crsql_TableInfo,
+    table_name: &str,
+    pk_list: String,
+    pk_new_list: String,
+) -> Result<String, Utf8Error> {
     let non_pk_columns =
         unsafe { slice::from_raw_parts((*table_info).nonPks, (*table_info).nonPksLen as usize) };
     let mut trigger_components = vec![];
@@ -175,14 +211,14 @@ fn update_trigger_body(
         trigger_components.push(format!(
             "INSERT INTO \"{table_name}__crsql_clock\" (
           {pk_list},
-          __crsql_col_name,
+          __crsql_col_id,
           __crsql_col_version,
           __crsql_db_version,
           __crsql_seq,
-          __crsql_site_id
+          __crsql_site_ordinal
         ) SELECT
           {pk_new_list},
-          '{sentinel}',
+          {sentinel_id},
           1,
           crsql_nextdbversion(),
           crsql_increment_and_get_seq(),
@@ -191,11 +227,11 @@ fn update_trigger_body(
           __crsql_col_version = __crsql_col_version + 1,
           __crsql_db_version = crsql_nextdbversion(),
           __crsql_seq = crsql_get_seq() - 1,
-          __crsql_site_id = NULL;",
+          __crsql_site_ordinal = NULL;",
             table_name = crate::util::escape_ident(table_name),
             pk_list = pk_list,
             pk_new_list = pk_new_list,
-            sentinel = crate::c::INSERT_SENTINEL,
+            sentinel_id = crate::c::INSERT_SENTINEL_ID,
         ))
     }
     for col in non_pk_columns {
@@ -203,14 +239,14 @@ fn update_trigger_body(
         trigger_components.push(format!(
             "INSERT INTO \"{table_name}__crsql_clock\" (
           {pk_list},
-          __crsql_col_name,
+          __crsql_col_id,
           __crsql_col_version,
           __crsql_db_version,
           __crsql_seq,
-          __crsql_site_id
+          __crsql_site_ordinal
         ) SELECT
           {pk_new_list},
-          '{col_name_val}',
+          {col_id},
           1,
           crsql_nextdbversion(),
           crsql_increment_and_get_seq(),
@@ -220,14 +256,29 @@ fn update_trigger_body(
           __crsql_col_version = __crsql_col_version + 1,
           __crsql_db_version = crsql_nextdbversion(),
           __crsql_seq = crsql_get_seq() - 1,
-          __crsql_site_id = NULL;",
+          __crsql_site_ordinal = NULL;",
             table_name = crate::util::escape_ident(table_name),
             pk_list = pk_list,
             pk_new_list = pk_new_list,
-            col_name_val = crate::util::escape_ident_as_value(col_name),
+            col_id = col.colId,
             col_name_ident = crate::util::escape_ident(col_name)
         ))
     }
+    // only if one of the statements above wrote a clock row
+    let mut changed = vec![];
+    for col in non_pk_columns {
+        let col_name = crate::util::escape_ident(unsafe { CStr::from_ptr(col.name).to_str()? });
+        changed.push(format!("NEW.\"{col_name}\" IS NOT OLD.\"{col_name}\""));
+    }
+    if changed.is_empty() {
+        trigger_components.push(format!("{};", crate::consts::RAISE_DB_VERSION));
+    } else {
+        trigger_components.push(format!(
+            "{} AND ({});",
+            crate::consts::RAISE_DB_VERSION,
+            changed.join(" OR ")
+        ));
+    }
 
     Ok(trigger_components.join("\n"))
 }
@@ -243,21 +294,33 @@ fn create_delete_trigger(
     let pk_list = crate::util::as_identifier_list(pk_columns, None)?;
     let pk_old_list = crate::util::as_identifier_list(pk_columns, Some("OLD."))?;
     let pk_where_list = crate::util::pk_where_list(pk_columns, Some("OLD."))?;
+    // Keeps the connection's filter of deleted rows current, see tombstones.rs.
+    // Without it deletes of the table are always probed for.
+    let report_delete = if 1 + pk_columns.len() <= crate::consts::MAX_FUNCTION_ARGS {
+        format!(
+            "SELECT crsql_after_delete('{table_val}', {pk_old_list});",
+            table_val = crate::util::escape_ident_as_value(table_name),
+            pk_old_list = pk_old_list
+        )
+    } else {
+        String::new()
+    };
 
     let create_trigger_sql = format!(
         "CREATE TRIGGER IF NOT EXISTS \"{table_name}__crsql_dtrig\"
     AFTER DELETE ON \"{table_name}\" WHEN crsql_internal_sync_bit() = 0
     BEGIN
+      {report_delete}
       INSERT INTO \"{table_name}__crsql_clock\" (
         {pk_list},
-        __crsql_col_name,
+        __crsql_col_id,
         __crsql_col_version,
         __crsql_db_version,
         __crsql_seq,
-        __crsql_site_id
+        __crsql_site_ordinal
       ) SELECT
         {pk_old_list},
-        '{sentinel}',
+        {sentinel_id},
         1,
         crsql_nextdbversion(),
         crsql_increment_and_get_seq(),
@@ -266,14 +329,17 @@ fn create_delete_trigger(
         __crsql_col_version = __crsql_col_version + 1,
         __crsql_db_version = crsql_nextdbversion(),
         __crsql_seq = crsql_get_seq() - 1,
-        __crsql_site_id = NULL;
+        __crsql_site_ordinal = NULL;
       DELETE FROM \"{table_name}__crsql_clock\"
-        WHERE {pk_where_list} AND __crsql_col_name != '{sentinel}';
+        WHERE {pk_where_list} AND __crsql_col_id != {sentinel_id};
+      {raise_db_version};
     END;",
         table_name = crate::util::escape_ident(table_name),
-        sentinel = crate::c::DELETE_SENTINEL,
+        sentinel_id = crate::c::DELETE_SENTINEL_ID,
         pk_where_list = pk_where_list,
-        pk_old_list = pk_old_list
+        pk_old_list = pk_old_list,
+        report_delete = report_delete,
+        raise_db_version = crate::consts::RAISE_DB_VERSION
     );
 
     db.exec_safe(&create_trigger_sql)
@@ -6,12 +6,14 @@ use core::slice;
 use alloc::boxed::Box;
 use alloc::ffi::CString;
 use alloc::format;
+use alloc::vec;
 use alloc::vec::Vec;
 use sqlite::{Connection, Context, Value};
 use sqlite_nostd as sqlite;
 use sqlite_nostd::ResultCode;
 
-use crate::{unpack_columns, ColumnValue};
+use crate::pack_columns::unpack_value;
+use crate::ColumnValue;
 
 #[derive(Debug)]
 enum Columns {
@@ -95,7 +97,10 @@ extern "C" fn best_index(vtab: *mut sqlite::vtab, index_info: *mut sqlite::index
 struct Cursor {
     base: sqlite::vtab_cursor,
     crsr: usize,
-    unpacked: Option<Vec<ColumnValue>>,
+    // A copy of the package. Cells are decoded from it in place as the cursor moves.
+    package: Vec<u8>,
+    num_columns: usize,
+    offset: usize,
 }
 
 extern "C" fn open(_vtab: *mut sqlite::vtab, cursor: *mut *mut sqlite::vtab_cursor) -> c_int {
@@ -105,7 +110,9 @@ extern "C" fn open(_vtab: *mut sqlite::vtab, cursor: *mut *mut sqlite::vtab_curs
                 pVtab: core::ptr::null_mut(),
             },
             crsr: 0,
-            unpacked: None,
+            package: vec![],
+            num_columns: 0,
+            offset: 0,
         });
         let raw_cursor = Box::into_raw(boxed);
         *cursor = raw_cursor.cast::<sqlite::vtab_cursor>();
@@ -142,41 +149,54 @@ extern "C" fn filter(
 
     let crsr = cursor.cast::<Cursor>();
     unsafe {
-        if let Ok(cols) = unpack_columns(args[0].blob()) {
-            (*crsr).unpacked = Some(cols);
-            (*crsr).crsr = 0;
-        } else {
+        let package = args[0].blob();
+        if !is_well_formed(package) {
             return ResultCode::ERROR as c_int;
         }
+        (*crsr).package.clear();
+        (*crsr).package.extend_from_slice(package);
+        (*crsr).num_columns = package[0] as usize;
+        (*crsr).offset = 1;
+        (*crsr).crsr = 0;
     }
 
     ResultCode::OK as c_int
 }
 
+fn is_well_formed(package: &[u8]) -> bool {
+    let mut buf = package;
+    if buf.is_empty() {
+        return false;
+    }
+    let num_columns = buf[0];
+    buf = &buf[1..];
+    (0..num_columns).all(|_| unpack_value(&mut buf).is_ok())
+}
+
 extern "C" fn next(cursor: *mut sqlite::vtab_cursor) -> c_int {
     // go so long as crsr < unpacked.len
     // if crsr == unpacked.len continue
     // else, return done
     let crsr = cursor.cast::<Cursor>();
     unsafe {
+        let mut rest = &(&(*crsr).package)[(*crsr).offset..];
+        if unpack_value(&mut rest).is_err() {
+            return ResultCode::ERROR as c_int;
+        }
+        (*crsr).offset = (*crsr).package.len() - rest.len();
         (*crsr).crsr += 1;
     }
     ResultCode::OK as c_int
 }
 
 extern "C" fn eof(cursor: *mut sqlite::vtab_cursor) -> c_int {
-    // crsr >= unpacked.len
+    // crsr >= num_columns
     let crsr = cursor.cast::<Cursor>();
     unsafe {
-        match &(*crsr).unpacked {
-            Some(cols) => {
-                if (*crsr).crsr >= cols.len() {
-                    1
-                } else {
-                    0
-                }
-            }
-            None => 1,
+        if (*crsr).crsr >= (*crsr).num_columns {
+            1
+        } else {
+            0
         }
     }
 }
@@ -189,17 +209,17 @@ extern "C" fn column(
     let crsr = cursor.cast::<Cursor>();
     if col_num == Columns::CELL as i32 {
         unsafe {
-            if let Some(cols) = &(*crsr).unpacked {
-                let col_value = &cols[(*crsr).crsr];
+            let mut rest = &(&(*crsr).package)[(*crsr).offset..];
+            if let Ok(col_value) = unpack_value(&mut rest) {
                 match col_value {
                     ColumnValue::Blob(b) => {
                         ctx.result_blob_static(b);
                     }
                     ColumnValue::Float(f) => {
-                        ctx.result_double(*f);
+                        ctx.result_double(f);
                     }
                     ColumnValue::Integer(i) => {
-                        ctx.result_int64(*i);
+                        ctx.result_int64(i);
                     }
                     ColumnValue::Null => {
                         ctx.result_null();
@@ -210,7 +230,7 @@ extern "C" fn column(
                 }
                 ResultCode::OK as c_int
             } else {
-                (*(*cursor).pVtab).zErrMsg = CString::new("No columns to unpack!")
+                (*(*cursor).pVtab).zErrMsg = CString::new("Failed to unpack column")
                     .map_or(core::ptr::null_mut(), |f| f.into_raw());
                 ResultCode::ABORT as c_int
             }
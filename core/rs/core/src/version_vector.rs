@@ -0,0 +1,154 @@
+extern crate alloc;
+
+use alloc::collections::BTreeMap;
+use alloc::format;
+use alloc::string::String;
+use alloc::vec;
+use alloc::vec::Vec;
+use core::slice;
+use sqlite::{ColumnType, Connection, Context, Destructor, ResultCode, Value};
+use sqlite_nostd as sqlite;
+use sqlite_nostd::sqlite3;
+
+use crate::c::crsql_ExtData;
+use crate::consts;
+use crate::pack_columns::{pack_value, unpack_columns_from, ColumnValue};
+
+/**
+ * A version vector says, per origin site, up to which db version of this
+ * database a peer already has the changes of that site. Reading
+ * `crsql_changes WHERE vv = ?` returns only the changes the peer lacks, in
+ * one pass over the clock tables.
+ *
+ * The vector is a concatenation of `crsql_pack_columns` records of
+ * `(site_id, db_version)`. A NULL site id, or the site id of this database,
+ * stands for changes made locally. Changes of sites the vector does not
+ * mention are all returned.
+ *
+ * Records concatenate so peers tracking more sites than fit the arguments of
+ * one `crsql_vv` call can build vectors themselves.
+ */
+
+// Stands in for the vector's condition in the WHERE clause built by
+// `changes_best_index` until the vector is known in `changes_filter`.
+pub const VV_CONDITION: &str = "crsql_vv_condition";
+
+/**
+ * `crsql_vv(site_id, db_version, ...)` - packs pairs of site ids and db
+ * versions into a version vector for `crsql_changes.vv`.
+ */
+pub extern "C" fn crsql_vv(ctx: *mut sqlite::context, argc: i32, argv: *mut *mut sqlite::value) {
+    let args = sqlite::args!(argc, argv);
+    if args.len() % 2 != 0 {
+        ctx.result_error("crsql_vv takes pairs of site ids and db versions");
+        return;
+    }
+
+    let mut buf = vec![];
+    for pair in args.chunks(2) {
+        let (site_id, version) = (pair[0], pair[1]);
+        let site_id_ok = match site_id.value_type() {
+            ColumnType::Null => true,
+            ColumnType::Blob => site_id.bytes() == consts::SITE_ID_LEN,
+            _ => false,
+        };
+        if !site_id_ok || version.value_type() != ColumnType::Integer {
+            ctx.result_error("crsql_vv takes pairs of site ids and db versions");
+            return;
+        }
+        buf.push(2);
+        pack_value(&mut buf, site_id);
+        pack_value(&mut buf, version);
+    }
+    // SQLite copies it. An empty vec has no allocation to hand over.
+    ctx.result_blob_shared(&buf);
+}
+
+/// Decodes a vector into `(site_id, db_version)` pairs. An empty site id is the
+/// local site.
+fn decode_vv(vv: &[u8]) -> Option<Vec<(&[u8], sqlite::int64)>> {
+    let mut buf = vv;
+    let mut ret = vec![];
+    while !buf.is_empty() {
+        let record = unpack_columns_from(&mut buf).ok()?;
+        match record[..] {
+            [ColumnValue::Null, ColumnValue::Integer(version)] => ret.push((&[][..], version)),
+            [ColumnValue::Blob(site_id), ColumnValue::Integer(version)]
+                if site_id.len() == consts::SITE_ID_LEN as usize =>
+            {
+                ret.push((site_id, version))
+            }
+            _ => return None,
+        }
+    }
+    Some(ret)
+}
+
+/// The condition on `site_ordinal` and `db_vrsn` that selects the changes a
+/// peer with version vector `vv` lacks. `None` if `vv` is malformed.
+///
+/// Sites are matched by ordinal so site ids are never looked up per row. When
+/// the vector covers every site this database has changes from, the lowest of
+/// its versions also bounds `db_vrsn` so tables are read from their db version
+/// index rather than scanned.
+pub unsafe fn vv_condition(
+    db: *mut sqlite3,
+    ext_data: *mut crsql_ExtData,
+    vv: &[u8],
+) -> Result<Option<String>, ResultCode> {
+    let entries = match decode_vv(vv) {
+        Some(entries) => entries,
+        None => return Ok(None),
+    };
+    let local_site_id = slice::from_raw_parts((*ext_data).siteId, consts::SITE_ID_LEN as usize);
+
+    // local changes have a NULL ordinal, which we match as 0
+    let mut versions = BTreeMap::new();
+    let ordinal_stmt = db.prepare_v2(&format!(
+        "SELECT ordinal FROM \"{tbl}\" WHERE site_id = ?",
+        tbl = consts::TBL_SITE_ORDINALS
+    ))?;
+    for (site_id, version) in entries {
+        let ordinal = if site_id.is_empty() || site_id == local_site_id {
+            0
+        } else {
+            ordinal_stmt.bind_blob(1, site_id, Destructor::STATIC)?;
+            let ordinal = match ordinal_stmt.step()? {
+                ResultCode::ROW => Some(ordinal_stmt.column_int64(0)?),
+                _ => None,
+            };
+            ordinal_stmt.reset()?;
+            match ordinal {
+                Some(ordinal) => ordinal,
+                // no changes of this site to hold back
+                None => continue,
+            }
+        };
+        let entry = versions.entry(ordinal).or_insert(version);
+        *entry = (*entry).max(version);
+    }
+
+    if versions.is_empty() {
+        return Ok(Some(String::from("1")));
+    }
+
+    let count_stmt = db.prepare_v2(&format!(
+        "SELECT count(*) FROM \"{tbl}\"",
+        tbl = consts::TBL_SITE_ORDINALS
+    ))?;
+    count_stmt.step()?;
+    let known_sites = count_stmt.column_int64(0)? + 1;
+
+    let mut condition = String::new();
+    if versions.contains_key(&0) && versions.len() as sqlite::int64 == known_sites {
+        if let Some(floor) = versions.values().min() {
+            condition.push_str(&format!("db_vrsn > {} AND ", floor));
+        }
+    }
+    condition.push_str("CASE coalesce(site_ordinal, 0)");
+    for (ordinal, version) in versions.iter() {
+        condition.push_str(&format!(" WHEN {} THEN db_vrsn > {}", ordinal, version));
+    }
+    condition.push_str(" ELSE 1 END");
+    Ok(Some(condition))
+}
@@ -33,19 +33,29 @@ static void testChangesUnionQuery() {
                 "seq FROM (SELECT\n"
                 "          'foo' as tbl,\n"
                 "          crsql_pack_columns(\"a\") as pks,\n"
-                "          __crsql_col_name as cid,\n"
+                "          CASE __crsql_col_id WHEN -1 THEN '__crsql_del' WHEN "
+                "-2 THEN '__crsql_pko' WHEN 1 THEN 'b' ELSE (SELECT "
+                "col_name FROM \"__crsql_colids\" WHERE tbl_name = 'foo' "
+                "AND col_id = __crsql_col_id) END as cid,\n"
                 "          __crsql_col_version as col_vrsn,\n"
                 "          __crsql_db_version as db_vrsn,\n"
-                "          __crsql_site_id as site_id,\n"
+                "          (SELECT site_id FROM \"crsql_site_ordinals\" WHERE "
+                "ordinal = __crsql_site_ordinal) as site_id,\n"
+                "          __crsql_site_ordinal as site_ordinal,\n"
                 "          _rowid_,\n"
                 "          __crsql_seq as seq\n"
                 "      FROM \"foo__crsql_clock\" UNION ALL SELECT\n"
                 "          'bar' as tbl,\n"
                 "          crsql_pack_columns(\"x\") as pks,\n"
-                "          __crsql_col_name as cid,\n"
+                "          CASE __crsql_col_id WHEN -1 THEN '__crsql_del' WHEN "
+                "-2 THEN '__crsql_pko' WHEN 1 THEN 'y' ELSE (SELECT "
+                "col_name FROM \"__crsql_colids\" WHERE tbl_name = 'bar' "
+                "AND col_id = __crsql_col_id) END as cid,\n"
                 "          __crsql_col_version as col_vrsn,\n"
                 "          __crsql_db_version as db_vrsn,\n"
-                "          __crsql_site_id as site_id,\n"
+                "          (SELECT site_id FROM \"crsql_site_ordinals\" WHERE "
+                "ordinal = __crsql_site_ordinal) as site_id,\n"
+                "          __crsql_site_ordinal as site_ordinal,\n"
                 "          _rowid_,\n"
                 "          __crsql_seq as seq\n"
                 "      FROM \"bar__crsql_clock\") ") == 0);
@@ -59,19 +69,29 @@ static void testChangesUnionQuery() {
                 "seq FROM (SELECT\n"
                 "          'foo' as tbl,\n"
                 "          crsql_pack_columns(\"a\") as pks,\n"
-                "          __crsql_col_name as cid,\n"
+                "          CASE __crsql_col_id WHEN -1 THEN '__crsql_del' WHEN "
+                "-2 THEN '__crsql_pko' WHEN 1 THEN 'b' ELSE (SELECT "
+                "col_name FROM \"__crsql_colids\" WHERE tbl_name = 'foo' "
+                "AND col_id = __crsql_col_id) END as cid,\n"
                 "          __crsql_col_version as col_vrsn,\n"
                 "          __crsql_db_version as db_vrsn,\n"
-                "          __crsql_site_id as site_id,\n"
+                "          (SELECT site_id FROM \"crsql_site_ordinals\" WHERE "
+                "ordinal = __crsql_site_ordinal) as site_id,\n"
+                "          __crsql_site_ordinal as site_ordinal,\n"
                 "          _rowid_,\n"
                 "          __crsql_seq as seq\n"
                 "      FROM \"foo__crsql_clock\" UNION ALL SELECT\n"
                 "          'bar' as tbl,\n"
                 "          crsql_pack_columns(\"x\") as pks,\n"
-                "          __crsql_col_name as cid,\n"
+                "          CASE __crsql_col_id WHEN -1 THEN '__crsql_del' WHEN "
+                "-2 THEN '__crsql_pko' WHEN 1 THEN 'y' ELSE (SELECT "
+                "col_name FROM \"__crsql_colids\" WHERE tbl_name = 'bar' "
+                "AND col_id = __crsql_col_id) END as cid,\n"
                 "          __crsql_col_version as col_vrsn,\n"
                 "          __crsql_db_version as db_vrsn,\n"
-                "          __crsql_site_id as site_id,\n"
+                "          (SELECT site_id FROM \"crsql_site_ordinals\" WHERE "
+                "ordinal = __crsql_site_ordinal) as site_id,\n"
+                "          __crsql_site_ordinal as site_ordinal,\n"
                 "          _rowid_,\n"
                 "          __crsql_seq as seq\n"
                 "      FROM \"bar__crsql_clock\") WHERE site_id IS ? AND "
@@ -11,6 +11,8 @@
 #include "util.h"
 
 int crsql_changes_next(sqlite3_vtab_cursor *cur);
+void crsql_changes_end_merge_ctx(sqlite3_vtab *pVTab);
+int crsql_changes_crsr_finalize(crsql_Changes_cursor *crsr);
 
 /**
  * Created when the virtual table is initialized.
@@ -29,7 +31,8 @@ static int changesConnect(sqlite3 *db, void *pAux, int argc,
       "CREATE TABLE x([table] TEXT NOT NULL, [pk] BLOB NOT NULL, [cid] TEXT "
       "NOT NULL, [val] ANY, [col_version] INTEGER NOT NULL, [db_version] "
       "INTEGER "
-      "NOT NULL, [site_id] BLOB, [seq] HIDDEN INTEGER NOT NULL)");
+      "NOT NULL, [site_id] BLOB, [seq] HIDDEN INTEGER NOT NULL, "
+      "[resume_token] HIDDEN BLOB, [vv] HIDDEN BLOB, [sender] HIDDEN BLOB)");
   if (rc != SQLITE_OK) {
     *pzErr = sqlite3_mprintf("Could not define the table");
     return rc;
@@ -64,6 +67,7 @@ static int changesConnect(sqlite3 *db, void *pAux, int argc,
 static int changesDisconnect(sqlite3_vtab *pVtab) {
   crsql_Changes_vtab *p = (crsql_Changes_vtab *)pVtab;
   // ext data is free by other registered extensions
+  crsql_changes_end_merge_ctx(pVtab);
   sqlite3_free(p);
   return SQLITE_OK;
 }
@@ -84,23 +88,6 @@ static int changesOpen(sqlite3_vtab *p, sqlite3_vtab_cursor **ppCursor) {
   return SQLITE_OK;
 }
 
-static int changesCrsrFinalize(crsql_Changes_cursor *crsr) {
-  // Assign pointers to null after freeing
-  // since we can get into this twice for the same cursor object.
-  int rc = SQLITE_OK;
-  rc += sqlite3_finalize(crsr->pChangesStmt);
-  crsr->pChangesStmt = 0;
-  if (crsr->pRowStmt != 0) {
-    rc += sqlite3_clear_bindings(crsr->pRowStmt);
-    rc += sqlite3_reset(crsr->pRowStmt);
-  }
-  crsr->pRowStmt = 0;
-
-  crsr->dbVersion = MIN_POSSIBLE_DB_VERSION;
-
-  return rc;
-}
-
 /**
  * Called to reclaim all of the resources allocated in `changesOpen`
  * once a query against the virtual table has completed.
@@ -116,7 +103,7 @@ static int changesCrsrFinalize(crsql_Changes_cursor *crsr) {
  */
 static int changesClose(sqlite3_vtab_cursor *cur) {
   crsql_Changes_cursor *pCur = (crsql_Changes_cursor *)cur;
-  changesCrsrFinalize(pCur);
+  crsql_changes_crsr_finalize(pCur);
   sqlite3_free(pCur);
   return SQLITE_OK;
 }
@@ -145,6 +132,8 @@ int crsql_changes_update(sqlite3_vtab *pVTab, int argc, sqlite3_value **argv,
 // If xBegin is not defined xCommit is not called.
 int crsql_changes_begin(sqlite3_vtab *pVTab);
 int crsql_changes_commit(sqlite3_vtab *pVTab);
+int crsql_changes_rollback(sqlite3_vtab *pVTab);
+int crsql_changes_rollback_to(sqlite3_vtab *pVTab, int iSavepoint);
 int crsql_changes_rowid(sqlite3_vtab_cursor *cur, sqlite_int64 *pRowid);
 int crsql_changes_column(
     sqlite3_vtab_cursor *cur, /* The cursor */
@@ -154,7 +143,7 @@ int crsql_changes_column(
 int crsql_changes_eof(sqlite3_vtab_cursor *cur);
 
 sqlite3_module crsql_changesModule = {
-    /* iVersion    */ 0,
+    /* iVersion    */ 2,
     /* xCreate     */ 0,
     /* xConnect    */ changesConnect,
     /* xBestIndex  */ crsql_changes_best_index,
@@ -171,10 +160,10 @@ sqlite3_module crsql_changesModule = {
     /* xBegin      */ crsql_changes_begin,
     /* xSync       */ 0,
     /* xCommit     */ crsql_changes_commit,
-    /* xRollback   */ 0,
+    /* xRollback   */ crsql_changes_rollback,
     /* xFindMethod */ 0,
     /* xRename     */ 0,
     /* xSavepoint  */ 0,
     /* xRelease    */ 0,
-    /* xRollbackTo */ 0,
+    /* xRollbackTo */ crsql_changes_rollback_to,
     /* xShadowName */ 0};
@@ -61,6 +61,10 @@ struct crsql_Changes_vtab {
   sqlite3 *db;
 
   crsql_ExtData *pExtData;
+
+  // State for the merges of the current transaction, including the clock state
+  // of the row most recently merged. Owned and managed by the Rust merge code.
+  void *pMergeCtx;
 };
 
 /**
@@ -74,7 +78,9 @@ struct crsql_Changes_vtab {
  *
  * Most columns are passed-through from
  * `pChangesStmt` and `pRowStmt` which are stepped
- * in each call to `changesNext`.
+ * in calls to `changesNext`. `pRowStmt` selects every
+ * non-pk column of a row and is only re-stepped when
+ * the next change is for a different row.
  *
  * `colVersion` is copied given it is unclear
  * what the behavior is of calling `sqlite3_column_x` on
@@ -106,6 +112,17 @@ struct crsql_Changes_cursor {
 
   sqlite3_int64 changesRowid;
   int tblInfoIdx;
+
+  // Set when changes are read as a merge of per table, version ordered
+  // statements. Owns those statements. `pChangesStmt` then points at
+  // whichever of them holds the current row.
+  void *pChangesMerge;
+
+  // The table and packed primary key `pRowStmt` is positioned on. Consecutive
+  // changes to the same row are served from that one fetch. Owned by Rust.
+  void *pRowKey;
+  // Column of `pRowStmt` holding the value of the current change.
+  int rowStmtCol;
 };
 
 #endif
\ No newline at end of file
@@ -10,6 +10,9 @@
 
 #define DELETE_CID_SENTINEL "__crsql_del"
 #define PKS_ONLY_CID_SENTINEL "__crsql_pko"
+// What the sentinels are stored as in a clock table's `__crsql_col_id`
+#define DELETE_CID_SENTINEL_ID -1
+#define PKS_ONLY_CID_SENTINEL_ID -2
 
 #define CRR_SPACE 0
 #define USER_SPACE 1
@@ -24,10 +27,17 @@
 #define TBL_SITE_ID "__crsql_siteid"
 #define TBL_DB_VERSION "__crsql_dbversion"
 #define TBL_SCHEMA "crsql_master"
+#define TBL_COL_IDS "__crsql_colids"
 #define UNION_ALL "UNION ALL"
 
 #define MAX_TBL_NAME_LEN 2048
 #define SITE_ID_LEN 16
+// Rows backfilled by a `crsql_backfill` call that doesn't pass a chunk size
+#define BACKFILL_CHUNK_ROWS 10000
+// Clock rows compacted per batch by `crsql_commit_alter`
+#define COMPACT_BATCH_ROWS 10000
+// Tombstones removed by a `crsql_gc_tombstones` call that doesn't pass a budget
+#define TOMBSTONE_GC_BUDGET 1000
 
 // Version int:
 // M - major
@@ -38,6 +48,6 @@
 // 00 00 00 00
 // Given we can't prefix an int with 0s, read from right to left.
 // Rightmost is always `bb`
-#define CRSQLITE_VERSION 130000
+#define CRSQLITE_VERSION 140000
 
 #endif
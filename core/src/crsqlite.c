@@ -98,10 +98,12 @@ static void getSeqFunc(sqlite3_context *context, int argc,
 /**
  * Create a new crr --
  * all triggers, views, tables
+ *
+ * With `deferBackfill` existing rows are left to `crsql_backfill`.
  */
 static int createCrr(sqlite3_context *context, sqlite3 *db,
                      const char *schemaName, const char *tblName,
-                     int isCommitAlter, char **err) {
+                     int isCommitAlter, int deferBackfill, char **err) {
   int rc = SQLITE_OK;
   crsql_TableInfo *tableInfo = 0;
 
@@ -124,6 +126,14 @@ static int createCrr(sqlite3_context *context, sqlite3 *db,
     return rc;
   }
 
+  rc = crsql_ensure_col_ids(db, tableInfo);
+  if (rc != SQLITE_OK) {
+    *err =
+        sqlite3_mprintf("Failed to assign column ids for crr -- %s", tblName);
+    crsql_freeTableInfo(tableInfo);
+    return rc;
+  }
+
   rc = crsql_create_clock_table(db, tableInfo, err);
   if (rc == SQLITE_OK) {
     rc = crsql_remove_crr_triggers_if_exist(db, tableInfo->tblName);
@@ -131,6 +141,13 @@ static int createCrr(sqlite3_context *context, sqlite3 *db,
       rc = crsql_create_crr_triggers(db, tableInfo, err);
     }
   }
+  if (rc != SQLITE_OK || deferBackfill) {
+    if (rc == SQLITE_OK) {
+      rc = crsql_begin_backfill(db, tblName);
+    }
+    crsql_freeTableInfo(tableInfo);
+    return rc;
+  }
 
   const char **pkNames = sqlite3_malloc(sizeof(char *) * tableInfo->pksLen);
   for (size_t i = 0; i < tableInfo->pksLen; i++) {
@@ -138,18 +155,57 @@ static int createCrr(sqlite3_context *context, sqlite3 *db,
   }
   const char **nonPkNames =
       sqlite3_malloc(sizeof(char *) * tableInfo->nonPksLen);
+  int *nonPkColIds = sqlite3_malloc(sizeof(int) * tableInfo->nonPksLen);
   for (size_t i = 0; i < tableInfo->nonPksLen; i++) {
     nonPkNames[i] = tableInfo->nonPks[i].name;
+    nonPkColIds[i] = tableInfo->nonPks[i].colId;
   }
   rc = crsql_backfill_table(context, tblName, pkNames, tableInfo->pksLen,
-                            nonPkNames, tableInfo->nonPksLen, isCommitAlter);
+                            nonPkNames, nonPkColIds, tableInfo->nonPksLen,
+                            isCommitAlter);
   sqlite3_free(pkNames);
   sqlite3_free(nonPkNames);
+  sqlite3_free(nonPkColIds);
 
   crsql_freeTableInfo(tableInfo);
   return rc;
 }
 
+/**
+ * Called by the update trigger of each crr with the new pk values followed by
+ * the new and old value of every non-pk column. Bumps the clocks of the
+ * columns that changed.
+ */
+static void crsqlAfterUpdateFunc(sqlite3_context *context, int argc,
+                                 sqlite3_value **argv) {
+  crsql_ExtData *pExtData = (crsql_ExtData *)sqlite3_user_data(context);
+  sqlite3 *db = sqlite3_context_db_handle(context);
+  char *errmsg = 0;
+
+  int rc = crsql_after_update(db, pExtData, argc, argv, &errmsg);
+  if (rc != SQLITE_OK) {
+    sqlite3_result_error(
+        context, errmsg != 0 ? errmsg : "crsql - failed to record update", -1);
+    sqlite3_result_error_code(context, rc);
+    sqlite3_free(errmsg);
+  }
+}
+
+/**
+ * Called by the delete trigger of each crr with the old pk values. Adds the
+ * row to the connection's filter of deleted rows.
+ */
+static void crsqlAfterDeleteFunc(sqlite3_context *context, int argc,
+                                 sqlite3_value **argv) {
+  crsql_ExtData *pExtData = (crsql_ExtData *)sqlite3_user_data(context);
+
+  int rc = crsql_after_delete(pExtData, argc, argv);
+  if (rc != SQLITE_OK) {
+    sqlite3_result_error(context, "crsql - failed to record delete", -1);
+    sqlite3_result_error_code(context, rc);
+  }
+}
+
 static void crsqlSyncBit(sqlite3_context *context, int argc,
                          sqlite3_value **argv) {
   int *syncBit = (int *)sqlite3_user_data(context);
@@ -203,7 +259,7 @@ static void crsqlMakeCrrFunc(sqlite3_context *context, int argc,
     return;
   }
 
-  rc = createCrr(context, db, schemaName, tblName, 0, &errmsg);
+  rc = createCrr(context, db, schemaName, tblName, 0, 0, &errmsg);
   if (rc != SQLITE_OK) {
     sqlite3_result_error(context, errmsg, -1);
     sqlite3_result_error_code(context, rc);
@@ -215,6 +271,162 @@ static void crsqlMakeCrrFunc(sqlite3_context *context, int argc,
   sqlite3_exec(db, "RELEASE as_crr", 0, 0, 0);
 }
 
+/**
+ * Turns a table into a crr over many transactions. The first call creates the
+ * crr without backfilling its existing rows. Every call then backfills the
+ * next chunk of at most the given number of rows and returns how many it
+ * covered, 0 once the backfill is complete. Commit between calls to keep the
+ * write lock short. An interrupted backfill picks up where the last committed
+ * call left off.
+ */
+static void crsqlBackfillFunc(sqlite3_context *context, int argc,
+                              sqlite3_value **argv) {
+  const char *tblName = 0;
+  int rc = SQLITE_OK;
+  sqlite3 *db = sqlite3_context_db_handle(context);
+  char *errmsg = 0;
+  sqlite3_int64 maxRows = BACKFILL_CHUNK_ROWS;
+  sqlite3_int64 rows = 0;
+
+  if (argc < 1 || argc > 2) {
+    sqlite3_result_error(
+        context,
+        "Wrong number of args provided to crsql_backfill. Provide the table "
+        "name and optionally the most rows to backfill.",
+        -1);
+    return;
+  }
+  tblName = (const char *)sqlite3_value_text(argv[0]);
+  if (tblName == 0) {
+    sqlite3_result_error(context, "crsql_backfill needs a table name", -1);
+    return;
+  }
+  if (argc == 2 && sqlite3_value_type(argv[1]) != SQLITE_NULL) {
+    maxRows = sqlite3_value_int64(argv[1]);
+  }
+
+  rc = sqlite3_exec(db, "SAVEPOINT backfill_step", 0, 0, &errmsg);
+  if (rc != SQLITE_OK) {
+    sqlite3_result_error(context, errmsg, -1);
+    sqlite3_free(errmsg);
+    return;
+  }
+
+  rc = crsql_is_crr(db, tblName);
+  if (rc == 0) {
+    rc = createCrr(context, db, "main", tblName, 0, 1, &errmsg);
+  } else if (rc < 0) {
+    rc = rc * -1;
+  } else {
+    rc = SQLITE_OK;
+  }
+  if (rc == SQLITE_OK) {
+    rc = crsql_backfill_step(db, tblName, maxRows, &rows);
+  }
+  if (rc != SQLITE_OK) {
+    sqlite3_result_error(
+        context, errmsg != 0 ? errmsg : "crsql - failed to backfill", -1);
+    sqlite3_result_error_code(context, rc);
+    sqlite3_free(errmsg);
+    sqlite3_exec(db, "ROLLBACK TO backfill_step", 0, 0, 0);
+    sqlite3_exec(db, "RELEASE backfill_step", 0, 0, 0);
+    return;
+  }
+
+  sqlite3_exec(db, "RELEASE backfill_step", 0, 0, 0);
+  sqlite3_result_int64(context, rows);
+}
+
+/**
+ * Reads whether the insert trigger of the named table is paused by a bulk
+ * load on this connection. Called from the `__crsql_itrig` triggers.
+ */
+static void crsqlBulkLoadBitFunc(sqlite3_context *context, int argc,
+                                 sqlite3_value **argv) {
+  crsql_ExtData *pExtData = (crsql_ExtData *)sqlite3_user_data(context);
+  if (pExtData->bulkLoadTablesLen == 0) {
+    sqlite3_result_int(context, 0);
+    return;
+  }
+  const char *tblName = (const char *)sqlite3_value_text(argv[0]);
+  sqlite3_result_int(context,
+                     tblName != 0 && crsql_isBulkLoading(pExtData, tblName));
+}
+
+/**
+ * `crsql_begin_bulk_load(table)` stops recording clock rows for rows
+ * inserted into the crr on this connection until `crsql_end_bulk_load(table)`
+ * records them all at once. Updates and deletes are still recorded as they
+ * happen.
+ */
+static void crsqlBeginBulkLoadFunc(sqlite3_context *context, int argc,
+                                   sqlite3_value **argv) {
+  crsql_ExtData *pExtData = (crsql_ExtData *)sqlite3_user_data(context);
+  sqlite3 *db = sqlite3_context_db_handle(context);
+  const char *tblName = (const char *)sqlite3_value_text(argv[0]);
+  if (tblName == 0) {
+    sqlite3_result_error(context, "crsql_begin_bulk_load needs a table name",
+                         -1);
+    return;
+  }
+
+  int rc = crsql_is_crr(db, tblName);
+  if (rc < 0) {
+    sqlite3_result_error_code(context, rc * -1);
+    return;
+  }
+  if (rc == 0) {
+    char *zErr =
+        sqlite3_mprintf("crsql - %s is not a crr and can't be bulk loaded",
+                        tblName);
+    sqlite3_result_error(context, zErr, -1);
+    sqlite3_free(zErr);
+    return;
+  }
+
+  rc = crsql_addBulkLoad(pExtData, tblName);
+  if (rc != SQLITE_OK) {
+    sqlite3_result_error_code(context, rc);
+  }
+}
+
+/**
+ * `crsql_end_bulk_load(table)` resumes recording inserts into the crr and
+ * gives every row inserted during the bulk load its clock rows, set based and
+ * at a single db version.
+ */
+static void crsqlEndBulkLoadFunc(sqlite3_context *context, int argc,
+                                 sqlite3_value **argv) {
+  crsql_ExtData *pExtData = (crsql_ExtData *)sqlite3_user_data(context);
+  sqlite3 *db = sqlite3_context_db_handle(context);
+  char *errmsg = 0;
+  const char *tblName = (const char *)sqlite3_value_text(argv[0]);
+  if (tblName == 0) {
+    sqlite3_result_error(context, "crsql_end_bulk_load needs a table name",
+                         -1);
+    return;
+  }
+
+  int rc = sqlite3_exec(db, "SAVEPOINT bulk_load", 0, 0, &errmsg);
+  if (rc != SQLITE_OK) {
+    sqlite3_result_error(context, errmsg, -1);
+    sqlite3_free(errmsg);
+    return;
+  }
+
+  rc = crsql_end_bulk_load(db, tblName);
+  if (rc != SQLITE_OK) {
+    sqlite3_result_error(context, "crsql - failed to end the bulk load", -1);
+    sqlite3_result_error_code(context, rc);
+    sqlite3_exec(db, "ROLLBACK TO bulk_load", 0, 0, 0);
+    sqlite3_exec(db, "RELEASE bulk_load", 0, 0, 0);
+    return;
+  }
+
+  sqlite3_exec(db, "RELEASE bulk_load", 0, 0, 0);
+  crsql_removeBulkLoad(pExtData, tblName);
+}
+
 static void crsqlBeginAlterFunc(sqlite3_context *context, int argc,
                                 sqlite3_value **argv) {
   const char *tblName = 0;
@@ -254,132 +466,301 @@ static void crsqlBeginAlterFunc(sqlite3_context *context, int argc,
     sqlite3_exec(db, "ROLLBACK", 0, 0, 0);
     return;
   }
-}
 
-int crsql_compactPostAlter(sqlite3 *db, const char *tblName,
-                           crsql_ExtData *pExtData, char **errmsg) {
-  int rc = SQLITE_OK;
-  rc = crsql_getDbVersion(db, pExtData, errmsg);
+  // lets crsql_commit_alter tell whether any rows were written in between
+  crsql_ExtData *pExtData = (crsql_ExtData *)sqlite3_user_data(context);
+  rc = crsql_addAlterStart(pExtData, tblName, sqlite3_total_changes64(db));
   if (rc != SQLITE_OK) {
-    return rc;
+    sqlite3_result_error_code(context, rc);
+    sqlite3_exec(db, "ROLLBACK", 0, 0, 0);
+    return;
   }
-  char *zSql = 0;
-  sqlite3_int64 currentDbVersion = pExtData->dbVersion;
+}
 
-  // If primary key columns changes
-  // We need to drop, re-create and backfill
-  // the clock table.
-  // A change in pk columns means a change in all identities
-  // of all rows.
-  // We can determine this by comparing pks on clock table vs
-  // pks on source table
+/**
+ * Whether the table's primary key is no longer the one its clock table was
+ * created with.
+ */
+static int pksChanged(sqlite3 *db, const char *tblName,
+                      crsql_TableInfo *tblInfo, int *pChanged) {
   sqlite3_stmt *pStmt = 0;
-  zSql = sqlite3_mprintf(
-      "SELECT count(name) FROM (SELECT name FROM pragma_table_info('%q') "
-      "WHERE pk "
-      "> 0 AND name NOT IN "
-      "(SELECT name FROM pragma_table_info('%q__crsql_clock') WHERE pk > 0) "
-      "UNION "
+  char *zSql = sqlite3_mprintf(
       "SELECT name FROM pragma_table_info('%q__crsql_clock') WHERE pk > 0 "
-      "AND "
-      "name NOT IN (SELECT name FROM pragma_table_info('%q') WHERE pk > 0) "
-      "AND "
-      "name != '__crsql_col_name');",
-      tblName, tblName, tblName, tblName);
-  rc = sqlite3_prepare_v2(db, zSql, -1, &pStmt, 0);
+      "AND name != '__crsql_col_id'",
+      tblName);
+  int rc = sqlite3_prepare_v2(db, zSql, -1, &pStmt, 0);
   sqlite3_free(zSql);
   if (rc != SQLITE_OK) {
     return rc;
   }
-  rc = sqlite3_step(pStmt);
-  if (rc != SQLITE_ROW) {
+
+  int numClockPks = 0;
+  *pChanged = 0;
+  while ((rc = sqlite3_step(pStmt)) == SQLITE_ROW) {
+    const char *zName = (const char *)sqlite3_column_text(pStmt, 0);
+    numClockPks += 1;
+    if (crsql_indexofPk(tblInfo, zName, sqlite3_column_bytes(pStmt, 0)) < 0) {
+      *pChanged = 1;
+    }
+  }
+  sqlite3_finalize(pStmt);
+  if (rc != SQLITE_DONE) {
     return rc;
   }
+  if (numClockPks != tblInfo->pksLen) {
+    *pChanged = 1;
+  }
+  return SQLITE_OK;
+}
 
-  int pkDiff = sqlite3_column_int(pStmt, 0);
+/**
+ * Deletes the clock rows of columns that were dropped. The clock table is
+ * only scanned if a column actually was.
+ */
+static int compactDroppedColumns(sqlite3 *db, const char *tblName,
+                                 crsql_TableInfo *tblInfo,
+                                 sqlite3_int64 *pRemoved, char **errmsg) {
+  sqlite3_stmt *pStmt = 0;
+  int rc = sqlite3_prepare_v2(
+      db, "SELECT col_name, col_id FROM \"" TBL_COL_IDS "\" WHERE tbl_name = ?",
+      -1, &pStmt, 0);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  sqlite3_bind_text(pStmt, 1, tblName, -1, SQLITE_STATIC);
+
+  sqlite3_str *pDropped = sqlite3_str_new(db);
+  int numDropped = 0;
+  while ((rc = sqlite3_step(pStmt)) == SQLITE_ROW) {
+    const char *zName = (const char *)sqlite3_column_text(pStmt, 0);
+    if (crsql_indexofNonPk(tblInfo, zName, sqlite3_column_bytes(pStmt, 0)) <
+        0) {
+      sqlite3_str_appendf(pDropped, "%s%lld", numDropped > 0 ? ", " : "",
+                          sqlite3_column_int64(pStmt, 1));
+      numDropped += 1;
+    }
+  }
   sqlite3_finalize(pStmt);
+  char *zDropped = sqlite3_str_finish(pDropped);
+  if (rc != SQLITE_DONE || numDropped == 0) {
+    sqlite3_free(zDropped);
+    return rc == SQLITE_DONE ? SQLITE_OK : rc;
+  }
 
-  if (pkDiff > 0) {
-    // drop the clock table so we can re-create it
-    zSql = sqlite3_mprintf("DROP TABLE \"%w__crsql_clock\"", tblName);
-    rc = sqlite3_exec(db, zSql, 0, 0, errmsg);
+  char *zSql = sqlite3_mprintf(
+      "DELETE FROM \"%w__crsql_clock\" WHERE \"__crsql_col_id\" IN (%s)",
+      tblName, zDropped);
+  sqlite3_free(zDropped);
+  rc = sqlite3_exec(db, zSql, 0, 0, errmsg);
+  sqlite3_free(zSql);
+  if (rc == SQLITE_OK) {
+    *pRemoved += sqlite3_changes64(db);
+  }
+  return rc;
+}
+
+/**
+ * Deletes the clock rows of rows that were deleted while the table's triggers
+ * were down, leaving their delete sentinels.
+ *
+ * Rather than probing the table once per clock row, the clock table is walked
+ * in primary key order a batch of COMPACT_BATCH_ROWS clock rows at a time and
+ * each batch is anti-joined against the same primary key range of the table,
+ * so both sides are read as ordered range scans.
+ */
+static int compactDeletedRows(sqlite3 *db, const char *tblName,
+                              crsql_TableInfo *tblInfo,
+                              sqlite3_int64 *pRemoved, char **errmsg) {
+  int rc = SQLITE_OK;
+  int nPks = tblInfo->pksLen;
+  sqlite3_str *pPkList = sqlite3_str_new(db);
+  sqlite3_str *pAfterBinds = sqlite3_str_new(db);
+  sqlite3_str *pUptoBinds = sqlite3_str_new(db);
+  sqlite3_str *pNullPks = sqlite3_str_new(db);
+  for (int i = 0; i < nPks; ++i) {
+    const char *zSep = i > 0 ? ", " : "";
+    sqlite3_str_appendf(pPkList, "%s\"%w\"", zSep, tblInfo->pks[i].name);
+    sqlite3_str_appendf(pAfterBinds, "%s?%d", zSep, i + 1);
+    sqlite3_str_appendf(pUptoBinds, "%s?%d", zSep, nPks + i + 1);
+    sqlite3_str_appendf(pNullPks, " OR \"%w\" IS NULL", tblInfo->pks[i].name);
+  }
+  char *zPkList = sqlite3_str_finish(pPkList);
+  char *zAfterBinds = sqlite3_str_finish(pAfterBinds);
+  char *zUptoBinds = sqlite3_str_finish(pUptoBinds);
+  char *zNullPks = sqlite3_str_finish(pNullPks);
+  char *zAfter = sqlite3_mprintf("(%s) > (%s)", zPkList, zAfterBinds);
+  char *zUpto = sqlite3_mprintf("(%s) <= (%s)", zPkList, zUptoBinds);
+
+  // primary key of the last clock row of the previous batch
+  sqlite3_value **apAfter = sqlite3_malloc(nPks * sizeof *apAfter);
+  if (apAfter == 0) {
+    rc = SQLITE_NOMEM;
+  } else {
+    memset(apAfter, 0, nPks * sizeof *apAfter);
+  }
+  int isFirst = 1;
+  int isLast = 0;
+  while (rc == SQLITE_OK && !isLast) {
+    // The last clock row of the batch bounds it from above.
+    sqlite3_stmt *pBound = 0;
+    char *zSql = sqlite3_mprintf(
+        "SELECT %s FROM \"%w__crsql_clock\" WHERE %s ORDER BY %s "
+        "LIMIT 1 OFFSET %d",
+        zPkList, tblName, isFirst ? "1" : zAfter, zPkList,
+        COMPACT_BATCH_ROWS - 1);
+    rc = sqlite3_prepare_v2(db, zSql, -1, &pBound, 0);
     sqlite3_free(zSql);
-    if (rc != SQLITE_OK) {
-      return rc;
+    for (int i = 0; rc == SQLITE_OK && !isFirst && i < nPks; ++i) {
+      rc = sqlite3_bind_value(pBound, i + 1, apAfter[i]);
+    }
+    if (rc == SQLITE_OK) {
+      rc = sqlite3_step(pBound);
+      isLast = rc == SQLITE_DONE;
+      rc = rc == SQLITE_ROW || rc == SQLITE_DONE ? SQLITE_OK : rc;
     }
-  } else {
-    // clock table is still relevant but needs compacting
-    // in case columns were removed during the migration
 
-    // First delete entries that no longer have a column
+    // Rows with NULLs in their primary key sort first but never compare as
+    // in range. The first batch takes them.
+    char *zRange = 0;
+    if (isFirst) {
+      zRange = isLast ? sqlite3_mprintf("1")
+                      : sqlite3_mprintf("(%s%s)", zUpto, zNullPks);
+    } else {
+      zRange = isLast ? sqlite3_mprintf("%s", zAfter)
+                      : sqlite3_mprintf("%s AND %s", zAfter, zUpto);
+    }
+    sqlite3_stmt *pDelete = 0;
     zSql = sqlite3_mprintf(
-        "DELETE FROM \"%w__crsql_clock\" WHERE \"__crsql_col_name\" NOT IN "
-        "(SELECT name FROM pragma_table_info(%Q) UNION SELECT '%s' UNION "
-        "SELECT "
-        "'%s')",
-        tblName, tblName, DELETE_CID_SENTINEL, PKS_ONLY_CID_SENTINEL);
-    rc = sqlite3_exec(db, zSql, 0, 0, errmsg);
+        "DELETE FROM \"%w__crsql_clock\" WHERE __crsql_col_id != %d AND "
+        "(%s) IN (SELECT %s FROM \"%w__crsql_clock\" WHERE %s EXCEPT "
+        "SELECT %s FROM \"%w\" WHERE %s)",
+        tblName, DELETE_CID_SENTINEL_ID, zPkList, zPkList, tblName, zRange,
+        zPkList, tblName, zRange);
+    sqlite3_free(zRange);
+    if (rc == SQLITE_OK) {
+      rc = sqlite3_prepare_v2(db, zSql, -1, &pDelete, 0);
+    }
     sqlite3_free(zSql);
-    if (rc != SQLITE_OK) {
-      return rc;
+    for (int i = 0; rc == SQLITE_OK && !isFirst && i < nPks; ++i) {
+      rc = sqlite3_bind_value(pDelete, i + 1, apAfter[i]);
     }
-
-    // Next delete entries that no longer have a row
-    sqlite3_str *pDynStr = sqlite3_str_new(db);
-    if (pDynStr == 0) {
-      return SQLITE_NOMEM;
+    for (int i = 0; rc == SQLITE_OK && !isLast && i < nPks; ++i) {
+      rc = sqlite3_bind_value(pDelete, nPks + i + 1,
+                              sqlite3_column_value(pBound, i));
     }
-    sqlite3_str_appendf(
-        pDynStr,
-        "DELETE FROM \"%w__crsql_clock\" WHERE __crsql_col_name != "
-        "'__crsql_del' AND NOT EXISTS (SELECT 1 FROM "
-        "\"%w\" WHERE ",
-        tblName, tblName);
-    // get table info
-    rc = crsql_ensureTableInfosAreUpToDate(db, pExtData, errmsg);
-    if (rc != SQLITE_OK) {
-      zSql = sqlite3_str_finish(pDynStr);
-      sqlite3_free(zSql);
-      return rc;
+    if (rc == SQLITE_OK) {
+      rc = sqlite3_step(pDelete);
+      rc = rc == SQLITE_DONE ? SQLITE_OK : rc;
     }
-    crsql_TableInfo *tblInfo = crsql_findTableInfo(
-        pExtData->zpTableInfos, pExtData->tableInfosLen, (const char *)tblName);
-    if (tblInfo == 0) {
-      zSql = sqlite3_str_finish(pDynStr);
-      sqlite3_free(zSql);
-      return SQLITE_ERROR;
+    sqlite3_finalize(pDelete);
+    if (rc == SQLITE_OK) {
+      *pRemoved += sqlite3_changes64(db);
     }
-    // for each pk col, append \"%w\".\"%w\" = \"%w__crsql_clock\".\"%w\"
-    // to the where clause then close the statement.
-    for (size_t i = 0; i < tblInfo->pksLen; i++) {
-      if (i > 0) {
-        sqlite3_str_appendall(pDynStr, " AND ");
+
+    for (int i = 0; rc == SQLITE_OK && !isLast && i < nPks; ++i) {
+      sqlite3_value_free(apAfter[i]);
+      apAfter[i] = sqlite3_value_dup(sqlite3_column_value(pBound, i));
+      if (apAfter[i] == 0) {
+        rc = SQLITE_NOMEM;
       }
-      sqlite3_str_appendf(pDynStr, "\"%w\".\"%w\" = \"%w__crsql_clock\".\"%w\"",
-                          tblName, tblInfo->pks[i].name, tblName,
-                          tblInfo->pks[i].name);
     }
-    sqlite3_str_appendall(pDynStr, "LIMIT 1)");
-    zSql = sqlite3_str_finish(pDynStr);
+    sqlite3_finalize(pBound);
+    isFirst = 0;
+  }
+
+  for (int i = 0; apAfter != 0 && i < nPks; ++i) {
+    sqlite3_value_free(apAfter[i]);
+  }
+  sqlite3_free(apAfter);
+  sqlite3_free(zPkList);
+  sqlite3_free(zAfterBinds);
+  sqlite3_free(zUptoBinds);
+  sqlite3_free(zNullPks);
+  sqlite3_free(zAfter);
+  sqlite3_free(zUpto);
+  if (rc != SQLITE_OK && *errmsg == 0) {
+    *errmsg = sqlite3_mprintf("crsql - failed to compact %s: %s", tblName,
+                              sqlite3_errmsg(db));
+  }
+  return rc;
+}
+
+static int tableIsEmpty(sqlite3 *db, const char *tblName, int *pEmpty) {
+  sqlite3_stmt *pStmt = 0;
+  char *zSql = sqlite3_mprintf("SELECT 1 FROM \"%w\" LIMIT 1", tblName);
+  if (zSql == 0) {
+    return SQLITE_NOMEM;
+  }
+  int rc = sqlite3_prepare_v2(db, zSql, -1, &pStmt, 0);
+  sqlite3_free(zSql);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  rc = sqlite3_step(pStmt);
+  *pEmpty = rc == SQLITE_DONE;
+  if (rc == SQLITE_ROW || rc == SQLITE_DONE) {
+    rc = SQLITE_OK;
+  }
+  sqlite3_finalize(pStmt);
+  return rc;
+}
+
+/**
+ * Brings the clock table of a crr in line with its altered schema. Clock rows
+ * of dropped columns and of rows deleted during the alter are removed. The
+ * clock table is dropped, to be recreated and backfilled, if the primary key
+ * changed, since that changes the identity of every row.
+ *
+ * `pRemoved` is set to the number of clock rows removed by compaction.
+ */
+int crsql_compactPostAlter(sqlite3 *db, const char *tblName,
+                           crsql_ExtData *pExtData, sqlite3_int64 *pRemoved,
+                           char **errmsg) {
+  *pRemoved = 0;
+  sqlite3_int64 totalChangesAtBegin = -1;
+  crsql_removeAlterStart(pExtData, tblName, &totalChangesAtBegin);
+  int rc = crsql_ensureTableInfosAreUpToDate(db, pExtData, errmsg);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  crsql_TableInfo *tblInfo = crsql_findTableInfoByName(pExtData, tblName);
+  if (tblInfo == 0) {
+    return SQLITE_ERROR;
+  }
+
+  int pkChanged = 0;
+  rc = pksChanged(db, tblName, tblInfo, &pkChanged);
+  if (rc != SQLITE_OK) {
+    return rc;
+  }
+  if (pkChanged) {
+    // drop the clock table so we can re-create it
+    char *zSql = sqlite3_mprintf("DROP TABLE \"%w__crsql_clock\"", tblName);
     rc = sqlite3_exec(db, zSql, 0, 0, errmsg);
     sqlite3_free(zSql);
-    if (rc != SQLITE_OK) {
-      return rc;
-    }
+    return rc;
   }
 
-  rc = sqlite3_prepare_v2(db,
-                          "INSERT OR REPLACE INTO crsql_master (key, value) "
-                          "VALUES ('pre_compact_dbversion', ?)",
-                          -1, &pStmt, 0);
-  rc += sqlite3_bind_int64(pStmt, 1, currentDbVersion);
-  rc += sqlite3_step(pStmt);
-  if (rc != SQLITE_DONE) {
+  rc = compactDroppedColumns(db, tblName, tblInfo, pRemoved, errmsg);
+  if (rc != SQLITE_OK) {
     return rc;
   }
-  rc = sqlite3_finalize(pStmt);
 
-  return rc;
+  // Rows can only have gone missing if rows were written since
+  // crsql_begin_alter on this table. An alter that only added columns writes
+  // none. Dropping and re-creating the table writes none either but leaves it
+  // empty until rows are inserted, which are counted.
+  if (totalChangesAtBegin >= 0 &&
+      totalChangesAtBegin == sqlite3_total_changes64(db)) {
+    int empty = 0;
+    rc = tableIsEmpty(db, tblName, &empty);
+    if (rc != SQLITE_OK || !empty) {
+      return rc;
+    }
+  }
+  // The db version lives in its own table so dropping clock rows here
+  // doesn't move it backwards.
+  return compactDeletedRows(db, tblName, tblInfo, pRemoved, errmsg);
 }
 
 static void crsqlCommitAlterFunc(sqlite3_context *context, int argc,
@@ -408,9 +789,10 @@ static void crsqlCommitAlterFunc(sqlite3_context *context, int argc,
   }
 
   crsql_ExtData *pExtData = (crsql_ExtData *)sqlite3_user_data(context);
-  rc = crsql_compactPostAlter(db, tblName, pExtData, &errmsg);
+  sqlite3_int64 removed = 0;
+  rc = crsql_compactPostAlter(db, tblName, pExtData, &removed, &errmsg);
   if (rc == SQLITE_OK) {
-    rc = createCrr(context, db, schemaName, tblName, 1, &errmsg);
+    rc = createCrr(context, db, schemaName, tblName, 1, 0, &errmsg);
   }
   if (rc == SQLITE_OK) {
     rc = sqlite3_exec(db, "RELEASE alter_crr", 0, 0, &errmsg);
@@ -421,6 +803,7 @@ static void crsqlCommitAlterFunc(sqlite3_context *context, int argc,
     sqlite3_exec(db, "ROLLBACK", 0, 0, 0);
     return;
   }
+  sqlite3_result_int64(context, removed);
 }
 
 static void freeConnectionExtData(void *pUserData) {
@@ -441,11 +824,236 @@ static void crsqlRowsImpacted(sqlite3_context *context, int argc,
   sqlite3_result_int(context, pExtData->rowsImpacted);
 }
 
+/**
+ * Merges a batch of changes packed as consecutive `crsql_pack_columns`
+ * records of `crsql_changes` rows. Cells are grouped by (table, pk) so each row
+ * is merged with one clock lookup and one upsert rather than one per cell.
+ * A truthy second argument merges rows in primary key order rather than in
+ * the order they arrived. The optional third is the site id of the peer the
+ * changes came from, whose changes below its applied watermark are dropped.
+ *
+ * Returns the number of cells that won the merge.
+ */
+static void crsqlApplyChangesFunc(sqlite3_context *context, int argc,
+                                  sqlite3_value **argv) {
+  int rc = SQLITE_OK;
+  sqlite3 *db = sqlite3_context_db_handle(context);
+  crsql_ExtData *pExtData = (crsql_ExtData *)sqlite3_user_data(context);
+  char *errmsg = 0;
+  sqlite3_int64 applied = 0;
+
+  int inKeyOrder = 0;
+  const unsigned char *sender = 0;
+  int senderLen = 0;
+
+  if (argc < 1 || argc > 3) {
+    sqlite3_result_error(
+        context,
+        "Wrong number of args provided to crsql_apply_changes. Provide the "
+        "packed changes, optionally whether to merge them in key order and "
+        "the site id of the sender.",
+        -1);
+    return;
+  }
+  if (argc >= 2) {
+    inKeyOrder = sqlite3_value_int(argv[1]);
+  }
+  if (argc == 3 && sqlite3_value_type(argv[2]) == SQLITE_BLOB) {
+    sender = sqlite3_value_blob(argv[2]);
+    senderLen = sqlite3_value_bytes(argv[2]);
+  }
+
+  rc = sqlite3_exec(db, "SAVEPOINT apply_changes", 0, 0, &errmsg);
+  if (rc != SQLITE_OK) {
+    sqlite3_result_error(context, errmsg, -1);
+    sqlite3_free(errmsg);
+    return;
+  }
+
+  rc = crsql_apply_changes(db, pExtData, sqlite3_value_blob(argv[0]),
+                           sqlite3_value_bytes(argv[0]), inKeyOrder, sender,
+                           senderLen, &applied, &errmsg);
+  if (rc != SQLITE_OK) {
+    sqlite3_result_error(
+        context, errmsg != 0 ? errmsg : "crsql - failed to apply changes", -1);
+    sqlite3_result_error_code(context, rc);
+    sqlite3_free(errmsg);
+    sqlite3_exec(db, "ROLLBACK TO apply_changes", 0, 0, 0);
+    sqlite3_exec(db, "RELEASE apply_changes", 0, 0, 0);
+    return;
+  }
+
+  sqlite3_exec(db, "RELEASE apply_changes", 0, 0, 0);
+  sqlite3_result_int64(context, applied);
+}
+
+/**
+ * Encodes every change after the given db version into a compact changeset.
+ * Changes that originated at the optional site id are left out.
+ */
+static void crsqlChangesetExportFunc(sqlite3_context *context, int argc,
+                                     sqlite3_value **argv) {
+  int rc = SQLITE_OK;
+  sqlite3 *db = sqlite3_context_db_handle(context);
+  char *errmsg = 0;
+  unsigned char *changeset = 0;
+  int changesetLen = 0;
+  const unsigned char *excludeSite = 0;
+  int excludeSiteLen = 0;
+
+  if (argc < 1 || argc > 2) {
+    sqlite3_result_error(
+        context,
+        "Wrong number of args provided to crsql_changeset_export. Provide the "
+        "db version to export changes after and optionally a site id to "
+        "exclude.",
+        -1);
+    return;
+  }
+
+  if (argc == 2 && sqlite3_value_type(argv[1]) != SQLITE_NULL) {
+    excludeSite = sqlite3_value_blob(argv[1]);
+    excludeSiteLen = sqlite3_value_bytes(argv[1]);
+  }
+
+  crsql_ExtData *pExtData = (crsql_ExtData *)sqlite3_user_data(context);
+  rc = crsql_changeset_export(db, pExtData, sqlite3_value_int64(argv[0]),
+                              excludeSite, excludeSiteLen, &changeset,
+                              &changesetLen, &errmsg);
+  if (rc != SQLITE_OK) {
+    sqlite3_result_error(
+        context, errmsg != 0 ? errmsg : "crsql - failed to export changes",
+        -1);
+    sqlite3_result_error_code(context, rc);
+    sqlite3_free(errmsg);
+    return;
+  }
+
+  sqlite3_result_blob(context, changeset, changesetLen, sqlite3_free);
+}
+
+static void crsqlChangesetImportFunc(sqlite3_context *context, int argc,
+                                     sqlite3_value **argv) {
+  int rc = SQLITE_OK;
+  sqlite3 *db = sqlite3_context_db_handle(context);
+  crsql_ExtData *pExtData = (crsql_ExtData *)sqlite3_user_data(context);
+  char *errmsg = 0;
+  sqlite3_int64 applied = 0;
+
+  if (argc != 1) {
+    sqlite3_result_error(
+        context,
+        "Wrong number of args provided to crsql_changeset_import. Provide the "
+        "changeset.",
+        -1);
+    return;
+  }
+
+  rc = sqlite3_exec(db, "SAVEPOINT changeset_import", 0, 0, &errmsg);
+  if (rc != SQLITE_OK) {
+    sqlite3_result_error(context, errmsg, -1);
+    sqlite3_free(errmsg);
+    return;
+  }
+
+  rc = crsql_changeset_import(db, pExtData, sqlite3_value_blob(argv[0]),
+                              sqlite3_value_bytes(argv[0]), &applied, &errmsg);
+  if (rc != SQLITE_OK) {
+    sqlite3_result_error(
+        context, errmsg != 0 ? errmsg : "crsql - failed to import changeset",
+        -1);
+    sqlite3_result_error_code(context, rc);
+    sqlite3_free(errmsg);
+    sqlite3_exec(db, "ROLLBACK TO changeset_import", 0, 0, 0);
+    sqlite3_exec(db, "RELEASE changeset_import", 0, 0, 0);
+    return;
+  }
+
+  sqlite3_exec(db, "RELEASE changeset_import", 0, 0, 0);
+  sqlite3_result_int64(context, applied);
+}
+
+/**
+ * Removes tombstones that every tracked peer has received, at most the given
+ * number of them. Returns how many were removed. Call again until it returns 0
+ * to collect all of them without holding the write lock for long.
+ */
+static void crsqlGcTombstonesFunc(sqlite3_context *context, int argc,
+                                  sqlite3_value **argv) {
+  int rc = SQLITE_OK;
+  sqlite3 *db = sqlite3_context_db_handle(context);
+  crsql_ExtData *pExtData = (crsql_ExtData *)sqlite3_user_data(context);
+  char *errmsg = 0;
+  sqlite3_int64 budget = TOMBSTONE_GC_BUDGET;
+  sqlite3_int64 removed = 0;
+
+  if (argc > 1) {
+    sqlite3_result_error(
+        context,
+        "Wrong number of args provided to crsql_gc_tombstones. Optionally "
+        "provide the most tombstones to remove.",
+        -1);
+    return;
+  }
+  if (argc == 1 && sqlite3_value_type(argv[0]) != SQLITE_NULL) {
+    budget = sqlite3_value_int64(argv[0]);
+  }
+
+  rc = sqlite3_exec(db, "SAVEPOINT gc_tombstones", 0, 0, &errmsg);
+  if (rc != SQLITE_OK) {
+    sqlite3_result_error(context, errmsg, -1);
+    sqlite3_free(errmsg);
+    return;
+  }
+
+  rc = crsql_gc_tombstones(db, pExtData, budget, &removed, &errmsg);
+  if (rc != SQLITE_OK) {
+    sqlite3_result_error(
+        context,
+        errmsg != 0 ? errmsg : "crsql - failed to collect tombstones", -1);
+    sqlite3_result_error_code(context, rc);
+    sqlite3_free(errmsg);
+    sqlite3_exec(db, "ROLLBACK TO gc_tombstones", 0, 0, 0);
+    sqlite3_exec(db, "RELEASE gc_tombstones", 0, 0, 0);
+    return;
+  }
+
+  sqlite3_exec(db, "RELEASE gc_tombstones", 0, 0, 0);
+  sqlite3_result_int64(context, removed);
+}
+
+/**
+ * Reports how well the prepared statement cache used by merges and
+ * `crsql_changes` reads is doing, as a JSON object.
+ */
+static void crsqlStmtCacheStatsFunc(sqlite3_context *context, int argc,
+                                    sqlite3_value **argv) {
+  crsql_ExtData *pExtData = (crsql_ExtData *)sqlite3_user_data(context);
+  sqlite3_int64 hits = 0;
+  sqlite3_int64 misses = 0;
+  sqlite3_int64 evictions = 0;
+  sqlite3_int64 size = 0;
+  sqlite3_int64 capacity = 0;
+
+  crsql_get_stmt_cache_stats(pExtData, &hits, &misses, &evictions, &size,
+                             &capacity);
+  char *zStats = sqlite3_mprintf(
+      "{\"hits\":%lld,\"misses\":%lld,\"evictions\":%lld,\"size\":%lld,"
+      "\"capacity\":%lld}",
+      hits, misses, evictions, size, capacity);
+  if (zStats == 0) {
+    sqlite3_result_error_nomem(context);
+    return;
+  }
+  sqlite3_result_text(context, zStats, -1, sqlite3_free);
+}
+
 static int commitHook(void *pUserData) {
   crsql_ExtData *pExtData = (crsql_ExtData *)pUserData;
 
   pExtData->dbVersion = -1;
   pExtData->seq = 0;
+  crsql_end_tombstone_filters_txn(pExtData, 1);
   return SQLITE_OK;
 }
 
@@ -453,6 +1061,7 @@ static void rollbackHook(void *pUserData) {
   crsql_ExtData *pExtData = (crsql_ExtData *)pUserData;
 
   pExtData->dbVersion = -1;
+  crsql_end_tombstone_filters_txn(pExtData, 0);
 }
 
 int sqlite3_crsqlrustbundle_init(sqlite3 *db, char **pzErrMsg,
@@ -507,7 +1116,7 @@ __declspec(dllexport)
   }
 
   if (rc == SQLITE_OK) {
-    rc = crsql_maybe_update_db(db);
+    rc = crsql_maybe_update_db(db, pzErrMsg);
   }
   if (rc == SQLITE_OK) {
     rc = sqlite3_create_function(
@@ -540,6 +1149,18 @@ __declspec(dllexport)
         getSeqFunc, 0, 0);
   }
 
+  if (rc == SQLITE_OK) {
+    rc = sqlite3_create_function(db, "crsql_after_update", -1,
+                                 SQLITE_UTF8 | SQLITE_INNOCUOUS, pExtData,
+                                 crsqlAfterUpdateFunc, 0, 0);
+  }
+
+  if (rc == SQLITE_OK) {
+    rc = sqlite3_create_function(db, "crsql_after_delete", -1,
+                                 SQLITE_UTF8 | SQLITE_INNOCUOUS, pExtData,
+                                 crsqlAfterDeleteFunc, 0, 0);
+  }
+
   if (rc == SQLITE_OK) {
     // Only register a commit hook, not update or pre-update, since all rows
     // in the same transaction should have the same clock value. This allows
@@ -553,8 +1174,32 @@ __declspec(dllexport)
   }
 
   if (rc == SQLITE_OK) {
-    rc = sqlite3_create_function(db, "crsql_begin_alter", -1,
+    rc = sqlite3_create_function(db, "crsql_backfill", -1,
                                  SQLITE_UTF8 | SQLITE_DIRECTONLY, 0,
+                                 crsqlBackfillFunc, 0, 0);
+  }
+
+  if (rc == SQLITE_OK) {
+    rc = sqlite3_create_function(db, "crsql_internal_bulk_load_bit", 1,
+                                 SQLITE_UTF8 | SQLITE_INNOCUOUS, pExtData,
+                                 crsqlBulkLoadBitFunc, 0, 0);
+  }
+
+  if (rc == SQLITE_OK) {
+    rc = sqlite3_create_function(db, "crsql_begin_bulk_load", 1,
+                                 SQLITE_UTF8 | SQLITE_DIRECTONLY, pExtData,
+                                 crsqlBeginBulkLoadFunc, 0, 0);
+  }
+
+  if (rc == SQLITE_OK) {
+    rc = sqlite3_create_function(db, "crsql_end_bulk_load", 1,
+                                 SQLITE_UTF8 | SQLITE_DIRECTONLY, pExtData,
+                                 crsqlEndBulkLoadFunc, 0, 0);
+  }
+
+  if (rc == SQLITE_OK) {
+    rc = sqlite3_create_function(db, "crsql_begin_alter", -1,
+                                 SQLITE_UTF8 | SQLITE_DIRECTONLY, pExtData,
                                  crsqlBeginAlterFunc, 0, 0);
   }
 
@@ -577,6 +1222,36 @@ __declspec(dllexport)
                                  crsqlRowsImpacted, 0, 0);
   }
 
+  if (rc == SQLITE_OK) {
+    rc = sqlite3_create_function(db, "crsql_apply_changes", -1,
+                                 SQLITE_UTF8 | SQLITE_DIRECTONLY, pExtData,
+                                 crsqlApplyChangesFunc, 0, 0);
+  }
+
+  if (rc == SQLITE_OK) {
+    rc = sqlite3_create_function(db, "crsql_changeset_export", -1,
+                                 SQLITE_UTF8 | SQLITE_DIRECTONLY, pExtData,
+                                 crsqlChangesetExportFunc, 0, 0);
+  }
+
+  if (rc == SQLITE_OK) {
+    rc = sqlite3_create_function(db, "crsql_changeset_import", 1,
+                                 SQLITE_UTF8 | SQLITE_DIRECTONLY, pExtData,
+                                 crsqlChangesetImportFunc, 0, 0);
+  }
+
+  if (rc == SQLITE_OK) {
+    rc = sqlite3_create_function(db, "crsql_gc_tombstones", -1,
+                                 SQLITE_UTF8 | SQLITE_DIRECTONLY, pExtData,
+                                 crsqlGcTombstonesFunc, 0, 0);
+  }
+
+  if (rc == SQLITE_OK) {
+    rc = sqlite3_create_function(db, "crsql_stmt_cache_stats", 0,
+                                 SQLITE_UTF8 | SQLITE_INNOCUOUS, pExtData,
+                                 crsqlStmtCacheStatsFunc, 0, 0);
+  }
+
   if (rc == SQLITE_OK) {
     rc = sqlite3_create_module_v2(db, "crsql_changes", &crsql_changesModule,
                                   pExtData, 0);
@@ -1,11 +1,15 @@
 #include "ext-data.h"
 
+#include <string.h>
+
 #include "consts.h"
 #include "get-table.h"
 #include "util.h"
 
 void crsql_init_stmt_cache(crsql_ExtData *pExtData);
 void crsql_clear_stmt_cache(crsql_ExtData *pExtData);
+void crsql_reset_stmt_cache(crsql_ExtData *pExtData);
+void crsql_free_tombstone_filters(crsql_ExtData *pExtData);
 
 crsql_ExtData *crsql_newExtData(sqlite3 *db) {
   crsql_ExtData *pExtData = sqlite3_malloc(sizeof *pExtData);
@@ -34,9 +38,15 @@ crsql_ExtData *crsql_newExtData(sqlite3 *db) {
   pExtData->pDbVersionStmt = 0;
   pExtData->zpTableInfos = 0;
   pExtData->tableInfosLen = 0;
+  crsql_initNameIndex(&(pExtData->tableInfoIndex), 0);
   pExtData->rowsImpacted = 0;
   pExtData->pStmtCache = 0;
   crsql_init_stmt_cache(pExtData);
+  pExtData->zpBulkLoadTables = 0;
+  pExtData->bulkLoadTablesLen = 0;
+  pExtData->pAlterStarts = 0;
+  pExtData->pTombstoneFilters = 0;
+  pExtData->pSetDbVersionStmt = 0;
 
   int pv = crsql_fetchPragmaDataVersion(db, pExtData);
   if (pv == -1 || rc != SQLITE_OK) {
@@ -54,8 +64,20 @@ void crsql_freeExtData(crsql_ExtData *pExtData) {
   sqlite3_finalize(pExtData->pPragmaDataVersionStmt);
   sqlite3_finalize(pExtData->pSetSyncBitStmt);
   sqlite3_finalize(pExtData->pClearSyncBitStmt);
+  sqlite3_finalize(pExtData->pSetDbVersionStmt);
   crsql_freeAllTableInfos(pExtData->zpTableInfos, pExtData->tableInfosLen);
+  crsql_freeNameIndex(&(pExtData->tableInfoIndex));
   crsql_clear_stmt_cache(pExtData);
+  crsql_free_tombstone_filters(pExtData);
+  for (int i = 0; i < pExtData->bulkLoadTablesLen; ++i) {
+    sqlite3_free(pExtData->zpBulkLoadTables[i]);
+  }
+  sqlite3_free(pExtData->zpBulkLoadTables);
+  sqlite3_int64 totalChanges;
+  while (pExtData->pAlterStarts != 0) {
+    crsql_removeAlterStart(pExtData, pExtData->pAlterStarts->zTblName,
+                           &totalChanges);
+  }
   sqlite3_free(pExtData);
 }
 
@@ -70,12 +92,14 @@ void crsql_finalize(crsql_ExtData *pExtData) {
   sqlite3_finalize(pExtData->pPragmaDataVersionStmt);
   sqlite3_finalize(pExtData->pSetSyncBitStmt);
   sqlite3_finalize(pExtData->pClearSyncBitStmt);
+  sqlite3_finalize(pExtData->pSetDbVersionStmt);
   crsql_clear_stmt_cache(pExtData);
   pExtData->pDbVersionStmt = 0;
   pExtData->pPragmaSchemaVersionStmt = 0;
   pExtData->pPragmaDataVersionStmt = 0;
   pExtData->pSetSyncBitStmt = 0;
   pExtData->pClearSyncBitStmt = 0;
+  pExtData->pSetDbVersionStmt = 0;
 }
 
 #define DB_VERSION_SCHEMA_VERSION 0
@@ -135,6 +159,19 @@ int crsql_recreateDbVersionStmt(sqlite3 *db, crsql_ExtData *pExtData) {
   sqlite3_finalize(pExtData->pDbVersionStmt);
   pExtData->pDbVersionStmt = 0;
 
+  // The db version is kept in a single row that writers raise once per
+  // transaction, see crsql_raiseDbVersion.
+  rc = sqlite3_prepare_v3(db, "SELECT db_version FROM \"" TBL_DB_VERSION "\"",
+                          -1, SQLITE_PREPARE_PERSISTENT,
+                          &(pExtData->pDbVersionStmt), 0);
+  if (rc == SQLITE_OK) {
+    return rc;
+  }
+  sqlite3_finalize(pExtData->pDbVersionStmt);
+  pExtData->pDbVersionStmt = 0;
+
+  // Dbs that predate that table and were opened read-only, so could not be
+  // migrated, compute the version from every clock table instead.
   crsql_get_table(db, CLOCK_TABLES_SELECT, &rClockTableNames, &rNumRows,
                   &rNumCols, 0);
 
@@ -256,6 +293,34 @@ int crsql_getDbVersion(sqlite3 *db, crsql_ExtData *pExtData, char **errmsg) {
   return rc;
 }
 
+/**
+ * Stores `version` in __crsql_dbversion if it is later than what is there.
+ *
+ * Called by whatever writes a clock row, with the version it wrote. The
+ * triggers do the same in SQL. Each transaction hands out a single version of
+ * its own so only its first clock row, and merged rows carrying a later
+ * version, change the stored row.
+ */
+int crsql_raiseDbVersion(sqlite3 *db, crsql_ExtData *pExtData,
+                         sqlite3_int64 version) {
+  int rc = SQLITE_OK;
+  if (pExtData->pSetDbVersionStmt == 0) {
+    rc = sqlite3_prepare_v3(
+        db,
+        "UPDATE \"" TBL_DB_VERSION "\" SET db_version = ?1"
+        " WHERE db_version < ?1",
+        -1, SQLITE_PREPARE_PERSISTENT, &(pExtData->pSetDbVersionStmt), 0);
+    if (rc != SQLITE_OK) {
+      return rc;
+    }
+  }
+
+  sqlite3_bind_int64(pExtData->pSetDbVersionStmt, 1, version);
+  rc = sqlite3_step(pExtData->pSetDbVersionStmt);
+  sqlite3_reset(pExtData->pSetDbVersionStmt);
+  return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
 /**
  * Should only ever be called when absolutely required.
  * This can be an expensive operation.
@@ -283,19 +348,142 @@ int crsql_ensureTableInfosAreUpToDate(sqlite3 *db, crsql_ExtData *pExtData,
   }
 
   if (bSchemaChanged || pExtData->zpTableInfos == 0) {
-    // clean up old table infos
+    // clean up old table infos.
+    // cached statements are keyed by table info index so they go too.
+    crsql_reset_stmt_cache(pExtData);
+    crsql_freeNameIndex(&(pExtData->tableInfoIndex));
     crsql_freeAllTableInfos(pExtData->zpTableInfos, pExtData->tableInfosLen);
 
     // re-fetch table infos
     rc = crsql_pullAllTableInfos(db, &(pExtData->zpTableInfos),
                                  &(pExtData->tableInfosLen), errmsg);
+    if (rc == SQLITE_OK) {
+      rc = crsql_initNameIndex(&(pExtData->tableInfoIndex),
+                               pExtData->tableInfosLen);
+    }
     if (rc != SQLITE_OK) {
       crsql_freeAllTableInfos(pExtData->zpTableInfos, pExtData->tableInfosLen);
       pExtData->zpTableInfos = 0;
       pExtData->tableInfosLen = 0;
       return rc;
     }
+    for (int i = 0; i < pExtData->tableInfosLen; ++i) {
+      crsql_addToNameIndex(&(pExtData->tableInfoIndex),
+                           pExtData->zpTableInfos[i]->tblName, i);
+    }
   }
 
   return rc;
 }
+
+/**
+ * Hash lookup of a table info by name. Only valid after
+ * `crsql_ensureTableInfosAreUpToDate`. `tblName` need not be null terminated.
+ */
+int crsql_indexofTableInfoByName(crsql_ExtData *pExtData, const char *tblName,
+                                 int tblNameLen) {
+  return crsql_lookupNameIndex(&(pExtData->tableInfoIndex), tblName,
+                               tblNameLen);
+}
+
+crsql_TableInfo *crsql_findTableInfoByName(crsql_ExtData *pExtData,
+                                           const char *tblName) {
+  int idx = crsql_indexofTableInfoByName(pExtData, tblName, strlen(tblName));
+  if (idx < 0) {
+    return 0;
+  }
+  return pExtData->zpTableInfos[idx];
+}
+
+/**
+ * Whether `tblName` is being bulk loaded on this connection. Table names
+ * compare case insensitively, as they do in SQL.
+ */
+int crsql_isBulkLoading(crsql_ExtData *pExtData, const char *tblName) {
+  for (int i = 0; i < pExtData->bulkLoadTablesLen; ++i) {
+    if (sqlite3_stricmp(pExtData->zpBulkLoadTables[i], tblName) == 0) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+int crsql_addBulkLoad(crsql_ExtData *pExtData, const char *tblName) {
+  if (crsql_isBulkLoading(pExtData, tblName)) {
+    return SQLITE_OK;
+  }
+  char **zpTables = sqlite3_realloc64(
+      pExtData->zpBulkLoadTables,
+      (pExtData->bulkLoadTablesLen + 1) * sizeof *zpTables);
+  if (zpTables == 0) {
+    return SQLITE_NOMEM;
+  }
+  pExtData->zpBulkLoadTables = zpTables;
+  char *zName = sqlite3_mprintf("%s", tblName);
+  if (zName == 0) {
+    return SQLITE_NOMEM;
+  }
+  zpTables[pExtData->bulkLoadTablesLen] = zName;
+  pExtData->bulkLoadTablesLen += 1;
+  return SQLITE_OK;
+}
+
+/**
+ * Returns 1 if `tblName` was being bulk loaded, 0 otherwise.
+ */
+int crsql_removeBulkLoad(crsql_ExtData *pExtData, const char *tblName) {
+  for (int i = 0; i < pExtData->bulkLoadTablesLen; ++i) {
+    if (sqlite3_stricmp(pExtData->zpBulkLoadTables[i], tblName) == 0) {
+      sqlite3_free(pExtData->zpBulkLoadTables[i]);
+      pExtData->bulkLoadTablesLen -= 1;
+      pExtData->zpBulkLoadTables[i] =
+          pExtData->zpBulkLoadTables[pExtData->bulkLoadTablesLen];
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Records that `tblName` is being altered, replacing any record left behind
+ * by an alter that was never committed.
+ */
+int crsql_addAlterStart(crsql_ExtData *pExtData, const char *tblName,
+                        sqlite3_int64 totalChanges) {
+  sqlite3_int64 ignored;
+  crsql_removeAlterStart(pExtData, tblName, &ignored);
+  crsql_AlterStart *pStart = sqlite3_malloc(sizeof *pStart);
+  if (pStart == 0) {
+    return SQLITE_NOMEM;
+  }
+  pStart->zTblName = sqlite3_mprintf("%s", tblName);
+  if (pStart->zTblName == 0) {
+    sqlite3_free(pStart);
+    return SQLITE_NOMEM;
+  }
+  pStart->totalChanges = totalChanges;
+  pStart->pNext = pExtData->pAlterStarts;
+  pExtData->pAlterStarts = pStart;
+  return SQLITE_OK;
+}
+
+/**
+ * Returns 1 and sets `pTotalChanges` if `tblName` was being altered, 0
+ * otherwise.
+ */
+int crsql_removeAlterStart(crsql_ExtData *pExtData, const char *tblName,
+                           sqlite3_int64 *pTotalChanges) {
+  crsql_AlterStart **ppStart = &pExtData->pAlterStarts;
+  while (*ppStart != 0) {
+    crsql_AlterStart *pStart = *ppStart;
+    if (sqlite3_stricmp(pStart->zTblName, tblName) == 0) {
+      *pTotalChanges = pStart->totalChanges;
+      *ppStart = pStart->pNext;
+      sqlite3_free(pStart->zTblName);
+      sqlite3_free(pStart);
+      return 1;
+    }
+    ppStart = &pStart->pNext;
+  }
+  return 0;
+}
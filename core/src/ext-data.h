@@ -5,6 +5,15 @@
 SQLITE_EXTENSION_INIT3
 #include "tableinfo.h"
 
+// a crr between crsql_begin_alter and crsql_commit_alter on a connection.
+typedef struct crsql_AlterStart crsql_AlterStart;
+struct crsql_AlterStart {
+  char *zTblName;
+  // sqlite3_total_changes64 as of crsql_begin_alter on the table.
+  sqlite3_int64 totalChanges;
+  crsql_AlterStart *pNext;
+};
+
 typedef struct crsql_ExtData crsql_ExtData;
 struct crsql_ExtData {
   // perma statement -- used to check db schema version
@@ -26,6 +35,8 @@ struct crsql_ExtData {
   sqlite3_stmt *pDbVersionStmt;
   crsql_TableInfo **zpTableInfos;
   int tableInfosLen;
+  // table name -> index into zpTableInfos. Rebuilt with zpTableInfos.
+  crsql_NameIndex tableInfoIndex;
 
   // tracks the number of rows impacted by all inserts into crsql_changes in the
   // current transaction. This number is reset on transaction commit.
@@ -36,6 +47,20 @@ struct crsql_ExtData {
   sqlite3_stmt *pSetSyncBitStmt;
   sqlite3_stmt *pClearSyncBitStmt;
   void *pStmtCache;
+
+  // tables whose insert trigger is paused by crsql_begin_bulk_load on this
+  // connection.
+  char **zpBulkLoadTables;
+  int bulkLoadTablesLen;
+
+  // tables being altered on this connection.
+  crsql_AlterStart *pAlterStarts;
+
+  // per table filters of the pks that have a delete sentinel. Owned by rust.
+  void *pTombstoneFilters;
+
+  // stores the db version, see crsql_raiseDbVersion.
+  sqlite3_stmt *pSetDbVersionStmt;
 };
 
 crsql_ExtData *crsql_newExtData(sqlite3 *db);
@@ -47,8 +72,21 @@ int crsql_recreateDbVersionStmt(sqlite3 *db, crsql_ExtData *pExtData);
 int crsql_fetchDbVersionFromStorage(sqlite3 *db, crsql_ExtData *pExtData,
                                     char **errmsg);
 int crsql_getDbVersion(sqlite3 *db, crsql_ExtData *pExtData, char **errmsg);
+int crsql_raiseDbVersion(sqlite3 *db, crsql_ExtData *pExtData,
+                         sqlite3_int64 version);
 void crsql_finalize(crsql_ExtData *pExtData);
 int crsql_ensureTableInfosAreUpToDate(sqlite3 *db, crsql_ExtData *pExtData,
                                       char **errmsg);
+int crsql_indexofTableInfoByName(crsql_ExtData *pExtData, const char *tblName,
+                                 int tblNameLen);
+crsql_TableInfo *crsql_findTableInfoByName(crsql_ExtData *pExtData,
+                                           const char *tblName);
+int crsql_isBulkLoading(crsql_ExtData *pExtData, const char *tblName);
+int crsql_addBulkLoad(crsql_ExtData *pExtData, const char *tblName);
+int crsql_removeBulkLoad(crsql_ExtData *pExtData, const char *tblName);
+int crsql_addAlterStart(crsql_ExtData *pExtData, const char *tblName,
+                        sqlite3_int64 totalChanges);
+int crsql_removeAlterStart(crsql_ExtData *pExtData, const char *tblName,
+                           sqlite3_int64 *pTotalChanges);
 
 #endif
\ No newline at end of file
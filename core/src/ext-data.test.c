@@ -208,9 +208,9 @@ static void testRecreateDbVersionStmt() {
 
   rc = crsql_recreateDbVersionStmt(db, pExtData);
 
-  // there are no clock tables yet. nothing to create.
-  assert(rc == -1);
-  assert(pExtData->pDbVersionStmt == 0);
+  // the version is read from its own table whether or not crrs exist
+  assert(rc == SQLITE_OK);
+  assert(pExtData->pDbVersionStmt != 0);
 
   sqlite3_exec(db, "CREATE TABLE foo (a primary key, b);", 0, 0, 0);
   sqlite3_exec(db, "SELECT crsql_as_crr('foo')", 0, 0, 0);
@@ -277,6 +277,12 @@ static void fetchDbVersionFromStorage() {
   assert(pExtData->dbVersion == 2);
   assert(rc == SQLITE_OK);
 
+  // removing clock rows never moves the version backwards
+  sqlite3_exec(db, "DELETE FROM bar__crsql_clock", 0, 0, 0);
+  rc = crsql_fetchDbVersionFromStorage(db, pExtData, &errmsg);
+  assert(pExtData->dbVersion == 2);
+  assert(rc == SQLITE_OK);
+
   crsql_finalize(pExtData);
   crsql_freeExtData(pExtData);
   crsql_close(db);
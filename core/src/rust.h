@@ -2,6 +2,7 @@
 #define CRSQLITE_RUST_H
 
 #include "crsqlite.h"
+#include "ext-data.h"
 
 // Parts of CR-SQLite are written in Rust and parts are in C.
 // As we gradually convert more code to Rust, we'll have to expose
@@ -10,8 +11,8 @@
 
 int crsql_backfill_table(sqlite3_context *context, const char *tblName,
                          const char **zpkNames, int pkCount,
-                         const char **zNonPkNames, int nonPkCount,
-                         int isCommitAlter);
+                         const char **zNonPkNames, const int *nonPkColIds,
+                         int nonPkCount, int isCommitAlter);
 int crsql_is_crr(sqlite3 *db, const char *tblName);
 int crsql_compare_sqlite_values(const sqlite3_value *l, const sqlite3_value *r);
 int crsql_create_crr_triggers(sqlite3 *db, crsql_TableInfo *tableInfo,
@@ -21,11 +22,42 @@ int crsql_remove_crr_triggers_if_exist(sqlite3 *db, const char *tblName);
 char *crsql_changes_union_query(crsql_TableInfo **tableInfos, int tableInfosLen,
                                 const char *idxStr);
 char *crsql_row_patch_data_query(crsql_TableInfo *tblInfo, const char *colName);
+int crsql_begin_backfill(sqlite3 *db, const char *tblName);
+int crsql_backfill_step(sqlite3 *db, const char *tblName,
+                        sqlite3_int64 maxRows, sqlite3_int64 *rows);
+int crsql_end_bulk_load(sqlite3 *db, const char *tblName);
+int crsql_load_col_ids(sqlite3 *db, crsql_TableInfo *tableInfo);
+int crsql_ensure_col_ids(sqlite3 *db, crsql_TableInfo *tableInfo);
 int crsql_create_clock_table(sqlite3 *db, crsql_TableInfo *tableInfo,
                              char **err);
 int crsql_init_site_id(sqlite3 *db, unsigned char *ret);
 int crsql_init_peer_tracking_table(sqlite3 *db);
 int crsql_create_schema_table_if_not_exists(sqlite3 *db);
-int crsql_maybe_update_db(sqlite3 *db);
+int crsql_maybe_update_db(sqlite3 *db, char **pzErrMsg);
+int crsql_apply_changes(sqlite3 *db, crsql_ExtData *pExtData,
+                        const unsigned char *changes, int changesLen,
+                        int inKeyOrder, const unsigned char *sender,
+                        int senderLen, sqlite3_int64 *applied,
+                        char **errmsg);
+int crsql_changeset_export(sqlite3 *db, crsql_ExtData *pExtData,
+                           sqlite3_int64 since,
+                           const unsigned char *excludeSite,
+                           int excludeSiteLen, unsigned char **changeset,
+                           int *changesetLen, char **errmsg);
+int crsql_changeset_import(sqlite3 *db, crsql_ExtData *pExtData,
+                           const unsigned char *changeset, int changesetLen,
+                           sqlite3_int64 *applied, char **errmsg);
+int crsql_after_update(sqlite3 *db, crsql_ExtData *pExtData, int argc,
+                       sqlite3_value **argv, char **errmsg);
+int crsql_after_delete(crsql_ExtData *pExtData, int argc,
+                       sqlite3_value **argv);
+void crsql_end_tombstone_filters_txn(crsql_ExtData *pExtData, int committed);
+int crsql_gc_tombstones(sqlite3 *db, crsql_ExtData *pExtData,
+                        sqlite3_int64 budget, sqlite3_int64 *removed,
+                        char **errmsg);
+void crsql_get_stmt_cache_stats(crsql_ExtData *pExtData, sqlite3_int64 *hits,
+                                sqlite3_int64 *misses,
+                                sqlite3_int64 *evictions, sqlite3_int64 *size,
+                                sqlite3_int64 *capacity);
 
 #endif
@@ -8,6 +8,7 @@
 #include "consts.h"
 #include "crsqlite.h"
 #include "get-table.h"
+#include "rust.h"
 #include "util.h"
 
 void crsql_freeColumnInfoContents(crsql_ColumnInfo *columnInfo) {
@@ -115,6 +116,15 @@ static crsql_TableInfo *crsql_tableInfo(const char *tblName,
       crsql_nonPks(ret->baseCols, ret->baseColsLen, &(ret->nonPksLen));
   ret->pks = crsql_pks(ret->baseCols, ret->baseColsLen, &(ret->pksLen));
 
+  crsql_initNameIndex(&(ret->pkIndex), ret->pksLen);
+  for (int i = 0; i < ret->pksLen; ++i) {
+    crsql_addToNameIndex(&(ret->pkIndex), ret->pks[i].name, i);
+  }
+  crsql_initNameIndex(&(ret->nonPkIndex), ret->nonPksLen);
+  for (int i = 0; i < ret->nonPksLen; ++i) {
+    crsql_addToNameIndex(&(ret->nonPkIndex), ret->nonPks[i].name, i);
+  }
+
   return ret;
 }
 
@@ -183,6 +193,7 @@ int crsql_getTableInfo(sqlite3 *db, const char *tblName,
 
     columnInfos[i].notnull = sqlite3_column_int(pStmt, 3);
     columnInfos[i].pk = sqlite3_column_int(pStmt, 4);
+    columnInfos[i].colId = 0;
 
     ++i;
     rc = sqlite3_step(pStmt);
@@ -201,6 +212,14 @@ int crsql_getTableInfo(sqlite3 *db, const char *tblName,
   }
 
   *pTableInfo = crsql_tableInfo(tblName, columnInfos, numColInfos);
+  rc = crsql_load_col_ids(db, *pTableInfo);
+  if (rc != SQLITE_OK) {
+    *pErrMsg =
+        sqlite3_mprintf("Failed to load the column ids of crr -- %s", tblName);
+    crsql_freeTableInfo(*pTableInfo);
+    *pTableInfo = 0;
+    return rc;
+  }
 
   return SQLITE_OK;
 }
@@ -217,6 +236,8 @@ void crsql_freeTableInfo(crsql_TableInfo *tableInfo) {
   sqlite3_free(tableInfo->tblName);
   sqlite3_free(tableInfo->pks);
   sqlite3_free(tableInfo->nonPks);
+  crsql_freeNameIndex(&(tableInfo->pkIndex));
+  crsql_freeNameIndex(&(tableInfo->nonPkIndex));
 
   sqlite3_free(tableInfo);
 }
@@ -471,13 +492,103 @@ int crsql_isTableCompatible(sqlite3 *db, const char *tblName, char **errmsg) {
   return 1;
 }
 
-int crsql_columnExists(const char *colName, crsql_ColumnInfo *colInfos,
-                       int colInfosLen) {
-  for (int i = 0; i < colInfosLen; ++i) {
-    if (strcmp(colInfos[i].name, colName) == 0) {
-      return 1;
+int crsql_indexofPk(crsql_TableInfo *tblInfo, const char *colName,
+                    int colNameLen) {
+  return crsql_lookupNameIndex(&(tblInfo->pkIndex), colName, colNameLen);
+}
+
+int crsql_indexofNonPk(crsql_TableInfo *tblInfo, const char *colName,
+                       int colNameLen) {
+  return crsql_lookupNameIndex(&(tblInfo->nonPkIndex), colName, colNameLen);
+}
+
+// FNV-1a
+static unsigned int hashName(const char *zName, int nName) {
+  unsigned int h = 2166136261u;
+  for (int i = 0; i < nName; ++i) {
+    h ^= (unsigned char)zName[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+/**
+ * Sizes the index for `numNames` names, keeping the load factor at or below
+ * one half so probe sequences stay short.
+ */
+int crsql_initNameIndex(crsql_NameIndex *pIndex, int numNames) {
+  pIndex->azNames = 0;
+  pIndex->aIdx = 0;
+  pIndex->nSlot = 0;
+  if (numNames <= 0) {
+    return SQLITE_OK;
+  }
+
+  int nSlot = 8;
+  while (nSlot < numNames * 2) {
+    nSlot *= 2;
+  }
+  pIndex->azNames = sqlite3_malloc(nSlot * sizeof *(pIndex->azNames));
+  pIndex->aIdx = sqlite3_malloc(nSlot * sizeof *(pIndex->aIdx));
+  if (pIndex->azNames == 0 || pIndex->aIdx == 0) {
+    crsql_freeNameIndex(pIndex);
+    return SQLITE_NOMEM;
+  }
+  for (int i = 0; i < nSlot; ++i) {
+    pIndex->azNames[i] = 0;
+    pIndex->aIdx[i] = -1;
+  }
+  pIndex->nSlot = nSlot;
+  return SQLITE_OK;
+}
+
+/**
+ * The first name added wins if the same name is added twice, matching what a
+ * linear scan from the front would find.
+ */
+void crsql_addToNameIndex(crsql_NameIndex *pIndex, const char *zName,
+                          int idx) {
+  if (pIndex->nSlot == 0) {
+    return;
+  }
+  int nName = strlen(zName);
+  int mask = pIndex->nSlot - 1;
+  int slot = hashName(zName, nName) & mask;
+  while (pIndex->azNames[slot] != 0) {
+    if (strcmp(pIndex->azNames[slot], zName) == 0) {
+      return;
+    }
+    slot = (slot + 1) & mask;
+  }
+  pIndex->azNames[slot] = zName;
+  pIndex->aIdx[slot] = idx;
+}
+
+/**
+ * `zName` does not need to be null terminated so callers can look up names
+ * straight out of sqlite values.
+ */
+int crsql_lookupNameIndex(const crsql_NameIndex *pIndex, const char *zName,
+                          int nName) {
+  if (pIndex->nSlot == 0 || nName < 0) {
+    return -1;
+  }
+  int mask = pIndex->nSlot - 1;
+  int slot = hashName(zName, nName) & mask;
+  while (pIndex->azNames[slot] != 0) {
+    const char *zSlot = pIndex->azNames[slot];
+    if ((int)strlen(zSlot) == nName && memcmp(zSlot, zName, nName) == 0) {
+      return pIndex->aIdx[slot];
     }
+    slot = (slot + 1) & mask;
   }
+  return -1;
+}
 
-  return 0;
+void crsql_freeNameIndex(crsql_NameIndex *pIndex) {
+  sqlite3_free(pIndex->azNames);
+  sqlite3_free(pIndex->aIdx);
+  pIndex->azNames = 0;
+  pIndex->aIdx = 0;
+  pIndex->nSlot = 0;
 }
\ No newline at end of file
@@ -17,6 +17,21 @@ struct crsql_ColumnInfo {
   char *type;
   int notnull;
   int pk;
+  // What the clock table records this column as. See `__crsql_colids`.
+  // 0 for primary key columns and columns that have not been given an id yet.
+  int colId;
+};
+
+/**
+ * Open addressing hash index from a name to its position in an array.
+ * Names are borrowed from the indexed array and must outlive the index.
+ */
+typedef struct crsql_NameIndex crsql_NameIndex;
+struct crsql_NameIndex {
+  const char **azNames;
+  int *aIdx;
+  // power of two. 0 when nothing has been indexed.
+  int nSlot;
 };
 
 typedef struct crsql_TableInfo crsql_TableInfo;
@@ -32,8 +47,18 @@ struct crsql_TableInfo {
 
   crsql_ColumnInfo *nonPks;
   int nonPksLen;
+
+  // column name -> index into pks / nonPks
+  crsql_NameIndex pkIndex;
+  crsql_NameIndex nonPkIndex;
 };
 
+int crsql_initNameIndex(crsql_NameIndex *pIndex, int numNames);
+void crsql_addToNameIndex(crsql_NameIndex *pIndex, const char *zName, int idx);
+int crsql_lookupNameIndex(const crsql_NameIndex *pIndex, const char *zName,
+                          int nName);
+void crsql_freeNameIndex(crsql_NameIndex *pIndex);
+
 crsql_ColumnInfo *crsql_extractBaseCols(crsql_ColumnInfo *colInfos,
                                         int colInfosLen, int *pBaseColsLen);
 
@@ -53,7 +78,9 @@ sqlite3_int64 crsql_slabRowid(int idx, sqlite3_int64 rowid);
 int crsql_pullAllTableInfos(sqlite3 *db, crsql_TableInfo ***pzpTableInfos,
                             int *rTableInfosLen, char **errmsg);
 int crsql_isTableCompatible(sqlite3 *db, const char *tblName, char **errmsg);
-int crsql_columnExists(const char *colName, crsql_ColumnInfo *colInfos,
-                       int colInfosLen);
+int crsql_indexofPk(crsql_TableInfo *tblInfo, const char *colName,
+                    int colNameLen);
+int crsql_indexofNonPk(crsql_TableInfo *tblInfo, const char *colName,
+                       int colNameLen);
 
 #endif
\ No newline at end of file
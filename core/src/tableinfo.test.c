@@ -128,6 +128,67 @@ static void testFindTableInfo() {
   printf("\t\e[0;32mSuccess\e[0m\n");
 }
 
+static void testNameIndex() {
+  printf("NameIndex\n");
+
+  crsql_NameIndex index;
+  assert(crsql_initNameIndex(&index, 0) == SQLITE_OK);
+  assert(crsql_lookupNameIndex(&index, "a", 1) == -1);
+  crsql_freeNameIndex(&index);
+
+  // enough names to force probing past collisions
+  char *names[100];
+  assert(crsql_initNameIndex(&index, 100) == SQLITE_OK);
+  for (int i = 0; i < 100; ++i) {
+    names[i] = sqlite3_mprintf("name_%d", i);
+    crsql_addToNameIndex(&index, names[i], i);
+  }
+  // a duplicate keeps the first index
+  crsql_addToNameIndex(&index, names[3], 42);
+
+  for (int i = 0; i < 100; ++i) {
+    assert(crsql_lookupNameIndex(&index, names[i], strlen(names[i])) == i);
+  }
+  // names need not be null terminated
+  assert(crsql_lookupNameIndex(&index, "name_12xyz", 7) == 12);
+  assert(crsql_lookupNameIndex(&index, "name_1", 5) == -1);
+  assert(crsql_lookupNameIndex(&index, "name_100", 8) == -1);
+  assert(crsql_lookupNameIndex(&index, "", 0) == -1);
+
+  crsql_freeNameIndex(&index);
+  for (int i = 0; i < 100; ++i) {
+    sqlite3_free(names[i]);
+  }
+
+  printf("\t\e[0;32mSuccess\e[0m\n");
+}
+
+static void testIndexofColumn() {
+  printf("IndexofColumn\n");
+  sqlite3 *db = 0;
+  crsql_TableInfo *tableInfo = 0;
+  char *errMsg = 0;
+  int rc = SQLITE_OK;
+
+  rc = sqlite3_open(":memory:", &db);
+  rc += sqlite3_exec(db, "CREATE TABLE foo (a, b, c, d, PRIMARY KEY (c, a))",
+                     0, 0, 0);
+  rc += crsql_getTableInfo(db, "foo", &tableInfo, &errMsg);
+  assert(rc == SQLITE_OK);
+
+  assert(crsql_indexofPk(tableInfo, "a", 1) == 1);
+  assert(crsql_indexofPk(tableInfo, "c", 1) == 0);
+  assert(crsql_indexofPk(tableInfo, "b", 1) == -1);
+  assert(crsql_indexofNonPk(tableInfo, "b", 1) == 0);
+  assert(crsql_indexofNonPk(tableInfo, "d", 1) == 1);
+  assert(crsql_indexofNonPk(tableInfo, "a", 1) == -1);
+  assert(crsql_indexofNonPk(tableInfo, "e", 1) == -1);
+
+  crsql_freeTableInfo(tableInfo);
+  crsql_close(db);
+  printf("\t\e[0;32mSuccess\e[0m\n");
+}
+
 static void testIsTableCompatible() {
   printf("IsTableCompatible\n");
   sqlite3 *db = 0;
@@ -289,6 +350,8 @@ void crsqlTableInfoTestSuite() {
   // testAsIdentifierList();
   testGetTableInfo();
   testFindTableInfo();
+  testNameIndex();
+  testIndexofColumn();
   testIsTableCompatible();
   testSlabRowid();
   // testPullAllTableInfos();
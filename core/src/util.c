@@ -175,3 +175,5 @@ int crsql_getCount(sqlite3 *db, char *zSql) {
 
   return count;
 }
+
+int crsql_isStmtBusy(sqlite3_stmt *pStmt) { return sqlite3_stmt_busy(pStmt); }
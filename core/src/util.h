@@ -14,6 +14,7 @@ char *crsql_getDbVersionUnionQuery(int numRows, char **tableNames);
 char *crsql_join(char **in, size_t inlen);
 
 int crsql_getCount(sqlite3 *db, char *zSql);
+int crsql_isStmtBusy(sqlite3_stmt *pStmt);
 
 void crsql_joinWith(char *dest, char **src, size_t srcLen, char delim);
 
@@ -0,0 +1,69 @@
+from crsql_correctness import connect, close
+import pytest
+import sqlite3
+
+# Merges take their temporaries from an arena that lives as long as the
+# transaction and reuse the row they cache between cells, so merging does not
+# allocate once per change. Allocations are only counted by builds made with
+# `make loadable CRSQLITE_ALLOC_STATS=1`, the tests are skipped otherwise.
+
+changes_query = "SELECT [table], pk, cid, val, col_version, db_version, site_id FROM crsql_changes"
+
+
+def setup():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a PRIMARY KEY NOT NULL, b, c)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.commit()
+    try:
+        allocations(c)
+    except sqlite3.OperationalError:
+        close(c)
+        pytest.skip("built without allocation counters")
+    return c
+
+
+def allocations(c):
+    return c.execute("SELECT crsql_allocations()").fetchone()[0]
+
+
+def test_counters_only_grow():
+    c = setup()
+    before = (allocations(c), c.execute("SELECT crsql_allocated_bytes()").fetchone()[0])
+    c.execute("INSERT INTO foo VALUES (1, 'one', 1)")
+    c.commit()
+    after = (allocations(c), c.execute("SELECT crsql_allocated_bytes()").fetchone()[0])
+    assert after[0] >= before[0]
+    assert after[1] >= before[1]
+    close(c)
+
+
+def test_merges_do_not_allocate_per_change():
+    src = setup()
+    src.executemany("INSERT INTO foo VALUES (?, ?, ?)",
+                    ((i, 'x' * i, i) for i in range(500)))
+    src.commit()
+    changes = src.execute(changes_query).fetchall()
+    packed = b''.join(src.execute(
+        "SELECT crsql_pack_columns(?, ?, ?, ?, ?, ?, ?)", change).fetchone()[0] for change in changes)
+
+    dst = setup()
+    for _ in range(2):
+        before = allocations(dst)
+        dst.executemany("INSERT INTO crsql_changes VALUES (?, ?, ?, ?, ?, ?, ?)", changes)
+        dst.commit()
+        assert allocations(dst) - before < len(changes) / 10
+
+        before = allocations(dst)
+        dst.execute("SELECT crsql_apply_changes(?)", (packed,)).fetchone()
+        dst.commit()
+        assert allocations(dst) - before < len(changes) / 10
+
+    assert dst.execute("SELECT * FROM foo ORDER BY a").fetchall() == src.execute(
+        "SELECT * FROM foo ORDER BY a").fetchall()
+
+    before = allocations(src)
+    assert len(src.execute(changes_query).fetchall()) == len(changes)
+    assert allocations(src) - before < len(changes) / 10
+    close(src)
+    close(dst)
@@ -0,0 +1,243 @@
+from crsql_correctness import connect, close, min_db_v
+import pytest
+import sqlite3
+
+# crsql_apply_changes must reach the same state as inserting the same cells,
+# one at a time, into crsql_changes.
+
+changes_query = "SELECT [table], pk, cid, val, col_version, db_version, site_id FROM crsql_changes WHERE db_version > ? ORDER BY db_version, seq ASC"
+
+
+def create_schema(c):
+    c.execute("CREATE TABLE foo (a PRIMARY KEY, b, c DEFAULT 'c', d NOT NULL DEFAULT 1)")
+    c.execute("CREATE TABLE bar (x, y, z, PRIMARY KEY (x, y))")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("SELECT crsql_as_crr('bar')")
+    c.commit()
+
+
+def pack_changes(src, since):
+    changes = src.execute(changes_query, (since,)).fetchall()
+    return b''.join(src.execute(
+        "SELECT crsql_pack_columns(?, ?, ?, ?, ?, ?, ?)", change).fetchone()[0] for change in changes)
+
+
+def apply_per_row(src, dst, since):
+    for change in src.execute(changes_query, (since,)):
+        dst.execute(
+            "INSERT INTO crsql_changes VALUES (?, ?, ?, ?, ?, ?, ?)", change)
+    dst.commit()
+
+
+def apply_batched(src, dst, since):
+    applied = dst.execute(
+        "SELECT crsql_apply_changes(?)", (pack_changes(src, since),)).fetchone()[0]
+    dst.commit()
+    return applied
+
+
+def state(c):
+    return (
+        c.execute("SELECT * FROM foo ORDER BY a").fetchall(),
+        c.execute("SELECT * FROM bar ORDER BY x, y").fetchall(),
+        c.execute(
+            "SELECT [table], pk, cid, val, col_version, site_id FROM crsql_changes ORDER BY [table], pk, cid").fetchall()
+    )
+
+
+def make_dbs():
+    dbs = [connect(":memory:") for _ in range(3)]
+    for db in dbs:
+        create_schema(db)
+    return dbs
+
+
+def write_source(src):
+    src.execute("INSERT INTO foo VALUES (1, 2, 3, 4)")
+    src.execute("INSERT INTO foo (a, b) VALUES (2, 'two')")
+    src.execute("INSERT INTO foo (a) VALUES (3)")
+    src.execute("INSERT INTO bar VALUES (1, 'one', x'0102')")
+    src.execute("INSERT INTO bar VALUES (2, 'two', 2.5)")
+    src.commit()
+    src.execute("UPDATE foo SET b = 22 WHERE a = 2")
+    src.execute("DELETE FROM foo WHERE a = 3")
+    src.execute("UPDATE bar SET z = NULL WHERE x = 2")
+    src.commit()
+
+
+def test_empty_changeset():
+    c = connect(":memory:")
+    create_schema(c)
+    assert c.execute("SELECT crsql_apply_changes(x'')").fetchone()[0] == 0
+    assert c.execute("SELECT crsql_apply_changes(NULL)").fetchone()[0] == 0
+    close(c)
+
+
+def test_apply_matches_per_row_merge():
+    src, per_row, batched = make_dbs()
+    write_source(src)
+
+    apply_per_row(src, per_row, min_db_v)
+    applied = apply_batched(src, batched, min_db_v)
+
+    assert applied == len(src.execute(changes_query, (min_db_v,)).fetchall())
+    assert state(batched) == state(per_row)
+    assert state(batched) == state(src)
+
+    for c in [src, per_row, batched]:
+        close(c)
+
+
+def test_apply_is_idempotent():
+    src, _, dst = make_dbs()
+    write_source(src)
+
+    apply_batched(src, dst, min_db_v)
+    before = state(dst)
+    assert apply_batched(src, dst, min_db_v) == 0
+    assert state(dst) == before
+
+    close(src)
+    close(dst)
+
+
+def test_apply_merges_concurrent_edits():
+    a, b, c = make_dbs()
+    a.execute("INSERT INTO foo VALUES (1, 'a', 'a', 1)")
+    a.commit()
+    b.execute("INSERT INTO foo VALUES (1, 'b', 'b', 2)")
+    b.commit()
+    b.execute("UPDATE foo SET c = 'bb' WHERE a = 1")
+    b.commit()
+
+    # Ties on b and d are broken by value, c wins on version.
+    apply_per_row(b, c, min_db_v)
+    apply_per_row(a, c, min_db_v)
+    apply_batched(b, a, min_db_v)
+
+    assert state(a)[0] == state(c)[0]
+    assert state(a)[0] == [(1, 'b', 'bb', 2)]
+
+    for db in [a, b, c]:
+        close(db)
+
+
+def test_apply_respects_local_delete():
+    src, _, dst = make_dbs()
+    src.execute("INSERT INTO foo VALUES (1, 2, 3, 4)")
+    src.commit()
+    apply_batched(src, dst, min_db_v)
+
+    dst.execute("DELETE FROM foo WHERE a = 1")
+    dst.commit()
+    src.execute("UPDATE foo SET b = 100 WHERE a = 1")
+    src.commit()
+
+    assert apply_batched(src, dst, min_db_v) == 0
+    assert dst.execute("SELECT * FROM foo").fetchall() == []
+
+    close(src)
+    close(dst)
+
+
+def test_failed_apply_rolls_back():
+    src, _, dst = make_dbs()
+    write_source(src)
+    blob = pack_changes(src, min_db_v) + src.execute(
+        "SELECT crsql_pack_columns('missing', crsql_pack_columns(1), 'b', 1, 1, 1, NULL)").fetchone()[0]
+
+    try:
+        dst.execute("SELECT crsql_apply_changes(?)", (blob,)).fetchone()
+        assert False
+    except Exception:
+        pass
+
+    assert dst.execute("SELECT count(*) FROM foo").fetchone()[0] == 0
+    assert dst.execute("SELECT count(*) FROM crsql_changes").fetchone()[0] == 0
+
+    close(src)
+    close(dst)
+
+
+def test_prepared_changes_apply_the_same():
+    src, batched, prepared = make_dbs()
+    write_source(src)
+    blob = pack_changes(src, min_db_v)
+    # preparing needs no schema, so any connection on any thread can do it
+    worker = connect(":memory:")
+    ready = worker.execute("SELECT crsql_prepare_changes(?)", (blob,)).fetchone()[0]
+    assert worker.execute("SELECT crsql_prepare_changes(?)", (ready,)).fetchone()[0] == ready
+    close(worker)
+
+    apply_batched(src, batched, min_db_v)
+    assert prepared.execute(
+        "SELECT crsql_apply_changes(?)", (ready,)).fetchone()[0] == len(
+        src.execute(changes_query, (min_db_v,)).fetchall())
+    prepared.commit()
+    assert state(prepared) == state(batched)
+    assert state(prepared) == state(src)
+
+    for c in [src, batched, prepared]:
+        close(c)
+
+
+def test_prepare_rejects_malformed_changes():
+    c = connect(":memory:")
+    for bad in [
+        "crsql_pack_columns('foo', crsql_pack_columns(1), 'b', 1, 1)",
+        "crsql_pack_columns('foo', x'ff', 'b', 1, 1, 1, NULL)",
+        "crsql_pack_columns('foo', crsql_pack_columns(1), 'b', 1, 'x', 1, NULL)",
+        "crsql_pack_columns('foo', crsql_pack_columns(1), 'b', 1, 1, 1, zeroblob(17))",
+        "x'0701'",
+    ]:
+        with pytest.raises(sqlite3.OperationalError, match='crsql - '):
+            c.execute("SELECT crsql_prepare_changes({})".format(bad)).fetchone()
+    close(c)
+
+
+def test_key_order_applies_the_same():
+    src, arrival, keyed = make_dbs()
+    write_source(src)
+    # updates that scatter over the tables in db version order
+    for i in range(20):
+        src.execute(
+            "INSERT INTO foo (a, b) VALUES (?, ?) ON CONFLICT DO UPDATE SET b = excluded.b",
+            (10 + (i * 7) % 11, i))
+        src.execute(
+            "INSERT INTO bar VALUES (?, 'k', ?) ON CONFLICT DO UPDATE SET z = excluded.z",
+            ((i * 5) % 13, i))
+        src.commit()
+    src.execute("DELETE FROM foo WHERE a = 14")
+    src.commit()
+
+    apply_batched(src, arrival, min_db_v)
+    keyed.execute(
+        "SELECT crsql_apply_changes(?, 1)", (pack_changes(src, min_db_v),)).fetchone()
+    keyed.commit()
+    assert state(keyed) == state(arrival)
+    assert state(keyed) == state(src)
+
+    for c in [src, arrival, keyed]:
+        close(c)
+
+
+def test_key_order_is_the_tables_order():
+    src, dst, prepared = make_dbs()
+    for a in [3, 256, -1, 2.5, 'b', 'a', b'\x01', 10, 'B', 2]:
+        src.execute("INSERT INTO foo (a) VALUES (?)", (a,))
+        src.commit()
+    blob = pack_changes(src, min_db_v)
+
+    dst.execute("SELECT crsql_apply_changes(?, 1)", (blob,)).fetchone()
+    dst.commit()
+    prepared.execute("SELECT crsql_apply_changes(crsql_prepare_changes(?))", (blob,)).fetchone()
+    prepared.commit()
+
+    # rows were merged, and so got their rowids, in the order SQLite keeps them
+    expected = src.execute("SELECT a FROM foo ORDER BY a").fetchall()
+    assert src.execute("SELECT a FROM foo ORDER BY rowid").fetchall() != expected
+    assert dst.execute("SELECT a FROM foo ORDER BY rowid").fetchall() == expected
+    assert prepared.execute("SELECT a FROM foo ORDER BY rowid").fetchall() == expected
+
+    for c in [src, dst, prepared]:
+        close(c)
@@ -0,0 +1,125 @@
+from crsql_correctness import connect, close
+import json
+import pytest
+
+# crsql_backfill lets a large pre-existing table become a crr a chunk at a
+# time, each chunk committed by the caller.
+
+
+def populate(c, n):
+    c.execute("CREATE TABLE foo (a INTEGER PRIMARY KEY NOT NULL, b, c)")
+    c.executemany("INSERT INTO foo VALUES (?, ?, ?)",
+                  [(i, i, i * 2) for i in range(n)])
+    c.commit()
+
+
+def progress(c, tbl):
+    return json.loads(c.execute("SELECT crsql_backfill_progress(?)", (tbl,)).fetchone()[0])
+
+
+def clock_rows(c, tbl):
+    return c.execute(
+        "SELECT count(*) FROM \"{}__crsql_clock\"".format(tbl)).fetchone()[0]
+
+
+def run_to_completion(c, tbl, rows):
+    counts = []
+    while True:
+        n = c.execute("SELECT crsql_backfill(?, ?)", (tbl, rows)).fetchone()[0]
+        c.commit()
+        if n == 0:
+            return counts
+        counts.append(n)
+
+
+def test_backfills_in_chunks():
+    c = connect(":memory:")
+    populate(c, 25)
+
+    assert run_to_completion(c, "foo", 10) == [10, 10, 5]
+    assert clock_rows(c, "foo") == 50
+    assert progress(c, "foo") == {
+        "backfilled": 25, "total": 25, "complete": True}
+    assert c.execute("SELECT crsql_backfill('foo')").fetchone()[0] == 0
+
+    # the crr behaves as if it was created by crsql_as_crr
+    c.execute("UPDATE foo SET b = 'x' WHERE a = 3")
+    c.commit()
+    assert c.execute(
+        "SELECT count(*) FROM crsql_changes WHERE cid = 'b'").fetchone()[0] == 25
+    close(c)
+
+
+def test_progress_between_chunks():
+    c = connect(":memory:")
+    populate(c, 25)
+
+    c.execute("SELECT crsql_backfill('foo', 10)")
+    c.commit()
+    assert progress(c, "foo") == {
+        "backfilled": 10, "total": 25, "complete": False}
+    close(c)
+
+
+def test_resumes_after_a_rolled_back_chunk():
+    c = connect(":memory:")
+    populate(c, 25)
+
+    c.execute("SELECT crsql_backfill('foo', 10)")
+    c.commit()
+    # a SELECT alone doesn't open a transaction in the python driver
+    c.execute("BEGIN")
+    c.execute("SELECT crsql_backfill('foo', 10)")
+    c.rollback()
+    assert progress(c, "foo")["backfilled"] == 10
+    assert clock_rows(c, "foo") == 20
+
+    assert run_to_completion(c, "foo", 10) == [10, 5]
+    assert clock_rows(c, "foo") == 50
+    close(c)
+
+
+def test_rows_written_during_backfill():
+    c = connect(":memory:")
+    populate(c, 20)
+
+    c.execute("SELECT crsql_backfill('foo', 5)")
+    c.commit()
+    # triggers are installed by the first chunk
+    c.execute("INSERT INTO foo VALUES (100, 1, 1)")
+    c.execute("UPDATE foo SET b = 'y' WHERE a = 15")
+    c.commit()
+
+    run_to_completion(c, "foo", 5)
+    assert clock_rows(c, "foo") == 42
+    assert c.execute(
+        "SELECT val FROM crsql_changes WHERE pk = crsql_pack_columns(15) AND cid = 'b'").fetchone()[0] == 'y'
+    close(c)
+
+
+def test_compound_and_pk_only_tables():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE bar (a NOT NULL, b NOT NULL, c, PRIMARY KEY (a, b))")
+    c.executemany("INSERT INTO bar VALUES (?, ?, ?)",
+                  [(i % 3, i, i) for i in range(10)])
+    c.execute("CREATE TABLE baz (a PRIMARY KEY NOT NULL)")
+    c.executemany("INSERT INTO baz VALUES (?)", [(i,) for i in range(7)])
+    c.commit()
+
+    assert run_to_completion(c, "bar", 4) == [4, 4, 2]
+    assert clock_rows(c, "bar") == 10
+    assert run_to_completion(c, "baz", 3) == [3, 3, 1]
+    assert c.execute(
+        "SELECT count(*) FROM baz__crsql_clock WHERE __crsql_col_id = -2").fetchone()[0] == 7
+    close(c)
+
+
+def test_as_crr_still_backfills_fully():
+    c = connect(":memory:")
+    populate(c, 25)
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.commit()
+
+    assert clock_rows(c, "foo") == 50
+    assert progress(c, "foo")["complete"]
+    close(c)
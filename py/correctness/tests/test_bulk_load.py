@@ -0,0 +1,134 @@
+from crsql_correctness import connect, close
+import pytest
+
+# Inserts made between crsql_begin_bulk_load and crsql_end_bulk_load get their
+# clock rows when the load ends, all at one db version.
+
+
+def setup():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a PRIMARY KEY NOT NULL, b, c DEFAULT 0)")
+    c.execute("CREATE TABLE bar (a PRIMARY KEY NOT NULL, b)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("SELECT crsql_as_crr('bar')")
+    c.commit()
+    return c
+
+
+def clock_rows(c, tbl):
+    return c.execute(
+        "SELECT count(*) FROM \"{}__crsql_clock\"".format(tbl)).fetchone()[0]
+
+
+def test_clocks_are_written_at_the_end():
+    c = setup()
+    c.execute("INSERT INTO foo VALUES (0, 0, 0)")
+    c.commit()
+
+    c.execute("SELECT crsql_begin_bulk_load('foo')")
+    c.executemany("INSERT INTO foo VALUES (?, ?, ?)",
+                  [(i, i, i) for i in range(1, 101)])
+    c.commit()
+    assert clock_rows(c, "foo") == 2
+
+    c.execute("SELECT crsql_end_bulk_load('foo')")
+    c.commit()
+    assert clock_rows(c, "foo") == 202
+    assert c.execute(
+        "SELECT DISTINCT db_version FROM crsql_changes WHERE db_version > 1").fetchall() == [(2,)]
+    # one seq per clock row, row by row
+    assert c.execute(
+        "SELECT count(DISTINCT seq) FROM crsql_changes WHERE db_version = 2").fetchone()[0] == 200
+
+    # inserts are recorded as they happen again
+    c.execute("INSERT INTO foo VALUES (101, 1, 1)")
+    c.commit()
+    assert clock_rows(c, "foo") == 204
+    close(c)
+
+
+def test_only_the_loaded_table_is_paused():
+    c = setup()
+    c.execute("SELECT crsql_begin_bulk_load('foo')")
+    c.execute("INSERT INTO foo VALUES (1, 1, 1)")
+    c.execute("INSERT INTO bar VALUES (1, 1)")
+    c.commit()
+
+    assert clock_rows(c, "foo") == 0
+    assert clock_rows(c, "bar") == 1
+    c.execute("SELECT crsql_end_bulk_load('FOO')")
+    c.commit()
+    assert clock_rows(c, "foo") == 2
+    close(c)
+
+
+def test_updates_during_the_load_are_recorded():
+    c = setup()
+    c.execute("INSERT INTO foo VALUES (1, 1, 1)")
+    c.commit()
+
+    c.execute("SELECT crsql_begin_bulk_load('foo')")
+    c.execute("INSERT INTO foo VALUES (2, 2, 2)")
+    c.execute("UPDATE foo SET b = 10 WHERE a = 1")
+    c.execute("DELETE FROM foo WHERE a = 2")
+    c.execute("SELECT crsql_end_bulk_load('foo')")
+    c.commit()
+
+    assert c.execute(
+        "SELECT pk, cid, val, col_version FROM crsql_changes ORDER BY db_version, seq").fetchall() == [
+        (b'\x01\x09\x01', 'c', 1, 1),
+        (b'\x01\x09\x01', 'b', 10, 2),
+        (b'\x01\x09\x02', '__crsql_del', None, 1)]
+    close(c)
+
+
+def test_loaded_rows_sync():
+    c = setup()
+    c.execute("SELECT crsql_begin_bulk_load('foo')")
+    c.executemany("INSERT INTO foo VALUES (?, ?, ?)",
+                  [(i, i, i) for i in range(10)])
+    c.execute("SELECT crsql_end_bulk_load('foo')")
+    c.commit()
+
+    d = setup()
+    for change in c.execute(
+            "SELECT [table], pk, cid, val, col_version, db_version, site_id FROM crsql_changes"):
+        d.execute("INSERT INTO crsql_changes VALUES (?, ?, ?, ?, ?, ?, ?)", change)
+    d.commit()
+    assert d.execute("SELECT * FROM foo ORDER BY a").fetchall() == c.execute(
+        "SELECT * FROM foo ORDER BY a").fetchall()
+    close(c)
+    close(d)
+
+
+def test_rows_deleted_before_the_load_are_clocked_again():
+    def reinsert(bulk):
+        c = setup()
+        c.execute("INSERT INTO foo VALUES (1, 1, 1)")
+        c.execute("INSERT INTO foo VALUES (2, 2, 2)")
+        c.commit()
+        c.execute("DELETE FROM foo WHERE a = 1")
+        c.commit()
+        if bulk:
+            c.execute("SELECT crsql_begin_bulk_load('foo')")
+        c.execute("INSERT INTO foo VALUES (1, 'again', 0)")
+        if bulk:
+            c.execute("SELECT crsql_end_bulk_load('foo')")
+        c.commit()
+        changes = c.execute(
+            "SELECT pk, cid, val, col_version, db_version FROM crsql_changes "
+            "ORDER BY pk, cid").fetchall()
+        close(c)
+        return changes
+
+    # the same clock rows as the insert trigger writes, defaults included
+    assert reinsert(True) == reinsert(False)
+    assert (b'\x01\x09\x01', 'b', 'again', 1, 3) in reinsert(True)
+
+
+def test_needs_a_crr():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE baz (a PRIMARY KEY NOT NULL, b)")
+    with pytest.raises(Exception):
+        c.execute("SELECT crsql_begin_bulk_load('baz')")
+    close(c)
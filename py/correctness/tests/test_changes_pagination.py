@@ -0,0 +1,93 @@
+from crsql_correctness import connect, close
+import pytest
+
+# Reading crsql_changes a page at a time with `resume_token > ?` and LIMIT, even
+# within a single db version.
+
+columns = "[table], pk, cid, val, col_version, db_version, site_id, seq"
+changes_query = "SELECT " + columns + " FROM crsql_changes"
+
+
+def setup():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a PRIMARY KEY NOT NULL, b)")
+    c.execute("CREATE TABLE bar (a PRIMARY KEY NOT NULL, b, c)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("SELECT crsql_as_crr('bar')")
+    c.commit()
+    # one big transaction
+    for i in range(50):
+        c.execute("INSERT INTO foo VALUES (?, ?)", (i, i))
+        c.execute("INSERT INTO bar VALUES (?, ?, ?)", (i, i, i))
+    c.commit()
+    c.execute("UPDATE foo SET b = 'x' WHERE a < 5")
+    c.commit()
+    return c
+
+
+def pages(c, size, where=""):
+    token = b''
+    result = []
+    while True:
+        page = c.execute(
+            "SELECT " + columns +
+            ", resume_token FROM crsql_changes WHERE resume_token > ? {} LIMIT ?".format(where),
+            (token, size)).fetchall()
+        if len(page) == 0:
+            return result
+        assert len(page) <= size
+        result.append([row[:-1] for row in page])
+        token = page[-1][-1]
+
+
+def test_pages_cover_every_change_in_order():
+    c = setup()
+    everything = c.execute(changes_query + " ORDER BY db_version, seq").fetchall()
+    assert len(everything) == 150
+
+    paged = pages(c, 10)
+    assert [len(p) for p in paged] == [10] * 15
+    assert [row for p in paged for row in p] == everything
+    close(c)
+
+
+def test_pages_with_other_constraints():
+    c = setup()
+    expected = c.execute(
+        changes_query + " WHERE db_version = 1 AND cid = 'b' ORDER BY db_version, seq").fetchall()
+    paged = pages(c, 7, "AND db_version = 1 AND cid = 'b'")
+    assert [row for p in paged for row in p] == expected
+    close(c)
+
+
+def test_limit_and_offset():
+    c = setup()
+    everything = c.execute(changes_query + " ORDER BY db_version, seq").fetchall()
+    assert c.execute(changes_query + " LIMIT 10 OFFSET 20").fetchall() == everything[20:30]
+    assert c.execute(
+        changes_query + " ORDER BY db_version DESC, seq DESC LIMIT 3").fetchall() == everything[::-1][:3]
+    assert c.execute(
+        changes_query + " WHERE [table] = 'bar' LIMIT 4 OFFSET 1").fetchall() == [
+        row for row in everything if row[0] == 'bar'][1:5]
+    # a filter crsql_changes can't apply itself must see every row
+    assert c.execute(
+        changes_query + " WHERE val = 'x' LIMIT 2").fetchall() == [
+        row for row in everything if row[3] == 'x'][:2]
+    close(c)
+
+
+def test_tokens_order_like_changes():
+    c = setup()
+    rows = c.execute(
+        "SELECT db_version, seq, resume_token FROM crsql_changes ORDER BY resume_token").fetchall()
+    assert rows == sorted(rows, key=lambda r: (r[0], r[1]))
+    assert [r[2] for r in rows] == sorted(r[2] for r in rows)
+    close(c)
+
+
+def test_malformed_token():
+    c = setup()
+    with pytest.raises(Exception):
+        c.execute(
+            "SELECT * FROM crsql_changes WHERE resume_token > ?", (b'nope',)).fetchall()
+    close(c)
@@ -0,0 +1,98 @@
+from crsql_correctness import connect, close, min_db_v
+
+# Changes of every table are read in (db_version, seq) order by merging one
+# version ordered read per clock table.
+
+
+def setup_db():
+    c = connect(":memory:")
+    for t in ["a", "b", "c"]:
+        c.execute("CREATE TABLE {} (id PRIMARY KEY, x, y)".format(t))
+        c.execute("SELECT crsql_as_crr('{}')".format(t))
+    c.commit()
+
+    for i in range(10):
+        c.execute("INSERT INTO {} VALUES (?, ?, ?)".format(["a", "b", "c"][i % 3]), (i, i, i))
+        c.execute("INSERT INTO {} VALUES (?, ?, ?)".format(["c", "a", "b"][i % 3]), (i, i, i))
+        if i % 2 == 0:
+            c.commit()
+    c.execute("UPDATE b SET x = 100")
+    c.execute("DELETE FROM a WHERE id < 4")
+    c.commit()
+    return c
+
+
+changes_query = "SELECT [table], pk, cid, val, col_version, db_version, site_id, seq FROM crsql_changes"
+
+
+def sort_key(row):
+    return (row[5], row[7])
+
+
+def test_default_order_is_version_order():
+    c = setup_db()
+    rows = c.execute(changes_query).fetchall()
+    assert len(rows) > 0
+    assert [sort_key(r) for r in rows] == sorted(sort_key(r) for r in rows)
+    assert sorted(rows) == sorted(c.execute(
+        changes_query + " ORDER BY db_version DESC").fetchall())
+    close(c)
+
+
+def test_explicit_version_order_matches_default():
+    c = setup_db()
+    rows = c.execute(changes_query).fetchall()
+    assert c.execute(changes_query + " ORDER BY db_version, seq ASC").fetchall() == rows
+    assert [r[5] for r in c.execute(changes_query + " ORDER BY db_version").fetchall()] == [r[5] for r in rows]
+    close(c)
+
+
+def test_filters_apply_to_every_table():
+    c = setup_db()
+    rows = c.execute(changes_query).fetchall()
+    since = rows[len(rows) // 2][5]
+    assert c.execute(changes_query + " WHERE db_version > ?", (since,)).fetchall() == [
+        r for r in rows if r[5] > since]
+    close(c)
+
+
+def test_limit_returns_the_earliest_changes():
+    c = setup_db()
+    rows = c.execute(changes_query).fetchall()
+    assert c.execute(changes_query + " LIMIT 5").fetchall() == rows[:5]
+    close(c)
+
+
+def test_other_orders_still_sort():
+    c = setup_db()
+    rows = c.execute(changes_query + " ORDER BY db_version DESC").fetchall()
+    assert [r[5] for r in rows] == sorted([r[5] for r in rows], reverse=True)
+    close(c)
+
+
+def test_no_changes():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE a (id PRIMARY KEY, x)")
+    c.execute("SELECT crsql_as_crr('a')")
+    assert c.execute(changes_query).fetchall() == []
+    assert c.execute(changes_query + " WHERE db_version > ?", (min_db_v,)).fetchall() == []
+    close(c)
+
+
+def test_values_match_the_rows_they_were_read_from():
+    c = setup_db()
+    c.execute("INSERT INTO a VALUES (2, 'back', 'again')")
+    c.execute("UPDATE c SET y = 'y' WHERE id % 2 = 0")
+    c.commit()
+
+    for (tbl, pk, cid, val) in c.execute(
+            "SELECT [table], pk, cid, val FROM crsql_changes").fetchall():
+        id = c.execute(
+            "SELECT cell FROM crsql_unpack_columns WHERE package = ?", (pk,)).fetchone()[0]
+        row = c.execute(
+            "SELECT x, y FROM {} WHERE id = ?".format(tbl), (id,)).fetchone()
+        if cid in ('__crsql_del', '__crsql_pko'):
+            assert val is None
+        else:
+            assert val == {'x': row[0], 'y': row[1]}[cid]
+    close(c)
@@ -0,0 +1,174 @@
+from crsql_correctness import connect, close
+import pytest
+import random
+
+# `crsql_changes WHERE vv = crsql_vv(...)` returns the changes a peer lacks given,
+# per origin site, the db version of this database it has changes of that site up to.
+
+changes_query = "SELECT [table], pk, cid, val, col_version, db_version, site_id FROM crsql_changes"
+
+
+def make_db():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a PRIMARY KEY, b)")
+    c.execute("CREATE TABLE bar (a PRIMARY KEY, b, c)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("SELECT crsql_as_crr('bar')")
+    c.commit()
+    return c
+
+
+def site_id(c):
+    return c.execute("SELECT crsql_siteid()").fetchone()[0]
+
+
+def sync(src, dst):
+    for change in src.execute(changes_query + " WHERE site_id IS NULL").fetchall():
+        dst.execute("INSERT INTO crsql_changes VALUES (?, ?, ?, ?, ?, ?, ?)", change)
+    dst.commit()
+
+
+def setup():
+    hub = make_db()
+    a = make_db()
+    b = make_db()
+    for i in range(10):
+        a.execute("INSERT INTO foo VALUES (?, ?)", (i, 'a'))
+        a.commit()
+        b.execute("INSERT INTO bar VALUES (?, ?, ?)", (i, 'b', 'b'))
+        b.commit()
+        hub.execute("INSERT INTO foo VALUES (?, ?)", (100 + i, 'hub'))
+        hub.commit()
+        if i % 3 == 0:
+            sync(a, hub)
+            sync(b, hub)
+    sync(a, hub)
+    sync(b, hub)
+    return (hub, a, b)
+
+
+def lacking(hub, vv):
+    # what the vector should select, by brute force
+    local = site_id(hub)
+    ret = []
+    for row in hub.execute(changes_query).fetchall():
+        site = local if row[6] is None else row[6]
+        if site not in vv or row[5] > vv[site]:
+            ret.append(row)
+    return ret
+
+
+def read(hub, vv, extra=""):
+    args = []
+    for (site, version) in vv.items():
+        args += [site, version]
+    return hub.execute(
+        changes_query + " WHERE vv = crsql_vv({}) {}".format(
+            ", ".join(["?"] * len(args)), extra),
+        args).fetchall()
+
+
+def test_holds_back_what_the_peer_has():
+    (hub, a, b) = setup()
+    max_v = hub.execute("SELECT crsql_dbversion()").fetchone()[0]
+
+    # a has its own changes and everything of the hub up to version 12
+    vv = {site_id(a): max_v, site_id(hub): 12}
+    rows = read(hub, vv)
+    assert len(rows) > 0
+    assert rows == lacking(hub, vv)
+    assert all(r[6] != site_id(a) for r in rows)
+    assert all(r[5] > 12 for r in rows if r[6] is None)
+    # b's changes are not in the vector, all of them are sent
+    assert len([r for r in rows if r[6] == site_id(b)]) == len(
+        hub.execute(changes_query + " WHERE site_id = ?", (site_id(b),)).fetchall())
+    close(hub)
+    close(a)
+    close(b)
+
+
+def test_matches_brute_force():
+    (hub, a, b) = setup()
+    max_v = hub.execute("SELECT crsql_dbversion()").fetchone()[0]
+    sites = [site_id(hub), site_id(a), site_id(b)]
+    r = random.Random(1)
+    for _ in range(50):
+        vv = {}
+        for site in sites:
+            if r.random() < 0.8:
+                vv[site] = r.randint(0, max_v + 1)
+        assert read(hub, vv) == lacking(hub, vv)
+    close(hub)
+    close(a)
+    close(b)
+
+
+def test_null_is_the_local_site():
+    (hub, a, b) = setup()
+    assert read(hub, {None: 5, site_id(a): 0, site_id(b): 0}) == read(
+        hub, {site_id(hub): 5, site_id(a): 0, site_id(b): 0})
+    close(hub)
+    close(a)
+    close(b)
+
+
+def test_empty_vector_is_everything():
+    (hub, a, b) = setup()
+    assert hub.execute(
+        changes_query + " WHERE vv = crsql_vv()").fetchall() == hub.execute(changes_query).fetchall()
+    # sites we have no changes of have nothing to hold back
+    assert read(hub, {b'\x07' * 16: 100}) == hub.execute(changes_query).fetchall()
+    close(hub)
+    close(a)
+    close(b)
+
+
+def test_combines_with_other_constraints():
+    (hub, a, b) = setup()
+    vv = {site_id(hub): 12, site_id(a): 8}
+    expected = [r for r in lacking(hub, vv) if r[0] == 'foo' and r[5] < 30]
+    assert read(hub, vv, "AND [table] = 'foo' AND db_version < 30") == expected
+    assert read(hub, vv, "LIMIT 3") == lacking(hub, vv)[:3]
+
+    # paged with resume tokens
+    rows = []
+    token = b''
+    while True:
+        page = hub.execute(
+            "SELECT [table], pk, cid, val, col_version, db_version, site_id, resume_token FROM crsql_changes "
+            "WHERE vv = crsql_vv(?, 12, ?, 8) AND resume_token > ? ORDER BY resume_token LIMIT 4",
+            (site_id(hub), site_id(a), token)).fetchall()
+        if len(page) == 0:
+            break
+        rows += [r[:7] for r in page]
+        token = page[-1][7]
+    assert rows == lacking(hub, vv)
+    close(hub)
+    close(a)
+    close(b)
+
+
+def test_vectors_concatenate():
+    (hub, a, b) = setup()
+    left = hub.execute("SELECT crsql_vv(?, 12)", (site_id(hub),)).fetchone()[0]
+    right = hub.execute("SELECT crsql_vv(?, 8)", (site_id(a),)).fetchone()[0]
+    assert hub.execute(changes_query + " WHERE vv = ?", (left + right,)).fetchall() == lacking(
+        hub, {site_id(hub): 12, site_id(a): 8})
+    close(hub)
+    close(a)
+    close(b)
+
+
+def test_malformed():
+    c = make_db()
+    with pytest.raises(Exception):
+        c.execute("SELECT crsql_vv(x'01', 1)").fetchall()
+    with pytest.raises(Exception):
+        c.execute("SELECT crsql_vv(NULL)").fetchall()
+    with pytest.raises(Exception):
+        c.execute("SELECT crsql_vv(NULL, 'x')").fetchall()
+    with pytest.raises(Exception):
+        c.execute(changes_query + " WHERE vv = x'0102'").fetchall()
+    with pytest.raises(Exception):
+        c.execute(changes_query + " WHERE vv = 'abc'").fetchall()
+    close(c)
@@ -0,0 +1,181 @@
+from crsql_correctness import connect, close, min_db_v
+
+# A changeset carries the same changes as the rows of crsql_changes it was built
+# from, in far fewer bytes.
+
+changes_query = "SELECT [table], pk, cid, val, col_version, db_version, site_id FROM crsql_changes WHERE db_version > ? ORDER BY db_version, seq ASC"
+
+
+def create_schema(c):
+    c.execute("CREATE TABLE foo (a PRIMARY KEY, b, c DEFAULT 'c', d NOT NULL DEFAULT 1)")
+    c.execute("CREATE TABLE bar (x, y, z, PRIMARY KEY (x, y))")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("SELECT crsql_as_crr('bar')")
+    c.commit()
+
+
+def make_dbs(n):
+    dbs = [connect(":memory:") for _ in range(n)]
+    for db in dbs:
+        create_schema(db)
+    return dbs
+
+
+def write_source(src):
+    src.execute("INSERT INTO foo VALUES (1, 2, 3, 4)")
+    src.execute("INSERT INTO foo (a, b) VALUES (2, 'two')")
+    src.execute("INSERT INTO foo (a) VALUES (3)")
+    src.execute("INSERT INTO bar VALUES (1, 'one', x'0102')")
+    src.execute("INSERT INTO bar VALUES (2, 'two', 2.5)")
+    src.commit()
+    src.execute("UPDATE foo SET b = 22 WHERE a = 2")
+    src.execute("DELETE FROM foo WHERE a = 3")
+    src.execute("UPDATE bar SET z = -100000 WHERE x = 2")
+    src.commit()
+
+
+def state(c):
+    return (
+        c.execute("SELECT * FROM foo ORDER BY a").fetchall(),
+        c.execute("SELECT * FROM bar ORDER BY x, y").fetchall(),
+        c.execute(
+            "SELECT [table], pk, cid, val, col_version, site_id FROM crsql_changes ORDER BY [table], pk, cid").fetchall()
+    )
+
+
+def site_id(c):
+    return c.execute("SELECT crsql_siteid()").fetchone()[0]
+
+
+def transfer(src, dst, since=min_db_v, exclude_site=None):
+    changeset = src.execute(
+        "SELECT crsql_changeset_export(?, ?)", (since, exclude_site)).fetchone()[0]
+    applied = dst.execute(
+        "SELECT crsql_changeset_import(?)", (changeset,)).fetchone()[0]
+    dst.commit()
+    return applied
+
+
+def test_import_matches_per_row_merge():
+    src, per_row, imported = make_dbs(3)
+    write_source(src)
+
+    # local changes are exported under the source's site id
+    for change in src.execute(changes_query, (min_db_v,)).fetchall():
+        per_row.execute("INSERT INTO crsql_changes VALUES (?, ?, ?, ?, ?, ?, ?)",
+                        change[:-1] + (site_id(src),))
+    per_row.commit()
+    applied = transfer(src, imported)
+
+    assert applied == len(src.execute(changes_query, (min_db_v,)).fetchall())
+    assert state(imported) == state(per_row)
+    assert state(imported)[:2] == state(src)[:2]
+    assert transfer(src, imported) == 0
+
+    for c in [src, per_row, imported]:
+        close(c)
+
+
+def test_export_since():
+    src, dst = make_dbs(2)
+    write_source(src)
+    since = src.execute("SELECT crsql_dbversion()").fetchone()[0] - 1
+
+    assert transfer(src, dst, since) == len(
+        src.execute(changes_query, (since,)).fetchall())
+    assert dst.execute("SELECT * FROM foo ORDER BY a").fetchall() == [(2, 22, 'c', 1)]
+
+    close(src)
+    close(dst)
+
+
+def test_export_excludes_site():
+    a, b, c = make_dbs(3)
+    a.execute("INSERT INTO foo VALUES (1, 'a', 'a', 1)")
+    a.commit()
+    # local changes have no site id, stamp them with a's
+    for change in a.execute(changes_query, (min_db_v,)).fetchall():
+        b.execute("INSERT INTO crsql_changes VALUES (?, ?, ?, ?, ?, ?, ?)",
+                  change[:-1] + (site_id(a),))
+    b.commit()
+    b.execute("INSERT INTO foo VALUES (2, 'b', 'b', 2)")
+    b.commit()
+
+    changeset = b.execute(
+        "SELECT crsql_changeset_export(?, ?)", (min_db_v, site_id(a))).fetchone()[0]
+    c.execute("SELECT crsql_changeset_import(?)", (changeset,))
+    c.commit()
+    assert c.execute("SELECT a FROM foo").fetchall() == [(2,)]
+
+    # site ids survive the round trip
+    transfer(b, c)
+    assert c.execute(
+        "SELECT site_id FROM crsql_changes WHERE pk = crsql_pack_columns(1)").fetchall() == [
+        (site_id(a),) for _ in range(3)]
+
+    for db in [a, b, c]:
+        close(db)
+
+
+def test_local_changes_are_not_echoed_back():
+    a, b = make_dbs(2)
+    a.execute("INSERT INTO foo VALUES (1, 'a', 'a', 1)")
+    a.commit()
+    transfer(a, b)
+    assert b.execute(
+        "SELECT DISTINCT site_id FROM crsql_changes").fetchall() == [(site_id(a),)]
+
+    b.execute("INSERT INTO foo VALUES (2, 'b', 'b', 2)")
+    b.commit()
+    changeset = b.execute(
+        "SELECT crsql_changeset_export(?, ?)", (min_db_v, site_id(a))).fetchone()[0]
+    c = connect(":memory:")
+    create_schema(c)
+    c.execute("SELECT crsql_changeset_import(?)", (changeset,))
+    c.commit()
+    assert c.execute("SELECT a FROM foo").fetchall() == [(2,)]
+
+    for db in [a, b, c]:
+        close(db)
+
+
+def test_changeset_is_smaller_than_packed_rows():
+    src, dst = make_dbs(2)
+    for i in range(100):
+        src.execute("INSERT INTO foo VALUES (?, ?, ?, ?)", (i, i, i, i))
+        src.commit()
+    # changes from another site carry a site id
+    for change in src.execute(changes_query, (min_db_v,)).fetchall():
+        dst.execute("INSERT INTO crsql_changes VALUES (?, ?, ?, ?, ?, ?, ?)",
+                    change[:-1] + (site_id(src),))
+    dst.commit()
+    changeset = dst.execute(
+        "SELECT crsql_changeset_export(?)", (min_db_v,)).fetchone()[0]
+    packed = b''.join(dst.execute(
+        "SELECT crsql_pack_columns(?, ?, ?, ?, ?, ?, ?)", change).fetchone()[0]
+        for change in dst.execute(changes_query, (min_db_v,)).fetchall())
+
+    assert len(changeset) * 2 < len(packed)
+
+    close(src)
+    close(dst)
+
+
+def test_empty_and_malformed_changesets():
+    src, dst = make_dbs(2)
+    assert transfer(src, dst) == 0
+    assert dst.execute("SELECT crsql_changeset_import(NULL)").fetchone()[0] == 0
+
+    write_source(src)
+    changeset = src.execute(
+        "SELECT crsql_changeset_export(?)", (min_db_v,)).fetchone()[0]
+    for bad in [changeset[:-1], changeset + b'\x00', b'\x09\x02' + changeset[2:]]:
+        try:
+            dst.execute("SELECT crsql_changeset_import(?)", (bad,)).fetchone()
+            assert False
+        except Exception:
+            pass
+    assert dst.execute("SELECT count(*) FROM foo").fetchone()[0] == 0
+
+    close(src)
+    close(dst)
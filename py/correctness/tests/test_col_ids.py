@@ -0,0 +1,113 @@
+from crsql_correctness import connect, close
+
+# Clock tables record columns by an id local to each database.
+# crsql_changes translates them back to names.
+
+
+def col_ids(c, tbl):
+    return c.execute(
+        "SELECT col_name, col_id FROM __crsql_colids WHERE tbl_name = ? ORDER BY col_id",
+        (tbl,)).fetchall()
+
+
+def sync_left_to_right(l, r):
+    for change in l.execute("SELECT * FROM crsql_changes"):
+        r.execute("INSERT INTO crsql_changes VALUES (?, ?, ?, ?, ?, ?, ?)", change)
+    r.commit()
+
+
+def test_columns_are_numbered_per_table():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a PRIMARY KEY, b, c)")
+    c.execute("CREATE TABLE bar (a PRIMARY KEY, c)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("SELECT crsql_as_crr('bar')")
+    c.commit()
+
+    assert col_ids(c, 'foo') == [('b', 1), ('c', 2)]
+    assert col_ids(c, 'bar') == [('c', 1)]
+    close(c)
+
+
+def test_sentinels_and_columns_read_back_as_names():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a PRIMARY KEY, b)")
+    c.execute("CREATE TABLE pko (a PRIMARY KEY)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("SELECT crsql_as_crr('pko')")
+    c.execute("INSERT INTO foo VALUES (1, 2), (2, 3)")
+    c.execute("INSERT INTO pko VALUES (1)")
+    c.execute("DELETE FROM foo WHERE a = 2")
+    c.commit()
+
+    assert c.execute(
+        "SELECT [table], cid FROM crsql_changes ORDER BY [table], pk").fetchall() == [
+        ('foo', 'b'), ('foo', '__crsql_del'), ('pko', '__crsql_pko')]
+    assert c.execute(
+        "SELECT [table], cid FROM crsql_changes WHERE cid = 'b'").fetchall() == [('foo', 'b')]
+    close(c)
+
+
+def test_ids_survive_schema_changes():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a PRIMARY KEY, b, c)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("INSERT INTO foo VALUES (1, 2, 3)")
+    c.commit()
+
+    c.execute("SELECT crsql_begin_alter('foo')")
+    c.execute("ALTER TABLE foo DROP COLUMN b")
+    c.execute("ALTER TABLE foo ADD COLUMN d")
+    c.execute("SELECT crsql_commit_alter('foo')")
+    c.execute("UPDATE foo SET d = 4 WHERE a = 1")
+    c.commit()
+
+    # the id of the dropped column is not handed out again
+    assert col_ids(c, 'foo') == [('b', 1), ('c', 2), ('d', 3)]
+    assert c.execute(
+        "SELECT DISTINCT __crsql_col_id FROM foo__crsql_clock ORDER BY 1").fetchall() == [(2,), (3,)]
+    assert c.execute(
+        "SELECT cid, val FROM crsql_changes ORDER BY cid").fetchall() == [('c', 3), ('d', 4)]
+    close(c)
+
+
+def test_peers_with_different_ids_merge_by_name():
+    a = connect(":memory:")
+    a.execute("CREATE TABLE foo (id PRIMARY KEY, x, y)")
+    a.execute("SELECT crsql_as_crr('foo')")
+    a.commit()
+
+    b = connect(":memory:")
+    b.execute("CREATE TABLE foo (id PRIMARY KEY, y)")
+    b.execute("SELECT crsql_as_crr('foo')")
+    b.execute("SELECT crsql_begin_alter('foo')")
+    b.execute("ALTER TABLE foo ADD COLUMN x")
+    b.execute("SELECT crsql_commit_alter('foo')")
+    b.commit()
+    assert col_ids(a, 'foo') == [('x', 1), ('y', 2)]
+    assert col_ids(b, 'foo') == [('y', 1), ('x', 2)]
+
+    a.execute("INSERT INTO foo VALUES (1, 'x', 'y')")
+    a.commit()
+    sync_left_to_right(a, b)
+    assert b.execute("SELECT id, x, y FROM foo").fetchall() == [(1, 'x', 'y')]
+
+    b.execute("UPDATE foo SET x = 'xx' WHERE id = 1")
+    b.commit()
+    sync_left_to_right(b, a)
+    assert a.execute("SELECT id, x, y FROM foo").fetchall() == [(1, 'xx', 'y')]
+    assert a.execute(
+        "SELECT cid, col_version FROM crsql_changes ORDER BY cid").fetchall() == [('x', 2), ('y', 1)]
+    close(a)
+    close(b)
+
+
+def test_as_table_forgets_ids():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a PRIMARY KEY, b)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("SELECT crsql_as_table('foo')")
+    c.commit()
+
+    assert col_ids(c, 'foo') == []
+    close(c)
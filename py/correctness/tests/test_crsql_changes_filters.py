@@ -94,3 +94,64 @@ def test_site_id_filter():
 # value type of the underlying storage rather than a stringified version
 # def test_val_filter():
 #     run_test("val")
+
+
+def setup_tables():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a PRIMARY KEY, b)")
+    c.execute("CREATE TABLE bar (x, y, z, PRIMARY KEY (x, y))")
+    c.execute("CREATE TABLE baz (a PRIMARY KEY, b)")
+    for tbl in ['foo', 'bar', 'baz']:
+        c.execute("SELECT crsql_as_crr('{}')".format(tbl))
+    c.commit()
+
+    for i in range(5):
+        c.execute("INSERT INTO foo VALUES (?, ?)", (i, i))
+        c.execute("INSERT INTO bar VALUES (?, ?, ?)", (i, str(i), i))
+        c.execute("INSERT INTO baz VALUES (?, ?)", (i, i))
+        c.commit()
+    c.execute("UPDATE foo SET b = 10 WHERE a = 1")
+    c.execute("DELETE FROM baz WHERE a = 2")
+    c.commit()
+
+    return (c, c.execute(changes_query + " ORDER BY db_version, seq ASC").fetchall())
+
+
+def test_table_pushdown():
+    (c, all_changes) = setup_tables()
+
+    for tbl in ['foo', 'bar', 'baz', 'missing']:
+        assert c.execute(changes_query + " WHERE [table] = ?", (tbl,)).fetchall() == [
+            row for row in all_changes if row[0] == tbl]
+
+    assert c.execute(changes_query + " WHERE [table] IN ('foo', 'baz') ORDER BY db_version, seq ASC").fetchall() == [
+        row for row in all_changes if row[0] in ('foo', 'baz')]
+    assert c.execute(changes_query + " WHERE [table] = 'bar' AND db_version > 3").fetchall() == [
+        row for row in all_changes if row[0] == 'bar' and row[5] > 3]
+    ordered = c.execute(changes_query + " WHERE [table] = 'foo' ORDER BY cid DESC").fetchall()
+    assert [row[2] for row in ordered] == sorted(
+        [row[2] for row in all_changes if row[0] == 'foo'], reverse=True)
+    assert sorted(ordered) == sorted(row for row in all_changes if row[0] == 'foo')
+    assert c.execute(changes_query + " WHERE [table] = 1").fetchall() == []
+    assert c.execute(changes_query + " WHERE [table] = NULL").fetchall() == []
+
+    close(c)
+
+
+def test_pk_pushdown():
+    (c, all_changes) = setup_tables()
+
+    for pk in set(row[1] for row in all_changes):
+        assert c.execute(changes_query + " WHERE pk = ?", (pk,)).fetchall() == [
+            row for row in all_changes if row[1] == pk]
+        for tbl in ['foo', 'bar', 'baz']:
+            assert c.execute(changes_query + " WHERE [table] = ? AND pk = ?", (tbl, pk)).fetchall() == [
+                row for row in all_changes if row[0] == tbl and row[1] == pk]
+
+    pk = c.execute("SELECT crsql_pack_columns(2, '2')").fetchone()[0]
+    assert c.execute(changes_query + " WHERE pk = ? AND cid = 'z'", (pk,)).fetchall() == [
+        row for row in all_changes if row[1] == pk and row[2] == 'z']
+    assert c.execute(changes_query + " WHERE pk = x'01'").fetchall() == []
+    assert c.execute(changes_query + " WHERE pk = 1").fetchall() == []
+
+    close(c)
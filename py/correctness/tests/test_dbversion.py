@@ -1,4 +1,5 @@
 import pathlib
+import sqlite3
 from crsql_correctness import connect, close, min_db_v
 
 # c1
@@ -75,3 +76,163 @@ def test_each_tx_gets_a_version():
     c.execute("SELECT crsql_dbversion()").fetchone()[0] == min_db_v + 2
 
     close(c)
+
+
+def test_version_seen_across_connections():
+    dbfile = "./dbversion_c5.db"
+    pathlib.Path(dbfile).unlink(missing_ok=True)
+    a = connect(dbfile)
+    a.execute("create table foo (id primary key, a)")
+    a.execute("select crsql_as_crr('foo')")
+    a.commit()
+    b = connect(dbfile)
+    assert b.execute("SELECT crsql_dbversion()").fetchone()[0] == min_db_v
+
+    a.execute("insert into foo values (1, 2)")
+    a.commit()
+    assert b.execute("SELECT crsql_dbversion()").fetchone()[0] == min_db_v + 1
+
+    b.execute("insert into foo values (2, 2)")
+    b.commit()
+    assert a.execute("SELECT crsql_dbversion()").fetchone()[0] == min_db_v + 2
+
+    close(a)
+    close(b)
+    pathlib.Path(dbfile).unlink(missing_ok=True)
+
+
+def test_merged_versions_advance_the_version():
+    c = connect(":memory:")
+    c.execute("create table foo (id primary key, a)")
+    c.execute("select crsql_as_crr('foo')")
+    c.commit()
+    c.execute(
+        "INSERT INTO crsql_changes VALUES ('foo', crsql_pack_columns(1), 'a', 1, 1, 10, NULL)")
+    c.commit()
+    assert c.execute("SELECT crsql_dbversion()").fetchone()[0] == 10
+
+    c.execute("insert into foo values (2, 2)")
+    c.commit()
+    assert c.execute("SELECT crsql_dbversion()").fetchone()[0] == 11
+    close(c)
+
+
+def test_version_survives_removing_clock_rows():
+    c = connect(":memory:")
+    c.execute("create table foo (id primary key, a)")
+    c.execute("select crsql_as_crr('foo')")
+    c.execute("insert into foo values (1, 2)")
+    c.commit()
+    c.execute("select crsql_as_table('foo')")
+    c.commit()
+    assert c.execute("SELECT crsql_dbversion()").fetchone()[0] == min_db_v + 1
+    close(c)
+
+
+def test_version_table_seeded_on_migration():
+    dbfile = "./dbversion_c6.db"
+    pathlib.Path(dbfile).unlink(missing_ok=True)
+    c = connect(dbfile)
+    c.execute("create table foo (id primary key, a)")
+    c.execute("select crsql_as_crr('foo')")
+    c.execute("insert into foo values (1, 2)")
+    c.commit()
+    c.execute("insert into foo values (2, 2)")
+    c.commit()
+    # Look like a db from before the version was persisted
+    c.execute("DROP TABLE __crsql_dbversion")
+    c.commit()
+    close(c)
+
+    c = connect(dbfile)
+    assert c.execute("SELECT db_version FROM __crsql_dbversion").fetchone()[0] == min_db_v + 2
+    c.execute("insert into foo values (3, 2)")
+    c.commit()
+    assert c.execute("SELECT crsql_dbversion()").fetchone()[0] == min_db_v + 3
+    close(c)
+    pathlib.Path(dbfile).unlink(missing_ok=True)
+
+
+def test_version_stored_again_after_rolling_back_its_write():
+    c = connect(":memory:")
+    c.execute("create table foo (id primary key, a)")
+    c.execute("select crsql_as_crr('foo')")
+    c.commit()
+
+    c.execute("savepoint s")
+    c.execute("insert into foo values (1, 1)")
+    c.execute("rollback to s")
+    c.execute("insert into foo values (2, 2)")
+    c.commit()
+    assert c.execute("SELECT crsql_dbversion()").fetchone()[0] == min_db_v + 1
+
+    try:
+        c.execute("insert into foo values (3, 3), (3, 3)")
+    except sqlite3.IntegrityError:
+        pass
+    c.execute("insert into foo values (4, 4)")
+    c.commit()
+    assert c.execute("SELECT crsql_dbversion()").fetchone()[0] == min_db_v + 2
+    assert c.execute(
+        "SELECT max(db_version) FROM crsql_changes").fetchone()[0] == min_db_v + 2
+    close(c)
+
+
+def test_version_triggers_dropped_on_migration():
+    dbfile = "./dbversion_c7.db"
+    pathlib.Path(dbfile).unlink(missing_ok=True)
+    c = connect(dbfile)
+    c.execute("create table foo (id primary key, a)")
+    c.execute("select crsql_as_crr('foo')")
+    # Look like a db whose clock tables raised the version with triggers
+    c.execute("""CREATE TRIGGER foo__crsql_clock_dbv_insert AFTER INSERT ON foo__crsql_clock
+      BEGIN UPDATE __crsql_dbversion SET db_version = NEW.__crsql_db_version; END""")
+    c.commit()
+    close(c)
+
+    c = connect(dbfile)
+    assert c.execute(
+        "SELECT count(*) FROM sqlite_master WHERE type = 'trigger' AND tbl_name = 'foo__crsql_clock'").fetchone()[0] == 0
+    c.execute("insert into foo values (1, 2)")
+    c.commit()
+    assert c.execute("SELECT crsql_dbversion()").fetchone()[0] == min_db_v + 1
+    close(c)
+    pathlib.Path(dbfile).unlink(missing_ok=True)
+
+
+def test_asking_for_the_next_version_does_not_use_it_up():
+    c = connect(":memory:")
+    c.execute("create table foo (id primary key, a)")
+    c.execute("select crsql_as_crr('foo')")
+    c.execute("insert into foo values (1, 1)")
+    c.commit()
+
+    c.execute("update foo set a = 2 where id = 1")
+    c.execute("delete from foo where id = 1")
+    assert c.execute("SELECT crsql_nextdbversion()").fetchone()[0] == min_db_v + 2
+    c.commit()
+    c.execute("insert into foo values (2, 2)")
+    c.execute("SELECT crsql_nextdbversion()").fetchone()
+    c.rollback()
+    c.execute("create table bar (id)")
+    c.execute("SELECT crsql_nextdbversion()").fetchone()
+    c.commit()
+    assert c.execute("SELECT crsql_dbversion()").fetchone()[0] == min_db_v + 2
+    close(c)
+
+
+def test_version_stored_by_wide_table_updates():
+    c = connect(":memory:")
+    cols = ", ".join("c{}".format(i) for i in range(70))
+    c.execute("create table foo (id primary key, {})".format(cols))
+    c.execute("select crsql_as_crr('foo')")
+    c.execute("insert into foo (id) values (1)")
+    c.commit()
+
+    c.execute("update foo set c3 = 3 where id = 1")
+    c.commit()
+    assert c.execute("SELECT crsql_dbversion()").fetchone()[0] == min_db_v + 2
+    c.execute("update foo set c3 = 3 where id = 1")
+    c.commit()
+    assert c.execute("SELECT crsql_dbversion()").fetchone()[0] == min_db_v + 2
+    close(c)
@@ -0,0 +1,121 @@
+from crsql_correctness import connect, close
+
+# crsql_gc_tombstones removes the delete sentinels of rows every tracked peer
+# has received, a budget at a time.
+
+peer_a = b'\x0a' * 16
+peer_b = b'\x0b' * 16
+SEND = 1
+RECEIVE = 0
+
+
+def setup():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a PRIMARY KEY, b)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.commit()
+
+    # db versions 1 through 5
+    for i in range(1, 6):
+        c.execute("INSERT INTO foo VALUES (?, ?)", (i, i))
+        c.commit()
+    # db versions 6 through 10 delete those rows again
+    for i in range(1, 6):
+        c.execute("DELETE FROM foo WHERE a = ?", (i,))
+        c.commit()
+    return c
+
+
+def track(c, site, event, version):
+    c.execute(
+        "INSERT OR REPLACE INTO crsql_tracked_peers (site_id, tag, event, version, seq) VALUES (?, 0, ?, ?, 0)",
+        (site, event, version))
+    c.commit()
+
+
+def tombstones(c):
+    return c.execute(
+        "SELECT a FROM foo__crsql_clock WHERE __crsql_col_id = -1 ORDER BY a").fetchall()
+
+
+def test_nothing_is_removed_without_tracked_peers():
+    c = setup()
+    # what peers sent to us says nothing about what they have of ours
+    track(c, peer_a, RECEIVE, 100)
+
+    assert c.execute("SELECT crsql_gc_tombstones()").fetchone()[0] == 0
+    assert len(tombstones(c)) == 5
+    close(c)
+
+
+def test_removes_tombstones_below_the_lowest_peer():
+    c = setup()
+    track(c, peer_a, SEND, 10)
+    track(c, peer_b, SEND, 8)
+
+    # peer_b has only received the deletes of rows 1, 2 and 3
+    assert c.execute("SELECT crsql_gc_tombstones()").fetchone()[0] == 3
+    c.commit()
+    assert tombstones(c) == [(4,), (5,)]
+    assert c.execute(
+        "SELECT pk, cid FROM crsql_changes WHERE db_version > 8").fetchall() == [
+        (b'\x01\x09\x04', '__crsql_del'), (b'\x01\x09\x05', '__crsql_del')]
+
+    track(c, peer_b, SEND, 10)
+    assert c.execute("SELECT crsql_gc_tombstones()").fetchone()[0] == 2
+    c.commit()
+    assert tombstones(c) == []
+    assert c.execute("SELECT crsql_gc_tombstones()").fetchone()[0] == 0
+    close(c)
+
+
+def test_budget():
+    c = setup()
+    track(c, peer_a, SEND, 10)
+
+    removed = []
+    while True:
+        n = c.execute("SELECT crsql_gc_tombstones(2)").fetchone()[0]
+        c.commit()
+        if n == 0:
+            break
+        removed.append(n)
+    assert removed == [2, 2, 1]
+    assert tombstones(c) == []
+    assert c.execute("SELECT crsql_gc_tombstones(0)").fetchone()[0] == 0
+    close(c)
+
+
+def test_tombstones_of_reinserted_rows_are_kept():
+    c = setup()
+    c.execute("INSERT INTO foo VALUES (1, 'again')")
+    c.commit()
+    track(c, peer_a, SEND, 100)
+
+    assert c.execute("SELECT crsql_gc_tombstones()").fetchone()[0] == 4
+    assert tombstones(c) == [(1,)]
+    assert c.execute("SELECT * FROM foo").fetchall() == [(1, 'again')]
+    close(c)
+
+
+def test_db_version_is_unchanged():
+    c = setup()
+    track(c, peer_a, SEND, 10)
+    before = c.execute("SELECT crsql_dbversion()").fetchone()[0]
+    c.execute("SELECT crsql_gc_tombstones()")
+    c.commit()
+    assert c.execute("SELECT crsql_dbversion()").fetchone()[0] == before
+    close(c)
+
+
+def test_tombstones_are_found_without_walking_live_clock_rows():
+    c = setup()
+    c.executemany("INSERT INTO foo VALUES (?, ?)", [(i, i) for i in range(10, 1000)])
+    c.commit()
+
+    plan = c.execute(
+        "EXPLAIN QUERY PLAN SELECT _rowid_ FROM foo__crsql_clock WHERE __crsql_col_id = -1 AND __crsql_db_version <= 10").fetchall()
+    assert "foo__crsql_clock_del_idx" in plan[0][3]
+    assert c.execute(
+        "SELECT count(*) FROM foo__crsql_clock INDEXED BY foo__crsql_clock_del_idx WHERE __crsql_col_id = -1").fetchone()[0] == 5
+    close(c)
@@ -9,9 +9,11 @@ def test_c1_c2_c3_c4_c6_c7_crr_values():
   c.execute("insert into foo values(1, 2)")
   c.commit()
 
-  row = c.execute("select id, __crsql_col_name, __crsql_col_version, __crsql_db_version, __crsql_site_id from foo__crsql_clock").fetchone()
+  row = c.execute("select id, __crsql_col_id, __crsql_col_version, __crsql_db_version, __crsql_site_ordinal from foo__crsql_clock").fetchone()
   assert row[0] == 1
-  assert row[1] == 'a'
+  # the clock records the id `a` was given in the column dictionary
+  assert row[1] == 1
+  assert c.execute("select col_name from __crsql_colids where tbl_name = 'foo' and col_id = ?", (row[1],)).fetchone()[0] == 'a'
   assert row[2] == 1
   assert row[3] == init_version + 1
   assert row[4] == None
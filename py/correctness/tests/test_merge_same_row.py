@@ -0,0 +1,111 @@
+from crsql_correctness import connect, close
+
+# The cells of a row are merged against a per-row snapshot of the clock table.
+# These make sure that snapshot never outlives what it describes.
+
+
+def setup():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a PRIMARY KEY, b, c)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.commit()
+    return c
+
+
+def insert_change(c, cid, val, col_version):
+    c.execute(
+        "INSERT INTO crsql_changes VALUES ('foo', crsql_pack_columns(1), ?, ?, ?, 1, NULL)",
+        (cid, val, col_version))
+
+
+def test_cells_of_a_row_in_one_transaction():
+    c = setup()
+    insert_change(c, 'b', 'b1', 1)
+    insert_change(c, 'c', 'c1', 1)
+    # loses on version
+    insert_change(c, 'b', 'b0', 0)
+    # wins on version
+    insert_change(c, 'c', 'c2', 2)
+    # ties on version, loses on value
+    insert_change(c, 'b', 'a', 1)
+    # ties on version, wins on value
+    insert_change(c, 'b', 'z', 1)
+    # ties with a value that was merged earlier in this transaction
+    insert_change(c, 'c', 'c1', 2)
+    c.commit()
+
+    assert c.execute("SELECT * FROM foo").fetchall() == [(1, 'z', 'c2')]
+    assert c.execute(
+        "SELECT cid, col_version FROM crsql_changes ORDER BY cid").fetchall() == [('b', 1), ('c', 2)]
+    close(c)
+
+
+def test_local_write_between_cells():
+    c = setup()
+    insert_change(c, 'b', 'b1', 1)
+    c.execute("UPDATE foo SET b = 'local' WHERE a = 1")
+    # the local write bumped b to version 2
+    insert_change(c, 'b', 'b2', 2)
+    c.commit()
+
+    assert c.execute("SELECT b FROM foo").fetchall() == [('local',)]
+    close(c)
+
+
+def test_rollback_to_savepoint_between_cells():
+    c = setup()
+    c.execute("SAVEPOINT one")
+    insert_change(c, 'b', 'b5', 5)
+    c.execute("ROLLBACK TO one")
+    insert_change(c, 'b', 'b1', 1)
+    c.execute("RELEASE one")
+    c.commit()
+
+    assert c.execute("SELECT b FROM foo").fetchall() == [('b1',)]
+    close(c)
+
+
+def test_rollback_between_transactions():
+    c = setup()
+    insert_change(c, 'b', 'b5', 5)
+    c.rollback()
+    insert_change(c, 'b', 'b1', 1)
+    c.commit()
+
+    assert c.execute("SELECT b FROM foo").fetchall() == [('b1',)]
+    close(c)
+
+
+# The schema is checked once per transaction. Tables and columns added part way
+# through one must still be merged into.
+def test_schema_change_between_merges():
+    c = setup()
+    insert_change(c, 'b', 'b1', 1)
+    c.execute("SELECT crsql_begin_alter('foo')")
+    c.execute("ALTER TABLE foo ADD COLUMN d")
+    c.execute("SELECT crsql_commit_alter('foo')")
+    insert_change(c, 'd', 'd1', 1)
+    c.execute("CREATE TABLE bar (a PRIMARY KEY, b)")
+    c.execute("SELECT crsql_as_crr('bar')")
+    c.execute(
+        "INSERT INTO crsql_changes VALUES ('bar', crsql_pack_columns(1), 'b', 'bar', 1, 1, NULL)")
+    c.commit()
+
+    assert c.execute("SELECT * FROM foo").fetchall() == [(1, 'b1', None, 'd1')]
+    assert c.execute("SELECT * FROM bar").fetchall() == [(1, 'bar')]
+    close(c)
+
+
+def test_unknown_table_in_transaction():
+    c = setup()
+    insert_change(c, 'b', 'b1', 1)
+    try:
+        c.execute(
+            "INSERT INTO crsql_changes VALUES ('missing', crsql_pack_columns(1), 'b', 1, 1, 1, NULL)")
+        assert False
+    except Exception as e:
+        assert 'could not find the schema information for table missing' in str(e)
+    insert_change(c, 'c', 'c1', 1)
+    c.commit()
+    assert c.execute("SELECT * FROM foo").fetchall() == [(1, 'b1', 'c1')]
+    close(c)
@@ -0,0 +1,179 @@
+from crsql_correctness import connect, close
+
+# Changes the application says it already applied, by recording a watermark
+# under the applied event of crsql_tracked_peers, are dropped before merging.
+# They could only lose. Only changes made by the sender the application names
+# are compared with its watermark. What is recorded under the receive event
+# drops nothing.
+
+peer = b'\x0a' * 16
+RECEIVE = 0
+APPLIED = 2
+
+
+def setup():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a PRIMARY KEY, b)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.commit()
+    return c
+
+
+def track(c, version, seq=0, tag=0, event=APPLIED, commit=True):
+    c.execute(
+        "INSERT OR REPLACE INTO crsql_tracked_peers (site_id, tag, event, version, seq) VALUES (?, ?, ?, ?, ?)",
+        (peer, tag, event, version, seq))
+    if commit:
+        c.commit()
+
+
+def merge(c, pk, val, col_version, db_version, site_id=peer, seq=None, sender=peer):
+    c.execute(
+        "INSERT INTO crsql_changes ([table], pk, cid, val, col_version, db_version, site_id, seq, sender) "
+        "VALUES ('foo', crsql_pack_columns(?), 'b', ?, ?, ?, ?, ?, ?)",
+        (pk, val, col_version, db_version, site_id, seq, sender))
+    c.commit()
+
+
+def apply(c, pk, val, col_version, db_version, site_id=peer, sender=peer):
+    c.execute(
+        "SELECT crsql_apply_changes(crsql_pack_columns('foo', crsql_pack_columns(?), 'b', ?, ?, ?, ?), 0, ?)",
+        (pk, val, col_version, db_version, site_id, sender))
+    c.commit()
+
+
+def value(c, pk):
+    row = c.execute("SELECT b FROM foo WHERE a = ?", (pk,)).fetchone()
+    return None if row is None else row[0]
+
+
+def test_changes_below_the_watermark_are_dropped():
+    c = setup()
+    merge(c, 1, 'first', 1, 3)
+    track(c, 5)
+
+    # would win on col_version were it not already applied
+    merge(c, 1, 'stale', 2, 4)
+    assert value(c, 1) == 'first'
+    merge(c, 2, 'stale', 1, 4)
+    assert value(c, 2) is None
+
+    merge(c, 1, 'new', 2, 6)
+    assert value(c, 1) == 'new'
+    close(c)
+
+
+def test_batched_changes_below_the_watermark_are_dropped():
+    c = setup()
+    track(c, 5)
+    apply(c, 1, 'stale', 1, 4)
+    assert value(c, 1) is None
+    apply(c, 1, 'new', 1, 5)
+    assert value(c, 1) == 'new'
+    close(c)
+
+
+def test_seq_at_the_watermark_version():
+    c = setup()
+    track(c, 5, seq=2)
+
+    merge(c, 1, 'covered', 1, 5, seq=2)
+    assert value(c, 1) is None
+    merge(c, 2, 'after', 1, 5, seq=3)
+    assert value(c, 2) == 'after'
+    # without a seq only whole versions below the watermark are known to be applied
+    merge(c, 3, 'unknown', 1, 5)
+    assert value(c, 3) == 'unknown'
+    close(c)
+
+
+def test_only_direct_untagged_peers_and_remote_sites():
+    c = setup()
+    # versions of other tags may be some forwarder's
+    track(c, 5, tag=1)
+    merge(c, 1, 'kept', 1, 4)
+    assert value(c, 1) == 'kept'
+
+    track(c, 5)
+    # other sites and local changes are never dropped
+    merge(c, 2, 'other', 1, 4, site_id=b'\x0b' * 16)
+    assert value(c, 2) == 'other'
+    merge(c, 3, 'local', 1, 4, site_id=None)
+    assert value(c, 3) == 'local'
+    close(c)
+
+
+def test_changes_forwarded_by_the_sender_are_kept():
+    c = setup()
+    hub = b'\x0c' * 16
+    track(c, 5)
+    # made by peer, but passed on by a hub and carrying the hub's lower version
+    merge(c, 1, 'forwarded', 1, 2, sender=hub)
+    assert value(c, 1) == 'forwarded'
+    apply(c, 2, 'forwarded', 1, 2, sender=hub)
+    assert value(c, 2) == 'forwarded'
+    close(c)
+
+
+def test_nothing_is_dropped_without_a_sender():
+    c = setup()
+    track(c, 5)
+    merge(c, 1, 'kept', 1, 4, sender=None)
+    assert value(c, 1) == 'kept'
+    apply(c, 2, 'kept', 1, 4, sender=None)
+    assert value(c, 2) == 'kept'
+    close(c)
+
+
+def test_received_versions_drop_nothing():
+    c = setup()
+    track(c, 5, event=RECEIVE)
+    merge(c, 1, 'kept', 1, 4)
+    assert value(c, 1) == 'kept'
+    apply(c, 2, 'kept', 1, 4)
+    assert value(c, 2) == 'kept'
+    close(c)
+
+
+def test_received_version_recorded_before_the_changes():
+    c = setup()
+    # a sync that records how far it got first, then applies, in one transaction
+    track(c, 5, event=RECEIVE, commit=False)
+    c.execute(
+        "INSERT INTO crsql_changes ([table], pk, cid, val, col_version, db_version, site_id, sender) "
+        "VALUES ('foo', crsql_pack_columns(1), 'b', 'kept', 1, 4, ?, ?)", (peer, peer))
+    c.execute(
+        "SELECT crsql_apply_changes(crsql_pack_columns('foo', crsql_pack_columns(2), 'b', 'kept', 1, 4, ?), 0, ?)",
+        (peer, peer)).fetchone()
+    c.commit()
+    assert value(c, 1) == 'kept'
+    assert value(c, 2) == 'kept'
+    close(c)
+
+
+def test_resent_changesets_change_nothing():
+    src = setup()
+    for i in range(20):
+        src.execute("INSERT INTO foo VALUES (?, ?)", (i, i))
+        src.commit()
+    dst = setup()
+    changes = src.execute(
+        "SELECT [table], pk, cid, val, col_version, db_version, ?1, ?1 FROM crsql_changes", (peer,)).fetchall()
+    for change in changes:
+        dst.execute(
+            "INSERT INTO crsql_changes ([table], pk, cid, val, col_version, db_version, site_id, sender) "
+            "VALUES (?, ?, ?, ?, ?, ?, ?, ?)", change)
+    dst.commit()
+    track(dst, src.execute("SELECT crsql_dbversion()").fetchone()[0] + 1)
+
+    before = dst.execute("SELECT crsql_dbversion()").fetchone()[0]
+    for change in changes:
+        dst.execute(
+            "INSERT INTO crsql_changes ([table], pk, cid, val, col_version, db_version, site_id, sender) "
+            "VALUES (?, ?, ?, ?, ?, ?, ?, ?)", change)
+    dst.commit()
+    assert dst.execute("SELECT crsql_dbversion()").fetchone()[0] == before
+    assert dst.execute("SELECT * FROM foo ORDER BY a").fetchall() == src.execute(
+        "SELECT * FROM foo ORDER BY a").fetchall()
+    close(src)
+    close(dst)
@@ -0,0 +1,30 @@
+from crsql_correctness import connect, close
+
+
+def test_unpack_round_trip():
+    c = connect(":memory:")
+    values = (1, -2, 2**40, 1.5, "text", "", b"\x00\x01", b"", None)
+    package = c.execute(
+        "SELECT crsql_pack_columns(?, ?, ?, ?, ?, ?, ?, ?, ?)", values).fetchone()[0]
+
+    assert tuple(row[0] for row in c.execute(
+        "SELECT cell FROM crsql_unpack_columns WHERE package = ?", (package,))) == values
+
+    # the cursor outlives the binding it was filtered with
+    cursor = c.execute(
+        "SELECT cell FROM crsql_unpack_columns WHERE package = crsql_pack_columns('a', x'0102', 3)")
+    assert cursor.fetchall() == [('a',), (b'\x01\x02',), (3,)]
+    close(c)
+
+
+def test_unpack_malformed():
+    c = connect(":memory:")
+    package = c.execute("SELECT crsql_pack_columns('abc', 1)").fetchone()[0]
+    for bad in [package[:-1], package[:3], b'']:
+        try:
+            c.execute(
+                "SELECT cell FROM crsql_unpack_columns WHERE package = ?", (bad,)).fetchall()
+            assert False
+        except Exception:
+            pass
+    close(c)
@@ -1,5 +1,7 @@
 from crsql_correctness import connect, close, min_db_v
 import shutil
+import sqlite3
+import pytest
 from pprint import pprint
 
 
@@ -14,7 +16,7 @@ def test_can_load_v0_12_0():
 
     version = c.execute(
         "SELECT value FROM crsql_master WHERE key ='crsqlite_version'").fetchone()
-    assert (version[0] == 130000)
+    assert (version[0] == 140000)
     close(c)
 
 
@@ -32,7 +34,27 @@ def test_can_load_v0_13_0():
 
     version = c.execute(
         "SELECT value FROM crsql_master WHERE key ='crsqlite_version'").fetchone()
-    assert (version[0] == 130000)
+    assert (version[0] == 140000)
+    close(c)
+
+
+def test_v0_13_0_clock_tables_store_column_ids():
+    prefix = "./prior-dbs/v0.13.0"
+    shutil.copyfile(prefix + ".prior-db", prefix + ".db")
+    c = connect(prefix + ".db")
+    assert c.execute(
+        "SELECT DISTINCT __crsql_col_id FROM foo__crsql_clock").fetchall() == [(1,)]
+
+    # the triggers were recreated to write ids
+    c.execute("INSERT INTO foo VALUES (10, 11)")
+    c.execute("UPDATE foo SET b = 5 WHERE a = 3")
+    c.execute("DELETE FROM foo WHERE a = 1")
+    c.commit()
+    rows = c.execute(
+        "SELECT pk, cid, val, col_version, db_version FROM crsql_changes WHERE db_version > 3").fetchall()
+    assert (rows == [(b'\x01\x09\x0a', 'b', 11, 1, 4),
+                     (b'\x01\x09\x03', 'b', 5, 2, 4),
+                     (b'\x01\x09\x01', '__crsql_del', None, 1, 4)])
     close(c)
 
 
@@ -40,6 +62,15 @@ def test_can_load_as_readonly():
     prefix = "./prior-dbs/v0.13.0"
     # copy the file given connecting might migrate it!
     shutil.copyfile(prefix + ".prior-db", prefix + ".db")
+    close(connect(prefix + ".db"))
     c = connect('file:' + prefix + ".db?mode=ro", uri=True)
-    # just expecting not to throw.
+    rows = c.execute("SELECT pk, cid, db_version FROM crsql_changes").fetchall()
+    assert len(rows) == 5
     close(c)
+
+
+def test_unmigrated_db_does_not_load_as_readonly():
+    prefix = "./prior-dbs/v0.13.0"
+    shutil.copyfile(prefix + ".prior-db", prefix + ".db")
+    with pytest.raises(sqlite3.OperationalError, match="needs migration"):
+        connect('file:' + prefix + ".db?mode=ro", uri=True)
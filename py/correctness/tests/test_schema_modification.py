@@ -5,7 +5,7 @@ import pytest
 changes_query = "SELECT [table], [pk], [cid], [val] FROM crsql_changes"
 changes_with_versions_query = "SELECT [table], [pk], [cid], [val], [db_version], [col_version] FROM crsql_changes"
 full_changes_query = "SELECT [table], [pk], [cid], [val], [db_version], [col_version], [site_id] FROM crsql_changes"
-clock_query = "SELECT rowid, __crsql_col_version, __crsql_db_version, __crsql_col_name, __crsql_site_id FROM todo__crsql_clock"
+clock_query = "SELECT rowid, __crsql_col_version, __crsql_db_version, __crsql_col_id, __crsql_site_ordinal FROM todo__crsql_clock"
 
 
 def test_c1_4_no_primary_keys():
@@ -25,7 +25,7 @@ def test_c1_3_quoted_identifiers():
     c.execute("select crsql_as_crr('baz')")
 
     def check_clock(t): return c.execute(
-        "SELECT rowid, __crsql_col_version, __crsql_db_version, __crsql_col_name, __crsql_site_id FROM {t}__crsql_clock".format(t=t)).fetchall()
+        "SELECT rowid, __crsql_col_version, __crsql_db_version, __crsql_col_id, __crsql_site_ordinal FROM {t}__crsql_clock".format(t=t)).fetchall()
 
     check_clock("foo")
     check_clock("bar")
@@ -37,7 +37,7 @@ def test_c1_c5_compound_primary_key():
     c.execute("create table foo (a, b, c, primary key (a, b))")
     c.execute("select crsql_as_crr('foo')")
 
-    c.execute("SELECT a, b, __crsql_col_version, __crsql_col_name, __crsql_db_version, __crsql_site_id FROM foo__crsql_clock").fetchall()
+    c.execute("SELECT a, b, __crsql_col_version, __crsql_col_id, __crsql_db_version, __crsql_site_ordinal FROM foo__crsql_clock").fetchall()
     # with pytest.raises(Exception) as e_info:
     # c.execute("SELECT a__crsql_v FROM foo__crsql_crr").fetchall()
 
@@ -46,7 +46,7 @@ def test_c1_6_single_primary_key():
     c = connect(":memory:")
     c.execute("create table foo (a, b, c, primary key (a))")
     c.execute("select crsql_as_crr('foo')")
-    c.execute("SELECT a, __crsql_col_version, __crsql_col_name, __crsql_db_version, __crsql_site_id FROM foo__crsql_clock").fetchall()
+    c.execute("SELECT a, __crsql_col_version, __crsql_col_id, __crsql_db_version, __crsql_site_ordinal FROM foo__crsql_clock").fetchall()
 
 
 def test_c2_create_index():
@@ -83,9 +83,9 @@ def test_drop_clock_on_col_remove():
 
     clock_entries = c.execute(clock_query).fetchall()
     assert (clock_entries == [
-        (1, 1, 1, 'name', None),
-        (2, 1, 1, 'complete', None),
-        (3, 1, 1, 'list', None),
+        (1, 1, 1, 1, None),
+        (2, 1, 1, 2, None),
+        (3, 1, 1, 3, None),
     ])
 
     c.execute("SELECT crsql_begin_alter('todo');")
@@ -103,7 +103,7 @@ def test_drop_clock_on_col_remove():
 
     clock_entries = c.execute(clock_query).fetchall()
     assert (
-        clock_entries == [(1, 1, 1, 'name', None), (2, 1, 1, 'complete', None)]
+        clock_entries == [(1, 1, 1, 1, None), (2, 1, 1, 2, None)]
     )
 
 
@@ -511,6 +511,113 @@ def test_remove_rows_on_alter():
     assert (changes == [])
 
 
+def test_compaction_spans_batches():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a PRIMARY KEY NOT NULL, b, c);")
+    c.execute("SELECT crsql_as_crr('foo');")
+    c.executemany("INSERT INTO foo VALUES (?, ?, ?);",
+                  [(i, i, i) for i in range(12000)])
+    c.execute("DELETE FROM foo WHERE a = 7;")
+    c.commit()
+
+    c.execute("SELECT crsql_begin_alter('foo');")
+    # every third row, well past the first batch of clock rows
+    c.execute("DELETE FROM foo WHERE a % 3 = 0;")
+    removed = c.execute("SELECT crsql_commit_alter('foo');").fetchone()[0]
+    c.commit()
+
+    assert removed == 4000 * 2
+    assert c.execute(
+        "SELECT count(*) FROM foo__crsql_clock").fetchone()[0] == 7999 * 2 + 1
+    # the delete sentinel of the row deleted before the alter is kept
+    assert c.execute(
+        "SELECT a FROM foo__crsql_clock WHERE __crsql_col_id = -1").fetchall() == [(7,)]
+
+
+def test_compaction_of_compound_pks():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a NOT NULL, b NOT NULL, c, PRIMARY KEY (a, b));")
+    c.execute("SELECT crsql_as_crr('foo');")
+    c.executemany("INSERT INTO foo VALUES (?, ?, ?);",
+                  [(i % 2, i, i) for i in range(20)])
+    c.commit()
+
+    c.execute("SELECT crsql_begin_alter('foo');")
+    c.execute("DELETE FROM foo WHERE a = 1 AND b > 10;")
+    assert c.execute("SELECT crsql_commit_alter('foo');").fetchone()[0] == 5
+    c.commit()
+    assert c.execute(
+        "SELECT count(*) FROM foo__crsql_clock").fetchone()[0] == 15
+
+
+def test_compaction_of_dropped_columns():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a PRIMARY KEY NOT NULL, b, c);")
+    c.execute("SELECT crsql_as_crr('foo');")
+    c.executemany("INSERT INTO foo VALUES (?, ?, ?);",
+                  [(i, i, i) for i in range(10)])
+    c.commit()
+
+    c.execute("SELECT crsql_begin_alter('foo');")
+    c.execute("ALTER TABLE foo DROP COLUMN c;")
+    assert c.execute("SELECT crsql_commit_alter('foo');").fetchone()[0] == 10
+    c.commit()
+    assert c.execute(
+        "SELECT DISTINCT cid FROM crsql_changes").fetchall() == [('b',)]
+
+
+def test_compaction_when_another_alter_begins_in_between():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a PRIMARY KEY NOT NULL, b);")
+    c.execute("CREATE TABLE bar (a PRIMARY KEY NOT NULL, b);")
+    c.execute("SELECT crsql_as_crr('foo');")
+    c.execute("SELECT crsql_as_crr('bar');")
+    c.executemany("INSERT INTO foo VALUES (?, ?);",
+                  [(i, i) for i in range(10)])
+    c.commit()
+
+    c.execute("SELECT crsql_begin_alter('foo');")
+    c.execute("DELETE FROM foo WHERE a < 4;")
+    c.execute("SELECT crsql_begin_alter('bar');")
+    assert c.execute("SELECT crsql_commit_alter('foo');").fetchone()[0] == 4
+    assert c.execute("SELECT crsql_commit_alter('bar');").fetchone()[0] == 0
+    c.commit()
+    assert c.execute(
+        "SELECT count(*) FROM foo__crsql_clock").fetchone()[0] == 6
+
+
+def test_compaction_of_a_dropped_and_recreated_table():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a PRIMARY KEY NOT NULL, b);")
+    c.execute("SELECT crsql_as_crr('foo');")
+    c.executemany("INSERT INTO foo VALUES (?, ?);",
+                  [(i, i) for i in range(10)])
+    c.commit()
+
+    c.execute("SELECT crsql_begin_alter('foo');")
+    c.execute("DROP TABLE foo;")
+    c.execute("CREATE TABLE foo (a PRIMARY KEY NOT NULL, b);")
+    assert c.execute("SELECT crsql_commit_alter('foo');").fetchone()[0] == 10
+    c.commit()
+    assert c.execute("SELECT * FROM crsql_changes").fetchall() == []
+
+
+def test_adding_columns_compacts_nothing():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a PRIMARY KEY NOT NULL, b);")
+    c.execute("SELECT crsql_as_crr('foo');")
+    c.executemany("INSERT INTO foo VALUES (?, ?);",
+                  [(i, i) for i in range(10)])
+    c.commit()
+
+    c.execute("SELECT crsql_begin_alter('foo');")
+    c.execute("ALTER TABLE foo ADD COLUMN c;")
+    assert c.execute("SELECT crsql_commit_alter('foo');").fetchone()[0] == 0
+    c.commit()
+    assert c.execute(
+        "SELECT count(*) FROM foo__crsql_clock").fetchone()[0] == 10
+
+
 # TODO: this doesn't work at the moment and will not work until
 # we have a way to diff tables.
 # The workaround here would be:
@@ -124,7 +124,8 @@ def test_incr_by_one():
     c.execute("UPDATE bar SET b = 'b' WHERE a = 2")
     c.commit()
 
-    rows = c.execute("SELECT __crsql_seq FROM bar__crsql_clock").fetchall()
+    rows = c.execute(
+        "SELECT __crsql_seq FROM bar__crsql_clock ORDER BY _rowid_").fetchall()
     assert (rows == [(0,), (1,)])
 
     c.execute("CREATE TABLE baz (a primary key)")
@@ -0,0 +1,132 @@
+from crsql_correctness import connect, close
+import sqlite3
+import pytest
+
+# Clock tables record the site a change came from by an ordinal local to each
+# database. crsql_changes translates them back to site ids.
+
+site_a = b'\x0a' * 16
+site_b = b'\x0b' * 16
+unknown_site = b'\x0c' * 16
+
+
+def setup():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a PRIMARY KEY, b)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.commit()
+
+    c.execute("INSERT INTO foo VALUES (1, 'local')")
+    for (pk, site) in [(2, site_a), (3, site_b), (4, site_a)]:
+        c.execute(
+            "INSERT INTO crsql_changes VALUES ('foo', crsql_pack_columns(?), 'b', 'remote', 1, 1, ?)",
+            (pk, site))
+    c.commit()
+    return c
+
+
+def test_sites_are_recorded_by_ordinal():
+    c = setup()
+
+    assert c.execute(
+        "SELECT site_id, ordinal FROM crsql_site_ordinals ORDER BY ordinal").fetchall() == [
+        (site_a, 1), (site_b, 2)]
+    assert c.execute(
+        "SELECT a, __crsql_site_ordinal FROM foo__crsql_clock ORDER BY a").fetchall() == [
+        (1, None), (2, 1), (3, 2), (4, 1)]
+    assert c.execute(
+        "SELECT pk, site_id FROM crsql_changes ORDER BY pk").fetchall() == [
+        (b'\x01\x09\x01', None), (b'\x01\x09\x02', site_a), (b'\x01\x09\x03', site_b), (b'\x01\x09\x04', site_a)]
+    close(c)
+
+
+def test_site_filters():
+    c = setup()
+    all_changes = c.execute("SELECT pk, site_id FROM crsql_changes").fetchall()
+
+    operations = [
+        ['=', lambda x, y: False if x is None or y is None else x == y],
+        ['!=', lambda x, y: False if x is None or y is None else x != y],
+        ['IS', lambda x, y: x == y],
+        ['IS NOT', lambda x, y: x != y],
+    ]
+    for site in [site_a, site_b, unknown_site, None, 'text', 1]:
+        for (opcode, predicate) in operations:
+            changes = c.execute(
+                "SELECT pk, site_id FROM crsql_changes WHERE site_id {} ?".format(opcode),
+                (site,)).fetchall()
+            expected = [row for row in all_changes if predicate(row[1], site)]
+            assert sorted(changes) == sorted(expected), (opcode, site)
+
+    # through the merged read path too
+    assert c.execute(
+        "SELECT pk FROM crsql_changes WHERE site_id IS NOT ? ORDER BY db_version, seq",
+        (site_a,)).fetchall() == [(b'\x01\x09\x01',), (b'\x01\x09\x03',)]
+    close(c)
+
+
+def test_site_ordinal_is_not_deterministic():
+    c = setup()
+    # ordinals depend on crsql_site_ordinals, so an index over them would go stale
+    with pytest.raises(sqlite3.OperationalError, match="non-deterministic"):
+        c.execute("CREATE INDEX foo_site ON foo (crsql_site_ordinal(b))")
+    assert c.execute("SELECT crsql_site_ordinal(?)", (site_b,)).fetchone()[0] == 2
+    close(c)
+
+
+def test_site_interned_in_rolled_back_transaction():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a PRIMARY KEY, b)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.commit()
+
+    c.execute(
+        "INSERT INTO crsql_changes VALUES ('foo', crsql_pack_columns(1), 'b', 1, 1, 1, ?)", (site_a,))
+    c.rollback()
+    c.execute(
+        "INSERT INTO crsql_changes VALUES ('foo', crsql_pack_columns(1), 'b', 1, 1, 1, ?)", (site_b,))
+    c.execute(
+        "INSERT INTO crsql_changes VALUES ('foo', crsql_pack_columns(2), 'b', 2, 1, 1, ?)", (site_a,))
+    c.commit()
+
+    assert c.execute(
+        "SELECT site_id FROM crsql_changes ORDER BY pk").fetchall() == [(site_b,), (site_a,)]
+    close(c)
+
+
+def test_clock_tables_with_site_ids_are_migrated(tmp_path):
+    db_file = str(tmp_path / "site_ids.db")
+    c = connect(db_file)
+    c.execute("CREATE TABLE foo (a PRIMARY KEY, b)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("INSERT INTO foo VALUES (1, 1), (2, 2), (3, 3)")
+    c.commit()
+
+    # the clock table as v0.13.0 laid it out
+    c.execute("DROP TABLE foo__crsql_clock")
+    c.execute("""CREATE TABLE foo__crsql_clock (
+      a,
+      __crsql_col_name NOT NULL,
+      __crsql_col_version NOT NULL,
+      __crsql_db_version NOT NULL,
+      __crsql_site_id,
+      __crsql_seq NOT NULL DEFAULT 0,
+      PRIMARY KEY (a, __crsql_col_name)
+    )""")
+    c.execute("INSERT INTO foo__crsql_clock VALUES (1, 'b', 1, 1, NULL, 0)")
+    c.execute("INSERT INTO foo__crsql_clock VALUES (2, 'b', 1, 1, ?, 1)", (site_b,))
+    c.execute("INSERT INTO foo__crsql_clock VALUES (3, 'b', 1, 1, ?, 2)", (site_a,))
+    c.execute("DELETE FROM __crsql_colids")
+    c.execute("DELETE FROM crsql_site_ordinals")
+    c.execute("UPDATE crsql_master SET value = 130000 WHERE key = 'crsqlite_version'")
+    c.commit()
+    close(c)
+
+    c = connect(db_file)
+    assert c.execute(
+        "SELECT a, __crsql_site_ordinal FROM foo__crsql_clock ORDER BY a").fetchall() == [
+        (1, None), (2, 1), (3, 2)]
+    assert c.execute(
+        "SELECT pk, site_id FROM crsql_changes ORDER BY pk").fetchall() == [
+        (b'\x01\x09\x01', None), (b'\x01\x09\x02', site_b), (b'\x01\x09\x03', site_a)]
+    close(c)
@@ -0,0 +1,72 @@
+from crsql_correctness import connect, close
+import json
+
+# Merges reuse prepared statements from a bounded cache rather than
+# preparing a statement per cell.
+
+
+def stats(c):
+    return json.loads(c.execute("SELECT crsql_stmt_cache_stats()").fetchone()[0])
+
+
+def setup():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (a PRIMARY KEY, b, c)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.commit()
+    return c
+
+
+def merge_rows(c, start, count):
+    for pk in range(start, start + count):
+        c.execute(
+            "INSERT INTO crsql_changes VALUES ('foo', crsql_pack_columns(?), 'b', ?, 1, 1, NULL)", (pk, pk))
+        c.execute(
+            "INSERT INTO crsql_changes VALUES ('foo', crsql_pack_columns(?), 'c', ?, 1, 1, NULL)", (pk, pk))
+    c.commit()
+
+
+def test_merges_hit_the_cache():
+    c = setup()
+    merge_rows(c, 0, 10)
+    before = stats(c)
+    merge_rows(c, 10, 10)
+    after = stats(c)
+
+    assert after["misses"] == before["misses"]
+    assert after["hits"] > before["hits"]
+    assert after["size"] <= after["capacity"]
+    assert c.execute("SELECT count(*) FROM foo").fetchone()[0] == 20
+    close(c)
+
+
+def test_schema_change_drops_cached_statements():
+    c = setup()
+    merge_rows(c, 0, 1)
+    assert stats(c)["size"] > 0
+
+    c.execute("SELECT crsql_begin_alter('foo')")
+    c.execute("ALTER TABLE foo ADD COLUMN d")
+    c.execute("SELECT crsql_commit_alter('foo')")
+    c.commit()
+    c.execute(
+        "INSERT INTO crsql_changes VALUES ('foo', crsql_pack_columns(5), 'd', 'd', 1, 1, NULL)")
+    c.commit()
+
+    assert c.execute("SELECT d FROM foo WHERE a = 5").fetchone()[0] == 'd'
+    close(c)
+
+
+def test_reads_use_the_cache():
+    c = setup()
+    merge_rows(c, 0, 5)
+    c.execute("SELECT * FROM crsql_changes").fetchall()
+    before = stats(c)
+    rows = c.execute("SELECT * FROM crsql_changes").fetchall()
+    after = stats(c)
+
+    assert len(rows) == 10
+    assert after["misses"] == before["misses"]
+    # the cells of a row are served from one lookup of that row
+    assert after["hits"] == before["hits"] + len(set(r[1] for r in rows))
+    close(c)
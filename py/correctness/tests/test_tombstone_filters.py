@@ -0,0 +1,147 @@
+from crsql_correctness import connect, close
+
+# Merges skip the probe for a delete sentinel when the connection's filter of
+# deleted rows says the row was never deleted. The filter may only err towards
+# probing: changes to a deleted row must always lose, however it was deleted.
+
+peer = b'\x0a' * 16
+
+
+def setup(path=":memory:"):
+    c = connect(path)
+    c.execute("CREATE TABLE foo (a PRIMARY KEY, b)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.commit()
+    for i in range(10):
+        c.execute("INSERT INTO foo VALUES (?, ?)", (i, i))
+    c.commit()
+    return c
+
+
+def merge(c, pk, val, col_version=10, cid='b'):
+    c.execute(
+        "INSERT INTO crsql_changes ([table], pk, cid, val, col_version, db_version, site_id) "
+        "VALUES ('foo', crsql_pack_columns(?), ?, ?, ?, 1, ?)",
+        (pk, cid, val, col_version, peer))
+    c.commit()
+
+
+def rows(c):
+    return c.execute("SELECT a, b FROM foo ORDER BY a").fetchall()
+
+
+def test_filtered_merges_still_apply():
+    c = setup()
+    c.execute("DELETE FROM foo WHERE a = 3")
+    c.commit()
+    for i in range(10):
+        merge(c, i, 'remote')
+    assert rows(c) == [(i, 'remote') for i in range(10) if i != 3]
+    close(c)
+
+
+def test_local_deletes_after_the_filter_is_built():
+    c = setup()
+    # builds the filter
+    merge(c, 1, 'remote')
+    c.execute("DELETE FROM foo WHERE a = 2")
+    c.commit()
+    merge(c, 2, 'resurrected')
+    assert (2, 'resurrected') not in rows(c)
+    assert c.execute("SELECT count(*) FROM foo WHERE a = 2").fetchone()[0] == 0
+    close(c)
+
+
+def test_merged_deletes_after_the_filter_is_built():
+    c = setup()
+    merge(c, 1, 'remote')
+    merge(c, 2, None, 10, '__crsql_del')
+    merge(c, 2, 'resurrected', 20)
+    assert c.execute("SELECT count(*) FROM foo WHERE a = 2").fetchone()[0] == 0
+
+    batch = c.execute(
+        "SELECT crsql_pack_columns('foo', crsql_pack_columns(3), '__crsql_del', NULL, 10, 1, ?) || "
+        "crsql_pack_columns('foo', crsql_pack_columns(3), 'b', 'resurrected', 20, 1, ?)",
+        (peer, peer)).fetchone()[0]
+    c.execute("SELECT crsql_apply_changes(?)", (batch,)).fetchone()
+    c.commit()
+    assert c.execute("SELECT count(*) FROM foo WHERE a = 3").fetchone()[0] == 0
+    close(c)
+
+
+def test_deletes_by_other_connections(tmp_path):
+    path = str(tmp_path / "filters.db")
+    c = setup(path)
+    other = connect(path)
+    merge(c, 1, 'remote')
+    other.execute("DELETE FROM foo WHERE a = 4")
+    other.commit()
+    merge(c, 4, 'resurrected')
+    assert c.execute("SELECT count(*) FROM foo WHERE a = 4").fetchone()[0] == 0
+    close(other)
+    close(c)
+
+
+def test_equal_keys_of_different_types():
+    c = setup()
+    merge(c, 1, 'remote')
+    c.execute("DELETE FROM foo WHERE a = 5")
+    c.commit()
+    merge(c, 5.0, 'resurrected')
+    assert c.execute("SELECT count(*) FROM foo WHERE a = 5").fetchone()[0] == 0
+    close(c)
+
+
+def test_more_deletes_than_the_filter_was_sized_for():
+    c = setup()
+    c.executemany("INSERT INTO foo VALUES (?, ?)", ((i, i) for i in range(10, 1000)))
+    c.commit()
+    merge(c, 1, 'remote')
+    c.execute("DELETE FROM foo WHERE a >= 500")
+    c.commit()
+    for i in range(490, 1000, 7):
+        merge(c, i, 'remote')
+    assert c.execute("SELECT count(*) FROM foo WHERE a >= 500").fetchone()[0] == 0
+    assert c.execute("SELECT count(*) FROM foo WHERE b = 'remote'").fetchone()[0] == 3
+    close(c)
+
+
+def test_tables_whose_delete_trigger_predates_the_filter():
+    c = setup()
+    # the delete trigger as created by earlier versions
+    sql = c.execute(
+        "SELECT sql FROM sqlite_master WHERE name = 'foo__crsql_dtrig'").fetchone()[0]
+    c.execute("DROP TRIGGER foo__crsql_dtrig")
+    c.execute("\n".join(l for l in sql.split("\n") if "crsql_after_delete" not in l))
+    c.commit()
+
+    merge(c, 1, 'remote')
+    c.execute("DELETE FROM foo WHERE a = 6")
+    c.commit()
+    merge(c, 6, 'resurrected')
+    assert c.execute("SELECT count(*) FROM foo WHERE a = 6").fetchone()[0] == 0
+    close(c)
+
+
+def test_rolled_back_tombstone_collection():
+    c = setup()
+    c.execute("DELETE FROM foo WHERE a = 7")
+    c.commit()
+    c.execute(
+        "INSERT INTO crsql_tracked_peers (site_id, tag, event, version, seq) VALUES (?, 0, 1, 100, 0)",
+        (peer,))
+    c.commit()
+
+    c.execute("SAVEPOINT gc")
+    assert c.execute("SELECT crsql_gc_tombstones()").fetchone()[0] == 1
+    # builds the filter while the tombstone is gone
+    c.execute(
+        "INSERT INTO crsql_changes ([table], pk, cid, val, col_version, db_version, site_id) "
+        "VALUES ('foo', crsql_pack_columns(1), 'b', 'remote', 10, 1, ?)", (peer,))
+    c.execute("ROLLBACK TO gc")
+    c.execute("RELEASE gc")
+    c.commit()
+
+    merge(c, 7, 'resurrected')
+    assert c.execute("SELECT count(*) FROM foo WHERE a = 7").fetchone()[0] == 0
+    close(c)
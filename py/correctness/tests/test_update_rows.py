@@ -1,2 +1,95 @@
-from crsql_correctness import connect
+from crsql_correctness import connect, close
 
+# Updates only bump the clocks of the columns whose values changed.
+
+
+def setup():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (id PRIMARY KEY, a, b, c)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.commit()
+    return c
+
+
+def sync_left_to_right(l, r):
+    for change in l.execute("SELECT * FROM crsql_changes"):
+        r.execute("INSERT INTO crsql_changes VALUES (?, ?, ?, ?, ?, ?, ?)", change)
+    r.commit()
+
+
+def changes_at(c, db_version):
+    return c.execute(
+        "SELECT pk, cid, col_version, seq FROM crsql_changes WHERE db_version = ? ORDER BY seq",
+        (db_version,)).fetchall()
+
+
+def test_only_changed_columns_are_bumped():
+    c = setup()
+    c.execute("INSERT INTO foo VALUES (1, 'a', 'b', 'c')")
+    c.commit()
+    c.execute("UPDATE foo SET a = 'aa', b = 'b' WHERE id = 1")
+    c.commit()
+
+    assert changes_at(c, 2) == [(b'\x01\t\x01', 'a', 2, 0)]
+    close(c)
+
+
+def test_seq_spans_rows_and_columns():
+    c = setup()
+    c.execute("INSERT INTO foo VALUES (1, 'a', 'b', 'c')")
+    c.commit()
+    c.execute("INSERT INTO foo VALUES (2, 'a', 'b', 'c')")
+    c.execute("UPDATE foo SET b = NULL, c = 'cc' WHERE id = 1")
+    c.commit()
+
+    assert changes_at(c, 2) == [
+        (b'\x01\t\x02', 'a', 1, 0),
+        (b'\x01\t\x02', 'b', 1, 1),
+        (b'\x01\t\x02', 'c', 1, 2),
+        (b'\x01\t\x01', 'b', 2, 3),
+        (b'\x01\t\x01', 'c', 2, 4),
+    ]
+    close(c)
+
+
+def test_numerically_equal_values_are_unchanged():
+    c = setup()
+    c.execute("INSERT INTO foo VALUES (1, 1, 'b', 'c')")
+    c.commit()
+    c.execute("UPDATE foo SET a = 1.0 WHERE id = 1")
+    c.commit()
+
+    assert changes_at(c, 2) == []
+    close(c)
+
+
+def test_update_pk_only_table():
+    c = connect(":memory:")
+    c.execute("CREATE TABLE foo (id PRIMARY KEY)")
+    c.execute("SELECT crsql_as_crr('foo')")
+    c.execute("INSERT INTO foo VALUES (1)")
+    c.commit()
+    c.execute("UPDATE foo SET id = 1 WHERE id = 1")
+    c.commit()
+
+    assert changes_at(c, 2) == [(b'\x01\t\x01', '__crsql_pko', 2, 0)]
+    close(c)
+
+
+def test_changes_from_a_merge_are_not_recorded_as_local():
+    a = setup()
+    b = setup()
+    a.execute("INSERT INTO foo VALUES (1, 'a', 'b', 'c')")
+    a.commit()
+    b.execute("INSERT INTO foo VALUES (1, 'x', 'y', 'z')")
+    b.commit()
+    a.execute("UPDATE foo SET a = 'aa' WHERE id = 1")
+    a.commit()
+
+    sync_left_to_right(a, b)
+    # a's clock for `a` wins on version. The merge must not bump it again as a local write.
+    assert b.execute("SELECT a FROM foo").fetchall() == [('aa',)]
+    assert b.execute(
+        "SELECT col_version FROM crsql_changes WHERE cid = 'a'").fetchall() == [(2,)]
+    close(a)
+    close(b)
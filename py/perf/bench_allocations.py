@@ -0,0 +1,78 @@
+# Counts the allocations the extension makes per change read from or merged
+# into `crsql_changes`, as reported by `crsql_allocations()`. Allocations
+# SQLite makes for itself are not counted.
+#
+# The counters are only built in on request. Run from this directory after
+# `make loadable CRSQLITE_ALLOC_STATS=1` in core:
+#   python3 bench_allocations.py [rows]
+import sqlite3
+import sys
+
+extension = '../../core/dist/crsqlite'
+
+changes_query = "SELECT [table], pk, cid, val, col_version, db_version, site_id FROM crsql_changes"
+
+
+def connect():
+    c = sqlite3.connect(":memory:")
+    c.enable_load_extension(True)
+    c.load_extension(extension)
+    c.execute("CREATE TABLE item (id INTEGER PRIMARY KEY NOT NULL, a, b, c)")
+    c.execute("SELECT crsql_as_crr('item')")
+    c.commit()
+    return c
+
+
+def allocations(c):
+    return c.execute("SELECT crsql_allocations()").fetchone()[0]
+
+
+def count(c, run):
+    before = allocations(c)
+    run()
+    return allocations(c) - before
+
+
+def main():
+    num_rows = int(sys.argv[1]) if len(sys.argv) > 1 else 2000
+
+    src = connect()
+    src.executemany("INSERT INTO item VALUES (?, ?, ?, ?)",
+                    ((i, i, 'x' * (i % 100), None) for i in range(num_rows)))
+    src.commit()
+    src.execute("UPDATE item SET a = a + 1 WHERE id % 2 = 0")
+    src.commit()
+
+    changes = []
+    read = count(src, lambda: changes.extend(src.execute(changes_query).fetchall()))
+    packed = b''.join(src.execute(
+        "SELECT crsql_pack_columns(?, ?, ?, ?, ?, ?, ?)", change).fetchone()[0] for change in changes)
+
+    inserted = connect()
+    applied = connect()
+
+    def insert():
+        inserted.executemany("INSERT INTO crsql_changes VALUES (?, ?, ?, ?, ?, ?, ?)", changes)
+        inserted.commit()
+
+    def apply():
+        applied.execute("SELECT crsql_apply_changes(?)", (packed,)).fetchone()
+        applied.commit()
+
+    results = [
+        ("read", read),
+        ("insert", count(inserted, insert)),
+        ("apply", count(applied, apply)),
+        # every change ties with what is there and loses
+        ("re-insert", count(inserted, insert)),
+        ("re-apply", count(applied, apply)),
+    ]
+
+    print("{} changes".format(len(changes)))
+    for (name, allocs) in results:
+        print("{:<9} {:>8} allocations {:>6.2f} per change".format(
+            name, allocs, allocs / len(changes)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,99 @@
+# Compares merge throughput of `INSERT INTO crsql_changes` (one cell at a time)
+# against `crsql_apply_changes` (cells grouped by row) and
+# `crsql_changeset_import` (cells grouped by row, dictionary encoded).
+#
+# Run from this directory after `make loadable` in core:
+#   python3 bench_apply_changes.py [rows] [columns]
+import sqlite3
+import sys
+import time
+
+extension = '../../core/dist/crsqlite'
+
+changes_query = "SELECT [table], pk, cid, val, col_version, db_version, site_id FROM crsql_changes ORDER BY db_version, seq ASC"
+
+
+def connect():
+    c = sqlite3.connect(":memory:")
+    c.enable_load_extension(True)
+    c.load_extension(extension)
+    return c
+
+
+def create_schema(c, num_cols):
+    cols = ", ".join("c{} INTEGER".format(i) for i in range(num_cols))
+    c.execute("CREATE TABLE item (id INTEGER PRIMARY KEY NOT NULL, {})".format(cols))
+    c.execute("SELECT crsql_as_crr('item')")
+    c.commit()
+
+
+def populate(c, num_rows, num_cols):
+    bindings = ", ".join("?" for _ in range(num_cols + 1))
+    c.executemany(
+        "INSERT INTO item VALUES ({})".format(bindings),
+        ([row] + [row * col for col in range(num_cols)] for row in range(num_rows)))
+    c.commit()
+
+
+def per_row(changes, num_cols):
+    c = connect()
+    create_schema(c, num_cols)
+    start = time.perf_counter()
+    c.executemany(
+        "INSERT INTO crsql_changes VALUES (?, ?, ?, ?, ?, ?, ?)", changes)
+    c.commit()
+    elapsed = time.perf_counter() - start
+    c.execute("SELECT crsql_finalize()")
+    c.close()
+    return elapsed
+
+
+def batched(packed, num_cols):
+    c = connect()
+    create_schema(c, num_cols)
+    start = time.perf_counter()
+    c.execute("SELECT crsql_apply_changes(?)", (packed,)).fetchone()
+    c.commit()
+    elapsed = time.perf_counter() - start
+    c.execute("SELECT crsql_finalize()")
+    c.close()
+    return elapsed
+
+
+def changeset(blob, num_cols):
+    c = connect()
+    create_schema(c, num_cols)
+    start = time.perf_counter()
+    c.execute("SELECT crsql_changeset_import(?)", (blob,)).fetchone()
+    c.commit()
+    elapsed = time.perf_counter() - start
+    c.execute("SELECT crsql_finalize()")
+    c.close()
+    return elapsed
+
+
+def main():
+    num_rows = int(sys.argv[1]) if len(sys.argv) > 1 else 10000
+    num_cols = int(sys.argv[2]) if len(sys.argv) > 2 else 10
+
+    src = connect()
+    create_schema(src, num_cols)
+    populate(src, num_rows, num_cols)
+    changes = src.execute(changes_query).fetchall()
+    packed = b''.join(src.execute(
+        "SELECT crsql_pack_columns(?, ?, ?, ?, ?, ?, ?)", change).fetchone()[0] for change in changes)
+    exported = src.execute(
+        "SELECT crsql_changeset_export(-1)").fetchone()[0]
+    src.execute("SELECT crsql_finalize()")
+    src.close()
+
+    cells = len(changes)
+    for name, elapsed in [("per-row", per_row(changes, num_cols)), ("batched", batched(packed, num_cols)), ("changeset", changeset(exported, num_cols))]:
+        print("{:<9} {:>8} cells in {:.3f}s = {:>10.0f} cells/sec".format(
+            name, cells, elapsed, cells / elapsed))
+    print("packed rows: {} bytes, changeset: {} bytes".format(
+        len(packed), len(exported)))
+
+
+if __name__ == "__main__":
+    main()
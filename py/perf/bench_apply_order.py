@@ -0,0 +1,133 @@
+# Compares the pages `crsql_apply_changes` reads and writes when merging
+# changes in the order a peer sent them against merging them in primary key
+# order (`crsql_apply_changes(changes, 1)`).
+#
+# The destination already holds every row and receives updates to rows picked
+# at random, as a peer sends them: in db version order, scattered over the
+# table. The page cache is kept small so the table does not fit in it.
+# Pages are counted from the bytes read and written in /proc/self/io, so this
+# needs Linux. Within a transaction SQLite rewrites a spilled page's WAL frame
+# in place, so pages written can exceed the frames the WAL ends up with.
+#
+# Run from this directory after `make loadable` in core:
+#   python3 bench_apply_order.py [rows] [updates] [cache_pages]
+import os
+import random
+import shutil
+import sqlite3
+import sys
+import tempfile
+import time
+
+extension = '../../core/dist/crsqlite'
+
+changes_query = "SELECT [table], pk, cid, val, col_version, db_version, site_id FROM crsql_changes WHERE db_version > ? ORDER BY db_version, seq ASC"
+
+num_cols = 4
+
+
+def connect(path=":memory:"):
+    c = sqlite3.connect(path)
+    c.enable_load_extension(True)
+    c.load_extension(extension)
+    return c
+
+
+def create_schema(c):
+    cols = ", ".join("c{} TEXT".format(i) for i in range(num_cols))
+    c.execute("CREATE TABLE item (id INTEGER PRIMARY KEY NOT NULL, {})".format(cols))
+    c.execute("SELECT crsql_as_crr('item')")
+    c.commit()
+
+
+def pack(c, since):
+    return b''.join(c.execute(
+        "SELECT crsql_pack_columns(?, ?, ?, ?, ?, ?, ?)", change).fetchone()[0]
+        for change in c.execute(changes_query, (since,)).fetchall())
+
+
+def io():
+    counts = {}
+    with open("/proc/self/io") as f:
+        for line in f:
+            (name, count) = line.split(":")
+            counts[name] = int(count)
+    return (counts["rchar"], counts["wchar"])
+
+
+def merge(base, packed, in_key_order, cache_pages):
+    path = base + ".run"
+    shutil.copy(base, path)
+    c = connect(path)
+    c.execute("PRAGMA cache_size = {}".format(cache_pages))
+    c.execute("PRAGMA wal_autocheckpoint = 0")
+    page_size = c.execute("PRAGMA page_size").fetchone()[0]
+    # warm up the schema and the extension's statements outside of the count
+    c.execute("SELECT crsql_apply_changes(x'')").fetchone()
+
+    (read_before, written_before) = io()
+    start = time.perf_counter()
+    c.execute("SELECT crsql_apply_changes(?, ?)",
+              (packed, 1 if in_key_order else 0)).fetchone()
+    c.commit()
+    elapsed = time.perf_counter() - start
+    (read_after, written_after) = io()
+    pages_read = (read_after - read_before) // page_size
+    pages_written = (written_after - written_before) // page_size
+    frames = c.execute("PRAGMA wal_checkpoint(PASSIVE)").fetchone()[1]
+    state = c.execute("SELECT * FROM item ORDER BY id").fetchall()
+
+    c.execute("SELECT crsql_finalize()")
+    c.close()
+    for suffix in ["", "-wal", "-shm"]:
+        if os.path.exists(path + suffix):
+            os.remove(path + suffix)
+    return (elapsed, pages_read, pages_written, frames, state)
+
+
+def main():
+    num_rows = int(sys.argv[1]) if len(sys.argv) > 1 else 20000
+    num_updates = int(sys.argv[2]) if len(sys.argv) > 2 else 5000
+    cache_pages = int(sys.argv[3]) if len(sys.argv) > 3 else 64
+
+    r = random.Random(1)
+    src = connect()
+    create_schema(src)
+    bindings = ", ".join("?" for _ in range(num_cols + 1))
+    src.executemany(
+        "INSERT INTO item VALUES ({})".format(bindings),
+        ([row] + ["{:0>64}".format(row * col) for col in range(num_cols)] for row in range(num_rows)))
+    src.commit()
+    synced = src.execute("SELECT crsql_dbversion()").fetchone()[0]
+    initial = pack(src, -1)
+
+    for i in range(num_updates):
+        src.execute("UPDATE item SET c{} = ? WHERE id = ?".format(i % num_cols),
+                    ("{:x>64}".format(i), r.randrange(num_rows)))
+        src.commit()
+    updates = pack(src, synced)
+
+    with tempfile.TemporaryDirectory() as tmp:
+        base = os.path.join(tmp, "dst.db")
+        dst = connect(base)
+        dst.execute("PRAGMA journal_mode = WAL")
+        create_schema(dst)
+        dst.execute("SELECT crsql_apply_changes(?)", (initial,)).fetchone()
+        dst.commit()
+        dst.execute("PRAGMA wal_checkpoint(TRUNCATE)")
+        dst.execute("SELECT crsql_finalize()")
+        dst.close()
+
+        results = [(name, merge(base, updates, in_key_order, cache_pages))
+                   for (name, in_key_order) in [("arrival", False), ("key order", True)]]
+
+    assert results[0][1][4] == results[1][1][4]
+    print("{} updates to {} rows, {} page cache".format(
+        num_updates, num_rows, cache_pages))
+    for (name, (elapsed, pages_read, pages_written, frames, _)) in results:
+        print("{:<9} {:>8} pages read {:>8} pages written {:>8} WAL frames in {:.3f}s".format(
+            name, pages_read, pages_written, frames, elapsed))
+
+
+if __name__ == "__main__":
+    main()